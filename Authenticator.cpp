@@ -0,0 +1,304 @@
+#include "Authenticator.h"
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <sstream>
+#include <unistd.h>
+
+namespace {
+    auto &auth_latency = Metrics::instance().histogram("rab_auth_seconds");
+    auto &auth_queue = Metrics::instance().gauge("rab_auth_queue_depth");
+    auto &cache_hits = Metrics::instance().counter("rab_auth_cache_hits_total");
+    auto &tickets_accepted = Metrics::instance().counter("rab_auth_tickets_total");
+    auto &auth_failures = Metrics::instance().counter("rab_auth_failures_total");
+    auto &auth_rejected = Metrics::instance().counter("rab_auth_rejected_total");
+
+    constexpr size_t salt_size = 16;
+    constexpr size_t key_size = 32;
+
+    std::string to_hex(const unsigned char *data, size_t length) {
+        const char *hex_digits = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(length * 2);
+        for (size_t i = 0; i < length; i++) {
+            hex += hex_digits[data[i] >> 4u];
+            hex += hex_digits[data[i] & 15u];
+        }
+        return hex;
+    }
+
+    int nibble(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    bool from_hex(const std::string &hex, std::string &bytes) {
+        if (hex.size() % 2 != 0) return false;
+        bytes.clear();
+        for (size_t i = 0; i < hex.size(); i += 2) {
+            int high = nibble(hex[i]);
+            int low = nibble(hex[i + 1]);
+            if (high < 0 || low < 0) return false;
+            bytes += static_cast<char>(high << 4 | low);
+        }
+        return true;
+    }
+
+    /// Splits a record "scrypt$log_n$r$p$salt$hash", salt and hash being hex encoded
+    bool parse_record(const std::string &record, Scrypt_Params &params, std::string &salt, std::string &hash) {
+        std::vector<std::string> fields;
+        std::stringstream record_stream(record);
+        for (std::string field; std::getline(record_stream, field, '$');) fields.push_back(field);
+        if (fields.size() != 6 || fields[0] != "scrypt") return false;
+        try {
+            params = {static_cast<unsigned>(std::stoul(fields[1])), static_cast<unsigned>(std::stoul(fields[2])),
+                      static_cast<unsigned>(std::stoul(fields[3]))};
+        } catch (const std::exception &err) {
+            return false;
+        }
+        return params.log_n > 0 && params.log_n < 32 && from_hex(fields[4], salt) && from_hex(fields[5], hash) && !hash.empty();
+    }
+
+    /// Derives the hash of a digest, empty if the parameters exceed what scrypt accepts
+    std::string derive(const std::string &digest, const std::string &salt, const Scrypt_Params &params, size_t length) {
+        uint64_t n = uint64_t(1) << params.log_n;
+        uint64_t max_memory = 128 * uint64_t(params.r) * (n + params.p + 2) + (1 << 20);    // Just what the work factor needs
+        std::string hash(length, '\0');
+        if (EVP_PBE_scrypt(digest.data(), digest.size(), reinterpret_cast<const unsigned char*>(salt.data()), salt.size(),
+                           n, params.r, params.p, max_memory, reinterpret_cast<unsigned char*>(hash.data()), length) != 1) {
+            Logger::log(Log_Level::error, "Unable to derive a password hash with the configured work factor");
+            return {};
+        }
+        return hash;
+    }
+
+    /// Creates a record with the given work factor and random salt and hash, which no password matches
+    std::string make_dummy_record(const Scrypt_Params &params) {
+        unsigned char random[salt_size + key_size];
+        RAND_bytes(random, sizeof(random));
+        return "scrypt$" + std::to_string(params.log_n) + "$" + std::to_string(params.r) + "$" + std::to_string(params.p) + "$"
+               + to_hex(random, salt_size) + "$" + to_hex(random + salt_size, key_size);
+    }
+
+    bool equal(const std::string &a, const std::string &b) {
+        return a.size() == b.size() && CRYPTO_memcmp(a.data(), b.data(), a.size()) == 0;
+    }
+}
+
+Authenticator::Authenticator(boost::asio::thread_pool &workers, const Server_Config &config, const std::string &db_name,
+                             const std::string &key_file)
+        : workers(workers), params{config.auth_scrypt_log_n, config.auth_scrypt_r, config.auth_scrypt_p},
+        concurrency(std::max(1u, config.auth_concurrency)), queue_limit(config.auth_queue_limit),
+        cache_lifetime(config.auth_cache_seconds), ticket_lifetime(config.ticket_seconds), ticket_key(load_key(key_file)),
+        dummy_record(make_dummy_record(params)), db_name(db_name) {
+    std::lock_guard lg(db_mutex);
+    open_database();
+}
+
+Authenticator::~Authenticator() {
+    sqlite3_finalize(select_record);
+    sqlite3_finalize(update_record);
+    if (conn) sqlite3_close(conn);
+}
+
+bool Authenticator::open_database() {
+    if (sqlite3_open(db_name.c_str(), &conn) == SQLITE_OK) {
+        sqlite3_busy_timeout(conn, 5000);
+        if (sqlite3_prepare_v2(conn, "SELECT password FROM Client WHERE username = ?1;", -1, &select_record, nullptr) == SQLITE_OK
+                && sqlite3_prepare_v2(conn, "UPDATE Client SET password = ?2 WHERE username = ?1;", -1, &update_record, nullptr) == SQLITE_OK)
+            return true;
+    }
+    Logger::log(Log_Level::error, std::string("Unable to open the credentials, ") + sqlite3_errmsg(conn));
+    sqlite3_finalize(select_record);
+    sqlite3_finalize(update_record);
+    sqlite3_close(conn);
+    conn = nullptr;
+    select_record = update_record = nullptr;
+    return false;
+}
+
+bool Authenticator::load_record(const std::string &username, std::string &record) {
+    std::lock_guard lg(db_mutex);
+    if (!conn && !open_database()) return false;    // The database may have become available in the meantime
+    record.clear();
+    sqlite3_bind_text(select_record, 1, username.data(), static_cast<int>(username.size()), SQLITE_TRANSIENT);
+    int res = sqlite3_step(select_record);
+    if (res == SQLITE_ROW && sqlite3_column_text(select_record, 0))
+        record = reinterpret_cast<const char*>(sqlite3_column_text(select_record, 0));
+    else if (res != SQLITE_ROW && res != SQLITE_DONE)
+        Logger::log(Log_Level::error, std::string("Database Error, ") + sqlite3_errmsg(conn));
+    sqlite3_reset(select_record);
+    sqlite3_clear_bindings(select_record);
+    return res == SQLITE_ROW || res == SQLITE_DONE;
+}
+
+bool Authenticator::store_record(const std::string &username, const std::string &record) {
+    std::lock_guard lg(db_mutex);
+    if (!conn && !open_database()) return false;
+    sqlite3_bind_text(update_record, 1, username.data(), static_cast<int>(username.size()), SQLITE_TRANSIENT);
+    sqlite3_bind_text(update_record, 2, record.data(), static_cast<int>(record.size()), SQLITE_TRANSIENT);
+    bool ok = sqlite3_step(update_record) == SQLITE_DONE;
+    if (!ok) Logger::log(Log_Level::error, std::string("Database Error, ") + sqlite3_errmsg(conn));
+    sqlite3_reset(update_record);
+    sqlite3_clear_bindings(update_record);
+    return ok;
+}
+
+void Authenticator::authenticate(const std::string &username, const std::string &secret, std::function<void(Auth_Result)> done) {
+    if (secret.rfind(Message::ticket_prefix, 0) == 0) {
+        done(check_ticket(username, secret.substr(std::strlen(Message::ticket_prefix))));
+        return;
+    }
+    std::string verifier = mac("login\n" + username + "\n" + secret);
+    std::string record;
+    if (!load_record(username, record)) {
+        done({Auth_Result::unavailable, {}});
+        return;
+    }
+    bool cached = false;
+    {
+        std::lock_guard lg(auth_mutex);
+        auto it = cache.find(username);
+        cached = !record.empty() && it != cache.end() && it->second.expiry > std::chrono::steady_clock::now()
+                 && equal(it->second.verifier, verifier) && it->second.record == record;   // A changed password is verified again
+    }
+    if (cached) {
+        cache_hits.add();
+        done({Auth_Result::granted, issue_ticket(username, record)});
+        return;
+    }
+    bool known = !record.empty();
+    if (!known) record = dummy_record;      // Denied after the same work, the answer time does not tell the user exists
+    submit({username, secret, std::move(verifier), std::move(record), std::move(done), known});
+}
+
+void Authenticator::submit(Job job) {
+    {
+        std::lock_guard lg(auth_mutex);
+        if (queue.size() >= queue_limit) {      // The client retries later, as when the database is not available
+            auth_rejected.add();
+            job.done({Auth_Result::unavailable, {}});
+            return;
+        }
+        if (running >= concurrency) {
+            queue.push_back(std::move(job));
+            auth_queue.add(1);
+            return;
+        }
+        running++;
+    }
+    boost::asio::post(workers, [self = shared_from_this(), job = std::move(job)]() mutable {self->verify(std::move(job));});
+}
+
+void Authenticator::verify(Job job) {
+    auto start = std::chrono::steady_clock::now();
+    Auth_Result result;
+    if (check_password(job.digest, job.record) && job.known) {
+        Scrypt_Params stored;
+        if (!record_params(job.record, stored) || !(stored == params)) {    // Upgrading bare digests and old work factors
+            std::string upgraded = hash_password(job.digest, params);
+            if (!upgraded.empty() && store_record(job.username, upgraded)) {
+                Logger::log(Log_Level::info, "Password of " + job.username + " rehashed with the current work factor");
+                job.record = std::move(upgraded);
+            }
+        }
+        {
+            std::lock_guard lg(auth_mutex);
+            cache[job.username] = {job.verifier, job.record, std::chrono::steady_clock::now() + cache_lifetime};
+        }
+        result = {Auth_Result::granted, issue_ticket(job.username, job.record)};
+    } else {
+        auth_failures.add();
+        if (job.known) Logger::log(Log_Level::warning, "Wrong password for " + job.username);
+    }
+    auth_latency.observe(seconds_since(start));
+    job.done(std::move(result));
+    Job next;
+    {
+        std::lock_guard lg(auth_mutex);
+        if (queue.empty()) {
+            running--;
+            return;
+        }
+        next = std::move(queue.front());    // Keeping the slot for the next login
+        queue.pop_front();
+        auth_queue.add(-1);
+    }
+    boost::asio::post(workers, [self = shared_from_this(), next = std::move(next)]() mutable {self->verify(std::move(next));});
+}
+
+Auth_Result Authenticator::check_ticket(const std::string &username, const std::string &ticket) {
+    auto dot = ticket.find('.');
+    int64_t expiry = 0;
+    try {
+        expiry = std::stoll(ticket.substr(0, dot));
+    } catch (const std::exception &err) {
+        expiry = 0;
+    }
+    if (dot == std::string::npos || expiry < std::time(nullptr)) {
+        Logger::log(Log_Level::debug, "Expired ticket for " + username);
+        return {Auth_Result::denied, {}};
+    }
+    std::string record;
+    if (!load_record(username, record)) return {Auth_Result::unavailable, {}};
+    if (record.empty() || !equal(mac(username + "\n" + std::to_string(expiry) + "\n" + record), ticket.substr(dot + 1))) {
+        auth_failures.add();
+        return {Auth_Result::denied, {}};
+    }
+    tickets_accepted.add();
+    return {Auth_Result::granted, issue_ticket(username, record)};
+}
+
+std::string Authenticator::issue_ticket(const std::string &username, const std::string &record) const {
+    std::string expiry = std::to_string(std::time(nullptr) + ticket_lifetime.count());
+    return expiry + "." + mac(username + "\n" + expiry + "\n" + record);
+}
+
+std::string Authenticator::mac(const std::string &data) const {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    HMAC(EVP_sha256(), ticket_key.data(), static_cast<int>(ticket_key.size()), reinterpret_cast<const unsigned char*>(data.data()),
+         data.size(), digest, &length);
+    return to_hex(digest, length);
+}
+
+std::string Authenticator::load_key(const std::string &key_file) {
+    std::string key(key_size, '\0');
+    std::ifstream in(key_file, std::ios::in|std::ios::binary);
+    if (in.read(key.data(), key_size) && in.gcount() == key_size) return key;
+    RAND_bytes(reinterpret_cast<unsigned char*>(key.data()), key_size);
+    int fd = ::open(key_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);    // Readable by the server only
+    if (fd < 0 || ::write(fd, key.data(), key_size) != static_cast<ssize_t>(key_size) || ::fsync(fd) != 0)
+        Logger::log(Log_Level::warning, "Unable to save the ticket key, the tickets will not survive a restart");
+    if (fd >= 0) ::close(fd);
+    return key;
+}
+
+std::string Authenticator::hash_password(const std::string &digest, const Scrypt_Params &params) {
+    unsigned char salt[salt_size];
+    if (RAND_bytes(salt, salt_size) != 1) return {};
+    std::string hash = derive(digest, std::string(reinterpret_cast<char*>(salt), salt_size), params, key_size);
+    if (hash.empty()) return {};
+    return "scrypt$" + std::to_string(params.log_n) + "$" + std::to_string(params.r) + "$" + std::to_string(params.p) + "$"
+           + to_hex(salt, salt_size) + "$" + to_hex(reinterpret_cast<const unsigned char*>(hash.data()), hash.size());
+}
+
+bool Authenticator::check_password(const std::string &digest, const std::string &record) {
+    Scrypt_Params params;
+    std::string salt, hash;
+    if (!parse_record(record, params, salt, hash)) return equal(digest, record);    // Stored before the records were salted
+    std::string derived = derive(digest, salt, params, hash.size());
+    return !derived.empty() && equal(derived, hash);
+}
+
+bool Authenticator::record_params(const std::string &record, Scrypt_Params &params) {
+    std::string salt, hash;
+    return parse_record(record, params, salt, hash);
+}
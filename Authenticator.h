@@ -0,0 +1,123 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sqlite3.h>
+#include <string>
+#include "Config.h"
+#include "Logger.h"
+#include "Message.h"
+#include "Metrics.h"
+
+/// Cost of the scrypt derivation of the stored passwords, N = 2^log_n and about 128 * r * N bytes of memory
+struct Scrypt_Params {
+    unsigned log_n = 15;
+    unsigned r = 8;
+    unsigned p = 1;
+
+    bool operator==(const Scrypt_Params &other) const {return log_n == other.log_n && r == other.r && p == other.p;}
+};
+
+/// Outcome of a login, a granted one carries a new session ticket
+struct Auth_Result {
+    enum {granted, denied, unavailable} status = denied;
+    std::string ticket;
+};
+
+/// Verifies the credentials of the clients on the worker pool, at most a few expensive verifications at once, so that
+/// a crowd of clients logging in after a restart can not starve the other requests. The passwords are stored as salted
+/// scrypt hashes of the digest sent by the clients; the records still holding the bare digest are upgraded at their
+/// first login, and so are the ones hashed with a different work factor. Successful logins are cached for a while, as
+/// long as the stored password does not change, and the tickets granted with them let a client log in again with a
+/// single HMAC until they expire. Unknown users are checked against a dummy record, so they take as long to deny
+class Authenticator : public std::enable_shared_from_this<Authenticator> {
+    /// A login waiting for a verification slot
+    struct Job {
+        std::string username;
+        std::string digest;
+        std::string verifier;   // Cached once the digest is verified
+        std::string record;     // Stored password of the user
+        std::function<void(Auth_Result)> done;
+        bool known = true;      // False for a user that does not exist, checked against the dummy record
+    };
+
+    /// A credential verified recently
+    struct Cached {
+        std::string verifier;   // HMAC of the digest, the digest itself is not kept
+        std::string record;     // Stored password it was verified against, the entry is stale once it changes
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    boost::asio::thread_pool &workers;
+    Scrypt_Params params;
+    unsigned concurrency;
+    size_t queue_limit;
+    std::chrono::seconds cache_lifetime;
+    std::chrono::seconds ticket_lifetime;
+    std::string ticket_key;
+    std::string dummy_record;   // Matches no password, unknown users cost a derivation like the known ones
+    std::string db_name;
+    sqlite3 *conn = nullptr;
+    sqlite3_stmt *select_record = nullptr;
+    sqlite3_stmt *update_record = nullptr;
+    std::mutex db_mutex;
+    std::map<std::string, Cached> cache;
+    std::deque<Job> queue;      // Verifications waiting for a slot
+    unsigned running = 0;
+    std::mutex auth_mutex;      // Guards cache, queue and running
+
+    /// Opens the credentials and prepares the statements, returns false if the database is not available
+    bool open_database();
+
+    /// Gets the stored password of a user; returns false if the database is not available, with an empty record if
+    /// the user does not exist
+    bool load_record(const std::string &username, std::string &record);
+
+    /// Replaces the stored password of a user
+    bool store_record(const std::string &username, const std::string &record);
+
+    /// Queues an expensive verification and starts it if a slot is free
+    void submit(Job job);
+
+    /// Runs a verification on the worker pool, then starts the next queued one
+    void verify(Job job);
+
+    /// Verifies a ticket against the current record of the user
+    Auth_Result check_ticket(const std::string &username, const std::string &ticket);
+
+    /// Creates a ticket bound to the user and to its current record, so that changing the password revokes it
+    std::string issue_ticket(const std::string &username, const std::string &record) const;
+
+    /// Keyed hash with the ticket key, as lowercase hex
+    std::string mac(const std::string &data) const;
+
+    /// Reads the ticket key, creating it the first time, so that the tickets survive a restart
+    static std::string load_key(const std::string &key_file);
+
+public:
+
+    Authenticator(boost::asio::thread_pool &workers, const Server_Config &config, const std::string &db_name = "../Clients.sqlite",
+                  const std::string &key_file = "../Tickets.key");
+
+    ~Authenticator();
+
+    Authenticator(const Authenticator&) = delete;
+    Authenticator& operator=(const Authenticator&) = delete;
+
+    /// Checks a password digest or a ticket; done is called once, on the calling thread if the answer is immediate
+    /// and on the worker pool otherwise
+    void authenticate(const std::string &username, const std::string &secret, std::function<void(Auth_Result)> done);
+
+    /// Creates the stored form of a password digest, with a random salt
+    static std::string hash_password(const std::string &digest, const Scrypt_Params &params);
+
+    /// Checks a password digest against its stored form, either a scrypt record or a bare digest
+    static bool check_password(const std::string &digest, const std::string &record);
+
+    /// Gets the work factor of a scrypt record, false for a bare digest
+    static bool record_params(const std::string &record, Scrypt_Params &params);
+};
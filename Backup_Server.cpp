@@ -1,17 +1,64 @@
 #include "Backup_Server.h"
 
-Backup_Server::Backup_Server(boost::asio::io_context &io_context, const tcp::endpoint &endpoint) : acceptor(io_context, endpoint) {
-    do_accept();
+Backup_Server::Backup_Server(boost::asio::io_context &io_context, boost::asio::thread_pool &workers, const tcp::endpoint &endpoint,
+                             const Server_Config &config)
+        : gc_timer(io_context), retention_timer(io_context), workers(workers), config(config),
+        scheduler(std::make_shared<Fair_Scheduler>(config.workers ? config.workers : std::max(1u, std::thread::hardware_concurrency()))),
+        versions(std::make_shared<Version_Store>(Retention_Policy{config.keep_versions, config.keep_days, config.keep_snapshots}, config.durable_writes)),
+        staging(std::make_shared<Staging_Area>()),
+        auth(std::make_shared<Authenticator>(workers, config)),
+        tls(config.tls_cert.empty() ? nullptr : Tls_Context::server(config.tls_cert, config.tls_key)),
+        scrubber(std::chrono::seconds(config.scrub_interval), config.scrub_iops) {
+    listen(io_context, endpoint);
+    do_collect_partials();
+    do_apply_retention();
 };
 
-void Backup_Server::do_accept() {
-    std::cout << "Waiting for incoming connections..." << std::endl;
-    acceptor.async_accept([this](boost::system::error_code ec, tcp::socket socket) {
+unsigned short Backup_Server::port() const {
+    return acceptors.front().local_endpoint().port();
+}
+
+void Backup_Server::listen(boost::asio::io_context &io_context, tcp::endpoint endpoint) {
+    using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+    unsigned count = std::max(1u, config.acceptors);
+    acceptors.reserve(count);   // The accept loops refer to the acceptors
+    for (unsigned i = 0; i < count; i++) {
+        auto &acceptor = acceptors.emplace_back(io_context);
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(tcp::acceptor::reuse_address(true));
+        if (count > 1) acceptor.set_option(reuse_port(true));   // The kernel balances the connections among the sockets
+        acceptor.bind(endpoint);
+        acceptor.listen(config.accept_backlog);     // Room for a storm of reconnections after a restart
+        endpoint.port(acceptor.local_endpoint().port());    // The others share the port the first one got
+    }
+    for (auto &acceptor : acceptors) do_accept(acceptor);
+}
+
+void Backup_Server::do_accept(tcp::acceptor &acceptor) {
+    Logger::log(Log_Level::debug, "Waiting for incoming connections...");
+    acceptor.async_accept([this, &acceptor](boost::system::error_code ec, tcp::socket socket) {
         if (!ec) {
-            std::make_shared<Server_Session>(socket)->start();
+            std::make_shared<Server_Session>(socket, workers, scheduler, versions, staging, auth, tls, config)->start();
         } else {
-            std::cerr << "Error inside do_accept: " << ec.message() << std::endl;
+            Logger::log(Log_Level::error, "Error inside do_accept: " + ec.message());
         }
-        do_accept();
+        do_accept(acceptor);
+    });
+}
+
+void Backup_Server::do_collect_partials() {
+    auto expiration = std::time(nullptr) - 24 * 60 * 60;   // Partial uploads untouched for a day are considered abandoned
+    boost::asio::post(workers, [staging = staging, expiration]() {staging->collect(expiration);});
+    gc_timer.expires_after(std::chrono::hours(1));
+    gc_timer.async_wait([this](const boost::system::error_code &ec) {
+        if (!ec) do_collect_partials();
+    });
+}
+
+void Backup_Server::do_apply_retention() {
+    boost::asio::post(workers, [versions = versions]() {versions->apply_retention();});
+    retention_timer.expires_after(std::chrono::hours(1));
+    retention_timer.async_wait([this](const boost::system::error_code &ec) {
+        if (!ec) do_apply_retention();
     });
-}
\ No newline at end of file
+}
@@ -3,16 +3,48 @@
 #include <iostream>
 #include <boost/asio.hpp>
 #include <boost/filesystem.hpp>
+#include "Authenticator.h"
+#include "Config.h"
+#include "Fair_Scheduler.h"
+#include "Logger.h"
+#include "Scrubber.h"
 #include "Server_Session.h"
+#include "Staging_Area.h"
+#include "Version_Store.h"
 
 using boost::asio::ip::tcp;
 
 class Backup_Server {
-    tcp::acceptor acceptor;
+    std::vector<tcp::acceptor> acceptors;   // Bound to the same port, each with its own queue of connections
+    boost::asio::steady_timer gc_timer;
+    boost::asio::steady_timer retention_timer;
+    boost::asio::thread_pool &workers;  // Handles the requests of the sessions, hashing included
+    Server_Config config;
+    std::shared_ptr<Fair_Scheduler> scheduler;  // Shares the workers among the users
+    std::shared_ptr<Version_Store> versions;    // Shared with the sessions, which may outlive the server
+    std::shared_ptr<Staging_Area> staging;      // Shared with the sessions, which hold the files they are using
+    std::shared_ptr<Authenticator> auth;
+    std::shared_ptr<Tls_Context> tls;   // Null when the connections are plain TCP
+    Scrubber scrubber;
 
-    /// Waits for and accepts incoming client connections
-    void do_accept();
+    /// Opens the listening sockets, sharing the port when there are several
+    void listen(boost::asio::io_context &io_context, tcp::endpoint endpoint);
+
+    /// Waits for and accepts incoming client connections on a listening socket
+    void do_accept(tcp::acceptor &acceptor);
+
+    /// Periodically removes the partial uploads that have not been resumed for too long from the staging area, on the
+    /// worker pool
+    void do_collect_partials();
+
+    /// Periodically removes the versions and snapshots the retention policy no longer keeps, on the worker pool
+    void do_apply_retention();
 
 public:
-    Backup_Server(boost::asio::io_context &io_context, const tcp::endpoint &endpoint);
+    /// The worker pool must outlive the io_context, the sessions keep using it until they are destroyed
+    Backup_Server(boost::asio::io_context &io_context, boost::asio::thread_pool &workers, const tcp::endpoint &endpoint,
+                  const Server_Config &config = {});
+
+    /// Gets the port the server is listening on, useful when it has been bound to port 0
+    unsigned short port() const;
 };
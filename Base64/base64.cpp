@@ -1,89 +1,368 @@
 #include "base64.h"
+#include <array>
+#include <atomic>
 
-static inline bool is_base64(BYTE c) {
-    return (isalnum(c) || (c == '+') || (c == '/'));
-}
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BASE64_NEON
+#endif
 
-std::string base64_encode(BYTE const* buf, unsigned int bufLen) {
-    std::string base64_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    std::string ret;
-    int i = 0;
-    int j;
-    BYTE char_array_3[3], char_array_4[4];
-
-    while (bufLen--) {
-        char_array_3[i++] = *(buf++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 252u) / 4;
-            char_array_4[1] = ((char_array_3[0] & 3u) * 16) + ((char_array_3[1] & 240u) / 16);
-            char_array_4[2] = ((char_array_3[1] & 15u) * 4) + ((char_array_3[2] & 192u) / 64);
-            char_array_4[3] = char_array_3[2] & 63u;
-
-            for (i = 0; (i < 4) ; i++)
-                ret += base64_chars[char_array_4[i]];
-            i = 0;
+namespace {
+    const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    constexpr BYTE invalid = 0xFF;
+
+    /// Returns the table mapping each character to its index in base64_chars, invalid for the others
+    constexpr std::array<BYTE, 256> make_decode_table() {
+        std::array<BYTE, 256> table{};
+        for (auto &value : table) value = invalid;
+        for (int i = 0; i < 64; i++) table[static_cast<BYTE>(base64_chars[i])] = static_cast<BYTE>(i);
+        return table;
+    }
+    constexpr std::array<BYTE, 256> decode_table = make_decode_table();
+
+#ifdef BASE64_X86
+    /// Spreads 12 bytes over 16 lanes, each holding the 6 bit index of a character
+    __attribute__((target("ssse3"))) inline __m128i encode_reshuffle(__m128i in) {
+        in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        return _mm_or_si128(t1, t3);
+    }
+
+    /// Maps the indices to characters adding the offset of the range each one belongs to
+    __attribute__((target("ssse3"))) inline __m128i encode_translate(__m128i indices) {
+        const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));    // 0 for letters, 1..12 for digits, '+' and '/'
+        const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+        return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+    }
+
+    /// Maps 16 characters to their indices, valid is false if any of them is not a base64 character
+    __attribute__((target("ssse3"))) inline __m128i decode_translate(__m128i in, bool &valid) {
+        const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), in));
+        const __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), in));
+        const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in));
+        const __m128i plus = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+        const __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+        __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+        shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+        shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+        shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+        shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+        const __m128i matched = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, plus)), slash);
+        valid = _mm_movemask_epi8(matched) == 0xFFFF;
+        return _mm_add_epi8(in, shift);
+    }
+
+    /// Joins 16 indices of 6 bits into 12 bytes, stored in the low lanes
+    __attribute__((target("ssse3"))) inline __m128i decode_pack(__m128i values) {
+        const __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        const __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+        return _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    }
+
+    __attribute__((target("ssse3"))) size_t encode_ssse3(BYTE const* buf, size_t len, char* out) {
+        char *start = out;
+        while (len >= 16) {     // Each step reads 16 bytes but consumes 12 of them
+            __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), encode_translate(encode_reshuffle(in)));
+            buf += 12;
+            len -= 12;
+            out += 16;
         }
+        return (out - start) + base64_encode_scalar(buf, len, out);
     }
 
-    if (i) {    // If the buffer dimension is not divisible by 3
-        for (j = i; j < 3; j++)
-            char_array_3[j] = '\0';
+    __attribute__((target("ssse3"))) size_t decode_ssse3(char const* in, size_t len, BYTE* out) {
+        BYTE *start = out;
+        while (len >= 24) {     // The store writes 4 bytes past the decoded ones, the following characters reserve room for them
+            bool valid;
+            __m128i values = decode_translate(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), valid);
+            if (!valid) break;      // The scalar code stops at the exact character
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), decode_pack(values));
+            in += 16;
+            len -= 16;
+            out += 12;
+        }
+        return (out - start) + base64_decode_scalar(in, len, out);
+    }
 
-        char_array_4[0] = (char_array_3[0] & 252u) / 4;
-        char_array_4[1] = ((char_array_3[0] & 3u) * 16) + ((char_array_3[1] & 240u) / 16);
-        char_array_4[2] = ((char_array_3[1] & 15u) * 4) + ((char_array_3[2] & 192u) / 64);
-        char_array_4[3] = char_array_3[2] & 63u;
+    __attribute__((target("avx2"))) inline __m256i broadcast(__m128i lane) {
+        return _mm256_broadcastsi128_si256(lane);
+    }
 
-        for (j = 0; (j < i + 1); j++)
-            ret += base64_chars[char_array_4[j]];
+    /// Lanes set to all ones where the character lies between first and last
+    __attribute__((target("avx2"))) inline __m256i in_range(__m256i chars, char first, char last) {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8(static_cast<char>(first - 1))),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(last + 1)), chars));
+    }
 
-        while ((i++ < 3))   // Adding termination characters
-            ret += '=';
+    __attribute__((target("avx2"))) size_t encode_avx2(BYTE const* buf, size_t len, char* out) {
+        char *start = out;
+        const __m256i shuffle = broadcast(_mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        const __m256i offsets = broadcast(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0));
+        while (len >= 28) {     // Each step reads 28 bytes but consumes 24 of them, 12 per lane
+            __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+            __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 12));
+            __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+            in = _mm256_shuffle_epi8(in, shuffle);
+            const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+            const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+            const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+            const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+            const __m256i indices = _mm256_or_si256(t1, t3);
+            __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+            const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+            range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+            __m256i chars = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), chars);
+            buf += 24;
+            len -= 24;
+            out += 32;
+        }
+        return (out - start) + encode_ssse3(buf, len, out);
     }
 
-    return ret;
-}
+    __attribute__((target("avx2"))) size_t decode_avx2(char const* in, size_t len, BYTE* out) {
+        BYTE *start = out;
+        const __m256i pack = broadcast(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        while (len >= 48) {     // The store writes 8 bytes past the decoded ones, the following characters reserve room for them
+            __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+            const __m256i upper = in_range(chars, 'A', 'Z');
+            const __m256i lower = in_range(chars, 'a', 'z');
+            const __m256i digit = in_range(chars, '0', '9');
+            const __m256i plus = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('+'));
+            const __m256i slash = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('/'));
+            const __m256i matched = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, plus)), slash);
+            if (_mm256_movemask_epi8(matched) != -1) break;     // The narrower kernels stop at the exact character
+            __m256i shift = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')));
+            shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')));
+            const __m256i values = _mm256_add_epi8(chars, shift);
+            const __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+            const __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+            __m256i bytes = _mm256_shuffle_epi8(words, pack);
+            bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));   // Joining the 12 bytes of each lane
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), bytes);
+            in += 32;
+            len -= 32;
+            out += 24;
+        }
+        return (out - start) + decode_ssse3(in, len, out);
+    }
+#endif
 
-std::vector<BYTE> base64_decode(std::string const& encoded_string) {
-    std::string base64_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    int in_len = encoded_string.size();
-    int i = 0;
-    int j;
-    int in_ = 0;
-    BYTE char_array_4[4], char_array_3[3];
-    std::vector<BYTE> ret;
-
-    while (in_len-- && ( encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-        char_array_4[i++] = encoded_string[in_];
-        in_++;
-        if (i == 4) {
-            for (i = 0; i < 4; i++)
-                char_array_4[i] = base64_chars.find(char_array_4[i]);   // Substituting the character with its index in base64_chars
-
-            char_array_3[0] = (char_array_4[0] * 4) + ((char_array_4[1] & 48u) / 16);
-            char_array_3[1] = ((char_array_4[1] & 15u) * 16) + ((char_array_4[2] & 60u) / 4);
-            char_array_3[2] = ((char_array_4[2] & 3u) * 64) + char_array_4[3];
-
-            for (i = 0; (i < 3); i++)
-                ret.push_back(char_array_3[i]);
-            i = 0;
+#ifdef BASE64_NEON
+    size_t encode_neon(BYTE const* buf, size_t len, char* out) {
+        char *start = out;
+        uint8x16x4_t table;
+        for (int i = 0; i < 4; i++) table.val[i] = vld1q_u8(reinterpret_cast<const uint8_t*>(base64_chars) + 16 * i);
+        while (len >= 48) {
+            uint8x16x3_t in = vld3q_u8(buf);     // De-interleaving the first, second and third byte of each group
+            uint8x16x4_t chars;
+            chars.val[0] = vshrq_n_u8(in.val[0], 2);
+            chars.val[1] = vorrq_u8(vshrq_n_u8(in.val[1], 4), vshlq_n_u8(vandq_u8(in.val[0], vdupq_n_u8(3)), 4));
+            chars.val[2] = vorrq_u8(vshrq_n_u8(in.val[2], 6), vshlq_n_u8(vandq_u8(in.val[1], vdupq_n_u8(15)), 2));
+            chars.val[3] = vandq_u8(in.val[2], vdupq_n_u8(63));
+            for (auto &lane : chars.val) lane = vqtbl4q_u8(table, lane);
+            vst4q_u8(reinterpret_cast<uint8_t*>(out), chars);
+            buf += 48;
+            len -= 48;
+            out += 64;
         }
+        return (out - start) + base64_encode_scalar(buf, len, out);
     }
 
-    if (i) {
-        for (j = i; j < 4; j++)
-            char_array_4[j] = 0;
+    /// Maps 16 characters to their indices, the lanes of invalid characters are set to zero in matched
+    inline uint8x16_t neon_translate(uint8x16_t chars, uint8x16_t &matched) {
+        auto range = [&chars](uint8_t first, uint8_t last) {
+            return vandq_u8(vcgeq_u8(chars, vdupq_n_u8(first)), vcleq_u8(chars, vdupq_n_u8(last)));
+        };
+        const uint8x16_t upper = range('A', 'Z');
+        const uint8x16_t lower = range('a', 'z');
+        const uint8x16_t digit = range('0', '9');
+        const uint8x16_t plus = vceqq_u8(chars, vdupq_n_u8('+'));
+        const uint8x16_t slash = vceqq_u8(chars, vdupq_n_u8('/'));
+        uint8x16_t shift = vandq_u8(upper, vdupq_n_u8(static_cast<uint8_t>(-'A')));
+        shift = vorrq_u8(shift, vandq_u8(lower, vdupq_n_u8(static_cast<uint8_t>(26 - 'a'))));
+        shift = vorrq_u8(shift, vandq_u8(digit, vdupq_n_u8(static_cast<uint8_t>(52 - '0'))));
+        shift = vorrq_u8(shift, vandq_u8(plus, vdupq_n_u8(static_cast<uint8_t>(62 - '+'))));
+        shift = vorrq_u8(shift, vandq_u8(slash, vdupq_n_u8(static_cast<uint8_t>(63 - '/'))));
+        matched = vandq_u8(matched, vorrq_u8(vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, plus)), slash));
+        return vaddq_u8(chars, shift);
+    }
 
-        for (j = 0; j < 4; j++)
-            char_array_4[j] = base64_chars.find(char_array_4[j]);   // Substituting the character with its index in base64_chars
+    size_t decode_neon(char const* in, size_t len, BYTE* out) {
+        BYTE *start = out;
+        while (len >= 64) {
+            uint8x16x4_t chars = vld4q_u8(reinterpret_cast<const uint8_t*>(in));
+            uint8x16_t matched = vdupq_n_u8(0xFF);
+            for (auto &lane : chars.val) lane = neon_translate(lane, matched);
+            if (vminvq_u8(matched) != 0xFF) break;      // The scalar code stops at the exact character
+            uint8x16x3_t bytes;
+            bytes.val[0] = vorrq_u8(vshlq_n_u8(chars.val[0], 2), vshrq_n_u8(chars.val[1], 4));
+            bytes.val[1] = vorrq_u8(vshlq_n_u8(chars.val[1], 4), vshrq_n_u8(chars.val[2], 2));
+            bytes.val[2] = vorrq_u8(vshlq_n_u8(chars.val[2], 6), chars.val[3]);
+            vst3q_u8(out, bytes);
+            in += 64;
+            len -= 64;
+            out += 48;
+        }
+        return (out - start) + base64_decode_scalar(in, len, out);
+    }
+#endif
 
-        char_array_3[0] = (char_array_4[0] * 4) + ((char_array_4[1] & 48u) / 16);
-        char_array_3[1] = ((char_array_4[1] & 15u) * 16) + ((char_array_4[2] & 60u) / 4);
-        char_array_3[2] = ((char_array_4[2] & 3u) * 64) + char_array_4[3];
+    bool supported(Base64_Kernel kernel) {
+        switch (kernel) {
+            case Base64_Kernel::scalar:
+                return true;
+#ifdef BASE64_X86
+            case Base64_Kernel::ssse3:
+                return __builtin_cpu_supports("ssse3");
+            case Base64_Kernel::avx2:
+                return __builtin_cpu_supports("avx2");
+#endif
+#ifdef BASE64_NEON
+            case Base64_Kernel::neon:
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
 
-        for (j = 0; (j < i - 1); j++)
-            ret.push_back(char_array_3[j]);
+    /// Returns the fastest kernel the CPU supports
+    Base64_Kernel detect_kernel() {
+#ifdef BASE64_X86
+        __builtin_cpu_init();       // Running before the constructors of the runtime
+#endif
+        for (auto kernel : {Base64_Kernel::avx2, Base64_Kernel::neon, Base64_Kernel::ssse3})
+            if (supported(kernel)) return kernel;
+        return Base64_Kernel::scalar;
     }
 
+    std::atomic<Base64_Kernel> current_kernel{detect_kernel()};
+}
+
+size_t base64_encode_scalar(BYTE const* buf, size_t len, char* out) {
+    char *start = out;
+    for (; len >= 3; len -= 3, buf += 3, out += 4) {
+        out[0] = base64_chars[buf[0] >> 2u];
+        out[1] = base64_chars[((buf[0] & 3u) << 4u) | (buf[1] >> 4u)];
+        out[2] = base64_chars[((buf[1] & 15u) << 2u) | (buf[2] >> 6u)];
+        out[3] = base64_chars[buf[2] & 63u];
+    }
+    if (len) {    // If the buffer dimension is not divisible by 3
+        BYTE second = len > 1 ? buf[1] : 0;
+        out[0] = base64_chars[buf[0] >> 2u];
+        out[1] = base64_chars[((buf[0] & 3u) << 4u) | (second >> 4u)];
+        out[2] = len > 1 ? base64_chars[(second & 15u) << 2u] : '=';     // Adding termination characters
+        out[3] = '=';
+        out += 4;
+    }
+    return out - start;
+}
+
+size_t base64_decode_scalar(char const* in, size_t len, BYTE* out) {
+    BYTE *start = out;
+    BYTE values[4];
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4, out += 3) {
+        for (int j = 0; j < 4; j++) values[j] = decode_table[static_cast<BYTE>(in[i + j])];
+        if ((values[0] | values[1] | values[2] | values[3]) == invalid) break;      // Padding or not a base64 character
+        out[0] = (values[0] << 2u) | (values[1] >> 4u);
+        out[1] = (values[1] << 4u) | (values[2] >> 2u);
+        out[2] = (values[2] << 6u) | values[3];
+    }
+    size_t valid = 0;       // Characters of the last incomplete group, each one adds 6 bits
+    while (valid < 4 && i + valid < len && (values[valid] = decode_table[static_cast<BYTE>(in[i + valid])]) != invalid) valid++;
+    if (valid > 1) *(out++) = (values[0] << 2u) | (values[1] >> 4u);
+    if (valid > 2) *(out++) = (values[1] << 4u) | (values[2] >> 2u);
+    return out - start;
+}
+
+size_t base64_encode(BYTE const* buf, size_t len, char* out) {
+    switch (current_kernel.load(std::memory_order_relaxed)) {
+#ifdef BASE64_X86
+        case Base64_Kernel::avx2:
+            return encode_avx2(buf, len, out);
+        case Base64_Kernel::ssse3:
+            return encode_ssse3(buf, len, out);
+#endif
+#ifdef BASE64_NEON
+        case Base64_Kernel::neon:
+            return encode_neon(buf, len, out);
+#endif
+        default:
+            return base64_encode_scalar(buf, len, out);
+    }
+}
+
+size_t base64_decode(char const* in, size_t len, BYTE* out) {
+    switch (current_kernel.load(std::memory_order_relaxed)) {
+#ifdef BASE64_X86
+        case Base64_Kernel::avx2:
+            return decode_avx2(in, len, out);
+        case Base64_Kernel::ssse3:
+            return decode_ssse3(in, len, out);
+#endif
+#ifdef BASE64_NEON
+        case Base64_Kernel::neon:
+            return decode_neon(in, len, out);
+#endif
+        default:
+            return base64_decode_scalar(in, len, out);
+    }
+}
+
+std::string base64_encode(BYTE const* buf, unsigned int bufLen) {
+    std::string ret(base64_encoded_size(bufLen), '\0');
+    base64_encode(buf, bufLen, ret.data());
     return ret;
 }
+
+std::vector<BYTE> base64_decode(std::string const& encoded_string) {
+    std::vector<BYTE> ret(base64_decoded_max_size(encoded_string.size()));
+    ret.resize(base64_decode(encoded_string.data(), encoded_string.size(), ret.data()));
+    return ret;
+}
+
+Base64_Kernel base64_kernel() {
+    return current_kernel.load();
+}
+
+std::vector<Base64_Kernel> base64_available_kernels() {
+    std::vector<Base64_Kernel> kernels;
+    for (auto kernel : {Base64_Kernel::scalar, Base64_Kernel::ssse3, Base64_Kernel::avx2, Base64_Kernel::neon})
+        if (supported(kernel)) kernels.push_back(kernel);
+    return kernels;
+}
+
+bool base64_use_kernel(Base64_Kernel kernel) {
+    if (!supported(kernel)) return false;
+    current_kernel.store(kernel);
+    return true;
+}
+
+std::string base64_kernel_name(Base64_Kernel kernel) {
+    switch (kernel) {
+        case Base64_Kernel::ssse3:
+            return "ssse3";
+        case Base64_Kernel::avx2:
+            return "avx2";
+        case Base64_Kernel::neon:
+            return "neon";
+        default:
+            return "scalar";
+    }
+}
@@ -5,7 +5,33 @@
 #include <string>
 typedef unsigned char BYTE;
 
+/// Implementations of the codec, the best one supported by the CPU is selected at startup
+enum class Base64_Kernel {scalar, ssse3, avx2, neon};
+
 std::string base64_encode(BYTE const* buf, unsigned int bufLen);
 std::vector<BYTE> base64_decode(std::string const&);
 
+/// Number of characters produced by encoding len bytes, padding included
+inline size_t base64_encoded_size(size_t len) {return (len + 2) / 3 * 4;}
+/// Upper bound of the bytes produced by decoding len characters
+inline size_t base64_decoded_max_size(size_t len) {return (len + 3) / 4 * 3;}
+
+/// Encodes len bytes into out, which must hold base64_encoded_size(len) characters; returns the characters written
+size_t base64_encode(BYTE const* buf, size_t len, char* out);
+/// Decodes len characters into out, which must hold base64_decoded_max_size(len) bytes; returns the bytes written.
+/// As the string version, decoding stops at the first padding or non base64 character
+size_t base64_decode(char const* in, size_t len, BYTE* out);
+
+/// Table driven reference implementation, used for the tails of the vectorized kernels
+size_t base64_encode_scalar(BYTE const* buf, size_t len, char* out);
+size_t base64_decode_scalar(char const* in, size_t len, BYTE* out);
+
+/// Kernel currently used by base64_encode and base64_decode
+Base64_Kernel base64_kernel();
+/// Kernels the CPU can run, scalar always included
+std::vector<Base64_Kernel> base64_available_kernels();
+/// Forces a kernel, returns false and keeps the current one if the CPU does not support it
+bool base64_use_kernel(Base64_Kernel kernel);
+std::string base64_kernel_name(Base64_Kernel kernel);
+
 #endif
@@ -0,0 +1,39 @@
+#include "Buffer_Pool.h"
+
+Pooled_Buffer::Pooled_Buffer(std::shared_ptr<Buffer_Pool> pool, std::string buffer) : pool(std::move(pool)), buffer(std::move(buffer)) {}
+
+Pooled_Buffer &Pooled_Buffer::operator=(Pooled_Buffer &&other) noexcept {
+    if (this != &other) {
+        if (pool) pool->release(std::move(buffer));
+        pool = std::move(other.pool);
+        buffer = std::move(other.buffer);
+    }
+    return *this;
+}
+
+Pooled_Buffer::~Pooled_Buffer() {
+    if (pool) pool->release(std::move(buffer));
+}
+
+Buffer_Pool::Buffer_Pool(size_t max_buffers, size_t max_capacity) : max_buffers(max_buffers), max_capacity(max_capacity) {
+    free_buffers.reserve(max_buffers);      // Releasing never allocates
+}
+
+void Buffer_Pool::release(std::string buffer) {
+    if (buffer.capacity() > max_capacity) return;
+    std::lock_guard lg(pool_mutex);
+    if (free_buffers.size() < max_buffers) free_buffers.push_back(std::move(buffer));
+}
+
+Pooled_Buffer Buffer_Pool::acquire() {
+    std::string buffer;
+    {
+        std::lock_guard lg(pool_mutex);
+        if (!free_buffers.empty()) {
+            buffer = std::move(free_buffers.back());
+            free_buffers.pop_back();
+        }
+    }
+    buffer.clear();     // Keeping the capacity
+    return {shared_from_this(), std::move(buffer)};
+}
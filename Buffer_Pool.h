@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Buffer_Pool;
+
+/// String borrowed from a Buffer_Pool, it goes back to the pool with its capacity when the handle is destroyed
+class Pooled_Buffer {
+    std::shared_ptr<Buffer_Pool> pool;
+    std::string buffer;
+
+public:
+
+    /// Creating a buffer that does not belong to any pool
+    Pooled_Buffer() = default;
+
+    Pooled_Buffer(std::shared_ptr<Buffer_Pool> pool, std::string buffer);
+
+    Pooled_Buffer(Pooled_Buffer &&other) noexcept = default;
+
+    Pooled_Buffer &operator=(Pooled_Buffer &&other) noexcept;
+
+    ~Pooled_Buffer();
+
+    /// Getting the borrowed string
+    std::string &str() {return buffer;}
+
+    const std::string &str() const {return buffer;}
+
+    /// Telling whether the buffer goes back to a pool
+    bool pooled() const {return pool != nullptr;}
+};
+
+/// Free list of strings reused as send and receive buffers, so that the messages of a session stop allocating once warmed up
+class Buffer_Pool : public std::enable_shared_from_this<Buffer_Pool> {
+    std::vector<std::string> free_buffers;
+    size_t max_buffers;
+    size_t max_capacity;
+    std::mutex pool_mutex;
+
+    friend class Pooled_Buffer;
+
+    /// Giving a buffer back, it is dropped if the pool is full or the buffer grew over max_capacity
+    void release(std::string buffer);
+
+public:
+
+    /// Pool keeping up to max_buffers idle buffers, none of them larger than max_capacity bytes
+    explicit Buffer_Pool(size_t max_buffers = 16, size_t max_capacity = 4 << 20);
+
+    /// Borrowing an empty buffer, a new one is created only if all of them are in use
+    Pooled_Buffer acquire();
+};
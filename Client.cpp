@@ -1,51 +1,153 @@
 #include "Client.h"
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Content_Proof.h"
+#include "File_Extents.h"
+#include "File_Reader.h"
 
 #define delimiter "\n}\n"
 
-Client::Client(boost::asio::io_context& io_context, tcp::resolver::results_type  endpoints,
-        std::shared_ptr<bool> &running_client, std::string path_to_watch, std::shared_ptr<DirectoryWatcher> &dw, std::shared_ptr<bool> &stop, std::shared_ptr<bool> &running_watcher)
-        : io_context_(io_context), socket_(io_context), endpoints(std::move(endpoints)), running_client(running_client),
-        path_to_watch(std::move(path_to_watch)), dw_ptr(dw), stop(stop), running_watcher(running_watcher), delay(5000) {
-            do_connect();
+namespace {
+    auto &bytes_received = Metrics::instance().counter("rab_bytes_received_total{side=\"client\"}");
+    auto &bytes_sent = Metrics::instance().counter("rab_bytes_sent_total{side=\"client\"}");
+    auto &queue_depth = Metrics::instance().gauge("rab_write_queue_depth{side=\"client\"}");
+    auto &queue_bytes = Metrics::instance().gauge("rab_write_queue_bytes{side=\"client\"}");
+    auto &uploader_waits = Metrics::instance().counter("rab_backpressure_waits_total{side=\"client\"}");
+    auto &jobs_depth = Metrics::instance().gauge("rab_upload_jobs_depth");
+    auto &retry_waits = Metrics::instance().counter("rab_retry_waits_total{side=\"client\"}");
+    auto &write_lag = Metrics::instance().histogram("rab_write_lag_seconds{side=\"client\"}");
+    auto &changed_uploads = Metrics::instance().counter("rab_uploads_changed_total");
+    Message_Counters messages_received("rab_messages_received_total", "client");
+    Message_Counters messages_sent("rab_messages_sent_total", "client");
 }
 
-void Client::do_connect() {
+Client::Client(boost::asio::io_context& io_context, std::string host, std::string port,
+        std::shared_ptr<bool> &running_client, std::string path_to_watch, std::shared_ptr<DirectoryWatcher> &dw, std::shared_ptr<bool> &stop, std::shared_ptr<bool> &running_watcher,
+        Client_Config config, Throttling throttling, std::shared_ptr<Tls_Context> tls, std::string root_name, bool console)
+        : io_context_(io_context), socket_(io_context), transport(socket_, std::move(tls)), resolver(io_context), host(std::move(host)),
+        port(std::move(port)), dw_ptr(dw),
+        path_to_watch(std::move(path_to_watch)), root_name(std::move(root_name)), config(std::move(config)), throttling(std::move(throttling)),
+        reconnect_policy(retry_policy(this->config)), busy_policy(retry_policy(this->config)), retry_timer(io_context), busy_timer(io_context), signals(io_context),
+        answer_timer(io_context), stop_timer(io_context), running_client(running_client), running_watcher(running_watcher), stop(stop),
+        console(console && !this->config.daemon) {
+            while (this->root_name.find('.') < this->root_name.size())    // Making the name compatible with json polices
+                this->root_name.replace(this->root_name.find('.'), 1, ":");
+            Content_Hasher hasher;
+            hasher.update_raw(this->root_name.data(), this->root_name.size());
+            root_hash = hasher.final();
+            cred.ticket = this->config.ticket;
+            if (cred.ticket.empty() && !this->config.ticket_file.empty()) std::getline(std::ifstream(this->config.ticket_file), cred.ticket);
+            if (this->config.daemon) {
+                signals.add(SIGTERM);
+                signals.add(SIGINT);
+                signals.async_wait([this](const boost::system::error_code &ec, int) {if (!ec) shutdown();});
+            }
+            if (!this->console) watch_stop();
+            do_start_uploader();
+            boost::asio::co_spawn(io_context_, run_session(), boost::asio::detached);
+}
+
+boost::asio::awaitable<void> Client::run_session() {
     std::cout << "Trying to connect..." << std::endl;
-    boost::asio::async_connect(socket_, endpoints, [this](boost::system::error_code ec, const tcp::endpoint&) { // Asynchronous connection request
-        if (!ec) {
-            get_credentials();
-            do_read();
-        } else {
-            handle_connection_failures();
+    bool reconnection = false;
+    while (!*stop) {
+        auto ec = co_await open_connection();
+        if (ec) {
+            auto wait = *stop ? std::nullopt : next_retry(reconnect_policy);
+            if (!wait) {
+                if (*stop) co_return;
+                std::cerr << "Server unavailable. ";
+                co_await ask_reconnection();
+                if (*stop) co_return;
+                reconnect_policy.succeeded();   // A new round of attempts
+                continue;
+            }
+            retry_timer.expires_after(*wait);
+            co_await retry_timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            if (ec || *stop) co_return;     // Cancelled by shutdown
+            continue;
         }
-    });
+        reconnect_policy.succeeded();
+        read_buf.consume(read_buf.size());      // A partial message of the previous connection can not be completed
+        if (reconnection) resume_session();
+        else get_credentials();
+        co_await read_messages();
+        *running_watcher = false;   // Signaling to the directory watcher the end of the client session
+        if (*stop) co_return;
+        if (!*running_client) {     // Closed on purpose: the user is asked, the sessions without input wait and connect again
+            if (console) {
+                co_await ask_reconnection();
+                if (*stop) co_return;
+            } else {
+                auto wait = next_retry(reconnect_policy);
+                retry_timer.expires_after(*wait);
+                co_await retry_timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+                if (ec || *stop) co_return;
+            }
+            *running_client = true;
+        }
+        reconnection = true;
+    }
 }
 
-void Client::do_read() {
-    std::cout << "Reading message..." << std::endl;
-    boost::asio::async_read_until(socket_,read_buf, delimiter, [this](boost::system::error_code ec, std::size_t length) {
-        if (!ec) {
-            std::string str(boost::asio::buffers_begin(read_buf.data()),
-                            boost::asio::buffers_begin(read_buf.data()) + read_buf.size());
-            read_buf.consume(length);     // Cropping buffer in order to let the next do_read work properly
-            str.resize(length);           // Cropping in order to erase residuals taken from the buffer
-            Message msg;
-            *msg.get_msg_ptr() = str;
-            handle_status(msg);
-            do_read();
-        } else {
-            *running_watcher = false;   // Signaling to the directory watcher the end of the client session
-            if (*running_client) handle_reading_failures();   // If the socket has been closed by the server, then call the EOF handler
-        }
-    });
+boost::asio::awaitable<boost::system::error_code> Client::open_connection() {
+    boost::system::error_code ec;
+    auto endpoints = co_await resolver.async_resolve(host, port, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (ec) {   // Retried like a refused connection
+        Logger::log(Log_Level::warning, "Unable to resolve " + host + ": " + ec.message());
+        co_return ec;
+    }
+    co_await boost::asio::async_connect(socket_, endpoints, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    if (ec || !transport.secure()) co_return ec;
+    co_await transport.async_handshake(boost::asio::redirect_error(boost::asio::use_awaitable, ec));     // Resuming the previous TLS session if the server still knows it
+    if (ec) {
+        Logger::log(Log_Level::error, "TLS handshake failed: " + ec.message());
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+    }
+    co_return ec;
+}
+
+boost::asio::awaitable<void> Client::read_messages() {
+    boost::system::error_code ec;
+    read_buf.prepare(Message::read_room);    // The reads take in up to this many bytes at once, many small messages with a single call
+    while (true) {
+        Logger::log(Log_Level::trace, "Reading message...");
+        size_t length = Message::complete_length(std::string_view(static_cast<const char*>(read_buf.data().data()), read_buf.size()));
+        if (length == 0) length = co_await boost::asio::async_read_until(transport, read_buf, delimiter, boost::asio::redirect_error(boost::asio::use_awaitable, ec));    // Messages already received are handled without waiting
+        if (ec) co_return;
+        bytes_received.add(length);
+        handle_status(std::string_view(static_cast<const char*>(read_buf.data().data()), length));    // Parsing in place, the buffer is contiguous
+        read_buf.consume(length);     // Cropping buffer so that the next read starts from the following message
+    }
 }
 
 void Client::do_write() {
-    std::cout << "Writing message..." << std::endl;
-    auto msg = write_queue_c.front();
-    boost::asio::async_write(socket_, boost::asio::dynamic_string_buffer(*write_queue_c.front().get_msg_ptr()),
-            [this, msg](boost::system::error_code ec, std::size_t length) {
+    Logger::log(Log_Level::trace, "Writing message...");
+    {
+        std::lock_guard lg(wq_mutex);   // Lock in order to guarantee thread safe pop operation
+        auto queue = std::find_if(write_queue_c.begin(), write_queue_c.end(), [](const std::queue<Message> &q){return !q.empty();});
+        if (queue == write_queue_c.end()) {    // Nothing left to send, the next enqueue_msg restarts the writing
+            write_in_progress = false;
+            return;
+        }
+        writing = std::move(queue->front());
+        queue->pop();   // Popping before the write so that a message of a higher class can overtake the following ones
+        queue_depth.add(-1);
+    }
+    boost::asio::async_write(transport, writing.buffer(),
+            [this](boost::system::error_code ec, std::size_t length) {
+                {
+                    std::lock_guard lg(wq_mutex);
+                    queued_bytes -= writing.size();     // Written or lost with the connection
+                    queue_bytes.set(static_cast<double>(queued_bytes));
+                }
+                room_cv.notify_all();
                 if (!ec) {
+                    bytes_sent.add(length);
+                    write_lag.observe(writing.get_age());      // Time spent by the message in the queue and on the wire
                     auto response_timer = std::make_unique<boost::asio::system_timer>(io_context_);
                     response_timer->expires_from_now(boost::asio::chrono::minutes(10));
                     response_timer->async_wait([this](const boost::system::error_code &error){
@@ -56,7 +158,8 @@ void Client::do_write() {
                     });
                     try {
                         std::string key;
-                        auto header = const_cast<Message&>(msg).get_header();
+                        auto header = writing.get_header();
+                        messages_sent.count(header);
                         switch (header) {
                             case action_type::login : {
                                 key = "login";
@@ -66,47 +169,70 @@ void Client::do_write() {
                                 key = "synch";
                                 break;
                             }
+                            case action_type::metadata : {
+                                break;      // Not answered by the server
+                            }
                             default: {
                                 boost::property_tree::ptree pt;
-                                std::stringstream data_stream(const_cast<Message&>(msg).get_data());
+                                std::stringstream data_stream{std::string(writing.get_data())};
                                 boost::property_tree::read_json(data_stream, pt);
                                 key = pt.get<std::string>("path");
                                 break;
                             }
                         }
-                        ack_tracker[key] = std::move(response_timer);
-                        std::lock_guard lg(wq_mutex);   // Lock in order to guarantee thread safe pop operation
-                        write_queue_c.pop();
-                        if (!write_queue_c.empty()) do_write();
+                        if (!key.empty()) ack_tracker[key] = std::move(response_timer);    // A later chunk of the same file replaces the timer of the previous one
+                        do_write();
                     } catch (const boost::property_tree::ptree_error &err) {
                         std::cerr << "Error while completing login procedure. ";
                         close();
                     }
                 } else {
+                    {
+                        std::lock_guard lg(wq_mutex);
+                        write_in_progress = false;  // Letting the login message start the writing again after the reconnection
+                    }
                     if (*running_client) {
                         *running_watcher = false;   // Signaling to the directory watcher the end of the client session
-                        std::cerr << "Error while writing. ";
-                        close();
+                        std::cerr << "Error while writing: " << ec.message() << std::endl;
+                        if (socket_.is_open()) socket_.close();     // Letting the pending read fail, the session coroutine takes care of the reconnection
                     }
                 }
     });
 }
 
-void Client::enqueue_msg(const Message &msg) {
+void Client::enqueue_msg(Message &&msg, priority_class priority) {
     std::lock_guard lg(wq_mutex);   // Lock in order to guarantee thread safe push operation
-    bool write_in_progress = !write_queue_c.empty();
-    write_queue_c.push(msg);
-    if (!write_in_progress) do_write();    // Calling do_write only if it is not already running
+    queued_bytes += msg.size();     // Never blocking here, the network thread enqueues the control messages
+    queue_bytes.set(static_cast<double>(queued_bytes));
+    write_queue_c[priority].push(std::move(msg));
+    queue_depth.add(1);
+    if (!write_in_progress) {   // Calling do_write only if it is not already running, always from the io_context thread
+        write_in_progress = true;
+        boost::asio::post(io_context_, [this](){do_write();});
+    }
 }
 
 void Client::get_credentials() {
     try {
         std::unique_lock ul(input_mutex);   // Unique lock in order to use the cv wait
-        do_start_input_reader();
-        cv.wait(ul, [this](){return !cred.username.empty() && !cred.password.empty();});    // Waiting for the input reader thread to receive the credentials
-        Message login_message;
-        login_message.put_credentials(cred.username, cred.password);    // Saving the credentials in the message that has to be sent
-        enqueue_msg(login_message);
+        if (!config.username.empty() && (!config.password.empty() || !cred.ticket.empty())) {   // If the settings contain the credentials, then there is no need to ask them
+            std::string user = config.username;
+            std::string pwd = config.password;
+            set_username(user);
+            if (!pwd.empty()) set_password(pwd);
+        } else if (!console) {     // A ticket file that was never written
+            Logger::log(Log_Level::error, "No credentials to log in with, set the password or a ticket");
+            shutdown();
+            return;
+        } else {
+            wants_credentials = true;
+            std::cout << "Insert username: ";
+        }
+        if (console && !input_reader.joinable()) do_start_input_reader();     // The commands are read whatever the source of the credentials
+        cv.wait(ul, [this](){return !wants_credentials;});    // Waiting for the input reader thread to receive the credentials
+        Message login_message(pool);
+        login_message.put_credentials(cred.username, cred.secret());    // Saving the credentials in the message that has to be sent
+        enqueue_msg(std::move(login_message));
     } catch (const boost::property_tree::ptree_error &err) {
         std::cerr << "Error while completing login procedure. ";
         close();
@@ -118,53 +244,95 @@ void Client::set_username(std::string &user) {
 }
 
 void Client::set_password(std::string &pwd) {
+    cred.password = password_digest(pwd);
+}
+
+std::string Credentials::secret() const {
+    return ticket.empty() ? password : Message::ticket_prefix + ticket;
+}
+
+std::string password_digest(const std::string &password) {
     unsigned char digest[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, pwd.data(), pwd.length());
-    SHA256_Final(digest, &sha256);
+    EVP_Digest(password.data(), password.length(), digest, nullptr, EVP_sha256(), nullptr);
     std::stringstream ss;
     for (unsigned char ch : digest) {
         ss << std::hex << std::setw(2) << std::setfill('0') << (int)ch;
     }
-    cred.password = ss.str();
+    return ss.str();
 }
 
 void Client::do_start_input_reader() {
     input_reader = boost::thread([this](){
         std::string input;
-        bool user_done = false;    // True if the username has been inserted
-        bool cred_done = false;    // True if the credentials have been inserted
-        std::cout << "Insert username: ";
         while (std::cin >> input) {
-            if (!std::cin) close();    // If there is any error during the input process, then close.
-            if (cred_done) {
-                if (input == "exit") {
-                    if (*running_client) close();   // If the input is equal to 'exit' and the client session is still up, then close
-                    else std::cerr << "Do you want to reconnect? (y/n): ";
-                } else if (input == "y") {     // If the input is equal to 'y', then the thread sets the value of stop to false and notifies the input to the client thread
-                    std::lock_guard lg(input_mutex);
-                    *stop = false;
-                    cv.notify_all();
-                    break;
-                } else if (input == "n") {     // If the input is equal to 'n', then the thread sets the value of stop to true and notifies the input to the client thread
-                    std::lock_guard lg(input_mutex);
-                    *stop = true;
-                    cv.notify_all();
-                    break;
-                } else if (!*running_client){   // If the input is not an expected input and the client is not running anymore, then repeat the question
-                    std::cerr << "Do you want to reconnect? (y/n): ";
-                }
-            } else {
+            {
                 std::lock_guard lg(input_mutex);
-                if (!user_done) {   // If the username has not been inserted, then its set function is called on the input
-                    set_username(input);
-                    user_done = true;
-                    std::cout << "Insert password: ";
-                } else {            // Else the password set function is called on the input
-                    set_password(input);
-                    cred_done = true;
-                    cv.notify_all();    // Waking up the client thread in the get_credentials function
+                if (asking) {   // Only the answer is taken while the user is asked whether to reconnect
+                    if (input != "y" && input != "n") {
+                        std::cerr << "Do you want to reconnect? (y/n): ";
+                        continue;
+                    }
+                    *stop = input == "n";
+                    asking = false;
+                    answered = true;
+                    boost::asio::post(io_context_, [this]() {answer_timer.cancel();});     // Resuming the session, see ask_reconnection
+                    if (*stop) break;
+                    continue;
+                }
+                if (wants_credentials) {
+                    if (cred.username.empty()) {    // If the username has not been inserted, then its set function is called on the input
+                        set_username(input);
+                        std::cout << "Insert password: ";
+                    } else {            // Else the password set function is called on the input
+                        set_password(input);
+                        wants_credentials = false;
+                        cv.notify_all();    // Waking up the client thread in the get_credentials function
+                    }
+                    continue;
+                }
+            }
+            if (input == "exit") {
+                if (*running_client) close();   // If the input is equal to 'exit' and the client session is still up, then close, the session asks whether to reconnect
+            } else if (input == "limit") {     // If the input is equal to 'limit', then the following two words set a rate: limit <upload|read|iops> <units per second>
+                std::string target;
+                double rate;
+                if (std::cin >> target >> rate) {
+                    std::shared_ptr<Rate_Limiter> limiter;
+                    if (target == "upload") limiter = throttling.upload;
+                    else if (target == "read") limiter = throttling.read_bytes;
+                    else if (target == "iops") limiter = throttling.read_ops;
+                    if (limiter) {
+                        limiter->set_rate(rate);
+                        std::cout << "Limit of " << target << " set to " << rate << " per second (0 means unlimited)." << std::endl;
+                    } else {
+                        std::cerr << "Unknown limit, use upload, read or iops." << std::endl;
+                    }
+                }
+            } else if (input == "history" || input == "snapshot" || input == "snapshots" || input == "restore") {
+                // history <path> | snapshot <name> | snapshots | restore <path> [version | @snapshot], '/' is the whole tree
+                std::string arguments;
+                std::getline(std::cin, arguments);
+                std::istringstream args(arguments);
+                std::string path;
+                std::string which;
+                args >> path >> which;
+                boost::property_tree::ptree pt;
+                if (input == "snapshot" || input == "snapshots") {
+                    pt.put("path", "snapshot");
+                    if (input == "snapshot") pt.put("name", path.empty() ? "manual" : path);
+                    send_request(action_type::snapshot, pt);
+                    continue;
+                }
+                while (!path.empty() && path.back() == '/') path.pop_back();    // "/" and "dir/" name the whole tree and the directory
+                if (!path.empty() && path.front() == '/') path.erase(0, 1);
+                while (path.find('.') < path.size()) path.replace(path.find('.'), 1, ":");     // Making the path compatible with json polices
+                pt.put("path", path);
+                if (input == "history") {
+                    send_request(action_type::history, pt);
+                } else {
+                    if (!which.empty() && which.front() == '@') pt.put("snapshot", which.substr(1));
+                    else if (!which.empty()) pt.put("version", which);
+                    send_request(action_type::restore, pt);
                 }
             }
         }
@@ -175,146 +343,354 @@ void Client::do_start_directory_watcher() {
     if (!*running_watcher) *running_watcher = true;    // If the reconnection attempt went smoothly, then restart the directory watcher
     directory_watcher = boost::thread([this](){
         dw_ptr->start([this](std::string path, FileStatus status, bool isFile) {
-            if (boost::filesystem::is_regular_file(boost::filesystem::path(path))   // Process only regular files, all other file types are ignored
-            || boost::filesystem::is_directory(boost::filesystem::path(path)) || status == FileStatus::erased) {
-                boost::property_tree::ptree pt;
-                int action_type = 999;     // Setting action type to an unreachable (wrong) value
-                std::string path_to_send = path.substr(path_to_watch.size() + 1);   // Preparing only the name of the file or directory
-                while (path_to_send.find('.') < path_to_send.size())    // Making the path compatible with json polices
-                    path_to_send.replace(path_to_send.find('.'), 1, ":");
+            if (boost::filesystem::is_regular_file(boost::filesystem::path(path))   // Process only regular files, links and directories, all other file types are ignored
+            || boost::filesystem::is_directory(boost::filesystem::path(path)) || boost::filesystem::is_symlink(boost::filesystem::path(path))
+            || status == FileStatus::erased) {
+                std::string path_to_send = remote_path(path);   // Preparing only the name of the file or directory
                 switch (status) {
                     case FileStatus::created : {
-                        if (isFile) std::cout << "File created: " << path_to_send << '\n';
-                        else std::cout << "Directory created: " << path_to_send << '\n';
-                        try {
-                            read_file(path, path_to_send, pt);
-                            action_type = 2;
-                        } catch (const std::ios_base::failure &err) {
-                            std::cerr << "Error while opening the file: " << path_to_send << " It won't be sent." << std::endl;
-                            paths_to_ignore.emplace_back(path_to_send);    // Adding the path of the file to the black list for removal
-                        } catch (const boost::property_tree::ptree_bad_data &err) {
-                            std::cerr << "Error while parsing the file: " << path_to_send << " It won't be sent." << std::endl;
-                            paths_to_ignore.emplace_back(path_to_send);    // Adding the path of the file to the black list for removal
-                        }
+                        Logger::log(Log_Level::info, (isFile ? "File created: " : "Directory created: ") + path_to_send);
+                        enqueue_upload({path, path_to_send, action_type::create, 0, upload_priority(path, true)});
+                        enqueue_metadata(path);
                         break;
                     }
                     case FileStatus::modified : {
                         if (isFile) {
-                            std::cout << "File modified: " << path << '\n';
-                            try {
-                                read_file(path, path_to_send, pt);
-                                action_type = 3;
-                            } catch (const std::ios_base::failure &err) {
-                                std::cerr << "Error while opening the file: " << path_to_send << " It won't be sent." << std::endl;
-                                paths_to_ignore.emplace_back(path_to_send);    // Adding the path of the file to the black list for removal
-                            } catch (const boost::property_tree::ptree_bad_data &err) {
-                                std::cerr << "Error while parsing the file: " << path_to_send << " It won't be sent." << std::endl;
-                                paths_to_ignore.emplace_back(path_to_send);    // Adding the path of the file to the black list for removal
-                            }
+                            Logger::log(Log_Level::info, "File modified: " + path);
+                            enqueue_upload({path, path_to_send, action_type::update, 0, upload_priority(path, true)});
                         } else {
-                            std::cout << "Directory modified: " << path << '\n';
+                            Logger::log(Log_Level::debug, "Directory modified: " + path);
                         }
+                        enqueue_metadata(path);
+                        break;
+                    }
+                    case FileStatus::metadata : {
+                        Logger::log(Log_Level::debug, "Metadata changed: " + path_to_send);
+                        enqueue_metadata(path);
                         break;
                     }
                     case FileStatus::erased : {
-                        try {
-                            if (std::find(paths_to_ignore.begin(), paths_to_ignore.end(), path_to_send) == paths_to_ignore.end()) {    // If the path is not blacklisted, then send the delete command
-                                pt.add("path", path_to_send);
-                                action_type = 4;
-                                if (isFile) std::cout << "File erased: " << path_to_send << '\n';
-                                else std::cout << "Directory erased: " << path_to_send << '\n';
-                            }
-                        } catch (const boost::property_tree::ptree_error &err) {
-                            std::cerr << "Error while executing the action on the file " << path_to_send << ", closing session. " << std::endl;
-                            close();
-                        }
+                        Logger::log(Log_Level::info, (isFile ? "File erased: " : "Directory erased: ") + path_to_send);
+                        enqueue_upload({path, path_to_send, action_type::erase, 0, priority_class::control});
                         break;
                     }
                     default :
                         std::cout << "Error! Unknown file status.\n";
                 }
-                // Writing message
-                if (action_type <= 4) {    // If no errors occurred
-                    try {
-                        std::stringstream file_stream;
-                        boost::property_tree::write_json(file_stream, pt, false);   // Saving the json in a stream, "false" in order to avoid the '\n' before the '}' at the end
-                        std::string file_string(file_stream.str());
-                        Message write_msg;
-                        write_msg.encode_message(action_type, file_string);
-                        enqueue_msg(write_msg);
-                    } catch (const boost::property_tree::ptree_error &err) {
-                        paths_to_ignore.emplace_back(path_to_send);    // Adding the path of the file to the black list for removal
-                        std::cerr << "Error while executing the action on the file " << path_to_send << ", it won't be sent. " << std::endl;
-                        std::cerr << "If you want to resynchronize write \'exit\'." << std::endl;
-                    }
-                }
             }
         });
     });
 }
 
-void Client::handle_connection_failures() {
-    boost::asio::async_connect(socket_, endpoints, [this](boost::system::error_code ec, const tcp::endpoint&) {    // Retrying the connection request to the socket
-        if (!ec) {
-            delay = boost::chrono::milliseconds(5000);  // Resetting delay to the initial value
-            get_credentials();
-            do_read();
-        } else {
-            auto wait = boost::chrono::milliseconds(delay)/1000;
-            std::cout << "Server unavailable, retrying in " << wait.count() << " sec" << std::endl;
-            boost::this_thread::sleep_for(delay);
-            if (wait.count() >= 20) {
-                std::cerr << "Server unavailable. ";
-                std::cerr << "Do you want to reconnect? (y/n): ";
-                std::string input;
-                while (std::cin >> input) {
-                    if (!std::cin) close();        // If there is any error during the input process, then close.
-                    if (input == "n") {            // If the input is 'n', then stops the while in the main
-                        *stop = true;
-                        break;
-                    } else if (input == "y") {     // If the input is 'y', then take another round in the while in the main
-                        break;
-                    } else {
-                        std::cerr << "Do you want to reconnect? (y/n): ";
-                    }
+void Client::do_start_uploader() {
+    uploader = boost::thread([this](){
+        while (true) {
+            Upload_Job job;
+            std::vector<std::string> metadata;
+            auto pending = [this](){return std::find_if(upload_jobs.begin(), upload_jobs.end(), [](const std::deque<Upload_Job> &q){return !q.empty();});};
+            {
+                std::unique_lock ul(uj_mutex);      // Unique lock in order to use the cv wait
+                uj_cv.wait(ul, [this, &pending](){return exiting || pending() != upload_jobs.end() || !metadata_pending.empty();});
+                if (exiting) break;
+                auto jobs = pending();      // Taking the first job of the highest priority class
+                if (jobs == upload_jobs.end() || metadata_pending.size() >= metadata_batch) {     // Or a batch of metadata, behind the contents
+                    while (!metadata_pending.empty() && metadata.size() < metadata_batch)
+                        metadata.push_back(std::move(metadata_pending.extract(metadata_pending.begin()).value()));
+                } else {
+                    job = jobs->front();
+                    jobs->pop_front();
+                    jobs_depth.add(-1);
+                    if (job.action != action_type::erase && refused_uploads.count(job.path_to_send)) continue;
+                }
+            }
+            if (!metadata.empty()) {
+                if (*running_client && *running_watcher) {     // Otherwise sent again in full after the next login
+                    wait_for_room();
+                    send_metadata(metadata);
+                }
+                continue;
+            }
+            if (!*running_client || !*running_watcher) continue;    // Jobs taken while the session is down are requested again by the next synchronization
+            if (job.action != action_type::erase) wait_for_room();     // Reading the next chunk only once the socket has taken the previous ones
+            if (!do_upload(job)) {      // Putting the rest of the file back, so that jobs of a higher class can overtake it chunk by chunk
+                std::lock_guard lg(uj_mutex);
+                bool superseded = std::any_of(upload_jobs.begin(), upload_jobs.end(), [&job](const std::deque<Upload_Job> &q){
+                    return std::any_of(q.begin(), q.end(), [&job](const Upload_Job &queued){return queued.path_to_send == job.path_to_send;});
+                });
+                if (!superseded) {      // Otherwise the file changed meanwhile, the newer job sends it in full
+                    upload_jobs[job.priority].push_front(job);
+                    jobs_depth.add(1);
                 }
-            } else {
-                delay *= 2;    // If the wait is not over the limit and there is an error, then double the delay and recall the function
-                handle_connection_failures();
             }
         }
     });
 }
 
-void Client::handle_reading_failures() {
-    boost::asio::async_connect(socket_, endpoints, [this](boost::system::error_code ec, const tcp::endpoint&) {    // Retrying the connection request to the socket
-        if (!ec) {
-            try {
-                delay = boost::chrono::milliseconds(5000);  // Resetting delay to the initial value
-                timer.stop();   // Stopping the timer in order to measure the time between one failure and the following one
-                Message login_message;
-                login_message.put_credentials(cred.username, cred.password);    // Re-creating the login message with the saved credentials in order to automatize the reconnection attempt
-                enqueue_msg(login_message);
-                do_start_directory_watcher();   // Restarting the directory watcher if the reconnection goes well
-                do_read();   // Restarting the reading from socket procedure if the reconnection goes well
-                handle_reconnection_timer();
-            } catch (const boost::property_tree::ptree_error &err) {
-                std::cerr << "Error while reconnecting. ";
-                close();
-            }
+void Client::wait_for_room() {
+    std::unique_lock ul(wq_mutex);
+    if (queued_bytes < config.max_queued_bytes) return;
+    uploader_waits.add();
+    while (queued_bytes >= config.max_queued_bytes && *running_client && !exiting)
+        room_cv.wait_for(ul, std::chrono::milliseconds(100));  // The timeout notices the end of the session
+}
+
+void Client::enqueue_upload(Upload_Job job) {
+    std::lock_guard lg(uj_mutex);   // Lock in order to guarantee thread safe push operation
+    if (job.offset == 0) {      // A newer content of the file: it may fit now, and the jobs still queued would send an older one
+        refused_uploads.erase(job.path_to_send);
+        for (auto &jobs : upload_jobs)
+            jobs_depth.add(-static_cast<double>(std::erase_if(jobs, [&job](const Upload_Job &queued){return queued.path_to_send == job.path_to_send;})));
+    }
+    upload_jobs[job.priority].emplace_back(std::move(job));
+    jobs_depth.add(1);
+    uj_cv.notify_one();
+}
+
+void Client::enqueue_metadata(const std::string &path) {
+    std::lock_guard lg(uj_mutex);
+    metadata_pending.insert(path);
+    uj_cv.notify_one();
+}
+
+void Client::send_metadata(const std::vector<std::string> &paths) {
+    boost::property_tree::ptree pt;
+    boost::property_tree::ptree entries;
+    for (const auto &path : paths) {
+        Node_Info node = dw_ptr->getNode(path);     // The metadata seen by the last scan
+        if (node.metadata.empty()) continue;    // Erased in the meantime
+        boost::property_tree::ptree entry;
+        entry.put("path", remote_path(path));
+        entry.put("meta", node.metadata);
+        entries.push_back({"", entry});
+    }
+    if (entries.empty()) return;
+    pt.add_child("entries", entries);
+    std::stringstream metadata_stream;
+    boost::property_tree::write_json(metadata_stream, pt, false);
+    Message metadata_msg(pool);
+    metadata_msg.encode_message(action_type::metadata, metadata_stream.str());
+    if (throttling.upload) throttling.upload->acquire(metadata_msg.size());
+    enqueue_msg(std::move(metadata_msg), priority_class::bulk);
+}
+
+void Client::reset_pending() {
+    {
+        std::lock_guard lg(uj_mutex);
+        for (auto &jobs : upload_jobs) {
+            jobs_depth.add(-static_cast<double>(jobs.size()));
+            jobs.clear();
+        }
+        metadata_pending.clear();
+        probing.clear();
+        sending.clear();
+    }
+    {
+        std::lock_guard lg(wq_mutex);
+        for (auto &queue : write_queue_c) {
+            queue_depth.add(-static_cast<double>(queue.size()));
+            for (; !queue.empty(); queue.pop()) queued_bytes -= queue.front().size();
+        }
+        queue_bytes.set(static_cast<double>(queued_bytes));
+    }
+    room_cv.notify_all();
+    for (auto &entry : ack_tracker) entry.second->cancel();    // Messages lost with the connection will never be acknowledged
+    ack_tracker.clear();
+}
+
+bool Client::do_upload(Upload_Job &job) {
+    try {
+        Message write_msg(pool);
+        size_t length = 0;
+        uint64_t size = 0;
+        auto priority = job.priority;
+        if (job.action == action_type::erase) {
+            std::lock_guard lg(fs_mutex);
+            if (paths_to_ignore.count(job.path_to_send))
+                return true;    // If the path is blacklisted, then the delete command is not sent
+            write_msg.begin_object(job.action);
+            write_msg.add_field("path", job.path_to_send);
+            write_msg.end_object();
+        } else if (send_probe(job)) {
+            return true;
         } else {
-            auto wait = boost::chrono::milliseconds(delay)/1000;
-            std::cout << "Server unavailable, retrying in " << wait.count() << " sec" << std::endl;
-            boost::this_thread::sleep_for(delay);
-            if (wait.count() >= 20) {
-                std::cerr << "Server unavailable. ";
-                close();
-            } else {
-                delay *= 2;    // If the wait is not over the limit and there is an error, then double the delay and recall the function
-                handle_reading_failures();
-            }
+            length = read_chunk(job, write_msg, size);    // Sending one message per chunk, the server commits the file when the last one arrives
+            std::lock_guard lg(uj_mutex);    // In the class of the chunks already queued, so that they are not overtaken by the first one of a newer content
+            priority = sending.try_emplace(job.path_to_send, job.priority).first->second;
         }
+        if (throttling.upload) throttling.upload->acquire(write_msg.size());    // Pacing the messages at the allowed bandwidth
+        enqueue_msg(std::move(write_msg), priority);
+        job.offset += length;
+        return length == 0 || job.offset >= size;
+    } catch (const File_Changed &err) {
+        return upload_snapshot(job);
+    } catch (const std::ios_base::failure &err) {
+        std::cerr << "Error while opening the file: " << job.path_to_send << " It won't be sent." << std::endl;
+        std::lock_guard lg(fs_mutex);
+        paths_to_ignore.insert(job.path_to_send);    // Adding the path of the file to the black list for removal
+    } catch (const boost::property_tree::ptree_error &err) {
+        std::cerr << "Error while executing the action on the file " << job.path_to_send << ", it won't be sent. " << std::endl;
+        std::cerr << "If you want to resynchronize write \'exit\'." << std::endl;
+        std::lock_guard lg(fs_mutex);
+        paths_to_ignore.insert(job.path_to_send);    // Adding the path of the file to the black list for removal
+    }
+    return true;
+}
+
+bool Client::upload_snapshot(Upload_Job &job) {
+    changed_uploads.add();
+    job.snapshot = File_Snapshot::take(job.path, [this](size_t length) {
+        if (throttling.read_ops) throttling.read_ops->acquire(read_operations(length));
+        if (throttling.read_bytes) throttling.read_bytes->acquire(length);
+        return true;
+    });
+    if (!job.snapshot) {
+        Logger::log(Log_Level::warning, job.path_to_send + " changed while being sent, it is sent again once the next scan hashes it");
+        return true;
+    }
+    Logger::log(Log_Level::info, job.path_to_send + " changed while being sent, sending a snapshot of it");
+    job.offset = 0;     // The chunks already sent belong to another content, the server drops them
+    job.probe = false;
+    return false;
+}
+
+bool Client::send_probe(Upload_Job &job) {
+    if (!job.probe || job.snapshot || job.offset > 0 || job.path == path_to_watch) return false;
+    {
+        std::lock_guard lg(uj_mutex);
+        if (sending.contains(job.path_to_send)) return false;   // The answers to the chunks in flight would be taken for the one to the probe
+    }
+    Node_Info node = dw_ptr->getNode(job.path);
+    if (!node.isFile || node.size <= chunk_size || boost::filesystem::is_symlink(job.path)) return false;   // Small files are sent right away
+    boost::property_tree::ptree pt;
+    pt.add("path", job.path_to_send);
+    pt.add("hash", node.hash);
+    pt.add("isFile", node.isFile);
+    pt.add("size", node.size);
+    if (job.nonce.empty()) {
+        pt.add("probe", true);
+    } else {    // Read here, on the uploader thread, at the pace of the throttling
+        if (throttling.read_bytes) throttling.read_bytes->acquire(node.size);
+        auto proof = content_proof(job.path, job.nonce);
+        if (proof.empty()) throw std::ios_base::failure("Unable to read " + job.path);
+        pt.add("proof", proof);
+    }
+    std::stringstream probe_stream;
+    boost::property_tree::write_json(probe_stream, pt, false);
+    Message probe_msg(pool);
+    probe_msg.encode_message(job.action, probe_stream.str());
+    {
+        std::lock_guard lg(uj_mutex);   // Before the message, so that the answer finds the job
+        Upload_Job waiting = job;
+        waiting.nonce.clear();
+        probing.insert_or_assign(job.path_to_send, std::move(waiting));
+    }
+    enqueue_msg(std::move(probe_msg), job.priority);
+    return true;
+}
+
+priority_class Client::upload_priority(const std::string &path, bool recently_changed) {
+    boost::system::error_code ec;
+    if (boost::filesystem::is_directory(path, ec)) return priority_class::control;    // Directories go first, their content depends on them
+    auto size = boost::filesystem::file_size(path, ec);
+    if (recently_changed || (!ec && size <= config.small_file_size)) return priority_class::interactive;
+    return priority_class::bulk;
+}
+
+boost::asio::awaitable<void> Client::ask_reconnection() {
+    {
+        std::lock_guard lg(input_mutex);
+        asking = true;
+        answered = false;
+        if (!input_reader.joinable()) do_start_input_reader();     // The first connection failed, nothing was read yet
+    }
+    std::cerr << "Do you want to reconnect? (y/n): ";
+    answer_timer.expires_at(boost::asio::steady_timer::time_point::max());
+    while (true) {
+        {
+            std::lock_guard lg(input_mutex);    // Checked on this thread, so that the cancel posted by the input reader can only come after the wait started
+            if (answered) co_return;
+        }
+        boost::system::error_code ec;
+        co_await answer_timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+    }
+}
+
+void Client::watch_stop() {
+    stop_timer.expires_after(std::chrono::seconds(1));
+    stop_timer.async_wait([this](const boost::system::error_code &ec) {
+        if (ec) return;
+        if (*stop) shutdown();
+        else watch_stop();
+    });
+}
+
+void Client::resume_session() {
+    try {
+        timer.stop();   // Stopping the timer in order to measure the time between one failure and the following one
+        reset_pending();    // Interrupted uploads are resumed from the offsets the server reports after the synchronization
+        Message login_message(pool);
+        login_message.put_credentials(cred.username, cred.secret());    // Re-creating the login message with the saved credentials in order to automatize the reconnection attempt
+        enqueue_msg(std::move(login_message));
+        do_start_directory_watcher();   // Restarting the directory watcher if the reconnection goes well
+        handle_reconnection_timer();
+    } catch (const boost::property_tree::ptree_error &err) {
+        std::cerr << "Error while reconnecting. ";
+        close();
+    }
+}
+
+Retry_Policy Client::retry_policy(const Client_Config &config) {
+    return Retry_Policy(std::chrono::milliseconds(static_cast<int64_t>(config.retry_initial_seconds * 1000)),
+                        std::chrono::seconds(config.reconnect_max_seconds), config.retry_attempts);
+}
+
+bool Client::retry_later(Retry_Policy &policy, boost::asio::steady_timer &retry, std::function<void()> attempt) {
+    if (*stop) return true;
+    auto wait = next_retry(policy);
+    if (!wait) return false;
+    retry.expires_after(*wait);
+    retry.async_wait([this, attempt = std::move(attempt)](const boost::system::error_code &ec) {
+        if (!ec && !*stop) attempt();
     });
+    return true;
+}
+
+std::optional<std::chrono::milliseconds> Client::next_retry(Retry_Policy &policy) {
+    auto wait = policy.failed();
+    if (policy.is_open() && console) return std::nullopt;
+    if (policy.failure_count() == config.retry_attempts && !console)
+        Logger::log(Log_Level::error, "Server unavailable after " + std::to_string(config.retry_attempts) + " attempts, trying again every "
+                                      + std::to_string(config.reconnect_max_seconds) + " sec");
+    std::cout << "Server unavailable, retrying in " << static_cast<double>(wait.count()) / 1000 << " sec" << std::endl;
+    retry_waits.add();
+    return wait;
+}
+
+void Client::shutdown() {
+    Logger::log(Log_Level::info, "Stopping the backup of " + path_to_watch);
+    *stop = true;
+    *running_client = *running_watcher = false;
+    retry_timer.cancel();
+    busy_timer.cancel();
+    stop_timer.cancel();
+    resolver.cancel();
+    for (auto &entry : ack_tracker) entry.second->cancel();
+    boost::system::error_code ignored;
+    socket_.close(ignored);     // The pending operations complete with an error and leave the io_context without work
+}
+
+void Client::save_ticket() {
+    if (config.ticket_file.empty()) return;
+    std::string temporary = config.ticket_file + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);     // The ticket logs in like the password
+    if (fd < 0) {
+        Logger::log(Log_Level::warning, "Unable to write the ticket file " + temporary);
+        return;
+    }
+    bool written = ::write(fd, cred.ticket.data(), cred.ticket.size()) == static_cast<ssize_t>(cred.ticket.size());
+    ::close(fd);
+    if (!written || ::rename(temporary.c_str(), config.ticket_file.c_str()) != 0)
+        Logger::log(Log_Level::warning, "Unable to write the ticket file " + config.ticket_file);
 }
 
 void Client::handle_reconnection_timer() {
@@ -333,87 +709,177 @@ void Client::handle_reconnection_timer() {
 
 void Client::handle_sync() {
     try {
-        delay = boost::chrono::milliseconds(5000);  // Resetting delay to the initial value
+        {
+            std::lock_guard lg(uj_mutex);
+            refused_uploads.clear();    // Room may have been made meanwhile
+        }
         boost::property_tree::ptree pt;
-        for (const auto& tuple : dw_ptr->getPaths()) {  // Looping over the path map
-            std::string path(tuple.first);
-            path = path.substr(path_to_watch.size()+1);    // Taking only the file or directory name
-            while (path.find('.') < path.size()) path.replace(path.find('.'), 1, ":");    // Making the path compatible with json polices
-            pt.add(path, tuple.second.hash);    // Adding the node to the json
+        if (!root_name.empty()) {   // The server compares only the elements below the root, the other roots of the user are left alone
+            pt.add(Message::sync_root_key, root_name);
+            pt.add(root_name, root_hash);
         }
+        for (const auto& tuple : dw_ptr->getPaths())    // Looping over the path map
+            pt.add(remote_path(tuple.first), tuple.second.hash);    // Adding the node to the json
         std::stringstream map_stream;
         boost::property_tree::write_json(map_stream, pt, false);   // Saving the json in a stream, "false" in order to avoid the '\n' before the '}' at the end
         std::string map_string = map_stream.str();
-        Message write_msg;
+        Message write_msg(pool);
         write_msg.encode_message(1, map_string);
-        enqueue_msg(write_msg);
+        enqueue_msg(std::move(write_msg));
     } catch (const boost::property_tree::ptree_error &err) {
         throw;
     }
 }
 
-void Client::handle_status(Message msg) {
+void Client::handle_status(std::string_view response) {
     try {
-        msg.decode_message();
+        Message msg(pool);
+        msg.decode_message(response);
         auto status = static_cast<status_type>(msg.get_header());   // Casting header to status
-        std::string data = msg.get_data();
+        messages_received.count(status);
+        std::string_view data = msg.get_data();
         switch (status) {
             case status_type::in_need : {
+                busy_policy.succeeded();
                 ack_tracker["synch"]->cancel();
                 ack_tracker.erase("synch");
-                std::string separator = "||";
+                std::string_view separator = "||";
                 size_t pos;
-                std::string path_to_send;
-                while ((pos = data.find(separator)) != std::string::npos) {
-                    path_to_send = data.substr(0, pos);    // Taking the string section until the separator
-                    data.erase(0, pos + separator.length());    // Deleting the taken section of the string
-                    std::string path = path_to_send;
-                    while (path.find(':') < path.size())    // Resetting the original path format of the file or directory
-                        path.replace(path.find(':'), 1, ".");
-                    path = std::string(path_to_watch + "/").append(path);   // Restoring the 'relative' path of the file or directory
-                    boost::property_tree::ptree pt;
-                    read_file(path, path_to_send, pt);
-                    // Writing message
-                    std::stringstream file_stream;
-                    boost::property_tree::write_json(file_stream, pt, false);   // Saving the json in a stream, "false" in order to avoid the '\n' before the '}' at the end
-                    std::string file_string(file_stream.str());
-                    Message write_msg;
-                    write_msg.encode_message(2, file_string);
-                    enqueue_msg(write_msg);
+                while ((pos = data.find(separator)) != std::string_view::npos) {
+                    auto entry = data.substr(0, pos);    // Taking the string section until the separator
+                    data.remove_prefix(pos + separator.length());    // Skipping the taken section of the string
+                    size_t offset_pos = entry.rfind('|');      // Every entry has the form path|committed_offset
+                    std::string path_to_send(entry.substr(0, offset_pos));
+                    size_t offset = offset_pos == std::string_view::npos ? 0 : std::stoull(std::string(entry.substr(offset_pos + 1)));
+                    std::string path = local_path(path_to_send);   // Restoring the 'relative' path of the file or directory
+                    if (offset > 0) Logger::log(Log_Level::info, "Resuming " + path_to_send + " from byte " + std::to_string(offset));
+                    enqueue_upload({path, path_to_send, action_type::create, offset, upload_priority(path, false)});
+                }
+                break;
+            }
+            case status_type::partial : {   // Chunk committed by the server, the timer of the file is replaced by the one of the next chunk
+                auto separator = data.rfind(' ');
+                std::optional<Upload_Job> job;
+                {
+                    std::lock_guard lg(uj_mutex);
+                    if (auto it = probing.find(data.substr(0, separator)); it != probing.end()) job = std::move(probing.extract(it).mapped());
+                }
+                if (job) {      // Or the answer to a probe: the content is needed, from the bytes the server already has
+                    job->offset = std::stoull(std::string(data.substr(separator + 1)));
+                    job->probe = false;
+                    enqueue_upload(std::move(*job));
+                }
+                break;
+            }
+            case status_type::challenge : {     // The server keeps the content, a proof of it is sent instead
+                auto separator = data.rfind(' ');
+                std::optional<Upload_Job> job;
+                {
+                    std::lock_guard lg(uj_mutex);
+                    if (auto it = probing.find(data.substr(0, separator)); it != probing.end()) job = std::move(probing.extract(it).mapped());
+                }
+                if (job) {
+                    job->nonce = std::string(data.substr(separator + 1));
+                    enqueue_upload(std::move(*job));
                 }
                 break;
             }
             case status_type::no_need : {
+                busy_policy.succeeded();
                 ack_tracker["synch"]->cancel();
                 ack_tracker.erase("synch");
                 break;
             }
             case status_type::unauthorized : {
-                std::cerr << "Unauthorized. ";
                 ack_tracker["login"]->cancel();
                 ack_tracker.erase("login");
+                if (!cred.ticket.empty()) {     // The ticket expired or the password changed, logging in with the password
+                    Logger::log(Log_Level::info, "Session ticket refused, logging in with the password");
+                    cred.ticket.clear();
+                    Message login_message(pool);
+                    login_message.put_credentials(cred.username, cred.secret());
+                    enqueue_msg(std::move(login_message));
+                    break;
+                }
+                std::cerr << "Unauthorized. ";
                 close();    // If the login process failed, then close the current session
                 break;
             }
             case status_type::service_unavailable : {
-                auto wait = boost::chrono::milliseconds(delay)/1000;
-                std::cout << "Server unavailable, retrying in " << wait.count() << " sec" << std::endl;
-                boost::this_thread::sleep_for(delay);
-                Message last_message;
-                if (data == "login" || data == "Communication error") {               // If the server failed during login or any other process except from synchronization
-                    last_message.put_credentials(cred.username, cred.password);       // then send the credentials again to the server and retry the login
-                    enqueue_msg(last_message);
-                } else {
-                    handle_sync();     // Else retry the synchronization procedure
+                if (auto separator = data.find("||"); separator != std::string_view::npos) {     // Server busy, waiting as long as it asks
+                    auto hint = std::chrono::seconds(std::stoul(std::string(data.substr(separator + 2))));
+                    std::cout << "Server busy, retrying in " << hint.count() << " sec" << std::endl;
+                    busy_timer.expires_after(hint);
+                    busy_timer.async_wait([this](const boost::system::error_code &ec) {
+                        if (ec || !*running_client) return;
+                        Message login_message(pool);
+                        login_message.put_credentials(cred.username, cred.secret());
+                        enqueue_msg(std::move(login_message));
+                    });
+                    break;
                 }
-                if (wait.count() >= 20) {
+                bool login = data == "login" || data == "Communication error";   // The server failed during login or any other process except from synchronization
+                if (!retry_later(busy_policy, busy_timer, [this, login]() {
+                    if (!*running_client) return;
+                    if (login) {    // Sending the credentials again to the server and retrying the login
+                        Message last_message(pool);
+                        last_message.put_credentials(cred.username, cred.secret());
+                        enqueue_msg(std::move(last_message));
+                    } else {
+                        handle_sync();     // Else retrying the synchronization procedure
+                    }
+                })) {
                     std::cerr << "Server unavailable. ";
                     close();
-                } else {
-                        delay *= 2;    // If the wait is not over the limit and there is an error, then double the delay and restart the loop
                 }
                 break;
             }
+            case status_type::rejected : {
+                auto it = ack_tracker.find(data);
+                if (it != ack_tracker.end()) {
+                    it->second->cancel();
+                    ack_tracker.erase(it);
+                }
+                std::string path_to_send(data);
+                if (++rejected_uploads[path_to_send] > 3) {     // The file keeps changing while being sent, or the link corrupts it: leaving it to the next synchronization
+                    Logger::log(Log_Level::error, "Upload of " + path_to_send + " rejected too many times, giving up");
+                    rejected_uploads.erase(path_to_send);
+                    break;
+                }
+                Logger::log(Log_Level::warning, "Upload of " + path_to_send + " rejected by the server, sending it again");
+                std::string path = local_path(path_to_send);
+                enqueue_upload({path, path_to_send, action_type::create, 0, upload_priority(path, false)});
+                break;
+            }
+            case status_type::over_quota : {
+                if (auto it = ack_tracker.find(data); it != ack_tracker.end()) {
+                    it->second->cancel();
+                    ack_tracker.erase(it);
+                }
+                std::string path_to_send(data);
+                std::lock_guard lg(uj_mutex);     // The chunks still to be read are dropped by the uploader, the ones already sent are refused as well
+                probing.erase(path_to_send);
+                sending.erase(path_to_send);
+                if (refused_uploads.insert(path_to_send).second)
+                    std::cerr << "Storage quota exceeded, " << path_to_send << " was not backed up. It is sent again by the next synchronization." << std::endl;
+                break;
+            }
+            case status_type::versions :
+            case status_type::snapshots :
+            case status_type::restored : {
+                boost::property_tree::ptree pt;
+                std::stringstream data_stream{std::string(data)};
+                boost::property_tree::read_json(data_stream, pt);
+                auto request = pt.get<std::string>(status == status_type::restored ? "request" : "path");
+                if (auto it = ack_tracker.find(request); it != ack_tracker.end()) {     // The first message of a restore answers the request
+                    it->second->cancel();
+                    ack_tracker.erase(it);
+                }
+                if (status == status_type::versions) handle_history(pt);
+                else if (status == status_type::snapshots) handle_snapshots(pt);
+                else handle_restored(pt);
+                break;
+            }
             case status_type::wrong_action : {
                 std::cerr << "Wrong action. ";
                 close();    // If a wrong action is recognized by the server and sent back, then close the current session
@@ -421,16 +887,39 @@ void Client::handle_status(Message msg) {
             }
             case status_type::authorized : {
                 std::cout << "Authorized." << std::endl;
+                if (auto separator = data.find("||"); separator != std::string_view::npos) {
+                    cred.ticket = std::string(data.substr(separator + 2));  // Used by the reconnections, which skip the password verification
+                    save_ticket();
+                }
+                busy_policy.succeeded();
                 ack_tracker["login"]->cancel();
                 ack_tracker.erase("login");
                 do_start_directory_watcher();   // Starting the directory watcher
                 handle_sync();  // Starting the synchronization procedure
+                {
+                    std::vector<std::string> elements;
+                    for (const auto &tuple : dw_ptr->getPaths()) elements.push_back(tuple.first);
+                    std::lock_guard lg(uj_mutex);   // The metadata of every element, the server may have missed changes while disconnected
+                    metadata_pending.insert(elements.begin(), elements.end());
+                }
+                uj_cv.notify_one();
                 break;
             }
             default : {
-                std::cout << "Operation completed." << std::endl;
-                ack_tracker[data.substr(0, data.rfind(' '))]->cancel();
-                ack_tracker.erase(data.substr(0, data.rfind(' ')));
+                Logger::log(Log_Level::debug, "Operation completed.");
+                auto path = data.substr(0, data.rfind(' '));
+                auto it = ack_tracker.find(path);
+                if (it != ack_tracker.end()) {     // The same path may be acknowledged twice if it changed while being sent
+                    it->second->cancel();
+                    ack_tracker.erase(it);
+                }
+                if (auto rejected = rejected_uploads.find(path); rejected != rejected_uploads.end()) rejected_uploads.erase(rejected);
+                std::lock_guard lg(uj_mutex);
+                if (auto chunks = sending.find(path); chunks != sending.end()) sending.erase(chunks);
+                if (auto probe = probing.find(path); probe != probing.end()) {
+                    probing.erase(probe);
+                    Logger::log(Log_Level::info, "Content of " + std::string(path) + " already kept by the server, not sent");
+                }
             }
         }
     } catch (const boost::property_tree::ptree_error &err) {
@@ -442,19 +931,137 @@ void Client::handle_status(Message msg) {
     }
 }
 
-void Client::read_file(const std::string& path, const std::string& path_to_send, boost::property_tree::ptree& pt) {
-    std::ifstream inFile;
+void Client::send_request(action_type action, boost::property_tree::ptree &pt) {
+    if (!*running_client) {
+        std::cerr << "Not connected to the server." << std::endl;
+        return;
+    }
+    std::stringstream request_stream;
+    boost::property_tree::write_json(request_stream, pt, false);
+    Message request_msg(pool);
+    request_msg.encode_message(action, request_stream.str());
+    enqueue_msg(std::move(request_msg), priority_class::interactive);     // Ahead of the bulk uploads
+}
+
+void Client::handle_history(const boost::property_tree::ptree &pt) {
+    std::string path = pt.get<std::string>("path");
+    while (path.find(':') < path.size()) path.replace(path.find(':'), 1, ".");
+    auto versions = pt.get_child_optional("versions");
+    if (!versions || versions->empty()) {
+        std::cout << "No versions of " << path << "." << std::endl;
+        return;
+    }
+    std::cout << "Versions of " << path << ", most recent first:" << std::endl;
+    for (auto &entry : *versions) {
+        auto time = static_cast<std::time_t>(entry.second.get<int64_t>("time"));
+        std::cout << "  " << entry.second.get<std::string>("id") << "  " << std::put_time(std::localtime(&time), "%F %T") << "  ";
+        if (entry.second.get<bool>("erased")) std::cout << "erased" << std::endl;
+        else std::cout << entry.second.get<std::string>("size") << " bytes  " << entry.second.get<std::string>("hash") << std::endl;
+    }
+}
+
+void Client::handle_snapshots(const boost::property_tree::ptree &pt) {
+    if (auto taken = pt.get_optional<int64_t>("taken")) {
+        if (*taken == 0) std::cerr << "The server could not take the snapshot." << std::endl;
+        else std::cout << "Snapshot " << *taken << " taken." << std::endl;
+    }
+    auto snapshots = pt.get_child_optional("snapshots");
+    if (!snapshots || snapshots->empty()) {
+        std::cout << "No snapshots." << std::endl;
+        return;
+    }
+    std::cout << "Snapshots, most recent first:" << std::endl;
+    for (auto &entry : *snapshots) {
+        auto time = static_cast<std::time_t>(entry.second.get<int64_t>("time"));
+        std::cout << "  @" << entry.second.get<std::string>("id") << "  " << std::put_time(std::localtime(&time), "%F %T")
+                  << "  " << entry.second.get<std::string>("name") << std::endl;
+    }
+}
+
+void Client::handle_restored(const boost::property_tree::ptree &pt) {
+    if (pt.get<bool>("done", false)) {
+        for (auto it = restored_directories.rbegin(); it != restored_directories.rend(); ++it)    // Deepest first, after their content
+            it->second.apply(it->first, ::geteuid() == 0);
+        restored_directories.clear();
+        std::string request = pt.get<std::string>("request");
+        while (request.find(':') < request.size()) request.replace(request.find(':'), 1, ".");
+        std::cout << "Restore of /" << request << " completed, " << pt.get<std::string>("files") << " elements in "
+                  << config.restore_path << "." << std::endl;
+        return;
+    }
+    std::string path = pt.get<std::string>("path");
+    while (path.find(':') < path.size()) path.replace(path.find(':'), 1, ".");    // Resetting the original path format
+    for (auto &element : boost::filesystem::path(path)) {
+        if (element == "..") {
+            Logger::log(Log_Level::error, "Refusing to restore " + path + " outside of the restore path");
+            return;
+        }
+    }
+    boost::filesystem::path destination = boost::filesystem::path(config.restore_path) / path;
+    boost::system::error_code ec;
+    std::optional<File_Metadata> metadata;
+    if (auto record = pt.get_optional<std::string>("meta")) {
+        try {
+            metadata = File_Metadata::decode(*record);
+        } catch (const std::invalid_argument &err) {
+            Logger::log(Log_Level::warning, "Malformed metadata of " + path + " ignored");
+        }
+    }
+    if (!pt.get<bool>("isFile")) {
+        boost::filesystem::create_directories(destination, ec);
+        if (metadata) restored_directories.emplace_back(destination.string(), std::move(*metadata));
+        return;
+    }
+    boost::filesystem::create_directories(destination.parent_path(), ec);
+    auto offset = pt.get<uint64_t>("offset");
+    const auto &content = pt.get_child("content").data();
+    std::vector<BYTE> bytes(base64_decoded_max_size(content.size()));
+    bytes.resize(base64_decode(content.data(), content.size(), bytes.data()));
+    auto mode = offset == 0 ? std::ios::out|std::ios::binary|std::ios::trunc : std::ios::in|std::ios::out|std::ios::binary;
+    std::fstream out(destination.string(), mode);
+    out.seekp(static_cast<std::streamoff>(offset));
+    out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    out.close();
+    if (!out) {
+        Logger::log(Log_Level::error, "Unable to write the restored file " + destination.string());
+    } else if (offset + bytes.size() >= pt.get<uint64_t>("size")) {
+        if (metadata && !metadata->apply(destination.string(), ::geteuid() == 0))     // The owner only as root
+            Logger::log(Log_Level::warning, "Unable to restore the metadata of " + path);
+        Logger::log(Log_Level::info, "Restored " + path);
+    }
+}
+
+size_t Client::read_chunk(const Upload_Job &job, Message &message, uint64_t &size) {
     try {
         std::lock_guard lg(fs_mutex);
-        inFile.open(path, std::ios::in|std::ios::binary);   // Opening the file in binary mode
-        std::vector<BYTE> buffer_vec;   // Creating an unsigned char vector
-        char ch;
-        while (inFile.get(ch)) buffer_vec.emplace_back(ch);    // Adding every char read from the file to the vector
-        std::string encodedData = base64_encode(&buffer_vec[0], buffer_vec.size());
-        pt.add("path", path_to_send);
-        pt.add("hash", dw_ptr->getNode(path).hash);        // Retrieving the hash from the Node_Info struct of the directory watcher
-        pt.add("isFile", dw_ptr->getNode(path).isFile);    // Retrieving the hash from the Node_Info struct of the directory watcher
-        pt.add("content", encodedData);
+        const auto &path = job.path;
+        Node_Info node = path == path_to_watch ? Node_Info{0, false, root_hash} : dw_ptr->getNode(path);    // Retrieving hash and type from the Node_Info struct of the directory watcher
+        if (node.hash.empty()) throw std::ios_base::failure("Element no longer watched: " + path);
+        if (job.snapshot) node.hash = job.snapshot->hash();     // The content as it was when the snapshot was taken
+        bool read = node.isFile && !boost::filesystem::is_symlink(path);     // A link is sent empty, its target travels with the metadata
+        std::optional<File_Reader> file;
+        if (read) file.emplace(job.snapshot ? job.snapshot->path() : path);
+        size = read ? file->size() : 0;
+        message.begin_object(job.action);
+        message.add_field("path", job.path_to_send);
+        message.add_field("hash", node.hash);
+        message.add_field("isFile", node.isFile ? "true" : "false");
+        message.add_field("offset", std::to_string(job.offset));
+        message.add_field("size", std::to_string(size));
+        Extent extent;
+        if (read) {
+            std::optional<std::pair<int64_t, uint64_t>> hashed;
+            if (!job.snapshot) hashed = std::make_pair(node.mtime_ns, node.size);
+            extent = read_unchanged(*file, job.offset, chunk_size, hashed, [&message](const Extent &chunk, std::string_view data) {
+                if (chunk.hole > 0) message.add_field("hole", std::to_string(chunk.hole));     // Zeros the server recreates as a hole, before the content
+                char *content = message.add_plain_field("content", base64_encoded_size(data.size()));
+                base64_encode(reinterpret_cast<const BYTE *>(data.data()), data.size(), content);     // From the mapping straight into the wire text
+            });     // Skipping the bytes already committed by the server, and the hole after them
+        } else {
+            message.add_field("content", "");
+        }
+        message.end_object();
+        return extent.hole + extent.data;
     } catch (const std::ios_base::failure &err) {
         throw;
     } catch (const boost::property_tree::ptree_bad_data &err) {
@@ -462,18 +1069,41 @@ void Client::read_file(const std::string& path, const std::string& path_to_send,
     }
 }
 
+std::string Client::remote_path(const std::string &path) const {
+    std::string path_to_send = path.substr(path_to_watch.size() + 1);
+    while (path_to_send.find('.') < path_to_send.size())    // Making the path compatible with json polices
+        path_to_send.replace(path_to_send.find('.'), 1, ":");
+    return root_name.empty() ? path_to_send : root_name + "/" + path_to_send;
+}
+
+std::string Client::local_path(const std::string &path_to_send) const {
+    std::string path = path_to_send;
+    if (!root_name.empty()) {   // The root itself, or an element below it
+        if (path == root_name) return path_to_watch;
+        path.erase(0, root_name.size() + 1);
+    }
+    while (path.find(':') < path.size())    // Resetting the original path format of the file or directory
+        path.replace(path.find(':'), 1, ".");
+    return std::string(path_to_watch + "/").append(path);
+}
+
 void Client::close() {
     *running_client = *running_watcher = false;           // Closing watcher thread and setting the client session to not running
     for (auto it = ack_tracker.begin(); it != ack_tracker.end(); it++) it->second->cancel();    // Canceling every timer in the ack_tracker map
-    boost::asio::post(io_context_, [this]() {   // Requesting the io_context to invoke the given handler and returning immediately
-        if (socket_.is_open()) socket_.close();           // Closing the socket
-        std::unique_lock ul(input_mutex);             // Unique lock in order to use the cv wait
-        std::cerr << "Do you want to reconnect? (y/n): ";
-        cv.wait(ul);    // Waiting for the user decision about the reconnection attempt
+    boost::asio::post(io_context_, [this]() {   // The pending read fails, then the session asks the user or connects again after a wait
+        boost::system::error_code ignored;
+        socket_.close(ignored);
     });
 }
 
 Client::~Client() {
+    {
+        std::lock_guard lg(uj_mutex);
+        exiting = true;
+    }
+    uj_cv.notify_all();
+    room_cv.notify_all();
+    if (uploader.joinable()) uploader.join();                     // Joining the uploader thread before shutting down
     if (input_reader.joinable()) input_reader.join();             // Joining the input reader thread before shutting down
     if (directory_watcher.joinable()) directory_watcher.join();   // Joining the directory watcher thread before shutting down
 }
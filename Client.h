@@ -3,59 +3,140 @@
 #include <boost/asio.hpp>
 #include <boost/functional/hash.hpp>
 #include <boost/timer/timer.hpp>
+#include <openssl/evp.h>
 #include <openssl/sha.h>
+#include <array>
 #include <iostream>
+#include <optional>
 #include <queue>
+#include <set>
 #include "Base64/base64.h"
+#include "Config.h"
 #include "DirectoryWatcher.h"
+#include "File_Snapshot.h"
 #include "Headers.h"
+#include "Logger.h"
 #include "Message.h"
+#include "Metrics.h"
+#include "Retry_Policy.h"
+#include "Transport.h"
 
 using boost::asio::ip::tcp;
 
+/// Maximum number of file bytes carried by a single create or update message
+constexpr size_t chunk_size = 1048576;
+
+/// Maximum number of elements whose metadata is carried by a single metadata message
+constexpr size_t metadata_batch = 512;
+
 /// Struct for collecting the credentials related to a client
 struct Credentials {
     std::string username;
     std::string password;
+    std::string ticket{};   // Granted by the server at login, it replaces the password at the following ones
+
+    /// Gets the secret sent by the login message, the ticket when there is one
+    std::string secret() const;
+};
+
+/// Gets the digest of a password as stored by the server
+std::string password_digest(const std::string &password);
+
+/// Possible priority classes of the messages sent to the server, lower classes are sent first
+enum priority_class {
+    control = 0,
+    interactive = 1,
+    bulk = 2
+};
+
+/// Struct for collecting a pending upload of a file or a directory
+struct Upload_Job {
+    std::string path;
+    std::string path_to_send;
+    action_type action = action_type::create;
+    size_t offset = 0;
+    priority_class priority = priority_class::bulk;
+    bool probe = true;      // Whether the server is asked first if it already keeps the content
+    std::string nonce{};    // Of the proof of the content the server asked for, sent instead of the content
+    std::shared_ptr<File_Snapshot> snapshot{};  // Read instead of the file, once the file changed while being sent
 };
 
 class Client {
     boost::asio::io_context &io_context_;
     tcp::socket socket_;
-    tcp::resolver::results_type endpoints;
+    Transport transport;    // Plain or TLS stream over socket_
+    tcp::resolver resolver;
+    std::string host;       // Resolved again at every connection attempt, the server may move or the network come up late
+    std::string port;
     boost::asio::streambuf read_buf;
     std::shared_ptr<DirectoryWatcher> dw_ptr;
-    std::queue<Message> write_queue_c;
-    std::map<std::string, std::unique_ptr<boost::asio::system_timer>> ack_tracker;
-    std::vector<std::string> paths_to_ignore;
+    std::array<std::queue<Message>, 3> write_queue_c;
+    Message writing;        // Message being written on the socket
+    std::shared_ptr<Buffer_Pool> pool = std::make_shared<Buffer_Pool>();      // Buffers of the messages, reused once they have been written or handled
+    std::array<std::deque<Upload_Job>, 3> upload_jobs;
+    std::set<std::string, std::less<>> refused_uploads;     // Files refused for lack of quota, not read again until the next synchronization; guarded by uj_mutex
+    std::set<std::string, std::less<>> metadata_pending;    // Elements whose metadata has not been sent yet, guarded by uj_mutex
+    std::map<std::string, Upload_Job, std::less<>> probing;     // Uploads waiting for the server to tell whether their content is needed, guarded by uj_mutex
+    std::map<std::string, priority_class, std::less<>> sending;   // Class of the chunks in flight per file, until the server commits it; guarded by uj_mutex
+    std::map<std::string, std::unique_ptr<boost::asio::system_timer>, std::less<>> ack_tracker;
+    std::vector<std::pair<std::string, File_Metadata>> restored_directories;   // Applied at the end of the restore, guarded by the io_context
+    std::map<std::string, int, std::less<>> rejected_uploads;    // Uploads refused by the server verification, per path
+    std::set<std::string, std::less<>> paths_to_ignore;     // Files that could not be read, their removal is not sent either
     Credentials cred;
     boost::thread input_reader;
     boost::thread directory_watcher;
+    boost::thread uploader;
     std::string path_to_watch;
+    std::string root_name;      // Directory of the root on the server, in the format of the messages; empty for the top of the tree
+    std::string root_hash;      // Constant hash of that directory
+    Client_Config config;
+    Throttling throttling;
     int reconnection_counter = 0;
-    boost::chrono::milliseconds delay;
+    Retry_Policy reconnect_policy;      // Connection attempts after a failure
+    Retry_Policy busy_policy;           // Requests the server could not handle for the moment
+    boost::asio::steady_timer retry_timer;      // Every wait runs on the io_context instead of blocking its thread
+    boost::asio::steady_timer busy_timer;
+    boost::asio::signal_set signals;            // Termination requests of the daemon
+    boost::asio::steady_timer answer_timer;     // Cancelled by the input reader once the user answers whether to reconnect
+    boost::asio::steady_timer stop_timer;       // Notices that the session reading the input stopped the client
     boost::timer::cpu_timer timer;
     std::shared_ptr<bool> running_client;
     std::shared_ptr<bool> running_watcher;
     std::shared_ptr<bool> stop;
+    std::atomic<bool> exiting{false};
+    bool console;               // Whether the session reads the input, only one of the roots does and the others end with it
+    bool wants_credentials = false;     // Whether the input reader is asked for them, guarded by input_mutex
+    bool asking = false;        // Whether the user is asked whether to reconnect, guarded by input_mutex
+    bool answered = false;      // Whether the user answered, stop holding the answer; guarded by input_mutex
+    size_t queued_bytes = 0;    // Bytes of the queued messages and of the one being written, guarded by wq_mutex
+    bool write_in_progress = false;
     std::mutex input_mutex;
     std::mutex wq_mutex;
     std::mutex fs_mutex;
+    std::mutex uj_mutex;
     std::condition_variable cv;
+    std::condition_variable uj_cv;
+    std::condition_variable room_cv;    // Signaled whenever a written message leaves the queues
 
-    /// Opens the connection with the server, calling the get_credentials and the do_read right after
-    void do_connect();
+    /// Runs the session for as long as the client does: connects, logs in and reads the answers, then connects again
+    /// whenever the connection is lost, waiting as long as the reconnection policy says. Every wait is a co_await on
+    /// the io_context, and shutdown ends the session by cancelling the timers and closing the socket
+    boost::asio::awaitable<void> run_session();
 
-    /// Reads the message from the socket and calls the appropriate handler
-    void do_read();
+    /// Connects to the server and completes the TLS handshake when it is enabled, returning the error of either
+    boost::asio::awaitable<boost::system::error_code> open_connection();
 
-    /// Writes the available messages from the queue to the socket
+    /// Reads the messages from the socket and handles them, until the connection fails or is closed
+    boost::asio::awaitable<void> read_messages();
+
+    /// Writes the available messages from the queues to the socket, highest priority class first
     void do_write();
 
-    /// Adds messages to the write queue
-    void enqueue_msg(const Message &msg);
+    /// Adds messages to the write queue of the given priority class
+    void enqueue_msg(Message &&msg, priority_class priority = control);
 
-    /// Starts the input_reader thread by calling the do_start_input_reader function, and waits for the credentials to be written
+    /// Sends the login message, with the credentials of the settings or with the ones the input reader asks for; the
+    /// input reader is started anyway, to take the commands of the user
     void get_credentials();
 
     /// Sets the username in the Credentials structure
@@ -64,17 +145,76 @@ class Client {
     /// Sets the password in the Credentials structure
     void set_password(std::string &pwd);
 
-    /// Creates the input_reader thread that manages all the user's input
+    /// Creates the input_reader thread that manages all the user's input: the credentials, the answer to the reconnection
+    /// question and the commands
     void do_start_input_reader();
 
+    /// Shuts the session down once stop is set by the session that reads the input, checking every second
+    void watch_stop();
+
     /// Creates the directory_watcher thread that loops over the path_to_watch
     void do_start_directory_watcher();
 
-    /// Manages the errors occurred in the do_connect
-    void handle_connection_failures();
+    /// Creates the uploader thread that sends the pending upload jobs chunk by chunk, and the pending metadata in batches
+    /// once no job is left or a batch is full
+    void do_start_uploader();
+
+    /// Blocks the uploader while the queued messages hold at least max_queued_bytes, so that the files are read and
+    /// hashed at the pace of the network
+    void wait_for_room();
+
+    /// Adds an upload job to the pending ones and wakes up the uploader thread
+    void enqueue_upload(Upload_Job job);
+
+    /// Marks the metadata of an element to be sent, with the next metadata message
+    void enqueue_metadata(const std::string &path);
+
+    /// Sends the metadata of the given elements in a single message, in the bulk class so that it follows the contents
+    /// queued before it; the server records it without any upload
+    void send_metadata(const std::vector<std::string> &paths);
+
+    /// Drops the pending upload jobs and messages, the server reports the committed offsets at the next synchronization
+    void reset_pending();
+
+    /// Reads the next chunk of the job file, enqueues its message and returns true when the job is complete
+    bool do_upload(Upload_Job &job);
 
-    /// Manages the errors occurred in the do_read
-    void handle_reading_failures();
+    /// Restarts the upload of a file that changed while being sent from a snapshot of it, so that a file that keeps
+    /// changing is still backed up; returns true, dropping the job, if no snapshot can be taken, the next scan hashes
+    /// the file again and sends it anew
+    bool upload_snapshot(Upload_Job &job);
+
+    /// Asks the server whether it already keeps the content of a file larger than a chunk, or answers its challenge with
+    /// the proof of the content; the job waits in probing for the answer. Returns false if the content is to be sent
+    bool send_probe(Upload_Job &job);
+
+    /// Chooses the priority class of a file upload, small files go ahead of the bulk ones
+    priority_class upload_priority(const std::string &path, bool recently_changed);
+
+    /// Asks the user whether to connect again, once the session was closed or the circuit of the reconnections opened.
+    /// The input reader takes the answer and cancels answer_timer, the io_context goes on meanwhile; stop holds the answer
+    boost::asio::awaitable<void> ask_reconnection();
+
+    /// Logs in again with the saved credentials after a reconnection, and restarts the directory watcher
+    void resume_session();
+
+    /// Creates a policy with the waits and the attempts of the settings
+    static Retry_Policy retry_policy(const Client_Config &config);
+
+    /// Counts a failure and calls the attempt once the timer has waited as long as the policy says, the io_context goes
+    /// on meanwhile; returns false, without waiting, when the circuit of the policy opens and there is a user to ask,
+    /// the daemon keeps probing instead
+    bool retry_later(Retry_Policy &policy, boost::asio::steady_timer &retry, std::function<void()> attempt);
+
+    /// Counts a failure of the policy and gets the wait before the next attempt, none when the circuit opens and there
+    /// is a user to ask
+    std::optional<std::chrono::milliseconds> next_retry(Retry_Policy &policy);
+
+    /// Ends the daemon on SIGTERM or SIGINT: the session is closed and the io_context left without work
+    void shutdown();
+
+    /// Writes the ticket granted at login to the ticket file, so that the next start logs in with it
+    void save_ticket();
 
     /// Manages the client status regarding the reconnection attempts frequency
     void handle_reconnection_timer();
@@ -82,20 +222,47 @@ class Client {
     /// Manages the sending of the message containing all the local paths
     void handle_sync();
 
-    /// Manages the decoding of the message and takes the needed actions
-    void handle_status(Message msg);
+    /// Manages the decoding of the message, still in the receive buffer, and takes the needed actions
+    void handle_status(std::string_view response);
+
+    /// Sends a history, snapshot or restore request, the server answers it asynchronously
+    void send_request(action_type action, boost::property_tree::ptree &pt);
+
+    /// Prints the versions of a path listed by the server
+    void handle_history(const boost::property_tree::ptree &pt);
+
+    /// Prints the snapshots listed by the server
+    void handle_snapshots(const boost::property_tree::ptree &pt);
+
+    /// Writes a chunk of a restored file, or creates a restored directory, below the restore path; the metadata of the
+    /// directories is applied once the restore is over, after their content
+    void handle_restored(const boost::property_tree::ptree &pt);
+
+    /// Encodes the chunk of the job file starting at its offset straight into the message, with its info, sets size to the size of the file
+    /// and returns the number of bytes of the file it covers; a hole at offset is not read, the chunk gives its length and carries the data
+    /// after it. Throws File_Changed if the file was written since it was hashed, or while the chunk was read; a snapshot is read instead of
+    /// the file when the job has one
+    size_t read_chunk(const Upload_Job &job, Message &message, uint64_t &size);
+
+    /// Gets the path sent to the server for a local element of the root
+    std::string remote_path(const std::string &path) const;
 
-    /// Encodes the content of the given file, and adds its info to the json that has to be sent
-    void read_file(const std::string& path, const std::string& path_to_send, boost::property_tree::ptree& pt);
+    /// Gets the local element of a path sent to the server
+    std::string local_path(const std::string &path_to_send) const;
 
-    /// Closes the socket client side, and waits for an answer to the reconnect attempt
+    /// Closes the socket client side, then the session asks the user whether to reconnect; the sessions without input
+    /// reconnect on their own
     void close();
 
 public:
 
-    /// Starts the connection request with the server
-    Client(boost::asio::io_context& io_context, tcp::resolver::results_type  endpoints,
-           std::shared_ptr<bool> &running, std::string path_to_watch, std::shared_ptr<DirectoryWatcher> &dw, std::shared_ptr<bool> &stop, std::shared_ptr<bool> &watching);
+    /// Starts the connection request with the server; a root name backs up path_to_watch in that directory of the tree
+    /// of the user, so that several roots can share an account. Only the session given the console reads the input, the
+    /// daemon never does
+    Client(boost::asio::io_context& io_context, std::string host, std::string port,
+           std::shared_ptr<bool> &running, std::string path_to_watch, std::shared_ptr<DirectoryWatcher> &dw, std::shared_ptr<bool> &stop, std::shared_ptr<bool> &watching,
+           Client_Config config = {}, Throttling throttling = {}, std::shared_ptr<Tls_Context> tls = nullptr, std::string root_name = {},
+           bool console = true);
 
     ~Client();
 };
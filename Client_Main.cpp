@@ -3,30 +3,142 @@
 #include "Base64/base64.h"
 #include "Client.h"
 #include "DirectoryWatcher.h"
+#include "Hash_Pool.h"
+#include "Restore_Client.h"
+#include "Stats_Exporter.h"
 
 
+/// Creates the TLS settings of the client, null if the server is reached over plain TCP
+std::shared_ptr<Tls_Context> make_tls(const Client_Config &config, const std::string &host) {
+    if (!config.tls) return nullptr;
+    return Tls_Context::client(config.tls_ca, config.tls_server_name.empty() ? host : config.tls_server_name, config.tls_verify);
+}
+
+/// Compiles the ignore rules of the file and then the ones listed in the configuration, which come last and so win
+Ignore_Rules make_ignore_rules(const Client_Config &config) {
+    auto rules = Ignore_Rules::load(config.ignore_file);
+    for (auto &rule : config.ignore) {
+        if (!rules.add(rule)) Logger::log(Log_Level::warning, "Ignore rule " + rule + " skipped, too complex");
+    }
+    return rules;
+}
+
+/// Lists the roots to back up: the one of the command line, unless it is "-", then the ones of the settings. With several
+/// roots every one of them is stored in its own directory, named after the watched one unless the settings name it
+std::vector<Watch_Root> make_roots(const Client_Config &config, const std::string &host, const std::string &port, const std::string &path) {
+    std::vector<Watch_Root> roots;
+    if (path != "-") roots.push_back({path, "", host, port});
+    roots.insert(roots.end(), config.roots.begin(), config.roots.end());
+    if (roots.empty()) throw std::runtime_error("No directory to watch");
+    std::set<std::string> targets;
+    for (auto &root : roots) {
+        while (root.path.size() > 1 && root.path.back() == '/') root.path.pop_back();
+        if (root.host.empty()) root.host = host;
+        if (root.port.empty()) root.port = port;
+        if (root.username.empty()) root.username = config.username;
+        if (root.password.empty()) root.password = config.password;
+        if (roots.size() > 1 && root.name.empty()) root.name = boost::filesystem::path(root.path).filename().string();
+        if (!targets.insert(root.host + ":" + root.port + "/" + root.username + "/" + root.name).second)
+            throw std::runtime_error("Two roots would be stored in " + root.name + " of the same account on " + root.host);
+    }
+    return roots;
+}
+
+/// Backs up a root through its own session, reconnecting until the user stops the client; only the session given the
+/// console reads the input, the others stop with it
+void run_root(const Watch_Root &root, Client_Config config, const Throttling &throttling, const std::shared_ptr<Tls_Context> &tls,
+              const Ignore_Rules &rules, const std::shared_ptr<Hash_Pool> &hashing, std::shared_ptr<bool> stop, bool console) {
+    config.username = root.username;
+    config.password = root.password;
+    if (!config.ticket_file.empty() && !root.name.empty()) config.ticket_file += "." + root.name;    // The roots may use different accounts
+    do {
+        auto running_client = std::make_shared<bool>(true);
+        auto running_watcher = std::make_shared<bool>(true);
+        boost::asio::io_context io_context;
+        auto dw = std::make_shared<DirectoryWatcher>(root.path, boost::chrono::milliseconds(500), running_watcher, throttling, rules,
+                                                     hashing, root.priority);
+        Client cl(io_context, root.host, root.port, running_client, root.path, dw, stop, running_watcher, config, throttling, tls, root.name, console);
+        io_context.run();
+    } while (!*stop);
+}
+
+/// Restore mode: Client <host> <port> --restore <destination> [path] [version | @snapshot] [config.json]
+int run_restore(int argc, char* argv[]) {
+    std::vector<std::string> args(argv + 5, argv + argc);
+    Client_Config config;
+    if (!args.empty() && boost::filesystem::extension(args.back()) == ".json") {
+        config = load_client_config(args.back());
+        args.pop_back();
+    }
+    Logger::set_level(Logger::parse_level(config.log_level));
+    std::string path = args.empty() ? "" : args[0];
+    while (!path.empty() && path.back() == '/') path.pop_back();
+    if (!path.empty() && path.front() == '/') path.erase(0, 1);
+    int64_t snapshot = 0;
+    int64_t version = 0;
+    if (args.size() > 1) {
+        if (args[1].front() == '@') snapshot = std::stoll(args[1].substr(1));
+        else version = std::stoll(args[1]);
+    }
+    Credentials cred{config.username, config.password};
+    if (cred.username.empty() || cred.password.empty()) {
+        std::cout << "Insert username: ";
+        std::cin >> cred.username;
+        std::cout << "Insert password: ";
+        std::cin >> cred.password;
+    }
+    cred.password = password_digest(cred.password);
+    boost::asio::io_context io_context;
+    boost::asio::ip::tcp::resolver resolver(io_context);
+    Restore_Client restore_client(resolver.resolve(argv[1], argv[2]), cred, argv[4], path, snapshot, version, config.restore_streams,
+                                  make_tls(config, argv[1]));
+    return restore_client.run() ? 0 : 2;
+}
+
 int main(int argc, char* argv[]) {
 
     try {
 
-        if (argc != 4) {
-            std::cerr << "Usage: Client <host> <port> <rel_path_to_watch>\n";
+        if (argc >= 5 && std::string(argv[3]) == "--restore") return run_restore(argc, argv);
+
+        if (argc != 4 && argc != 5) {
+            std::cerr << "Usage: Client <host> <port> <rel_path_to_watch | -> [config.json]\n";
+            std::cerr << "       Client <host> <port> --restore <destination> [path] [version | @snapshot] [config.json]\n";
             return 1;
         }
 
-        std::string path_to_watch = argv[3];
-        auto stop = std::make_shared<bool>(false);
-
-        do {
-            auto running_client = std::make_shared<bool>(true);
-            auto running_watcher = std::make_shared<bool>(true);
-            boost::asio::io_context io_context;
-            boost::asio::ip::tcp::resolver resolver(io_context);
-            auto endpoints = resolver.resolve(argv[1], argv[2]);
-            auto dw = std::make_shared<DirectoryWatcher>(path_to_watch, boost::chrono::milliseconds(500), running_watcher);
-            Client cl(io_context, endpoints, running_client, path_to_watch, dw, stop, running_watcher);
-            io_context.run();
-        } while (!*stop);
+        Client_Config config = argc == 5 ? load_client_config(argv[4]) : Client_Config();
+        apply_client_environment(config);
+        auto roots = make_roots(config, argv[1], argv[2], argv[3]);
+        Throttling throttling = make_throttling(config);    // Created once so that the limits changed at runtime survive the reconnections, shared by the roots
+        auto rules = make_ignore_rules(config);
+        Logger::set_level(Logger::parse_level(config.log_level));
+        auto hashing = std::make_shared<Hash_Pool>(config.hash_threads, config.state_file, std::chrono::seconds(config.state_interval));   // Its cache spares reading the unchanged files again after a reconnection or a restart
+        Stats_Exporter exporter(config.metrics_port, config.stats_file, std::chrono::seconds(config.stats_interval));
+        std::map<std::string, std::shared_ptr<Tls_Context>> contexts;   // Keeping the TLS session of the previous connection to a server to resume it
+        for (auto &root : roots) {
+            bool credentials = !root.username.empty() && (!root.password.empty() || !config.ticket.empty() || !config.ticket_file.empty());
+            if (config.daemon && !credentials) throw std::runtime_error("The daemon needs a username and a password or a ticket for " + root.path);
+            if (roots.size() > 1 && !credentials) {    // Asked once, the sessions can not share the input
+                std::cout << "Insert username and password for " << root.path << " on " << root.host << ": ";
+                std::cin >> root.username >> root.password;
+            }
+            if (!contexts.count(root.host + ":" + root.port)) contexts[root.host + ":" + root.port] = make_tls(config, root.host);
+        }
+
+        auto stop = std::make_shared<bool>(false);     // Set by the session of the first root, which reads the input
+        std::vector<boost::thread> sessions;
+        for (size_t i = 1; i < roots.size(); i++) {
+            sessions.emplace_back([&, i]() {
+                try {
+                    run_root(roots[i], config, throttling, contexts.at(roots[i].host + ":" + roots[i].port), rules, hashing, stop, false);
+                } catch (const std::exception& e) {
+                    std::cerr << "Exception in the session of " << roots[i].path << ": " << e.what() << "\n";
+                }
+            });
+        }
+        run_root(roots[0], config, throttling, contexts.at(roots[0].host + ":" + roots[0].port), rules, hashing, stop, true);
+        for (auto &session : sessions) session.join();
 
     } catch (const std::exception& e) {
         std::cerr << "Exception: " << e.what() << "\n";
@@ -0,0 +1,120 @@
+#include "Commit_Batch.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+    auto &syncs = Metrics::instance().counter("rab_syncs_total");
+    auto &batch_size = Metrics::instance().histogram("rab_commit_batch_size", {1, 2, 4, 8, 16, 32, 64, 128});
+    auto &commit_latency = Metrics::instance().histogram("rab_commit_seconds");
+
+    /// Opens path and calls sync on its descriptor, returns false if either fails
+    bool sync_path(const std::string &path, int flags, int (*sync)(int)) {
+        int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+        if (fd < 0) return false;
+        bool ok = sync(fd) == 0;
+        syncs.add();
+        return ::close(fd) == 0 && ok;
+    }
+}
+
+Commit_Batch::Commit_Batch(bool durable, size_t syncfs_threshold) : durable(durable), syncfs_threshold(syncfs_threshold) {}
+
+void Commit_Batch::add(std::string part, std::string destination, std::function<void(bool)> done) {
+    if (entries.empty()) oldest = std::chrono::steady_clock::now();
+    entries.push_back({std::move(part), std::move(destination), std::move(done)});
+}
+
+void Commit_Batch::add_directory(std::string destination, std::function<void(bool)> done) {
+    add(std::string(), std::move(destination), std::move(done));
+}
+
+void Commit_Batch::commit() {
+    if (entries.empty()) return;
+    auto start = std::chrono::steady_clock::now();
+    batch_size.observe(static_cast<double>(entries.size()));
+    std::vector<bool> ok(entries.size(), true);
+    if (durable) sync_parts(ok);    // The data must be on disk before the rename makes it visible under the final name
+    std::set<std::string> directories;
+    for (size_t i = 0; i < entries.size(); i++) {
+        auto &entry = entries[i];
+        boost::system::error_code ec;
+        if (!ok[i]) {
+            boost::filesystem::remove(entry.part, ec);  // Its content is not trusted anymore, the client sends it again
+            continue;
+        }
+        try {
+            boost::filesystem::path destination(entry.destination);
+            create_parents(destination, directories);   // Small files may overtake the creation of their directory
+            if (!entry.part.empty()) boost::filesystem::rename(entry.part, destination);     // Atomic replacement of the previous version
+            directories.insert(destination.parent_path().string());
+        } catch (const boost::filesystem::filesystem_error &err) {
+            Logger::log(Log_Level::error, std::string("Unable to move the upload in place: ") + err.what());
+            boost::filesystem::remove(entry.part, ec);
+            ok[i] = false;
+        }
+    }
+    if (durable) sync_directories(directories);
+    std::vector<Entry> done;
+    done.swap(entries);     // The callbacks may add entries to a new batch
+    for (size_t i = 0; i < done.size(); i++) done[i].done(ok[i]);
+    commit_latency.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
+
+void Commit_Batch::sync_parts(std::vector<bool> &ok) {
+    size_t files = 0;
+    std::string staging;
+    for (auto &entry : entries) {
+        if (entry.part.empty()) continue;
+        if (files++ == 0) staging = boost::filesystem::path(entry.part).parent_path().string();
+    }
+    if (files == 0) return;
+    if (files >= syncfs_threshold) {    // One flush of the whole file system is cheaper than many file ones
+        if (sync_path(staging, O_RDONLY | O_DIRECTORY, ::syncfs)) return;
+        Logger::log(Log_Level::warning, "syncfs failed, syncing the files one by one");
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].part.empty()) continue;
+        if (!sync_path(entries[i].part, O_RDONLY, ::fdatasync)) {
+            Logger::log(Log_Level::error, "Unable to sync " + entries[i].part);
+            ok[i] = false;
+        }
+    }
+}
+
+void Commit_Batch::sync_directories(const std::set<std::string> &directories) {
+    if (directories.empty()) return;
+    if (directories.size() >= syncfs_threshold && sync_path(*directories.begin(), O_RDONLY | O_DIRECTORY, ::syncfs)) return;
+    for (auto &directory : directories) {
+        if (!sync_directory(directory))
+            Logger::log(Log_Level::warning, "Unable to sync directory " + directory);
+    }
+}
+
+void Commit_Batch::create_parents(const boost::filesystem::path &destination, std::set<std::string> &directories) {
+    auto parent = destination.parent_path();
+    if (parent.empty() || boost::filesystem::is_directory(parent)) return;
+    create_parents(parent, directories);
+    boost::filesystem::create_directory(parent);
+    directories.insert(parent.parent_path().string());      // The new entry lives in the grandparent
+}
+
+bool Commit_Batch::empty() const {
+    return entries.empty();
+}
+
+size_t Commit_Batch::size() const {
+    return entries.size();
+}
+
+double Commit_Batch::age() const {
+    return entries.empty() ? 0 : std::chrono::duration<double>(std::chrono::steady_clock::now() - oldest).count();
+}
+
+bool Commit_Batch::sync_directory(const std::string &directory) {
+    return sync_path(directory, O_RDONLY | O_DIRECTORY, ::fsync);
+}
+
+bool Commit_Batch::contains(const std::string &destination) const {
+    for (auto &entry : entries) if (entry.destination == destination) return true;
+    return false;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+#include "Logger.h"
+#include "Metrics.h"
+
+/// Completed uploads waiting in the staging area to be made durable and moved in place. The whole group is synced
+/// at once, so a burst of small files costs a few syncs instead of one per file
+class Commit_Batch {
+    /// A staged file, or a directory already created when the part is empty
+    struct Entry {
+        std::string part;
+        std::string destination;
+        std::function<void(bool)> done;     // Called once the entry is durable in place, or with false if it failed
+    };
+
+    bool durable;
+    size_t syncfs_threshold;
+    std::vector<Entry> entries;
+    std::chrono::steady_clock::time_point oldest;
+
+    /// Flushes the data of the staged files, one syncfs for large groups; the files that fail are marked in ok
+    void sync_parts(std::vector<bool> &ok);
+
+    /// Flushes the given directories so that the renames survive a crash
+    void sync_directories(const std::set<std::string> &directories);
+
+    /// Creates the missing parents of a destination, adding to directories the ones whose entries changed
+    static void create_parents(const boost::filesystem::path &destination, std::set<std::string> &directories);
+
+public:
+
+    /// With durable false the files are only renamed, for file systems whose sync is too expensive to be worth it.
+    /// Groups of at least syncfs_threshold files are flushed with one syncfs instead of one fdatasync each
+    Commit_Batch(bool durable, size_t syncfs_threshold);
+
+    /// Adds a complete file of the staging area, moved to destination by the next commit
+    void add(std::string part, std::string destination, std::function<void(bool)> done);
+
+    /// Adds a directory just created, whose entry in the parent is flushed by the next commit
+    void add_directory(std::string destination, std::function<void(bool)> done);
+
+    /// Syncs the staged data, renames the files in place, syncs their directories and then calls the callbacks
+    void commit();
+
+    bool empty() const;
+
+    size_t size() const;
+
+    /// Seconds since the oldest entry has been added
+    double age() const;
+
+    /// Whether the given destination is waiting in the batch
+    bool contains(const std::string &destination) const;
+
+    /// Flushes the entries of a directory, returns false if it fails
+    static bool sync_directory(const std::string &directory);
+};
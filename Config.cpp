@@ -0,0 +1,121 @@
+#include "Config.h"
+#include <cstdlib>
+
+Client_Config load_client_config(const std::string &path) {
+    Client_Config config;
+    try {
+        boost::property_tree::ptree pt;
+        boost::property_tree::read_json(path, pt);
+        config.username = pt.get<std::string>("username", config.username);
+        config.password = pt.get<std::string>("password", config.password);
+        config.upload_rate = pt.get<double>("upload_rate", config.upload_rate);
+        config.read_rate = pt.get<double>("read_rate", config.read_rate);
+        config.read_iops = pt.get<double>("read_iops", config.read_iops);
+        config.small_file_size = pt.get<size_t>("small_file_size", config.small_file_size);
+        config.max_queued_bytes = pt.get<size_t>("max_queued_bytes", config.max_queued_bytes);
+        config.ticket = pt.get<std::string>("ticket", config.ticket);
+        config.ticket_file = pt.get<std::string>("ticket_file", config.ticket_file);
+        config.daemon = pt.get<bool>("daemon", config.daemon);
+        config.retry_initial_seconds = pt.get<double>("retry_initial_seconds", config.retry_initial_seconds);
+        config.reconnect_max_seconds = pt.get<int>("reconnect_max_seconds", config.reconnect_max_seconds);
+        config.retry_attempts = pt.get<unsigned>("retry_attempts", config.retry_attempts);
+        config.state_file = pt.get<std::string>("state_file", config.state_file);
+        config.state_interval = pt.get<int>("state_interval", config.state_interval);
+        config.log_level = pt.get<std::string>("log_level", config.log_level);
+        config.metrics_port = pt.get<unsigned short>("metrics_port", config.metrics_port);
+        config.stats_file = pt.get<std::string>("stats_file", config.stats_file);
+        config.stats_interval = pt.get<int>("stats_interval", config.stats_interval);
+        config.restore_path = pt.get<std::string>("restore_path", config.restore_path);
+        config.restore_streams = pt.get<unsigned>("restore_streams", config.restore_streams);
+        config.tls = pt.get<bool>("tls", config.tls);
+        config.tls_ca = pt.get<std::string>("tls_ca", config.tls_ca);
+        config.tls_server_name = pt.get<std::string>("tls_server_name", config.tls_server_name);
+        config.tls_verify = pt.get<bool>("tls_verify", config.tls_verify);
+        config.ignore_file = pt.get<std::string>("ignore_file", config.ignore_file);
+        if (auto ignore = pt.get_child_optional("ignore")) {
+            for (auto &entry : *ignore) config.ignore.push_back(entry.second.data());
+        }
+        config.hash_threads = pt.get<unsigned>("hash_threads", config.hash_threads);
+        if (auto roots = pt.get_child_optional("roots")) {
+            for (auto &entry : *roots) {    // Every element of the array is a watched directory
+                config.roots.push_back({entry.second.get<std::string>("path"), entry.second.get<std::string>("name", ""),
+                                        entry.second.get<std::string>("host", ""), entry.second.get<std::string>("port", ""),
+                                        entry.second.get<std::string>("username", ""), entry.second.get<std::string>("password", ""),
+                                        entry.second.get<int>("priority", 0)});
+            }
+        }
+        if (auto schedule = pt.get_child_optional("schedule")) {
+            for (auto &entry : *schedule) {     // Every element of the array is a time of day window
+                config.schedule.push_back({entry.second.get<int>("from"), entry.second.get<int>("to"),
+                                           entry.second.get<double>("upload_rate", -1), entry.second.get<double>("read_rate", -1)});
+            }
+        }
+    } catch (const boost::property_tree::ptree_error &err) {
+        throw;
+    }
+    return config;
+}
+
+void apply_client_environment(Client_Config &config) {
+    auto apply = [](const char *name, std::string &setting) {
+        if (const char *value = std::getenv(name)) setting = value;
+    };
+    apply("RAB_USERNAME", config.username);
+    apply("RAB_PASSWORD", config.password);
+    apply("RAB_TICKET", config.ticket);
+    apply("RAB_TICKET_FILE", config.ticket_file);
+    apply("RAB_STATE_FILE", config.state_file);
+    if (const char *value = std::getenv("RAB_DAEMON")) config.daemon = std::string(value) == "1" || std::string(value) == "true";
+}
+
+Server_Config load_server_config(const std::string &path) {
+    Server_Config config;
+    try {
+        boost::property_tree::ptree pt;
+        boost::property_tree::read_json(path, pt);
+        config.log_level = pt.get<std::string>("log_level", config.log_level);
+        config.metrics_port = pt.get<unsigned short>("metrics_port", config.metrics_port);
+        config.stats_file = pt.get<std::string>("stats_file", config.stats_file);
+        config.stats_interval = pt.get<int>("stats_interval", config.stats_interval);
+        config.workers = pt.get<unsigned>("workers", config.workers);
+        config.max_session_bytes = pt.get<size_t>("max_session_bytes", config.max_session_bytes);
+        config.max_sessions = pt.get<size_t>("max_sessions", config.max_sessions);
+        config.max_user_sessions = pt.get<size_t>("max_user_sessions", config.max_user_sessions);
+        config.max_backlog_bytes = pt.get<uint64_t>("max_backlog_bytes", config.max_backlog_bytes);
+        config.retry_seconds = pt.get<unsigned>("retry_seconds", config.retry_seconds);
+        config.acceptors = pt.get<unsigned>("acceptors", config.acceptors);
+        config.accept_backlog = pt.get<int>("accept_backlog", config.accept_backlog);
+        config.scrub_interval = pt.get<int>("scrub_interval", config.scrub_interval);
+        config.scrub_iops = pt.get<double>("scrub_iops", config.scrub_iops);
+        config.durable_writes = pt.get<bool>("durable_writes", config.durable_writes);
+        config.syncfs_threshold = pt.get<unsigned>("syncfs_threshold", config.syncfs_threshold);
+        config.keep_versions = pt.get<unsigned>("keep_versions", config.keep_versions);
+        config.keep_days = pt.get<int>("keep_days", config.keep_days);
+        config.keep_snapshots = pt.get<unsigned>("keep_snapshots", config.keep_snapshots);
+        config.quota_bytes = pt.get<uint64_t>("quota_bytes", config.quota_bytes);
+        config.quota_files = pt.get<uint64_t>("quota_files", config.quota_files);
+        config.auth_scrypt_log_n = pt.get<unsigned>("auth_scrypt_log_n", config.auth_scrypt_log_n);
+        config.auth_scrypt_r = pt.get<unsigned>("auth_scrypt_r", config.auth_scrypt_r);
+        config.auth_scrypt_p = pt.get<unsigned>("auth_scrypt_p", config.auth_scrypt_p);
+        config.auth_concurrency = pt.get<unsigned>("auth_concurrency", config.auth_concurrency);
+        config.auth_queue_limit = pt.get<unsigned>("auth_queue_limit", config.auth_queue_limit);
+        config.auth_cache_seconds = pt.get<int>("auth_cache_seconds", config.auth_cache_seconds);
+        config.ticket_seconds = pt.get<int>("ticket_seconds", config.ticket_seconds);
+        config.tls_cert = pt.get<std::string>("tls_cert", config.tls_cert);
+        config.tls_key = pt.get<std::string>("tls_key", config.tls_key);
+    } catch (const boost::property_tree::ptree_error &err) {
+        throw;
+    }
+    return config;
+}
+
+Throttling make_throttling(const Client_Config &config) {
+    Throttling throttling{std::make_shared<Rate_Limiter>(config.upload_rate),
+                          std::make_shared<Rate_Limiter>(config.read_rate),
+                          std::make_shared<Rate_Limiter>(config.read_iops)};
+    for (const auto &entry : config.schedule) {
+        if (entry.upload_rate >= 0) throttling.upload->add_window(entry.from_hour, entry.to_hour, entry.upload_rate);
+        if (entry.read_rate >= 0) throttling.read_bytes->add_window(entry.from_hour, entry.to_hour, entry.read_rate);
+    }
+    return throttling;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Rate_Limiter.h"
+
+/// Struct for collecting a time of day window of the client schedule, negative rates keep the base value
+struct Schedule_Entry {
+    int from_hour;
+    int to_hour;
+    double upload_rate;
+    double read_rate;
+};
+
+/// Struct for collecting a directory backed up by the client and the server it goes to, the empty fields take the values
+/// of the command line and of the client settings
+struct Watch_Root {
+    std::string path;
+    std::string name;           // Directory holding the root in the tree of the user on the server, empty for the top of the tree
+    std::string host;
+    std::string port;
+    std::string username{};
+    std::string password{};
+    int priority = 0;           // Roots with a higher priority are hashed first
+};
+
+/// Struct for collecting the client settings, every rate equal to 0 means unlimited
+struct Client_Config {
+    std::string username;
+    std::string password;
+    std::string ticket;                     // Session ticket granted by a previous login, it replaces the password
+    std::string ticket_file;                // Where the tickets granted at login are kept for the next start, readable only by the user
+    bool daemon = false;                    // Running unattended: nothing is read from the input, the connection is retried forever
+    double retry_initial_seconds = 1;       // First wait after a failure, doubled at every further one
+    int reconnect_max_seconds = 300;        // Longest wait between two attempts
+    unsigned retry_attempts = 5;            // Failures in a row after which the user is asked whether to go on, the daemon probes every longest wait
+    std::string state_file;                 // Hashes of the watched files kept across the restarts, so that they are not read again
+    int state_interval = 60;                // Seconds between two saves of the state file
+    double upload_rate = 0;
+    double read_rate = 0;
+    double read_iops = 0;                   // Reads of 64 KiB per second at most when hashing and sending, 0 means unlimited
+    size_t small_file_size = 1048576;
+    size_t max_queued_bytes = 8 << 20;      // Messages waiting for the socket at most, the files are read no faster than they are sent
+    std::vector<Schedule_Entry> schedule;
+    std::string ignore_file;                // Rules in the .gitignore format for the elements not to back up
+    std::vector<std::string> ignore;        // More rules, applied after the ones of the file
+    std::vector<Watch_Root> roots;          // Directories backed up besides the one of the command line, each by its own session
+    unsigned hash_threads = 2;              // Threads hashing the files of all the roots, 0 means one per core
+    std::string log_level = "info";
+    unsigned short metrics_port = 0;
+    std::string stats_file;
+    int stats_interval = 10;
+    std::string restore_path = "restore";   // Directory receiving the restored files, never the watched one
+    unsigned restore_streams = 4;           // Parallel connections of the restore mode
+    bool tls = false;                       // Connecting to a server that uses TLS
+    std::string tls_ca;                     // Certificates trusted for the server, the system ones if empty
+    std::string tls_server_name;            // Name the certificate of the server is checked against, the host if empty
+    bool tls_verify = true;                 // Off only to test against a server whose certificate is not trusted
+};
+
+/// Struct for collecting the server settings
+struct Server_Config {
+    std::string log_level = "info";
+    unsigned short metrics_port = 0;
+    std::string stats_file;
+    int stats_interval = 10;
+    unsigned workers = 0;               // Threads handling the requests and hashing the received data, 0 means one per core
+    size_t max_session_bytes = 32 << 20;    // Requests waiting to be handled and answers waiting to be sent per session, reading stops past it
+    size_t max_sessions = 1024;         // Sessions at most, the further logins are asked to retry later; 0 means unlimited
+    size_t max_user_sessions = 16;      // Sessions of a single user at most, restores open several
+    uint64_t max_backlog_bytes = 1ull << 30;    // Requests waiting for a worker at most, in bytes, before new logins are refused
+    unsigned retry_seconds = 5;         // Minimum wait suggested to the refused clients, up to twice as much with the jitter
+    unsigned acceptors = 1;             // Listening sockets sharing the port with SO_REUSEPORT, the kernel spreads the connections
+    int accept_backlog = 1024;          // Connections waiting to be accepted per listening socket
+    int scrub_interval = 24 * 60 * 60;  // Seconds between two verifications of the stored files, 0 disables them
+    double scrub_iops = 100;            // Reads of 64 KiB per second the verification may issue, larger reads count as several
+    bool durable_writes = true;         // Syncing the uploads before acknowledging them, off only for throwaway storage
+    unsigned syncfs_threshold = 32;     // Groups of at least this many files are synced with one syncfs
+    unsigned keep_versions = 10;        // Versions kept per file regardless of their age
+    int keep_days = 30;                 // Days the older versions are kept for
+    unsigned keep_snapshots = 30;       // Most recent snapshots kept per user
+    uint64_t quota_bytes = 0;           // Bytes and files the current tree of a user may hold, unless set for the user; 0 means unlimited
+    uint64_t quota_files = 0;
+    unsigned auth_scrypt_log_n = 15;    // Work factor of the stored passwords: 2^log_n iterations of scrypt,
+    unsigned auth_scrypt_r = 8;         // using 128 * r * 2^log_n bytes of memory each
+    unsigned auth_scrypt_p = 1;
+    unsigned auth_concurrency = 2;      // Password verifications running at once, the other logins wait for a slot
+    unsigned auth_queue_limit = 1024;   // Logins waiting at most, the following ones are asked to retry later
+    int auth_cache_seconds = 300;       // Seconds a verified password is accepted again without hashing it
+    int ticket_seconds = 7 * 24 * 60 * 60;  // Validity of the session tickets granted at login
+    std::string tls_cert;               // PEM certificate chain and private key, the connections use TLS when both are set
+    std::string tls_key;
+};
+
+/// Loads the client settings from the given json file, missing fields keep their default value
+Client_Config load_client_config(const std::string &path);
+
+/// Overrides the client settings with the RAB_USERNAME, RAB_PASSWORD, RAB_TICKET, RAB_TICKET_FILE, RAB_STATE_FILE and
+/// RAB_DAEMON environment variables that are set, so that a service manager can keep the secrets out of the file
+void apply_client_environment(Client_Config &config);
+
+/// Loads the server settings from the given json file, missing fields keep their default value
+Server_Config load_server_config(const std::string &path);
+
+/// Creates the rate limiters described by the client settings
+Throttling make_throttling(const Client_Config &config);
@@ -0,0 +1,45 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "Content_Hasher.h"
+
+Content_Hasher::Content_Hasher() : md5(EVP_MD_CTX_new(), &EVP_MD_CTX_free) {
+    if (!md5 || EVP_DigestInit_ex(md5.get(), EVP_md5(), nullptr) != 1) throw std::runtime_error("Unable to initialize MD5");
+}
+
+void Content_Hasher::update(const char *data, size_t length) {
+    const char *end = data + length;
+    while (data != end) {   // Hashing the runs between line breaks without copying them
+        auto line_break = static_cast<const char*>(std::memchr(data, '\n', end - data));
+        const char *run_end = line_break ? line_break : end;
+        EVP_DigestUpdate(md5.get(), data, run_end - data);
+        data = line_break ? line_break + 1 : end;
+    }
+}
+
+void Content_Hasher::update_zeros(uint64_t length) {
+    static const char zeros[65536] = {};     // No line breaks among them, hashed as they are
+    while (length > 0) {
+        size_t run = std::min<uint64_t>(length, sizeof(zeros));
+        EVP_DigestUpdate(md5.get(), zeros, run);
+        length -= run;
+    }
+}
+
+void Content_Hasher::update_raw(const char *data, size_t length) {
+    EVP_DigestUpdate(md5.get(), data, length);
+}
+
+std::string Content_Hasher::final() {
+    unsigned char checksum[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_DigestFinal_ex(md5.get(), checksum, &length);
+    const char *hex_digits = "0123456789abcdef";
+    std::string digest;
+    digest.reserve(2 * length);
+    for (auto c = checksum; c != checksum + length; c++) {
+        digest += hex_digits[*c >> 4u];
+        digest += hex_digits[*c & 15u];
+    }
+    return digest;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <openssl/evp.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/// Streaming form of the hash the client assigns to each element, so that the server can verify the bytes it receives
+/// while they arrive. Line breaks are not part of the hash of a file content
+class Content_Hasher {
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> md5;
+
+public:
+
+    /// Throws std::runtime_error if OpenSSL can not provide MD5
+    Content_Hasher();
+
+    /// Adds a block of file content, the line breaks it contains are skipped
+    void update(const char *data, size_t length);
+
+    /// Adds length zero bytes, the content of the holes of a sparse file
+    void update_zeros(uint64_t length);
+
+    /// Adds the bytes as they are, used for the metadata of directories and empty files
+    void update_raw(const char *data, size_t length);
+
+    /// Gets the hexadecimal digest, the hasher must not be updated afterwards
+    std::string final();
+};
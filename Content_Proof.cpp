@@ -0,0 +1,34 @@
+#include "Content_Proof.h"
+#include <ios>
+#include <memory>
+#include <openssl/evp.h>
+#include "File_Reader.h"
+
+std::string content_proof(const std::string &path, const std::string &nonce) {
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    bool ok = context && EVP_DigestInit_ex(context.get(), EVP_sha256(), nullptr) == 1
+            && EVP_DigestUpdate(context.get(), nonce.data(), nonce.size()) == 1;
+    try {
+        File_Reader file(path);
+        for (uint64_t offset = 0; ok && offset < file.size();) {
+            auto data = file.read(offset, read_window);
+            if (data.empty()) break;
+            ok = EVP_DigestUpdate(context.get(), data.data(), data.size()) == 1;
+            offset += data.size();
+        }
+        ok = ok && !file.truncated();
+    } catch (const std::ios_base::failure &) {
+        return {};
+    }
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if (!ok || EVP_DigestFinal_ex(context.get(), digest, &length) != 1) return {};
+    const char *hex_digits = "0123456789abcdef";
+    std::string proof;
+    proof.reserve(2 * length);
+    for (unsigned int i = 0; i < length; i++) {
+        proof += hex_digits[digest[i] >> 4u];
+        proof += hex_digits[digest[i] & 15u];
+    }
+    return proof;
+}
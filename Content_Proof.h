@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+
+/// Proof that the sender holds the whole content of a file and not only its hash, which is weak and known to anyone
+/// the file was shared with: the hexadecimal SHA-256 digest of a nonce chosen by the server followed by every byte of
+/// the file, line breaks included. Empty if the file can not be read
+std::string content_proof(const std::string &path, const std::string &nonce);
@@ -1,33 +1,9 @@
 #include "Database_Connection.h"
+#include "Logger.h"
+#include "Metrics.h"
 
 Database_Connection::Database_Connection(): db_name("../Clients.sqlite") {}
 
-std::tuple<bool, bool> Database_Connection::check_database(const std::string& username, const std::string& password) {
-    std::cout << "Checking Database..." << std::endl;
-    sqlite3* conn;  // Database handle defined by the sqlite3 structure
-    int count = 0;
-    bool db_availability = true;
-    if (sqlite3_open(db_name.data(), &conn) == SQLITE_OK) {
-        std::string sqlStatement = std::string("SELECT COUNT(*) FROM Client WHERE username = '") + username + std::string("' AND password = '") + password + std::string("';");
-        sqlite3_stmt *statement;    // Representing a single sql statement
-        int res = sqlite3_prepare_v2(conn, sqlStatement.c_str(), -1, &statement, nullptr);  // Compiling the sql statement into a bytecode saved in statement structure
-        if (res == SQLITE_OK) {
-            while (sqlite3_step(statement) == SQLITE_ROW) {    // Running the bytecode of the sql statement
-                count = sqlite3_column_int(statement, 0);
-            }
-        } else {
-            std::cerr << "Database Error, " << sqlite3_errmsg(conn) << std::endl;
-            db_availability = false;
-        }
-        sqlite3_finalize(statement);    // Destroying the prepared statement object
-        sqlite3_close(conn);    // Closing the db connection and destroying the handle
-    } else {
-        db_availability = false;
-    }
-    std::tuple<bool, bool> count_avail = {count, db_availability};
-    return count_avail;
-}
-
 std::tuple<bool, bool> Database_Connection::get_paths(std::map<std::string, std::string> &paths, const std::string& username) {
     sqlite3* conn;  // Database handle defined by the sqlite3 structure
     unsigned char *paths_ch = nullptr;
@@ -58,7 +34,7 @@ std::tuple<bool, bool> Database_Connection::get_paths(std::map<std::string, std:
             }
         } else {
             db_availability = false;
-            std::cerr << "Database Connection Error, " << sqlite3_errmsg(conn) << std::endl;
+            Logger::log(Log_Level::error, std::string("Database Connection Error, ") + sqlite3_errmsg(conn));
         }
         sqlite3_finalize(statement);    // Destroying the prepared statement object
         sqlite3_close(conn);    // Closing the db connection and destroying the handle
@@ -70,7 +46,9 @@ std::tuple<bool, bool> Database_Connection::get_paths(std::map<std::string, std:
 }
 
 bool Database_Connection::update_db_paths(std::map<std::string, std::string> &paths, const std::string& username) {
-    std::cout << "Updating Database..." << std::endl;
+    static auto &commit_latency = Metrics::instance().histogram("rab_db_commit_seconds");
+    auto start = std::chrono::steady_clock::now();
+    Logger::log(Log_Level::debug, "Updating Database...");
     sqlite3* conn;  // Database handle defined by the sqlite3 structure
     bool db_availability = true;
     boost::property_tree::ptree pt;
@@ -82,7 +60,7 @@ bool Database_Connection::update_db_paths(std::map<std::string, std::string> &pa
             boost::property_tree::write_json(map_to_stream, pt);    // Saving the json in a stream
         }
     } catch (const boost::property_tree::ptree_error &err) {
-        std::cerr << "Error while writing json." << std::endl;
+        Logger::log(Log_Level::error, "Error while writing json.");
         throw;
     }
     if (sqlite3_open(db_name.data(), &conn) == SQLITE_OK) {
@@ -97,7 +75,7 @@ bool Database_Connection::update_db_paths(std::map<std::string, std::string> &pa
         if (res == SQLITE_OK) {
             sqlite3_step(statement);    // Running the bytecode of the sql statement
         } else {
-            std::cerr << "Database Error, " << sqlite3_errmsg(conn) << std::endl;
+            Logger::log(Log_Level::error, std::string("Database Error, ") + sqlite3_errmsg(conn));
             db_availability = false;
         }
         sqlite3_finalize(statement);    // Destroying the prepared statement object
@@ -105,5 +83,6 @@ bool Database_Connection::update_db_paths(std::map<std::string, std::string> &pa
     } else {
         db_availability = false;
     }
+    commit_latency.observe(seconds_since(start));
     return db_availability;
 }
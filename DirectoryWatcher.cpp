@@ -1,49 +1,133 @@
 #include "DirectoryWatcher.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "File_Extents.h"
 
-DirectoryWatcher::DirectoryWatcher(std::string path_to_watch, boost::chrono::milliseconds delay, std::shared_ptr<bool> &watching)
-        : path_to_watch(std::move(path_to_watch)), delay(delay), running_watcher(watching) {
+namespace {
+    /// Regular files and symbolic links are uploaded as files, any other element as a directory
+    bool is_file(const File_Metadata &metadata) {
+        return S_ISREG(metadata.mode) || metadata.is_link();
+    }
+}
+
+DirectoryWatcher::DirectoryWatcher(std::string path_to_watch, boost::chrono::milliseconds delay, std::shared_ptr<bool> &watching, Throttling throttling,
+                                   Ignore_Rules rules, std::shared_ptr<Hash_Pool> hashing, int priority)
+        : running_watcher(watching), path_to_watch(std::move(path_to_watch)), delay(delay), throttling(std::move(throttling)), rules(std::move(rules)),
+        hashing(std::move(hashing)), priority(priority) {
     std::lock_guard lg(paths_mutex);    // Lock in order to guarantee thread safe access to the map
-    for (boost::filesystem::directory_entry &element : boost::filesystem::recursive_directory_iterator(this->path_to_watch)) {  // Recursively iterating to path_to_watch
-            auto last_time_edit = boost::filesystem::last_write_time(element);                                                  // in order to add the elements to the paths map
-        paths[element.path().string()] = { last_time_edit, boost::filesystem::is_regular_file(element), make_hash(element) };
+    std::vector<Pending_Hash> batch;
+    for (boost::filesystem::recursive_directory_iterator it(this->path_to_watch), end; it != end; ++it) {   // Recursively iterating to path_to_watch
+        if (skip(it)) continue;
+        auto &element = *it;
+        auto metadata = File_Metadata::read(element.path().string());     // in order to add the elements to the paths map
+        if (!metadata) continue;
+        bool isFile = is_file(*metadata);
+        batch.push_back({element, std::move(*metadata), isFile, FileStatus::created, {}});
+    }
+    hash_batch(batch);
+    for (auto &pending : batch) {
+        if (!pending.hash.empty()) paths[pending.element.path().string()] = node_info(pending);
     }
 }
 
+Node_Info DirectoryWatcher::node_info(Pending_Hash &pending) {
+    return {pending.metadata.last_edit(), pending.isFile, std::move(pending.hash), pending.metadata.encode(), pending.metadata.mtime_ns, pending.metadata.size};
+}
+
+bool DirectoryWatcher::skip(boost::filesystem::recursive_directory_iterator &it) {
+    static auto &pruned = Metrics::instance().counter("rab_ignored_elements_total");
+    if (rules.size() == 0) return false;
+    const auto &path = it->path().string();
+    bool directory = boost::filesystem::is_directory(it->status());
+    if (!rules.ignored(std::string_view(path).substr(path_to_watch.size() + 1), directory)) return false;
+    if (directory) it.disable_recursion_pending();  // The subtree is never walked, let alone hashed
+    pruned.add();
+    return true;
+}
+
 void DirectoryWatcher::start(const std::function<void (std::string, FileStatus, bool)>& action) {
     while (*running_watcher) {      // Looping until the client session is closed
         boost::this_thread::sleep_for(delay);
+        if (hashing) hashing->save_if_due();   // Out of the lock, the uploader keeps reading the map meanwhile
+        static auto &scan_duration = Metrics::instance().histogram("rab_scan_duration_seconds");
+        auto scan_start = std::chrono::steady_clock::now();
         std::lock_guard lg(paths_mutex);     // Lock in order to guarantee thread safe access to the map
         auto it = paths.begin();
         while (it != paths.end()) {     // Looping checking the differences between the map and the local filesystem and
             if (!boost::filesystem::exists(it->first)) {    // If they're not aligned, the command to erase that specific node is sent to the server
                 action(it->first, FileStatus::erased, it->second.isFile);
+                if (hashing) hashing->forget(it->first);
                 it = paths.erase(it);
             } else it++;
         }
+        std::vector<Pending_Hash> batch;
         try {
-            for (boost::filesystem::directory_entry& element : boost::filesystem::recursive_directory_iterator(path_to_watch)) {     // Checking recursively if a file was created or modified
-                auto last_time_edit = boost::filesystem::last_write_time(element);
-                if (paths.find(element.path().string()) == paths.end()) {   // If the element is not present in the map, then it has been created
-                    paths[element.path().string()] = { last_time_edit, boost::filesystem::is_regular_file(element), make_hash(element) };
-                    action(element.path().string(), FileStatus::created, boost::filesystem::is_regular_file(element));      // The command to create that specific node is sent to the server
-                } else if (paths[element.path().string()].lastEdit != last_time_edit) {      // Else if the element in the map has a different last_time_edit, then it has been updated
-                    paths[element.path().string()] = { last_time_edit, boost::filesystem::is_regular_file(element), make_hash(element) };
-                    action(element.path().string(), FileStatus::modified, boost::filesystem::is_regular_file(element));     // The command to modify that specific node is sent to the server
+            for (boost::filesystem::recursive_directory_iterator it(path_to_watch), end; it != end; ++it) {     // Checking recursively if a file was created or modified
+                if (skip(it)) continue;
+                auto &element = *it;
+                auto metadata = File_Metadata::read(element.path().string());
+                if (!metadata) continue;    // Gone since the walk listed it
+                bool isFile = is_file(*metadata);
+                auto known = paths.find(element.path().string());
+                if (known == paths.end()) {     // If the element is not present in the map, then it has been created
+                    batch.push_back({element, std::move(*metadata), isFile, FileStatus::created, {}});
+                } else if (known->second.mtime_ns != metadata->mtime_ns || known->second.size != metadata->size) {      // Else if its time of last edit or size changed, then it may have been updated
+                    batch.push_back({element, std::move(*metadata), isFile, FileStatus::modified, {}});
+                } else if (known->second.metadata != metadata->encode()) {     // Else if only its metadata changed, it is not hashed again
+                    batch.push_back({element, std::move(*metadata), isFile, FileStatus::metadata, known->second.hash});
                 }
             }
         } catch (const boost::filesystem::filesystem_error &err) {
-            std::cout << "Element deleted before its insertion in the local map." << std::endl;
+            Logger::log(Log_Level::debug, "Element deleted before its insertion in the local map.");
+        }
+        hash_batch(batch);      // The changes are hashed together, then reported in the order of the walk
+        for (auto &pending : batch) {
+            if (pending.hash.empty()) continue;     // Gone or unreadable, seen again by the next scan if it is still there
+            auto path = pending.element.path().string();
+            auto &node = paths[path];
+            bool changed = node.metadata != pending.metadata.encode();
+            if (pending.status == FileStatus::modified && node.hash == pending.hash) pending.status = FileStatus::metadata;   // Touched or rewritten with the same content
+            node = node_info(pending);
+            if (pending.status == FileStatus::metadata && !changed) continue;
+            action(path, pending.status, pending.isFile);    // The command to create or modify that specific node is sent to the server
         }
+        scan_duration.observe(seconds_since(scan_start));
     }
 }
 
+void DirectoryWatcher::hash_batch(std::vector<Pending_Hash> &batch) {
+    auto hash_one = [this](Pending_Hash &pending) {
+        try {
+            pending.hash = make_hash(pending.element);
+        } catch (const std::exception &err) {   // Erased or not readable any more
+            Logger::log(Log_Level::debug, "Unable to hash " + pending.element.path().string() + ": " + err.what());
+        }
+    };
+    if (!hashing) {
+        for (auto &pending : batch) {
+            if (pending.hash.empty()) hash_one(pending);
+        }
+        return;
+    }
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(batch.size());
+    for (auto &pending : batch) {
+        if (pending.hash.empty()) tasks.emplace_back([&hash_one, &pending]() {hash_one(pending);});
+    }
+    hashing->run(priority, tasks);
+}
+
 std::map<std::string, Node_Info> &DirectoryWatcher::getPaths() {
     std::lock_guard lg(paths_mutex);    // Lock in order to guarantee thread safe access to the map
     return paths;
 }
 
 Node_Info DirectoryWatcher::getNode(const std::string& path) {
-    return paths[path];
+    std::lock_guard lg(paths_mutex);    // Lock in order to guarantee thread safe access to the map
+    auto it = paths.find(path);
+    if (it == paths.end()) return {};   // Empty info if the node has been erased in the meantime
+    return it->second;
 }
 
 size_t DirectoryWatcher::node_size(boost::filesystem::directory_entry& element) {
@@ -59,28 +143,34 @@ size_t DirectoryWatcher::node_size(boost::filesystem::directory_entry& element)
 }
 
 std::string DirectoryWatcher::make_hash(boost::filesystem::directory_entry& element) {
-    unsigned char checksum[MD5_DIGEST_LENGTH];
-    MD5_CTX md5;
-    MD5_Init(&md5);
-    if (!boost::filesystem::is_directory(element) && node_size(element) != 0) {
-        std::ifstream file;
-        file.open(element.path().string(), std::ios::in|std::ios::binary);  // Opening the file that has to be hashed
-        file.seekg(0, std::ios::end);  // Finding the file length using seekg
-        file.seekg(0, std::ios::beg);
-        std::string buffer;
-        std::string str;
-        while (std::getline(file, str)) {
-            if (!str.empty()) buffer.append(str);   // Reading from the file into a buffer vector
+    static auto &hashed_bytes = Metrics::instance().counter("rab_hash_bytes_total");
+    static auto &hash_duration = Metrics::instance().histogram("rab_hash_seconds");
+    auto start = std::chrono::steady_clock::now();
+    std::optional<File_Stamp> stamp;
+    if (hashing && boost::filesystem::is_regular_file(element.symlink_status())) {    // Unchanged since a previous watcher read it
+        stamp = File_Stamp::read(element.path().string());
+        if (stamp) {
+            if (auto hash = hashing->cached(element.path().string(), *stamp)) return *hash;
         }
-        MD5_Update(&md5, buffer.data(), buffer.length());
+    }
+    Content_Hasher hasher;
+    if (boost::filesystem::is_symlink(element.symlink_status())) {     // Its content is the target, whichever element that is
+        std::string info = "link " + boost::filesystem::read_symlink(element.path()).string();
+        hasher.update_raw(info.data(), info.length());
+    } else if (!boost::filesystem::is_directory(element) && node_size(element) != 0) {
+        File_Reader file(element.path().string());    // The holes of a sparse file are hashed as zeros, only its data is read
+        hashed_bytes.add(hash_extents(file, file.size(), hasher, [this](size_t length) {
+            if (throttling.read_ops) throttling.read_ops->acquire(read_operations(length));     // Waiting for the read operations to be allowed
+            if (throttling.read_bytes) throttling.read_bytes->acquire(length);
+            return true;
+        }));
     } else {
         auto last_time_edit = boost::filesystem::last_write_time(element);
         std::string info = element.path().string() + std::to_string(last_time_edit) + std::to_string(node_size(element));
-        MD5_Update(&md5, info.data(), info.length());
+        hasher.update_raw(info.data(), info.length());
     }
-    MD5_Final(checksum, &md5);
-    std::ostringstream sout;
-    sout << std::hex << std::setfill('0');
-    for (auto c: checksum) sout << std::setw(2) <<(int) c;
-    return sout.str();
+    hash_duration.observe(seconds_since(start));
+    auto hash = hasher.final();
+    if (stamp && File_Stamp::read(element.path().string()) == stamp) hashing->remember(element.path().string(), *stamp, hash);    // Not when written while being read
+    return hash;
 }
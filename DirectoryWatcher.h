@@ -1,46 +1,83 @@
-#pragma once
-
-#include <boost/chrono.hpp>
-#include <boost/filesystem.hpp>
-#include <boost/thread.hpp>
-#include <openssl/md5.h>
-#include <iostream>
-#include <map>
-#include <string>
-#include "Headers.h"
-
-/// Struct for collecting information about files and directories
-struct Node_Info {
-    std::time_t lastEdit;
-    bool isFile;
-    std::string hash;
-};
-
-class DirectoryWatcher {
-    std::shared_ptr<bool> running_watcher;
-    std::string path_to_watch;
-    std::mutex paths_mutex;
-    boost::chrono::milliseconds delay;
-    std::map<std::string, Node_Info> paths;
-
-    /// Recursively calculates the size of a directory or a file
-    size_t node_size(boost::filesystem::directory_entry& element);
-
-    /// Calculates the hash of the node passed as input
-    std::string make_hash(boost::filesystem::directory_entry& element);
-
-public:
-
-    /// Keeps a record of files from the base directory and their info
-    DirectoryWatcher(std::string path_to_watch, boost::chrono::milliseconds delay, std::shared_ptr<bool> &watching);
-
-    /// Monitors "path_to_watch" for changes and in case of a change execute the user supplied "action" function
-    void start(const std::function<void (std::string, FileStatus, bool)>& action);
-
-    /// Gets the map containing the paths
-    std::map<std::string, Node_Info>& getPaths();
-
-    /// Gets the info about the single node given the path as input
-    Node_Info getNode(const std::string& path);
-
+#pragma once
+
+#include <boost/chrono.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <iostream>
+#include <map>
+#include <string>
+#include "Content_Hasher.h"
+#include "File_Metadata.h"
+#include "Hash_Pool.h"
+#include "Headers.h"
+#include "Ignore_Rules.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Rate_Limiter.h"
+
+/// Struct for collecting information about files and directories
+struct Node_Info {
+    std::time_t lastEdit;
+    bool isFile;        // Regular files and symbolic links, whose target travels with the metadata
+    std::string hash;
+    std::string metadata{};     // Record of its File_Metadata, sent apart from the content
+    int64_t mtime_ns = 0;       // A different time of last edit or size makes the element hashed again
+    uint64_t size = 0;
+};
+
+class DirectoryWatcher {
+    /// An element found by the walk, hashed before it is recorded
+    struct Pending_Hash {
+        boost::filesystem::directory_entry element;
+        File_Metadata metadata;
+        bool isFile;
+        FileStatus status;
+        std::string hash;   // Empty if the element could not be read, already set when only the metadata changed
+    };
+
+    std::shared_ptr<bool> running_watcher;
+    std::string path_to_watch;
+    std::mutex paths_mutex;
+    boost::chrono::milliseconds delay;
+    std::map<std::string, Node_Info> paths;
+    Throttling throttling;
+    Ignore_Rules rules;
+    std::shared_ptr<Hash_Pool> hashing;
+    int priority;
+
+    /// Whether the element the walk has reached is excluded by the rules, in which case a directory is not descended
+    bool skip(boost::filesystem::recursive_directory_iterator &it);
+
+    /// Hashes the elements found by a walk that have no hash yet, on the shared pool when there is one
+    void hash_batch(std::vector<Pending_Hash> &batch);
+
+    /// Gets the entry of the map for an element hashed by a walk
+    static Node_Info node_info(Pending_Hash &pending);
+
+    /// Recursively calculates the size of a directory or a file
+    size_t node_size(boost::filesystem::directory_entry& element);
+
+public:
+
+    /// Calculates the hash of the node passed as input
+    std::string make_hash(boost::filesystem::directory_entry& element);
+
+    /// Keeps a record of files from the base directory and their info, reading them at the pace allowed by the throttling;
+    /// the elements excluded by the rules are neither recorded nor hashed. The hashes are computed on the pool shared by
+    /// the roots of the client, with the given priority, or on the calling thread without a pool
+    DirectoryWatcher(std::string path_to_watch, boost::chrono::milliseconds delay, std::shared_ptr<bool> &watching, Throttling throttling = {},
+                     Ignore_Rules rules = {}, std::shared_ptr<Hash_Pool> hashing = nullptr, int priority = 0);
+
+    /// Monitors "path_to_watch" for changes and in case of a change execute the user supplied "action" function. The
+    /// metadata of every element is read with a single statx call: a changed time of last edit or size makes the element
+    /// hashed again, and if its hash did not change, or only its permissions, owner or attributes did, the change is
+    /// reported as a metadata one, which needs no upload
+    void start(const std::function<void (std::string, FileStatus, bool)>& action);
+
+    /// Gets the map containing the paths
+    std::map<std::string, Node_Info>& getPaths();
+
+    /// Gets the info about the single node given the path as input
+    Node_Info getNode(const std::string& path);
+
 };
\ No newline at end of file
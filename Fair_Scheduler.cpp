@@ -0,0 +1,113 @@
+#include "Fair_Scheduler.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+    auto &backlog_bytes = Metrics::instance().gauge("rab_scheduler_backlog_bytes");
+    auto &running_tasks = Metrics::instance().gauge("rab_scheduler_running_tasks");
+    auto &active_users = Metrics::instance().gauge("rab_scheduler_active_users");
+}
+
+Fair_Scheduler::Fair_Scheduler(size_t max_running) : max_running(std::max<size_t>(1, max_running)) {}
+
+std::shared_ptr<Fair_Scheduler::Flow> Fair_Scheduler::open(Dispatch dispatch) {
+    std::lock_guard lg(scheduler_mutex);
+    sessions++;
+    tenants[{}].sessions++;
+    return std::make_shared<Flow>(std::move(dispatch));
+}
+
+bool Fair_Scheduler::join(const std::shared_ptr<Flow> &flow, const std::string &user, size_t max_sessions) {
+    std::lock_guard lg(scheduler_mutex);
+    if (flow->user == user) return true;    // Logged in again on the same connection
+    auto &tenant = tenants[user];
+    if (max_sessions > 0 && tenant.sessions >= max_sessions) return false;
+    auto &previous = tenants[flow->user];
+    previous.sessions--;
+    bool ready = flow->ready;
+    if (ready) {    // Taking the queued tasks along
+        previous.ready.erase(std::find(previous.ready.begin(), previous.ready.end(), flow));
+        if (previous.ready.empty()) active.erase({previous.start, flow->user});
+        flow->ready = false;
+    }
+    flow->user = user;
+    tenant.sessions++;
+    if (ready) make_ready(flow);
+    return true;
+}
+
+void Fair_Scheduler::close(const std::shared_ptr<Flow> &flow) {
+    std::lock_guard lg(scheduler_mutex);
+    sessions--;
+    auto it = tenants.find(flow->user);
+    if (it == tenants.end()) return;
+    it->second.sessions--;
+    if (it->second.sessions == 0 && it->second.ready.empty() && !it->first.empty()) tenants.erase(it);
+}
+
+void Fair_Scheduler::submit(const std::shared_ptr<Flow> &flow, uint64_t cost, std::function<void()> task) {
+    std::unique_lock ul(scheduler_mutex);
+    flow->tasks.emplace_back(cost + task_overhead, std::move(task));
+    queued += cost + task_overhead;
+    if (!flow->running && !flow->ready) make_ready(flow);
+    dispatch_next(ul);
+}
+
+void Fair_Scheduler::make_ready(const std::shared_ptr<Flow> &flow) {
+    auto &tenant = tenants[flow->user];
+    if (tenant.ready.empty()) {     // An idle user starts from the current virtual time, idling earns no credit
+        tenant.start = std::max(tenant.start, now);
+        active.insert({tenant.start, flow->user});
+    }
+    tenant.ready.push_back(flow);
+    flow->ready = true;
+}
+
+void Fair_Scheduler::dispatch_next(std::unique_lock<std::mutex> &lock) {
+    std::vector<std::pair<std::shared_ptr<Flow>, std::function<void()>>> started;
+    while (running < max_running && !active.empty()) {
+        auto [start, user] = *active.begin();   // The user whose next task starts first in virtual time
+        active.erase(active.begin());
+        auto &tenant = tenants[user];
+        auto flow = std::move(tenant.ready.front());    // Its sessions take turns
+        tenant.ready.pop_front();
+        flow->ready = false;
+        flow->running = true;
+        auto [cost, task] = std::move(flow->tasks.front());
+        flow->tasks.pop_front();
+        queued -= cost;
+        now = start;
+        tenant.start = start + cost;
+        if (!tenant.ready.empty()) active.insert({tenant.start, user});
+        running++;
+        started.emplace_back(std::move(flow), std::move(task));
+    }
+    backlog_bytes.set(static_cast<double>(queued));
+    running_tasks.set(static_cast<double>(running));
+    active_users.set(static_cast<double>(active.size()));
+    lock.unlock();
+    for (auto &[flow, task] : started) {
+        flow->dispatch([self = shared_from_this(), flow = flow, task = std::move(task)]() {
+            task();
+            self->finished(flow);
+        });
+    }
+}
+
+void Fair_Scheduler::finished(const std::shared_ptr<Flow> &flow) {
+    std::unique_lock ul(scheduler_mutex);
+    running--;
+    flow->running = false;
+    if (!flow->tasks.empty()) make_ready(flow);
+    dispatch_next(ul);
+}
+
+size_t Fair_Scheduler::session_count() {
+    std::lock_guard lg(scheduler_mutex);
+    return sessions;
+}
+
+uint64_t Fair_Scheduler::backlog() {
+    std::lock_guard lg(scheduler_mutex);
+    return queued;
+}
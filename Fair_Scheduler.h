@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include "Metrics.h"
+
+/// Shares the worker pool among the users instead of among the requests: the work of every session is queued in a flow,
+/// and the flows are served by start time fair queuing on the bytes they handle, so that a user sending gigabytes gets
+/// the same share as one sending a few small files, whatever the number of sessions each of them opened. The tasks of a
+/// flow run one at a time and in order, at most a fixed number of tasks run at once. The scheduler also counts the
+/// sessions, of every user and overall, for the admission control
+class Fair_Scheduler : public std::enable_shared_from_this<Fair_Scheduler> {
+public:
+
+    /// Runs a task on the executor of a session
+    using Dispatch = std::function<void(std::function<void()>)>;
+
+    /// The queue of a session, owned by it
+    class Flow {
+        friend class Fair_Scheduler;
+        Dispatch dispatch;
+        std::string user;       // Empty until the login of the session is granted
+        std::deque<std::pair<uint64_t, std::function<void()>>> tasks;   // Cost in bytes and work of the tasks waiting
+        bool running = false;   // A task of the flow is on the executor
+        bool ready = false;     // Waiting in the ready flows of its user
+
+    public:
+        explicit Flow(Dispatch dispatch) : dispatch(std::move(dispatch)) {}
+    };
+
+private:
+
+    /// The flows of a user, served in turn
+    struct Tenant {
+        std::deque<std::shared_ptr<Flow>> ready;    // Flows with a task to run and none running
+        uint64_t start = 0;     // Virtual time at which the next task of the user starts
+        size_t sessions = 0;
+    };
+
+    size_t max_running;
+    size_t running = 0;
+    size_t sessions = 0;
+    uint64_t queued = 0;    // Cost of the tasks waiting
+    uint64_t now = 0;       // Virtual time of the last task started
+    std::map<std::string, Tenant> tenants;
+    std::set<std::pair<uint64_t, std::string>> active;     // Users with ready flows, by virtual start time
+    std::mutex scheduler_mutex;
+
+    /// Adds a flow with tasks and none running to the ready ones of its user
+    void make_ready(const std::shared_ptr<Flow> &flow);
+
+    /// Starts the next tasks while there are free slots, handing them out of the lock
+    void dispatch_next(std::unique_lock<std::mutex> &lock);
+
+    /// Ends a task, making its flow ready again if more work is waiting
+    void finished(const std::shared_ptr<Flow> &flow);
+
+public:
+
+    /// Fixed cost added to every task, so that the small requests are not free
+    static constexpr uint64_t task_overhead = 4096;
+
+    /// Runs at most max_running tasks at once, usually the number of workers
+    explicit Fair_Scheduler(size_t max_running);
+
+    Fair_Scheduler(const Fair_Scheduler&) = delete;
+    Fair_Scheduler& operator=(const Fair_Scheduler&) = delete;
+
+    /// Creates the flow of a new session, anonymous until it joins its user
+    std::shared_ptr<Flow> open(Dispatch dispatch);
+
+    /// Moves the flow of a session to its user once logged in, the queued tasks included; returns false, leaving the
+    /// flow anonymous, if the user already has max_sessions sessions
+    bool join(const std::shared_ptr<Flow> &flow, const std::string &user, size_t max_sessions);
+
+    /// Forgets the session of a flow, its tasks still run
+    void close(const std::shared_ptr<Flow> &flow);
+
+    /// Queues a task of a flow, cost being the bytes it handles
+    void submit(const std::shared_ptr<Flow> &flow, uint64_t cost, std::function<void()> task);
+
+    /// Gets the number of sessions
+    size_t session_count();
+
+    /// Gets the cost of the tasks waiting for a slot
+    uint64_t backlog();
+};
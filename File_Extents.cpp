@@ -0,0 +1,59 @@
+#include "File_Extents.h"
+#include <algorithm>
+#include <cerrno>
+#include <ios>
+#include <unistd.h>
+
+namespace {
+    /// Gets the first offset from the given one where whence (SEEK_DATA or SEEK_HOLE) is found, size if there is none
+    uint64_t seek(int fd, uint64_t offset, uint64_t size, int whence) {
+        if (offset >= size) return size;
+        off_t found = ::lseek(fd, static_cast<off_t>(offset), whence);
+        if (found < 0) return errno == ENXIO || whence == SEEK_HOLE ? size : offset;   // ENXIO: no data up to the end
+        return std::min(static_cast<uint64_t>(found), size);
+    }
+}
+
+Extent next_extent(int fd, uint64_t offset, uint64_t size, uint64_t limit) {
+    Extent extent;
+    if (offset >= size) return extent;
+    uint64_t start = seek(fd, offset, size, SEEK_DATA);
+    if (start - offset >= min_hole || start == size) {
+        extent.hole = start - offset;
+        offset = start;
+    }
+    uint64_t end = std::min(size, offset + limit);
+    for (uint64_t position = offset; position < end;) {     // Going through the short holes, up to a long one
+        uint64_t hole = seek(fd, position, size, SEEK_HOLE);
+        if (hole >= end) break;
+        uint64_t data = seek(fd, hole, size, SEEK_DATA);
+        if (data - hole >= min_hole || data == size) {
+            end = hole;
+            break;
+        }
+        position = data;
+    }
+    extent.data = end - offset;
+    return extent;
+}
+
+uint64_t hash_extents(File_Reader &file, uint64_t length, Content_Hasher &hasher, const std::function<bool(size_t)> &gate) {
+    uint64_t offset = 0;
+    uint64_t read_bytes = 0;
+    while (offset < length) {
+        Extent extent = next_extent(file.descriptor(), offset, length, length - offset);
+        hasher.update_zeros(extent.hole);
+        offset += extent.hole;
+        for (uint64_t end = offset + extent.data; offset < end;) {
+            size_t wanted = static_cast<size_t>(std::min<uint64_t>(read_window, end - offset));
+            if (gate && !gate(wanted)) return read_bytes;
+            auto data = file.read(offset, wanted);     // In place when the file is mapped
+            if (data.empty()) return read_bytes;    // Shorter than length, the hash does not match and the file is read again
+            hasher.update(data.data(), data.size());
+            offset += data.size();
+            read_bytes += data.size();
+        }
+    }
+    if (file.truncated()) throw std::ios_base::failure("File truncated while it was hashed");
+    return read_bytes;
+}
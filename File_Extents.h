@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "Content_Hasher.h"
+#include "File_Reader.h"
+
+/// A run of a file from a given offset: a hole, which reads as zeros without taking room on the disk, then data
+struct Extent {
+    uint64_t hole = 0;
+    uint64_t data = 0;
+};
+
+/// Holes shorter than this are handled like data, skipping them would only split the reads and the messages
+constexpr uint64_t min_hole = 64 << 10;
+
+/// Size of the read operation the iops limits count, a larger read counts as several of them
+constexpr uint64_t read_op_size = 64 << 10;
+
+/// Gets the read operations a read of length bytes counts as
+inline double read_operations(size_t length) {
+    return static_cast<double>((length + read_op_size - 1) / read_op_size);
+}
+
+/// Gets the extent of the file starting at offset, its data limited to limit bytes and ending before the next hole;
+/// the file is size bytes long. File systems that do not report holes show the whole file as data
+Extent next_extent(int fd, uint64_t offset, uint64_t size, uint64_t limit);
+
+/// Hashes the first length bytes of the file, the holes as the zeros they read as, without reading them. The gate is
+/// called with the size of every read, read_window bytes at most, before it is made, returning false stops the hashing;
+/// returns the bytes read from the disk, throws std::ios_base::failure if a read fails or the file is truncated meanwhile
+uint64_t hash_extents(File_Reader &file, uint64_t length, Content_Hasher &hasher, const std::function<bool(size_t)> &gate = {});
@@ -0,0 +1,139 @@
+#include "File_Metadata.h"
+#include <algorithm>
+#include <charconv>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include "Base64/base64.h"
+
+namespace {
+    std::string encode_field(const std::string &value) {
+        return base64_encode(reinterpret_cast<const BYTE*>(value.data()), static_cast<unsigned int>(value.size()));
+    }
+
+    std::string decode_field(std::string_view field) {
+        auto bytes = base64_decode(std::string(field));
+        return {bytes.begin(), bytes.end()};
+    }
+
+    template <typename Number>
+    Number parse(std::string_view field) {
+        Number value{};
+        auto [end, ec] = std::from_chars(field.data(), field.data() + field.size(), value);
+        if (ec != std::errc() || end != field.data() + field.size()) throw std::invalid_argument("Malformed metadata record");
+        return value;
+    }
+
+    /// Reads the extended attributes of path without following a link, none where the file system has no support
+    std::vector<std::pair<std::string, std::string>> read_xattrs(const std::string &path) {
+        std::vector<std::pair<std::string, std::string>> xattrs;
+        ssize_t length = ::llistxattr(path.c_str(), nullptr, 0);
+        if (length <= 0) return xattrs;
+        std::string names(static_cast<size_t>(length), '\0');
+        length = ::llistxattr(path.c_str(), names.data(), names.size());
+        if (length <= 0) return xattrs;
+        names.resize(length);
+        for (size_t start = 0; start < names.size();) {
+            size_t end = names.find('\0', start);
+            if (end == std::string::npos) end = names.size();
+            std::string name = names.substr(start, end - start);
+            start = end + 1;
+            ssize_t size = ::lgetxattr(path.c_str(), name.c_str(), nullptr, 0);
+            if (size < 0) continue;
+            std::string value(static_cast<size_t>(size), '\0');
+            size = ::lgetxattr(path.c_str(), name.c_str(), value.data(), value.size());
+            if (size < 0) continue;
+            value.resize(size);
+            xattrs.emplace_back(std::move(name), std::move(value));
+        }
+        std::sort(xattrs.begin(), xattrs.end());
+        return xattrs;
+    }
+}
+
+std::optional<File_Metadata> File_Metadata::read(const std::string &path) {
+    struct statx info{};
+    if (::statx(AT_FDCWD, path.c_str(), AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_MTIME | STATX_SIZE, &info) != 0)
+        return std::nullopt;
+    File_Metadata metadata;
+    metadata.mode = info.stx_mode;
+    metadata.uid = info.stx_uid;
+    metadata.gid = info.stx_gid;
+    metadata.mtime_ns = static_cast<int64_t>(info.stx_mtime.tv_sec) * 1000000000 + info.stx_mtime.tv_nsec;
+    metadata.size = info.stx_size;
+    if (metadata.is_link()) {
+        std::string target(info.stx_size + 1, '\0');   // The size of a link is the length of its target
+        ssize_t length = ::readlink(path.c_str(), target.data(), target.size());
+        if (length < 0) return std::nullopt;
+        target.resize(length);
+        metadata.link = std::move(target);
+    }
+    metadata.xattrs = read_xattrs(path);
+    return metadata;
+}
+
+std::string File_Metadata::encode() const {
+    std::string record = std::to_string(mode) + ' ' + std::to_string(uid) + ' ' + std::to_string(gid) + ' ' + std::to_string(mtime_ns);
+    if (!link.empty()) record.append(" l").append(encode_field(link));
+    for (auto &[name, value] : xattrs) record.append(" x").append(encode_field(name)).append(":").append(encode_field(value));
+    return record;
+}
+
+File_Metadata File_Metadata::decode(std::string_view record) {
+    std::vector<std::string_view> fields;
+    for (size_t start = 0; start <= record.size();) {
+        size_t end = std::min(record.find(' ', start), record.size());
+        fields.push_back(record.substr(start, end - start));
+        start = end + 1;
+    }
+    if (fields.size() < 4) throw std::invalid_argument("Malformed metadata record");
+    File_Metadata metadata;
+    metadata.mode = parse<uint32_t>(fields[0]);
+    metadata.uid = parse<uint32_t>(fields[1]);
+    metadata.gid = parse<uint32_t>(fields[2]);
+    metadata.mtime_ns = parse<int64_t>(fields[3]);
+    for (size_t i = 4; i < fields.size(); i++) {
+        auto field = fields[i];
+        if (field.size() > 1 && field[0] == 'l') {
+            metadata.link = decode_field(field.substr(1));
+        } else if (auto colon = field.find(':'); field.size() > 1 && field[0] == 'x' && colon != std::string_view::npos) {
+            metadata.xattrs.emplace_back(decode_field(field.substr(1, colon - 1)), decode_field(field.substr(colon + 1)));
+        } else {
+            throw std::invalid_argument("Malformed metadata record");
+        }
+    }
+    return metadata;
+}
+
+bool File_Metadata::apply(const std::string &path, bool ownership) const {
+    bool ok = true;
+    if (is_link()) {
+        std::string current(link.size() + 1, '\0');
+        ssize_t length = ::readlink(path.c_str(), current.data(), current.size());
+        if (length < 0 || current.compare(0, length, link) != 0 || static_cast<size_t>(length) != link.size()) {
+            ::unlink(path.c_str());     // The element restored in its place, if any
+            ok = ::symlink(link.c_str(), path.c_str()) == 0;
+        }
+    }
+    for (auto &[name, value] : xattrs)
+        ok &= ::lsetxattr(path.c_str(), name.c_str(), value.data(), value.size(), 0) == 0;
+    if (ownership) ok &= ::lchown(path.c_str(), uid, gid) == 0;
+    if (!is_link()) ok &= ::chmod(path.c_str(), mode & 07777) == 0;     // After the ownership, which clears the set-id bits
+    timespec times[2] = {{0, UTIME_OMIT}, {mtime_ns / 1000000000, mtime_ns % 1000000000}};
+    ok &= ::utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW) == 0;
+    return ok;
+}
+
+bool File_Metadata::is_link() const {
+    return S_ISLNK(mode);
+}
+
+bool File_Metadata::is_directory() const {
+    return S_ISDIR(mode);
+}
+
+std::time_t File_Metadata::last_edit() const {
+    return static_cast<std::time_t>(mtime_ns / 1000000000);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/// Metadata of an element besides its content, read with a single statx call plus its extended attributes, so that a
+/// restored tree matches the original one. It travels as a compact record of a single line
+struct File_Metadata {
+    uint32_t mode = 0;      // Type and permission bits
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    int64_t mtime_ns = 0;   // Time of last edit, in nanoseconds since the epoch
+    uint64_t size = 0;      // Not part of the record, it tells the content changes apart
+    std::string link;       // Target of a symbolic link
+    std::vector<std::pair<std::string, std::string>> xattrs;    // Extended attributes, sorted by name
+
+    /// Reads the metadata of path, without following a symbolic link; nullopt if it does not exist any more
+    static std::optional<File_Metadata> read(const std::string &path);
+
+    /// Encodes everything but the size as space separated fields: mode, uid, gid and time of last edit in decimal,
+    /// then the link target and the extended attributes in base64
+    std::string encode() const;
+
+    /// Decodes a record, throws std::invalid_argument if it is malformed
+    static File_Metadata decode(std::string_view record);
+
+    /// Applies the metadata to path: a symbolic link takes the place of the element, then come the extended attributes,
+    /// the ownership when asked for, the permissions and the time of last edit; returns false if any of them failed
+    bool apply(const std::string &path, bool ownership) const;
+
+    bool is_link() const;
+
+    bool is_directory() const;
+
+    /// Gets the time of last edit in seconds, as the watcher compares it
+    std::time_t last_edit() const;
+};
@@ -0,0 +1,152 @@
+#include "File_Reader.h"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <ios>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    /// A file mapping that may be truncated under the reader
+    struct Mapped_Range {
+        std::atomic<bool> used{false};
+        std::atomic<uintptr_t> start{0};
+        std::atomic<uintptr_t> end{0};
+        std::atomic<bool> truncated{false};
+    };
+
+    std::array<Mapped_Range, 64> mapped_ranges;     // Files beyond these are read by pread
+    const uintptr_t page_size = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+    struct sigaction previous_handler{};
+    std::once_flag handler_installed;
+
+    /// Maps zeros over the rest of a mapping whose file was truncated, so that the read goes on; faults out of the
+    /// mappings go to the previous handler, by faulting again once it is restored
+    void on_bus_error(int, siginfo_t *info, void *) {
+        auto address = reinterpret_cast<uintptr_t>(info->si_addr);
+        for (auto &range : mapped_ranges) {
+            uintptr_t start = range.start.load(), end = range.end.load();
+            if (start == 0 || address < start || address >= end) continue;
+            uintptr_t page = address & ~(page_size - 1);
+            if (::mmap(reinterpret_cast<void *>(page), end - page, PROT_READ, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) break;
+            range.truncated = true;
+            return;
+        }
+        ::sigaction(SIGBUS, &previous_handler, nullptr);
+    }
+
+    /// Takes a free entry of the ranges known to the handler for a mapping, -1 if there is none
+    int register_mapping(const char *mapping, uint64_t length) {
+        std::call_once(handler_installed, []() {
+            struct sigaction handler{};
+            handler.sa_sigaction = on_bus_error;
+            handler.sa_flags = SA_SIGINFO;
+            sigemptyset(&handler.sa_mask);
+            ::sigaction(SIGBUS, &handler, &previous_handler);
+        });
+        for (size_t i = 0; i < mapped_ranges.size(); i++) {
+            bool expected = false;
+            if (!mapped_ranges[i].used.compare_exchange_strong(expected, true)) continue;
+            mapped_ranges[i].truncated = false;
+            mapped_ranges[i].end = reinterpret_cast<uintptr_t>(mapping) + length;
+            mapped_ranges[i].start = reinterpret_cast<uintptr_t>(mapping);
+            return static_cast<int>(i);
+        }
+        return -1;
+    }
+}
+
+File_Reader::File_Reader(const std::string &path) {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+    if (fd < 0 && errno == EPERM) fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);     // Not the owner of the file
+    struct stat info{};
+    if (fd < 0 || ::fstat(fd, &info) != 0) {
+        if (fd >= 0) ::close(fd);
+        throw std::ios_base::failure("Unable to open " + path);
+    }
+    length = static_cast<uint64_t>(info.st_size);
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);   // Read ahead one window at a time instead, see read
+    if (length == 0 || length > max_mapped) return;
+    void *address = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) return;
+    slot = register_mapping(static_cast<char *>(address), length);
+    if (slot < 0) {     // Too many files mapped at once
+        ::munmap(address, length);
+        return;
+    }
+    mapping = static_cast<char *>(address);
+    ::madvise(mapping, length, MADV_RANDOM);
+}
+
+File_Reader::~File_Reader() {
+    release();
+    if (mapping) {
+        auto &range = mapped_ranges[slot];
+        range.start = 0;
+        range.end = 0;
+        ::munmap(mapping, length);
+        range.used = false;
+    }
+    ::close(fd);
+}
+
+std::string_view File_Reader::read(uint64_t offset, size_t size) {
+    release();
+    if (offset >= length) return {};
+    size = static_cast<size_t>(std::min<uint64_t>(size, length - offset));
+    bool was_cached = cached(offset, size);     // Before the window is read ahead, so that it tells whose pages they are
+    ::posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(size), POSIX_FADV_WILLNEED);
+    std::string_view view;
+    if (mapping) {
+        view = std::string_view(mapping + offset, size);
+    } else {
+        buffer.resize(size);
+        size_t got = 0;
+        while (got < size) {
+            ssize_t result = ::pread(fd, buffer.data() + got, size - got, static_cast<off_t>(offset + got));
+            if (result < 0 && errno == EINTR) continue;
+            if (result < 0) throw std::ios_base::failure("Unable to read the file");
+            if (result == 0) {
+                short_read = true;
+                break;
+            }
+            got += static_cast<size_t>(result);
+        }
+        view = std::string_view(buffer.data(), got);
+    }
+    if (!was_cached) {
+        cold_offset = offset;
+        cold_length = size;
+    }
+    return view;
+}
+
+bool File_Reader::truncated() const {
+    return short_read || (mapping && mapped_ranges[slot].truncated);
+}
+
+bool File_Reader::cached(uint64_t offset, uint64_t size) const {
+    uint64_t first = offset & ~static_cast<uint64_t>(page_size - 1);
+    size_t span = static_cast<size_t>(offset + size - first);
+    std::vector<unsigned char> pages((span + page_size - 1) / page_size);
+    void *window = mapping ? mapping + first : ::mmap(nullptr, span, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(first));
+    if (window == MAP_FAILED) return true;      // Left in the cache when unsure
+    bool resident = ::mincore(window, span, pages.data()) != 0;
+    for (size_t i = 0; i < pages.size() && !resident; i++) resident = pages[i] & 1u;
+    if (!mapping) ::munmap(window, span);
+    return resident;
+}
+
+void File_Reader::release() {
+    if (cold_length == 0) return;
+    if (mapping) {      // The pages mapped by this reader are not dropped from the cache while they are mapped
+        uint64_t first = cold_offset & ~static_cast<uint64_t>(page_size - 1);
+        ::madvise(mapping + first, static_cast<size_t>(cold_offset + cold_length - first), MADV_DONTNEED);
+    }
+    ::posix_fadvise(fd, static_cast<off_t>(cold_offset), static_cast<off_t>(cold_length), POSIX_FADV_DONTNEED);
+    cold_length = 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Bytes a reader is asked for at once by the hashing, and the unit of its throttling
+constexpr size_t read_window = 1 << 20;
+
+/// Read access to a file, shared by its hashing and its sending. Files up to max_mapped bytes are mapped and read in
+/// place, larger ones by large preads into a buffer. The kernel reads ahead exactly the window asked for, rather than
+/// guessing past it, and every window that was not in the page cache before it was read is dropped from it once
+/// consumed, so that a backup does not evict the pages of the applications of the host. A mapped file truncated while
+/// it is read shows zeros past its new end, instead of raising SIGBUS, and truncated() reports it
+class File_Reader {
+    int fd = -1;
+    uint64_t length = 0;
+    char *mapping = nullptr;
+    int slot = -1;              // Of the mapping among the ones known to the SIGBUS handler
+    std::vector<char> buffer;   // Read by pread when the file is not mapped
+    bool short_read = false;
+    uint64_t cold_offset = 0;   // Window read last, dropped at the next read if this reader brought it into the cache
+    uint64_t cold_length = 0;
+
+    /// Whether any page of the range is in the page cache
+    bool cached(uint64_t offset, uint64_t size) const;
+
+    /// Drops the window read last from the page cache, if it was not cached before
+    void release();
+
+public:
+
+    /// Files larger than this are read by pread rather than mapped
+    static constexpr uint64_t max_mapped = uint64_t(1) << 30;
+
+    /// Opens the file without updating its time of last access, throws std::ios_base::failure if it can not be opened
+    explicit File_Reader(const std::string &path);
+
+    File_Reader(const File_Reader &) = delete;
+    File_Reader &operator=(const File_Reader &) = delete;
+
+    ~File_Reader();
+
+    /// Gets the descriptor of the file, for the calls that look for its holes
+    int descriptor() const {return fd;}
+
+    /// Gets the size of the file when it was opened
+    uint64_t size() const {return length;}
+
+    /// Gets up to size bytes at offset, fewer at the end of the file; the view is valid until the next read. Throws
+    /// std::ios_base::failure if the read fails
+    std::string_view read(uint64_t offset, size_t size);
+
+    /// Whether the file turned out shorter than when it was opened, in which case the bytes past its end were not read
+    bool truncated() const;
+};
@@ -0,0 +1,85 @@
+#include "File_Snapshot.h"
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Metrics.h"
+
+namespace {
+    auto &clones = Metrics::instance().counter("rab_snapshots_total{kind=\"clone\"}");
+    auto &copies = Metrics::instance().counter("rab_snapshots_total{kind=\"copy\"}");
+
+    /// Copies the file, holes included, and tells whether it stayed the same meanwhile
+    bool copy_unchanged(int source, int target) {
+        auto before = file_version(source);
+        if (before.second > max_snapshot_copy) return false;
+        for (uint64_t offset = 0; offset < before.second;) {
+            Extent extent = next_extent(source, offset, before.second, before.second - offset);
+            offset += extent.hole;
+            for (uint64_t end = offset + extent.data; offset < end;) {
+                auto from = static_cast<off_t>(offset), to = static_cast<off_t>(offset);
+                ssize_t copied = ::copy_file_range(source, &from, target, &to, static_cast<size_t>(end - offset), 0);
+                if (copied <= 0) return false;
+                offset += static_cast<uint64_t>(copied);
+            }
+        }
+        return ::ftruncate(target, static_cast<off_t>(before.second)) == 0 && file_version(source) == before;
+    }
+}
+
+std::pair<int64_t, uint64_t> file_version(int fd) {
+    struct stat info{};
+    if (::fstat(fd, &info) != 0) return {-1, 0};
+    return {static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec, static_cast<uint64_t>(info.st_size)};
+}
+
+Extent read_unchanged(File_Reader &file, uint64_t offset, uint64_t limit, std::optional<std::pair<int64_t, uint64_t>> hashed,
+                      const std::function<void(const Extent &, std::string_view)> &consume) {
+    auto version = file_version(file.descriptor());
+    if (hashed && version != *hashed) throw File_Changed("File written since it was hashed");
+    Extent extent = next_extent(file.descriptor(), offset, file.size(), limit);
+    std::string_view data;
+    if (extent.data > 0) data = file.read(offset + extent.hole, extent.data);
+    consume(extent, data);
+    if (hashed && (file.truncated() || file_version(file.descriptor()) != version)) throw File_Changed("File written while it was read");
+    return extent;
+}
+
+std::shared_ptr<File_Snapshot> File_Snapshot::take(const std::string &path, const std::function<bool(size_t)> &gate) {
+    int source = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source < 0) return nullptr;
+    std::shared_ptr<File_Snapshot> snapshot(new File_Snapshot());
+    auto directory = boost::filesystem::path(path).parent_path().string();
+    snapshot->fd = ::open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    bool ok = snapshot->fd >= 0;
+    if (ok && ::ioctl(snapshot->fd, FICLONE, source) == 0) {    // Atomic, the writers only wait for the extents to be shared
+        clones.add();
+    } else if (ok && copy_unchanged(source, snapshot->fd)) {
+        copies.add();
+    } else {
+        ok = false;
+    }
+    ::close(source);
+    if (!ok) return nullptr;
+    try {
+        File_Reader file(snapshot->path());
+        if (file.size() == 0) return nullptr;     // Empty files are hashed by their metadata, they are sent as they are
+        Content_Hasher hasher;
+        hash_extents(file, file.size(), hasher, gate);
+        snapshot->content_hash = hasher.final();
+        snapshot->length = file.size();
+    } catch (const std::ios_base::failure &) {
+        return nullptr;
+    }
+    return snapshot;
+}
+
+File_Snapshot::~File_Snapshot() {
+    if (fd >= 0) ::close(fd);
+}
+
+std::string File_Snapshot::path() const {
+    return "/proc/self/fd/" + std::to_string(fd);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "File_Extents.h"
+
+/// Changing files up to this size are copied where they can not be cloned
+constexpr uint64_t max_snapshot_copy = 64 << 20;
+
+/// Thrown when a file changes while it is read for an upload, so that its content matches neither the hash sent with it
+/// nor the file as it ends up
+struct File_Changed : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+/// Point in time copy of a file that keeps changing, uploaded in its place. It is an unnamed file of the directory of
+/// the original, so on the same file system and never seen by the watcher, which shares the extents of the original
+/// through a reflink: taking it costs no copy and writers are not stopped. Where reflinks are not supported, small
+/// files are copied instead, and the copy is kept only if the file did not change meanwhile. It is removed once closed
+class File_Snapshot {
+    int fd = -1;
+    std::string content_hash;
+    uint64_t length = 0;
+
+    File_Snapshot() = default;
+
+public:
+
+    /// Takes a snapshot of path and hashes it, calling the gate before every read as hash_extents does; nullptr if the
+    /// file can be neither cloned nor copied unchanged
+    static std::shared_ptr<File_Snapshot> take(const std::string &path, const std::function<bool(size_t)> &gate = {});
+
+    File_Snapshot(const File_Snapshot &) = delete;
+    File_Snapshot &operator=(const File_Snapshot &) = delete;
+
+    ~File_Snapshot();
+
+    /// Gets a path the snapshot can be opened with, as long as it exists
+    std::string path() const;
+
+    const std::string &hash() const {return content_hash;}
+
+    uint64_t size() const {return length;}
+};
+
+/// Gets the time of last edit of an open file in nanoseconds since the epoch, as File_Metadata reads it, and its size;
+/// a change of either tells that the file was written
+std::pair<int64_t, uint64_t> file_version(int fd);
+
+/// Reads the extent of the file at offset, its data limited to limit bytes, and hands it to consume, the data in place
+/// when the file is mapped. Throws File_Changed if the file differs from the hashed version before the read, or is
+/// written before consume returns; a snapshot, which never changes, is read without the checks. Returns the extent
+Extent read_unchanged(File_Reader &file, uint64_t offset, uint64_t limit, std::optional<std::pair<int64_t, uint64_t>> hashed,
+                      const std::function<void(const Extent &, std::string_view)> &consume);
@@ -0,0 +1,161 @@
+#include "Hash_Pool.h"
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include "Logger.h"
+#include "Metrics.h"
+
+namespace {
+    auto &cache_hits = Metrics::instance().counter("rab_hash_cache_hits_total");
+    auto &queued_hashes = Metrics::instance().gauge("rab_hash_queue_depth");
+
+    constexpr const char *state_header = "rab-hashes 2";    // The state files of the earlier format are not read, their hashes are computed again
+}
+
+std::optional<File_Stamp> File_Stamp::read(const std::string &path) {
+    struct stat info{};
+    if (::stat(path.c_str(), &info) != 0) return std::nullopt;
+    return File_Stamp{static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec, static_cast<uint64_t>(info.st_size), info.st_ino};
+}
+
+Hash_Pool::Hash_Pool(unsigned count, std::string state_file, std::chrono::seconds save_interval)
+        : state_file(std::move(state_file)), save_interval(save_interval) {
+    load();
+    if (count == 0) count = std::max(1u, boost::thread::hardware_concurrency());
+    for (unsigned i = 0; i < count; i++) {
+        threads.emplace_back([this]() {
+            while (true) {
+                std::function<void()> work;
+                {
+                    std::unique_lock ul(pool_mutex);
+                    pool_cv.wait(ul, [this]() {return stopping || !tasks.empty();});
+                    if (tasks.empty()) return;      // Stopping once the queue is drained
+                    work = std::move(const_cast<Task&>(tasks.top()).work);
+                    tasks.pop();
+                    queued_hashes.add(-1);
+                }
+                work();
+            }
+        });
+    }
+}
+
+Hash_Pool::~Hash_Pool() {
+    {
+        std::lock_guard lg(pool_mutex);
+        stopping = true;
+    }
+    pool_cv.notify_all();
+    for (auto &thread : threads) thread.join();
+    try {
+        save();
+    } catch (const std::exception &err) {
+        Logger::log(Log_Level::error, std::string("Unable to save the state: ") + err.what());
+    }
+}
+
+void Hash_Pool::run(int priority, std::vector<std::function<void()>> &batch) {
+    if (batch.empty()) return;
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    size_t remaining = batch.size();
+    {
+        std::lock_guard lg(pool_mutex);
+        for (auto &work : batch) {
+            tasks.push({priority, submitted++, [&work, &done_mutex, &done_cv, &remaining]() {
+                work();
+                std::lock_guard done_lg(done_mutex);
+                if (--remaining == 0) done_cv.notify_one();
+            }});
+        }
+        queued_hashes.add(static_cast<double>(batch.size()));
+    }
+    pool_cv.notify_all();
+    std::unique_lock ul(done_mutex);
+    done_cv.wait(ul, [&remaining]() {return remaining == 0;});
+}
+
+std::optional<std::string> Hash_Pool::cached(const std::string &path, const File_Stamp &stamp) {
+    std::lock_guard lg(cache_mutex);
+    auto it = cache.find(path);
+    if (it == cache.end() || it->second.stamp != stamp) return std::nullopt;
+    cache_hits.add();
+    return it->second.hash;
+}
+
+void Hash_Pool::remember(const std::string &path, const File_Stamp &stamp, std::string hash) {
+    std::lock_guard lg(cache_mutex);
+    cache[path] = {stamp, std::move(hash)};
+    dirty = true;
+}
+
+void Hash_Pool::forget(const std::string &path) {
+    std::lock_guard lg(cache_mutex);
+    dirty |= cache.erase(path) > 0;
+}
+
+void Hash_Pool::load() {
+    if (state_file.empty()) return;
+    std::ifstream in(state_file);
+    std::string line;
+    if (std::getline(in, line) && line != state_header) {
+        Logger::log(Log_Level::info, "State file " + state_file + " has an earlier format, the files are hashed again");
+        return;
+    }
+    while (std::getline(in, line)) {    // Every line holds the stamp, the hash and the path
+        std::istringstream fields(line);
+        Cached_Hash entry;
+        std::string path;
+        if (!(fields >> entry.stamp.mtime_ns >> entry.stamp.size >> entry.stamp.ino >> entry.hash) || fields.get() != ' ' || !std::getline(fields, path))
+            continue;
+        cache[path] = std::move(entry);
+    }
+    if (!cache.empty()) Logger::log(Log_Level::info, "Loaded " + std::to_string(cache.size()) + " hashes from " + state_file);
+}
+
+void Hash_Pool::save_if_due() {
+    if (state_file.empty()) return;
+    {
+        std::lock_guard lg(cache_mutex);
+        if (!dirty || std::chrono::steady_clock::now() - last_save < save_interval) return;
+    }
+    try {
+        save();
+    } catch (const std::exception &err) {     // A full disk must not stop the watcher, the save is tried again later
+        Logger::log(Log_Level::warning, std::string("Unable to save the state: ") + err.what());
+    }
+}
+
+void Hash_Pool::save() {
+    if (state_file.empty()) return;
+    std::lock_guard save_lg(save_mutex);    // One writer of the file at once
+    std::vector<std::pair<std::string, Cached_Hash>> entries;
+    {
+        std::lock_guard lg(cache_mutex);    // Copied so that the hashing is not held up by the writing
+        last_save = std::chrono::steady_clock::now();
+        if (!dirty) return;
+        dirty = false;
+        entries.assign(cache.begin(), cache.end());
+    }
+    try {
+        std::string temporary = state_file + ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::out|std::ios::trunc);
+            out << state_header << '\n';
+            for (auto &[path, entry] : entries) {
+                if (path.find('\n') != std::string::npos) continue;    // Not representable in the file, hashed again at the next start
+                out << entry.stamp.mtime_ns << ' ' << entry.stamp.size << ' ' << entry.stamp.ino << ' ' << entry.hash << ' ' << path << '\n';
+            }
+            out.flush();
+            if (!out) throw std::ios_base::failure("Unable to write " + temporary);
+        }
+        boost::filesystem::rename(temporary, state_file);
+    } catch (...) {
+        std::lock_guard lg(cache_mutex);
+        dirty = true;   // The hashes are still to be saved
+        throw;
+    }
+    Logger::log(Log_Level::debug, "Saved " + std::to_string(entries.size()) + " hashes to " + state_file);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <boost/thread.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// What tells the contents of a file apart without reading it: the time of last edit to the nanosecond, the size and
+/// the inode, so that a file replaced by another one with the same time and size is not taken for it
+struct File_Stamp {
+    int64_t mtime_ns = 0;
+    uint64_t size = 0;
+    uint64_t ino = 0;
+
+    /// Reads the stamp of a file with a single stat, nullopt if it does not exist any more
+    static std::optional<File_Stamp> read(const std::string &path);
+
+    bool operator==(const File_Stamp &other) const = default;
+};
+
+/// Hashes the files of every root watched by the client on a fixed number of threads, the roots with a higher priority
+/// first, and remembers the hashes by the stamp of the file, so that the files left unchanged are not read again
+/// when a watcher is created after a reconnection. With a state file the hashes outlive the process as well, a client
+/// started again only walks its roots without reading the files that did not change meanwhile
+class Hash_Pool {
+    /// A hash to compute, ordered by priority and then by submission
+    struct Task {
+        int priority;
+        uint64_t sequence;
+        std::function<void()> work;
+
+        bool operator<(const Task &other) const {
+            return priority != other.priority ? priority < other.priority : sequence > other.sequence;
+        }
+    };
+
+    /// A hash known for a file, valid as long as its stamp does not change
+    struct Cached_Hash {
+        File_Stamp stamp;
+        std::string hash;
+    };
+
+    std::vector<boost::thread> threads;
+    std::priority_queue<Task> tasks;
+    uint64_t submitted = 0;
+    bool stopping = false;
+    std::mutex pool_mutex;
+    std::condition_variable pool_cv;
+    std::unordered_map<std::string, Cached_Hash> cache;
+    bool dirty = false;     // Changed since the last save, guarded by cache_mutex
+    std::mutex cache_mutex;
+    std::string state_file;
+    std::chrono::seconds save_interval;
+    std::chrono::steady_clock::time_point last_save = std::chrono::steady_clock::now();    // Guarded by cache_mutex
+    std::mutex save_mutex;
+
+    /// Reads the hashes saved by a previous run, a missing file is an empty state
+    void load();
+
+public:
+
+    /// Starts the given number of threads, 0 means one per core, and loads the hashes kept in the state file if any
+    explicit Hash_Pool(unsigned threads, std::string state_file = {}, std::chrono::seconds save_interval = std::chrono::seconds(60));
+
+    Hash_Pool(const Hash_Pool&) = delete;
+    Hash_Pool& operator=(const Hash_Pool&) = delete;
+
+    ~Hash_Pool();
+
+    /// Runs a batch of hashes of a root on the pool and waits for all of them; the tasks handle their own failures
+    void run(int priority, std::vector<std::function<void()>> &batch);
+
+    /// Gets the hash remembered for the file, if its stamp is still the same
+    std::optional<std::string> cached(const std::string &path, const File_Stamp &stamp);
+
+    /// Remembers the hash of a file, read while it had the given stamp
+    void remember(const std::string &path, const File_Stamp &stamp, std::string hash);
+
+    /// Forgets the hash of an erased file
+    void forget(const std::string &path);
+
+    /// Writes the hashes to the state file if they changed and the save interval has passed since the last write; a
+    /// failure is logged and the save is tried again after the interval
+    void save_if_due();
+
+    /// Writes the hashes to the state file, replacing it at once so that a crash leaves the previous one; throws if the
+    /// file can not be written, the hashes are then still to be saved
+    void save();
+};
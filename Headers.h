@@ -10,7 +10,14 @@ enum status_type {
     no_need = 5,
     in_need = 6,
     service_unavailable = 7,
-    wrong_action = 8
+    wrong_action = 8,
+    partial = 9,
+    rejected = 10,
+    versions = 11,
+    snapshots = 12,
+    restored = 13,
+    over_quota = 14,
+    challenge = 15
 };
 
 /// Possible responses of the client to the server status
@@ -19,12 +26,17 @@ enum action_type {
     synchronize = 1,
     create = 2,
     update = 3,
-    erase = 4
+    erase = 4,
+    history = 5,
+    snapshot = 6,
+    restore = 7,
+    metadata = 8
 };
 
 /// Possible status of a file or a directory
 enum class FileStatus {
     created,
     modified,
+    metadata,   // Only the metadata changed, the content is the same
     erased
 };
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "Ignore_Rules.h"
+#include <algorithm>
+#include <fstream>
+#include <ios>
+#include "Logger.h"
+
+namespace {
+    bool is_wildcard(char c) {
+        return c == '*' || c == '?' || c == '[' || c == '\\';
+    }
+
+    std::string_view trim(std::string_view line) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == '\n')) line.remove_suffix(1);
+        while (!line.empty() && line.back() == ' ' && (line.size() < 2 || line[line.size() - 2] != '\\')) line.remove_suffix(1);     // Trailing spaces, unless escaped
+        return line;
+    }
+}
+
+Ignore_Rules Ignore_Rules::load(const std::string &file) {
+    Ignore_Rules rules;
+    if (file.empty()) return rules;
+    std::ifstream in(file);
+    if (!in) throw std::ios_base::failure("Unable to read the ignore rules " + file);
+    unsigned number = 0;
+    for (std::string line; std::getline(in, line);) {
+        number++;
+        if (!rules.add(line)) Logger::log(Log_Level::warning, "Ignore rule at line " + std::to_string(number) + " of " + file + " skipped, too complex");
+    }
+    Logger::log(Log_Level::info, "Loaded " + std::to_string(rules.size()) + " ignore rules from " + file);
+    return rules;
+}
+
+bool Ignore_Rules::add(std::string_view line) {
+    line = trim(line);
+    if (line.empty() || line.front() == '#') return true;
+    Rule_Ref ref{count, false, false};
+    if (line.front() == '!') {
+        ref.negated = true;
+        line.remove_prefix(1);
+    }
+    if (!line.empty() && line.back() == '/') {
+        ref.directory_only = true;
+        line.remove_suffix(1);
+    }
+    bool anchored = line.find('/') != std::string_view::npos;
+    if (!line.empty() && line.front() == '/') line.remove_prefix(1);
+    if (line.compare(0, 3, "**/") == 0 && line.find('/', 3) == std::string_view::npos) {  // A name at any depth
+        line.remove_prefix(3);
+        anchored = false;
+    }
+    if (line.empty()) return true;
+    bool plain = std::none_of(line.begin(), line.end(), is_wildcard);
+    if (plain) {    // A single lookup whatever the number of such rules
+        (anchored ? paths : names)[std::string(line)].push_back(ref);
+    } else if (!anchored && line.size() > 2 && line[0] == '*' && line[1] == '.' && std::none_of(line.begin() + 1, line.end(), is_wildcard)) {
+        extensions[std::string(line.substr(1))].push_back(ref);
+    } else {
+        Glob glob{ref, anchored};
+        if (!compile(line, glob)) return false;
+        globs.push_back(std::move(glob));
+    }
+    count++;
+    return true;
+}
+
+bool Ignore_Rules::compile(std::string_view pattern, Glob &glob) {
+    glob.accepts.assign(256, 0);
+    std::vector<uint64_t> epsilon;      // Per state, the next states reached without consuming anything
+    unsigned state = 0;
+    auto next_state = [&epsilon, &state]() {
+        epsilon.push_back(0);
+        return uint64_t(1) << state++;
+    };
+    for (size_t i = 0; i < pattern.size(); i++) {
+        if (state + 2 > max_tokens) return false;
+        char c = pattern[i];
+        bool double_star = c == '*' && i + 1 < pattern.size() && pattern[i + 1] == '*' && (i == 0 || pattern[i - 1] == '/');
+        if (double_star && i + 2 < pattern.size() && pattern[i + 2] == '/') {   // Zero or more directories: a/**/b matches a/b and a/x/y/b
+            i += 2;
+            next_state();
+            uint64_t inside = next_state();
+            epsilon[state - 2] = inside | inside << 1;  // Either skipping the directories or entering them
+            glob.stays |= inside;
+            glob.stays_on_slash |= inside;
+            glob.accepts['/'] |= inside;     // Leaving them only at a separator
+        } else if (double_star && i + 2 == pattern.size()) {    // Everything below
+            i++;
+            uint64_t bit = next_state();
+            epsilon[state - 1] = bit << 1;
+            glob.stays |= bit;
+            glob.stays_on_slash |= bit;
+        } else if (c == '*') {      // Anything within a name
+            while (i + 1 < pattern.size() && pattern[i + 1] == '*') i++;
+            uint64_t bit = next_state();
+            epsilon[state - 1] = bit << 1;
+            glob.stays |= bit;
+        } else if (c == '?') {
+            uint64_t bit = next_state();
+            for (int byte = 0; byte < 256; byte++) if (byte != '/') glob.accepts[byte] |= bit;
+        } else if (c == '[') {      // A class of characters, possibly negated and with ranges
+            size_t end = pattern.find(']', i + 2);
+            if (end == std::string_view::npos) return false;
+            std::string_view set = pattern.substr(i + 1, end - i - 1);
+            bool negated = !set.empty() && (set.front() == '!' || set.front() == '^');
+            if (negated) set.remove_prefix(1);
+            std::vector<bool> members(256, false);
+            for (size_t j = 0; j < set.size(); j++) {
+                auto from = static_cast<unsigned char>(set[j]);
+                auto to = from;
+                if (j + 2 < set.size() && set[j + 1] == '-') {
+                    to = static_cast<unsigned char>(set[j + 2]);
+                    j += 2;
+                }
+                for (unsigned byte = from; byte <= to; byte++) members[byte] = true;
+            }
+            uint64_t bit = next_state();
+            for (int byte = 0; byte < 256; byte++) if (byte != '/' && members[byte] != negated) glob.accepts[byte] |= bit;
+            i = end;
+        } else {
+            if (c == '\\' && i + 1 < pattern.size()) c = pattern[++i];
+            glob.accepts[static_cast<unsigned char>(c)] |= next_state();
+        }
+    }
+    glob.final_state = state;
+    epsilon.push_back(0);
+    glob.closure.assign(state + 1, 0);
+    for (unsigned k = state + 1; k-- > 0;) {    // The epsilon moves only go forward, the later closures are complete
+        glob.closure[k] = uint64_t(1) << k;
+        for (unsigned target = k + 1; target <= state; target++)
+            if (epsilon[k] & uint64_t(1) << target) glob.closure[k] |= glob.closure[target];
+    }
+    return true;
+}
+
+bool Ignore_Rules::matches(const Glob &glob, std::string_view text) {
+    auto close = [&glob](uint64_t states) {
+        uint64_t reached = 0;
+        for (; states; states &= states - 1) reached |= glob.closure[__builtin_ctzll(states)];
+        return reached;
+    };
+    uint64_t active = glob.closure[0];
+    for (char c : text) {
+        auto byte = static_cast<unsigned char>(c);
+        uint64_t next = ((active & glob.accepts[byte]) << 1) | (active & (byte == '/' ? glob.stays_on_slash : glob.stays));
+        if (next == 0) return false;
+        active = close(next);
+    }
+    return active & uint64_t(1) << glob.final_state;
+}
+
+void Ignore_Rules::consider(const std::vector<Rule_Ref> &refs, bool is_directory, const Rule_Ref *&best) {
+    for (auto it = refs.rbegin(); it != refs.rend(); ++it) {
+        if (it->directory_only && !is_directory) continue;
+        if (!best || it->index > best->index) best = &*it;
+        return;
+    }
+}
+
+bool Ignore_Rules::ignored(std::string_view relative_path, bool is_directory) const {
+    if (count == 0) return false;
+    auto slash = relative_path.rfind('/');
+    std::string_view name = slash == std::string_view::npos ? relative_path : relative_path.substr(slash + 1);
+    const Rule_Ref *best = nullptr;
+    thread_local std::string key;   // Lookups without an allocation per path
+    if (!names.empty()) {
+        key.assign(name);
+        if (auto it = names.find(key); it != names.end()) consider(it->second, is_directory, best);
+    }
+    if (!paths.empty()) {
+        key.assign(relative_path);
+        if (auto it = paths.find(key); it != paths.end()) consider(it->second, is_directory, best);
+    }
+    if (!extensions.empty()) {
+        for (auto dot = name.find('.'); dot != std::string_view::npos; dot = name.find('.', dot + 1)) {
+            key.assign(name.substr(dot));
+            if (auto it = extensions.find(key); it != extensions.end()) consider(it->second, is_directory, best);
+        }
+    }
+    for (auto it = globs.rbegin(); it != globs.rend(); ++it) {     // The last matching glob, unless a table rule comes after it
+        if (best && it->ref.index < best->index) break;
+        if (it->ref.directory_only && !is_directory) continue;
+        if (matches(*it, it->anchored ? relative_path : name)) {
+            best = &it->ref;
+            break;
+        }
+    }
+    return best && !best->negated;
+}
+
+size_t Ignore_Rules::size() const {
+    return count;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// Elements of the watched directory that are not backed up, written as the lines of a .gitignore file: '#' starts a
+/// comment, '!' includes again what an earlier rule excludes, a trailing '/' only matches directories, and a pattern
+/// with a '/' before its end is anchored to the watched directory, otherwise it matches the name at any depth. The
+/// patterns support '*', '?', '[...]' and '**'. The last matching rule decides. The rules made of a plain name, path or
+/// extension are looked up in hash tables, the other ones are compiled into a small automaton run once over the path
+class Ignore_Rules {
+    /// Where a rule sits in the file and what it does
+    struct Rule_Ref {
+        unsigned index;
+        bool negated;
+        bool directory_only;
+    };
+
+    /// A glob compiled into one state per token, matched by advancing the set of active states with bit masks
+    struct Glob {
+        Rule_Ref ref;
+        bool anchored;      // Matched against the whole relative path, otherwise against the name
+        std::vector<uint64_t> accepts{};    // Per byte value, the states that consume it moving to the next one
+        uint64_t stays = 0;     // States that consume any byte but '/' staying where they are, the wildcards
+        uint64_t stays_on_slash = 0;    // States that consume '/' staying where they are, the ones of '**'
+        std::vector<uint64_t> closure{};    // Per state, the states reached without consuming anything, itself included
+        unsigned final_state = 0;
+    };
+
+    std::unordered_map<std::string, std::vector<Rule_Ref>> names;       // Plain names, at any depth
+    std::unordered_map<std::string, std::vector<Rule_Ref>> paths;       // Plain paths, from the watched directory
+    std::unordered_map<std::string, std::vector<Rule_Ref>> extensions;  // Rules like *.tmp, by suffix from a dot
+    std::vector<Glob> globs;    // The other rules, in the order of the file
+    unsigned count = 0;
+
+    /// Compiles a pattern, returns false if it is too long for the automaton
+    static bool compile(std::string_view pattern, Glob &glob);
+
+    /// Runs the automaton of a glob over the text
+    static bool matches(const Glob &glob, std::string_view text);
+
+    /// Keeps the last applicable rule of a table entry if it comes after the best one so far
+    static void consider(const std::vector<Rule_Ref> &refs, bool is_directory, const Rule_Ref *&best);
+
+public:
+
+    /// Most tokens a glob can have
+    static constexpr size_t max_tokens = 63;
+
+    Ignore_Rules() = default;
+
+    /// Loads the rules of a file, an empty name means no rules; throws std::ios_base::failure if it can not be read
+    static Ignore_Rules load(const std::string &file);
+
+    /// Adds a rule, the lines that are empty or comments are skipped; returns false if the rule can not be compiled
+    bool add(std::string_view line);
+
+    /// Whether the element at the given path, relative to the watched directory and with '/' separators, is excluded;
+    /// its parents are not checked, the walk never descends into the excluded directories
+    bool ignored(std::string_view relative_path, bool is_directory) const;
+
+    /// Gets the number of rules
+    size_t size() const;
+};
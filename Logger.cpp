@@ -0,0 +1,67 @@
+#include <iostream>
+#include "Logger.h"
+#include "Metrics.h"
+
+std::atomic<int> Logger::level(static_cast<int>(Log_Level::info));
+
+Logger::Logger() {
+    writer = std::thread([this](){do_write_lines();});
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+void Logger::do_write_lines() {
+    std::unique_lock ul(log_mutex);
+    while (true) {
+        cv.wait(ul, [this](){return exiting || !lines.empty();});
+        if (lines.empty() && exiting) break;
+        std::deque<std::string> batch;
+        batch.swap(lines);      // Writing outside the lock so that the callers never wait for the output
+        ul.unlock();
+        for (const auto &line : batch) std::clog << line << '\n';
+        std::clog.flush();
+        ul.lock();
+    }
+}
+
+void Logger::set_level(Log_Level new_level) {
+    level.store(static_cast<int>(new_level), std::memory_order_relaxed);
+}
+
+Log_Level Logger::parse_level(const std::string &name) {
+    if (name == "trace") return Log_Level::trace;
+    if (name == "debug") return Log_Level::debug;
+    if (name == "warning") return Log_Level::warning;
+    if (name == "error") return Log_Level::error;
+    if (name == "off") return Log_Level::off;
+    return Log_Level::info;
+}
+
+bool Logger::enabled(Log_Level line_level) {
+    return static_cast<int>(line_level) >= level.load(std::memory_order_relaxed);
+}
+
+void Logger::log(Log_Level line_level, std::string_view line) {
+    if (!enabled(line_level)) return;
+    static auto &dropped = Metrics::instance().counter("rab_log_lines_dropped_total");
+    auto &logger = instance();
+    std::lock_guard lg(logger.log_mutex);
+    if (logger.lines.size() >= 10000) {     // Dropping lines rather than growing without limit when the output is slow
+        dropped.add();
+        return;
+    }
+    logger.lines.emplace_back(line);
+    logger.cv.notify_one();
+}
+
+Logger::~Logger() {
+    {
+        std::lock_guard lg(log_mutex);
+        exiting = true;
+    }
+    cv.notify_all();
+    if (writer.joinable()) writer.join();
+}
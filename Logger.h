@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+/// Possible severities of a log line, lines below the configured level are dropped before being formatted
+enum class Log_Level {
+    trace = 0,
+    debug = 1,
+    info = 2,
+    warning = 3,
+    error = 4,
+    off = 5
+};
+
+class Logger {
+    static std::atomic<int> level;
+    std::deque<std::string> lines;
+    std::thread writer;
+    std::mutex log_mutex;
+    std::condition_variable cv;
+    bool exiting = false;
+
+    Logger();
+
+    /// Gets the logger shared by the whole process, starting its writer thread on first use
+    static Logger& instance();
+
+    /// Writes the queued lines to the standard log in the background
+    void do_write_lines();
+
+public:
+
+    /// Sets the minimum level of the lines that are written
+    static void set_level(Log_Level new_level);
+
+    /// Converts a level name (trace, debug, info, warning, error, off) to the level, unknown names give info
+    static Log_Level parse_level(const std::string &name);
+
+    /// Returns true if lines of the given level are written, to be checked before building expensive lines
+    static bool enabled(Log_Level line_level);
+
+    /// Queues the line for the writer thread if its level is enabled, without blocking on the output
+    static void log(Log_Level line_level, std::string_view line);
+
+    ~Logger();
+};
@@ -1,82 +1,270 @@
-#include <iostream>
+#include <charconv>
+#include <cstring>
+#include "Logger.h"
 #include "Message.h"
+#include "Metrics.h"
 
-Message::Message() {
-    msgPtr = std::make_shared<std::string>();
-}
+namespace {
+    /// Throwing the exception of the boost json parser, so that the callers keep handling malformed messages alike
+    [[noreturn]] void parse_error(const std::string &what) {
+        throw boost::property_tree::json_parser_error(what, "", 0);
+    }
+
+    const char *skip_spaces(const char *it, const char *end) {
+        while (it != end && (*it == ' ' || *it == '\n' || *it == '\r' || *it == '\t')) ++it;
+        return it;
+    }
+
+    constexpr uint64_t ones = 0x0101010101010101ull;
+    constexpr uint64_t highs = 0x8080808080808080ull;
+
+    /// Non zero if any byte of the word is lower than limit, which must not exceed 128
+    inline uint64_t has_less(uint64_t word, uint64_t limit) {
+        return (word - ones * limit) & ~word & highs;
+    }
+
+    /// Non zero if any byte of the word equals value
+    inline uint64_t has_byte(uint64_t word, uint64_t value) {
+        return has_less(word ^ (ones * value), 1);
+    }
 
-void Message::zip_message() {
-    try {
-        std::stringstream message_stream;
-        boost::property_tree::write_json(message_stream, pt);  // Saving the json in a stream
-        msgPtr = std::make_shared<std::string>(message_stream.str());
-    } catch (const boost::property_tree::ptree_error &err) {
-        throw;
+    /// Skipping eight characters at a time up to the first quote or backslash, or control character if controls is true
+    const char *find_special(const char *it, const char *end, bool controls) {
+        while (end - it >= 8) {
+            uint64_t word;
+            std::memcpy(&word, it, sizeof(word));
+            if (has_byte(word, '"') | has_byte(word, '\\') | (controls ? has_less(word, 0x20) : 0)) break;
+            it += 8;
+        }
+        while (it != end && *it != '"' && *it != '\\' && !(controls && static_cast<unsigned char>(*it) < 0x20)) ++it;
+        return it;
+    }
+
+    unsigned parse_hex4(const char *&it, const char *end) {
+        if (end - it < 4) parse_error("Truncated unicode escape");
+        unsigned value;
+        auto [ptr, ec] = std::from_chars(it, it + 4, value, 16);
+        if (ec != std::errc() || ptr != it + 4) parse_error("Invalid unicode escape");
+        it += 4;
+        return value;
+    }
+
+    void append_utf8(std::string &out, unsigned code_point) {
+        if (code_point < 0x80) {
+            out += static_cast<char>(code_point);
+        } else if (code_point < 0x800) {
+            out += static_cast<char>(0xC0 | (code_point >> 6));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        } else if (code_point < 0x10000) {
+            out += static_cast<char>(0xE0 | (code_point >> 12));
+            out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code_point >> 18));
+            out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code_point & 0x3F));
+        }
+    }
+
+    /// Parsing the string whose opening quote is at it, its unescaped content is appended to out unless it is null.
+    /// Returns the position following the closing quote
+    const char *parse_string(const char *it, const char *end, std::string *out) {
+        ++it;
+        while (true) {
+            const char *run = it;
+            it = find_special(it, end, false);
+            if (out) out->append(run, it - run);    // Copying the characters that need no unescaping at once
+            if (it == end) parse_error("Unterminated string");
+            if (*(it++) == '"') return it;
+            if (it == end) parse_error("Unterminated escape");
+            char escaped = *(it++);
+            if (!out) {
+                if (escaped == 'u') parse_hex4(it, end);
+                continue;
+            }
+            switch (escaped) {
+                case '"': case '\\': case '/': *out += escaped; break;
+                case 'b': *out += '\b'; break;
+                case 'f': *out += '\f'; break;
+                case 'n': *out += '\n'; break;
+                case 'r': *out += '\r'; break;
+                case 't': *out += '\t'; break;
+                case 'u': {
+                    unsigned code_point = parse_hex4(it, end);
+                    if (code_point >= 0xDC00 && code_point < 0xE000) parse_error("Stray low surrogate");
+                    if (code_point >= 0xD800 && code_point < 0xDC00) {      // High surrogate, the low one follows
+                        if (end - it < 2 || it[0] != '\\' || it[1] != 'u') parse_error("Unpaired surrogate");
+                        it += 2;
+                        unsigned low = parse_hex4(it, end);
+                        if (low < 0xDC00 || low >= 0xE000) parse_error("Invalid surrogate pair");
+                        code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(*out, code_point);
+                    break;
+                }
+                default:
+                    parse_error("Invalid escape");
+            }
+        }
+    }
+
+    /// Appending the JSON escaped form of data, with the same escapes used by the boost json writer except for '/'
+    void append_escaped(std::string &out, std::string_view data) {
+        const char *run = data.data();
+        const char *end = run + data.size();
+        for (const char *it = find_special(run, end, true); it != end; it = find_special(it + 1, end, true)) {
+            auto c = static_cast<unsigned char>(*it);
+            out.append(run, it - run);
+            run = it + 1;
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\b': out += "\\b"; break;
+                case '\f': out += "\\f"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default: {
+                    const char *hex_digits = "0123456789ABCDEF";
+                    out += "\\u00";
+                    out += hex_digits[c >> 4u];
+                    out += hex_digits[c & 15u];
+                }
+            }
+        }
+        out.append(run, end - run);
     }
 }
 
-std::shared_ptr<std::string> Message::get_msg_ptr() {
-    return msgPtr;
+Message::Message() : created_at(std::chrono::steady_clock::now()) {}
+
+Message::Message(std::shared_ptr<Buffer_Pool> pool) : pool(std::move(pool)), created_at(std::chrono::steady_clock::now()) {}
+
+size_t Message::complete_length(std::string_view received) {
+    constexpr std::string_view end = "\n}\n";
+    size_t position = received.find(end);
+    return position == std::string_view::npos ? 0 : position + end.size();
 }
 
-void Message::decode_message() {
-    try {
-        std::stringstream stream;
-        stream << (*msgPtr);
-        std::cout << (*msgPtr) << std::endl;
-        boost::property_tree::read_json(stream, pt);    // Re-creating json from data stream
-    } catch (const boost::property_tree::ptree_error &err) {
-        throw;
+void Message::decode_message(std::string_view text) {
+    if (Logger::enabled(Log_Level::trace)) Logger::log(Log_Level::trace, text.substr(0, 256));    // Only the beginning, the content can be huge
+    if (pool && !payload.pooled()) payload = pool->acquire();
+    std::string &data = payload.str();
+    data.clear();
+    bool has_header = false, has_data = false;
+    const char *it = skip_spaces(text.data(), text.data() + text.size());
+    const char *end = text.data() + text.size();
+    if (it == end || *it != '{') parse_error("Expected an object");
+    it = skip_spaces(it + 1, end);
+    while (it != end && *it != '}') {
+        if (*it != '"') parse_error("Expected a key");
+        const char *key_start = it + 1;
+        it = parse_string(it, end, nullptr);
+        std::string_view key(key_start, it - 1 - key_start);
+        it = skip_spaces(it, end);
+        if (it == end || *it != ':') parse_error("Expected ':'");
+        it = skip_spaces(it + 1, end);
+        if (it == end) parse_error("Expected a value");
+        if (key == "header") {
+            const char *number = *it == '"' ? it + 1 : it;      // The boost writer quotes every value
+            auto [ptr, ec] = std::from_chars(number, end, header);
+            if (ec != std::errc()) parse_error("Invalid header");
+            it = *it == '"' ? parse_string(it, end, nullptr) : ptr;
+            has_header = true;
+        } else if (*it == '"') {
+            bool is_data = key == "data";
+            it = parse_string(it, end, is_data ? &data : nullptr);
+            has_data |= is_data;
+        } else {
+            parse_error("Unsupported value");
+        }
+        it = skip_spaces(it, end);
+        if (it != end && *it == ',') it = skip_spaces(it + 1, end);
     }
+    if (it == end) parse_error("Unterminated object");
+    if (!has_header || !has_data) parse_error("Missing header or data");
+    decoded = true;
 }
 
-int Message::get_header() {
-    try {
-        return pt.get<int>("header");
-    } catch (const boost::property_tree::ptree_error &err) {
-        throw;
-    }
+int Message::get_header() const {
+    return header;
 }
 
-std::string Message::get_data() {
-    try {
-        return pt.get<std::string>("data");
-    } catch (const boost::property_tree::ptree_error &err) {
-        throw;
-    }
+std::string_view Message::get_data() {
+    if (!decoded && !wire.str().empty()) decode_message(wire.str());      // Outgoing message, the data is escaped in the wire text
+    return payload.str();
 }
 
 std::tuple<std::string, std::string> Message::get_credentials() {
-    try {
-        auto credentials_str = pt.get<std::string>("data");
-        int separator_pos = credentials_str.find("||");
-        auto username = credentials_str.substr(0, separator_pos);
-        std::stringstream pwd_stream(credentials_str.substr(separator_pos+2));
-        std::string pwd_hash;
-        pwd_stream >> pwd_hash;
-        return std::make_tuple(username, pwd_hash);
-    } catch (const boost::property_tree::ptree_error &err) {
-        throw;
-    }
+    auto credentials_str = get_data();
+    auto separator_pos = credentials_str.find("||");
+    if (separator_pos == std::string_view::npos) parse_error("Malformed credentials");
+    auto username = credentials_str.substr(0, separator_pos);
+    auto pwd_hash = credentials_str.substr(separator_pos + 2);
+    auto pwd_start = pwd_hash.find_first_not_of(" \t\r\n");      // Only the first word, as read by a stream
+    pwd_hash = pwd_start == std::string_view::npos ? std::string_view() : pwd_hash.substr(pwd_start);
+    pwd_hash = pwd_hash.substr(0, pwd_hash.find_first_of(" \t\r\n"));
+    return std::make_tuple(std::string(username), std::string(pwd_hash));
 }
 
 void Message::put_credentials(const std::string& username, const std::string& password) {
-    try {
-        std::string user_pass = std::string(username) + std::string("||") + std::string(password);
-        encode_message(0, user_pass);
-    } catch (const boost::property_tree::ptree_error &err) {
-        throw;
-    }
+    std::string user_pass = std::string(username) + std::string("||") + std::string(password);
+    encode_message(0, user_pass);
 }
 
-void Message::encode_message(int header, std::string& data) {
-    try {
-        pt.add("header", header);
-        pt.add("data", data);
-        zip_message();
-    } catch (const boost::property_tree::ptree_error &err) {
-        throw;
-    }
+double Message::get_age() const {
+    return seconds_since(created_at);
+}
+
+void Message::encode_message(int header_value, std::string_view data) {
+    if (pool && !wire.pooled()) wire = pool->acquire();
+    std::string &out = wire.str();
+    out.clear();
+    out.reserve(data.size() + 48);
+    char digits[12];
+    auto [digits_end, ec] = std::to_chars(digits, digits + sizeof(digits), header_value);
+    out.append("{\n    \"header\": \"").append(digits, digits_end - digits).append("\",\n    \"data\": \"");
+    append_escaped(out, data);
+    out.append("\"\n}\n");     // Same layout as the boost json writer, the reader splits the messages at "\n}\n"
+    header = header_value;
+    decoded = false;
+}
+
+void Message::begin_object(int header_value) {
+    encode_message(header_value, "{");
+    wire.str().resize(wire.str().size() - 4);   // Reopening the data string after the brace
 }
 
+void Message::add_field(std::string_view key, std::string_view value) {
+    std::string &out = wire.str();
+    std::string escaped;
+    out += out.back() == '{' ? "\\\"" : ",\\\"";
+    append_escaped(escaped, key);
+    append_escaped(out, escaped);
+    out += "\\\":\\\"";
+    escaped.clear();
+    append_escaped(escaped, value);
+    append_escaped(out, escaped);
+    out += "\\\"";
+}
 
+char *Message::add_plain_field(std::string_view key, size_t length) {
+    std::string &out = wire.str();
+    out.reserve(out.size() + key.size() + length + 32);
+    add_field(key, "");
+    out.insert(out.size() - 2, length, '\0');
+    return out.data() + out.size() - 2 - length;
+}
+
+void Message::end_object() {
+    wire.str().append("}\"\n}\n");
+}
+
+boost::asio::const_buffer Message::buffer() const {
+    return boost::asio::buffer(wire.str());
+}
+
+size_t Message::size() const {
+    return wire.str().size();
+}
@@ -1,42 +1,84 @@
 #pragma once
 
+#include <boost/asio/buffer.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/exceptions.hpp>
 #include <boost/property_tree/json_parser.hpp>
+#include <chrono>
+#include <string_view>
 #include <tuple>
-
-typedef std::shared_ptr<std::string> msg_ptr;
+#include "Buffer_Pool.h"
 
 class Message {
-    boost::property_tree::ptree pt;
-    msg_ptr msgPtr;
+    std::shared_ptr<Buffer_Pool> pool;
+    Pooled_Buffer wire;         // Encoded message, as written on the socket
+    Pooled_Buffer payload;      // Unescaped data field of a decoded message
+    int header = -1;
+    bool decoded = false;       // True once payload holds the data
+    std::chrono::steady_clock::time_point created_at;
 
 public:
 
-    /// Allocating memory and constructing a msgPtr before the do_read calls a get_msg_ptr on it
+    /// Room kept in the receive buffers of the sessions, the socket is read up to this many bytes at once
+    static constexpr size_t read_room = 1 << 16;
+
+    /// Prefix of the password field of a login that carries a session ticket instead of the password digest
+    static constexpr const char *ticket_prefix = "ticket:";
+
+    /// Key of a synchronization naming the directory it covers, the elements of the user outside of it are left alone
+    static constexpr const char *sync_root_key = "||root";
+
+    /// Creating a message with its own buffers, allocated on first use
     Message();
 
-    /// Assigning the content of the json (pt) to the msgPtr
-    void zip_message();
+    /// Creating a message whose buffers are borrowed from the pool of the session
+    explicit Message(std::shared_ptr<Buffer_Pool> pool);
 
-    /// Getting pointer to the message
-    msg_ptr get_msg_ptr();
+    Message(Message &&other) noexcept = default;
 
-    /// Saving the content of the msgPtr to the json (pt)
-    void decode_message();
+    Message &operator=(Message &&other) noexcept = default;
 
-    /// Getting the header of the message from the json (pt)
-    int get_header();
+    /// Parsing the header and the data from the wire text, which may be released as soon as the call returns
+    void decode_message(std::string_view text);
 
-    /// Getting the data of the message from the json (pt)
-    std::string get_data();
+    /// Getting the header of the message
+    int get_header() const;
 
-    /// Extracting and getting the credentials from the json (pt)
+    /// Getting the data of the message, valid as long as the message; outgoing messages unescape it on first use
+    std::string_view get_data();
+
+    /// Extracting and getting the credentials from the data
     std::tuple<std::string, std::string> get_credentials();
 
-    /// Inserting credentials into the message json (pt)
+    /// Inserting credentials into the message
     void put_credentials(const std::string& username, const std::string& password);
 
-    /// Assembling the json that has to be saved in the final message
-    void encode_message(int header, std::string& data);
-};
\ No newline at end of file
+    /// Assembling the text of the message, ready to be written on the socket
+    void encode_message(int header, std::string_view data);
+
+    /// Starting a message whose data is a json object, written field by field straight into the wire text, escaped for
+    /// the object and again for the data string; the object is closed by end_object
+    void begin_object(int header);
+
+    /// Adding a field to the object, its value quoted as the boost json writer quotes every value
+    void add_field(std::string_view key, std::string_view value);
+
+    /// Adding a field whose length characters need no escaping, as base64 text; returns where to write them
+    char *add_plain_field(std::string_view key, size_t length);
+
+    /// Closing the object, the message is then ready to be written on the socket
+    void end_object();
+
+    /// Getting the encoded message to write on the socket
+    boost::asio::const_buffer buffer() const;
+
+    /// Getting the size of the encoded message
+    size_t size() const;
+
+    /// Getting the seconds elapsed since the message was created
+    double get_age() const;
+
+    /// Getting the length of the first message of the received text, ending with its closing line, or 0 if the whole
+    /// message has not arrived yet
+    static size_t complete_length(std::string_view received);
+};
@@ -0,0 +1,128 @@
+#include <chrono>
+#include <sstream>
+#include "Metrics.h"
+
+void Counter::add(uint64_t amount) {
+    value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+uint64_t Counter::get() const {
+    return value.load(std::memory_order_relaxed);
+}
+
+void Gauge::set(double new_value) {
+    value.store(new_value, std::memory_order_relaxed);
+}
+
+void Gauge::add(double amount) {
+    double old_value = value.load(std::memory_order_relaxed);
+    while (!value.compare_exchange_weak(old_value, old_value + amount, std::memory_order_relaxed));
+}
+
+double Gauge::get() const {
+    return value.load(std::memory_order_relaxed);
+}
+
+Histogram::Histogram(std::vector<double> bounds) : bounds(std::move(bounds)), counts(new std::atomic<uint64_t>[this->bounds.size() + 1]) {
+    for (size_t i = 0; i <= this->bounds.size(); i++) counts[i] = 0;
+}
+
+void Histogram::observe(double observation) {
+    size_t bucket = 0;
+    while (bucket < bounds.size() && observation > bounds[bucket]) bucket++;     // The last bucket holds the values over every bound
+    counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    double old_sum = sum.load(std::memory_order_relaxed);
+    while (!sum.compare_exchange_weak(old_sum, old_sum + observation, std::memory_order_relaxed));
+}
+
+void Histogram::render(std::string &out, const std::string &name, const std::string &labels) const {
+    std::ostringstream stream;
+    std::string prefix = labels.empty() ? std::string("{") : "{" + labels + ",";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < bounds.size(); i++) {
+        cumulative += counts[i].load(std::memory_order_relaxed);
+        stream << name << "_bucket" << prefix << "le=\"" << bounds[i] << "\"} " << cumulative << "\n";
+    }
+    cumulative += counts[bounds.size()].load(std::memory_order_relaxed);
+    stream << name << "_bucket" << prefix << "le=\"+Inf\"} " << cumulative << "\n";
+    std::string suffix = labels.empty() ? std::string() : "{" + labels + "}";
+    stream << name << "_sum" << suffix << " " << sum.load(std::memory_order_relaxed) << "\n";
+    stream << name << "_count" << suffix << " " << count.load(std::memory_order_relaxed) << "\n";
+    out += stream.str();
+}
+
+Message_Counters::Message_Counters(const std::string &name, const std::string &side) {
+    for (int header = 0; header < 16; header++)
+        counters.push_back(&Metrics::instance().counter(name + "{side=\"" + side + "\",header=\"" + std::to_string(header) + "\"}"));
+}
+
+void Message_Counters::count(int header) {
+    if (header >= 0 && header < static_cast<int>(counters.size())) counters[header]->add();
+}
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Counter& Metrics::counter(const std::string &name) {
+    std::lock_guard lg(metrics_mutex);
+    auto &entry = counters[name];
+    if (!entry) entry = std::make_unique<Counter>();
+    return *entry;
+}
+
+Gauge& Metrics::gauge(const std::string &name) {
+    std::lock_guard lg(metrics_mutex);
+    auto &entry = gauges[name];
+    if (!entry) entry = std::make_unique<Gauge>();
+    return *entry;
+}
+
+Histogram& Metrics::histogram(const std::string &name, std::vector<double> bounds) {
+    std::lock_guard lg(metrics_mutex);
+    auto &entry = histograms[name];
+    if (!entry) {
+        if (bounds.empty()) bounds = {0.00001, 0.0001, 0.001, 0.01, 0.1, 1, 10, 100};
+        entry = std::make_unique<Histogram>(std::move(bounds));
+    }
+    return *entry;
+}
+
+void Metrics::remove_gauge(const std::string &name) {
+    std::lock_guard lg(metrics_mutex);
+    gauges.erase(name);
+}
+
+std::string Metrics::render() {
+    std::lock_guard lg(metrics_mutex);
+    std::string out;
+    std::string last_base;
+    auto type_line = [&out, &last_base](const std::string &base, const char *type) {     // One TYPE line per metric family
+        if (base != last_base) out += "# TYPE " + base + " " + type + "\n";
+        last_base = base;
+    };
+    for (auto &entry : counters) {
+        type_line(entry.first.substr(0, entry.first.find('{')), "counter");
+        out += entry.first + " " + std::to_string(entry.second->get()) + "\n";
+    }
+    for (auto &entry : gauges) {
+        type_line(entry.first.substr(0, entry.first.find('{')), "gauge");
+        std::ostringstream value;
+        value << entry.second->get();
+        out += entry.first + " " + value.str() + "\n";
+    }
+    for (auto &entry : histograms) {
+        auto label_pos = entry.first.find('{');
+        std::string base = entry.first.substr(0, label_pos);
+        std::string labels = label_pos == std::string::npos ? std::string() : entry.first.substr(label_pos + 1, entry.first.size() - label_pos - 2);
+        type_line(base, "histogram");
+        entry.second->render(out, base, labels);
+    }
+    return out;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
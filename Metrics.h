@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Monotonic counter, safe to update from any thread
+class Counter {
+    std::atomic<uint64_t> value{0};
+
+public:
+
+    /// Increases the counter by the given amount
+    void add(uint64_t amount = 1);
+
+    /// Gets the current value of the counter
+    uint64_t get() const;
+};
+
+/// Value that can go up and down, safe to update from any thread
+class Gauge {
+    std::atomic<double> value{0};
+
+public:
+
+    /// Sets the gauge to the given value
+    void set(double new_value);
+
+    /// Adds the given (possibly negative) amount to the gauge
+    void add(double amount);
+
+    /// Gets the current value of the gauge
+    double get() const;
+};
+
+/// Distribution of observed values over fixed buckets, safe to update from any thread
+class Histogram {
+    std::vector<double> bounds;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;
+    std::atomic<uint64_t> count{0};
+    std::atomic<double> sum{0};
+
+public:
+
+    /// Creates a histogram whose buckets have the given upper bounds, in increasing order
+    explicit Histogram(std::vector<double> bounds);
+
+    /// Adds an observation to the bucket it belongs to
+    void observe(double observation);
+
+    /// Appends the prometheus text representation of the histogram, "labels" may be empty
+    void render(std::string &out, const std::string &name, const std::string &labels) const;
+};
+
+/// Counters of the messages of each header type flowing in one direction
+class Message_Counters {
+    std::vector<Counter*> counters;
+
+public:
+
+    /// Registers one counter per header value under the given metric name
+    Message_Counters(const std::string &name, const std::string &side);
+
+    /// Counts a message with the given header
+    void count(int header);
+};
+
+/// Registry of all the metrics of the process, rendered in the prometheus text format
+class Metrics {
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Gauge>> gauges;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    std::mutex metrics_mutex;
+
+public:
+
+    /// Gets the registry shared by the whole process
+    static Metrics& instance();
+
+    /// Gets (creating it if needed) the counter with the given name, labels included as in name{label="value"}
+    Counter& counter(const std::string &name);
+
+    /// Gets (creating it if needed) the gauge with the given name
+    Gauge& gauge(const std::string &name);
+
+    /// Gets (creating it if needed) the histogram with the given name, latency buckets from 10us to 100s by default
+    Histogram& histogram(const std::string &name, std::vector<double> bounds = {});
+
+    /// Removes the gauge with the given name, used for the per-session ones
+    void remove_gauge(const std::string &name);
+
+    /// Renders every metric in the prometheus text exposition format
+    std::string render();
+};
+
+/// Returns the seconds elapsed since the given point in time
+double seconds_since(std::chrono::steady_clock::time_point start);
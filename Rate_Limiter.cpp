@@ -0,0 +1,55 @@
+#include <ctime>
+#include <thread>
+#include "Rate_Limiter.h"
+
+Rate_Limiter::Rate_Limiter(double rate, double burst_seconds)
+        : rate(rate), burst_seconds(burst_seconds), tokens(rate * burst_seconds), last_refill(std::chrono::steady_clock::now()) {}
+
+double Rate_Limiter::current_rate() {
+    if (schedule.empty()) return rate;
+    std::time_t now = std::time(nullptr);
+    std::tm local{};
+    localtime_r(&now, &local);
+    for (const auto &window : schedule) {
+        bool inside = window.from_hour <= window.to_hour    // Windows like 22-6 wrap around midnight
+                      ? local.tm_hour >= window.from_hour && local.tm_hour < window.to_hour
+                      : local.tm_hour >= window.from_hour || local.tm_hour < window.to_hour;
+        if (inside) return window.rate;
+    }
+    return rate;
+}
+
+void Rate_Limiter::acquire(double amount) {
+    std::chrono::duration<double> wait(0);
+    {
+        std::lock_guard lg(rl_mutex);
+        double effective_rate = current_rate();
+        auto now = std::chrono::steady_clock::now();
+        if (effective_rate <= 0) {      // Unlimited, the bucket is kept full for when a limit is set
+            last_refill = now;
+            return;
+        }
+        tokens += effective_rate * std::chrono::duration<double>(now - last_refill).count();
+        tokens = std::min(tokens, effective_rate * burst_seconds);
+        last_refill = now;
+        tokens -= amount;   // Going into debt allows amounts bigger than the burst, the caller pays it back by waiting
+        if (tokens < 0) wait = std::chrono::duration<double>(-tokens / effective_rate);
+    }
+    if (wait.count() > 0) std::this_thread::sleep_for(wait);
+}
+
+void Rate_Limiter::set_rate(double new_rate) {
+    std::lock_guard lg(rl_mutex);
+    rate = new_rate;
+    tokens = std::min(tokens, rate * burst_seconds);
+}
+
+double Rate_Limiter::get_rate() {
+    std::lock_guard lg(rl_mutex);
+    return rate;
+}
+
+void Rate_Limiter::add_window(int from_hour, int to_hour, double window_rate) {
+    std::lock_guard lg(rl_mutex);
+    schedule.push_back({from_hour, to_hour, window_rate});
+}
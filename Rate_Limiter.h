@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// Struct for collecting a time of day window during which a different rate applies
+struct Rate_Window {
+    int from_hour;
+    int to_hour;
+    double rate;
+};
+
+class Rate_Limiter {
+    double rate;
+    double burst_seconds;
+    double tokens;
+    std::chrono::steady_clock::time_point last_refill;
+    std::vector<Rate_Window> schedule;
+    std::mutex rl_mutex;
+
+    /// Gets the rate that applies at the current time of day
+    double current_rate();
+
+public:
+
+    /// Token bucket releasing "rate" units per second, up to "burst_seconds" worth of them at once, 0 means unlimited
+    explicit Rate_Limiter(double rate = 0, double burst_seconds = 1);
+
+    /// Takes the given amount of units from the bucket, blocking the calling thread until they are available
+    void acquire(double amount);
+
+    /// Changes the base rate while the limiter is in use
+    void set_rate(double new_rate);
+
+    /// Gets the base rate
+    double get_rate();
+
+    /// Adds a time of day window, hours in [from_hour, to_hour) use the given rate instead of the base one
+    void add_window(int from_hour, int to_hour, double window_rate);
+};
+
+/// Struct for collecting the rate limiters shared by the client threads
+struct Throttling {
+    std::shared_ptr<Rate_Limiter> upload;        // Bytes per second sent to the server
+    std::shared_ptr<Rate_Limiter> read_bytes;    // Bytes per second read from disk while hashing
+    std::shared_ptr<Rate_Limiter> read_ops;      // Read operations per second issued while hashing
+};
@@ -0,0 +1,264 @@
+#include "Restore_Client.h"
+#include <fcntl.h>
+#include <fstream>
+#include "File_Metadata.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define delimiter "\n}\n"
+
+namespace {
+    auto &bytes_restored = Metrics::instance().counter("rab_restore_bytes_total");
+    auto &files_failed = Metrics::instance().counter("rab_restore_failures_total");
+}
+
+Restore_Client::Restore_Client(const tcp::resolver::results_type &endpoints, Credentials cred, std::string destination, std::string path,
+                               int64_t snapshot, int64_t version, unsigned streams, std::shared_ptr<Tls_Context> tls)
+        : endpoints(endpoints), cred(std::move(cred)), destination(std::move(destination)), path(std::move(path)),
+        snapshot(snapshot), version(version), streams(std::max(1u, streams)), tls(std::move(tls)) {
+    while (this->path.find('.') < this->path.size())    // Making the path compatible with json polices
+        this->path.replace(this->path.find('.'), 1, ":");
+}
+
+bool Restore_Client::run() {
+    auto start = std::chrono::steady_clock::now();
+    Connection control(tls);
+    open(control);
+    auto entries = fetch_manifest(control);
+    boost::filesystem::create_directories(destination);
+    uint64_t total = 0;
+    for (auto &entry : entries) {
+        if (entry.isFile) {
+            total += entry.size;
+            pending.push_back(entry);
+        } else {
+            boost::filesystem::create_directories(local_path(entry.path));
+        }
+    }
+    std::sort(pending.begin(), pending.end(), [](const Restore_Entry &a, const Restore_Entry &b) {return a.size > b.size;});    // The largest files start first, so that the streams end together
+    std::cout << "Restoring " << pending.size() << " files, " << total << " bytes, over " << std::min<size_t>(streams, pending.size())
+              << " streams." << std::endl;
+    std::vector<boost::thread> workers;
+    for (size_t i = 0; i < std::min<size_t>(streams, pending.size()); i++) workers.emplace_back([this]() {do_stream();});
+    for (auto &worker : workers) worker.join();
+    apply_metadata(entries);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Restored " << files_restored << " files (" << files_present << " already present), " << bytes_received
+              << " bytes in " << seconds << " s, " << bytes_received / seconds / 1048576 << " MiB/s." << std::endl;
+    for (auto &element : failed) std::cerr << "Unable to restore " << element << std::endl;
+    return failed.empty();
+}
+
+void Restore_Client::open(Connection &connection) {
+    boost::system::error_code ignored;
+    connection.socket.close(ignored);
+    connection.read_buf.consume(connection.read_buf.size());
+    boost::asio::connect(connection.socket, endpoints);
+    connection.socket.set_option(tcp::no_delay(true));
+    connection.transport.handshake();   // The streams after the first one resume its TLS session
+    Message login(pool);
+    {
+        std::lock_guard lg(pending_mutex);
+        login.put_credentials(cred.username, cred.secret());    // The streams after the first one log in with its ticket
+    }
+    boost::asio::write(connection.transport, login.buffer());
+    auto answer = receive(connection);
+    if (auto separator = answer.second.find("||"); answer.first == status_type::service_unavailable && separator != std::string::npos) {
+        boost::this_thread::sleep_for(boost::chrono::seconds(std::stoul(answer.second.substr(separator + 2))));    // Server busy, the next attempt comes after the wait it asks for
+        throw std::runtime_error("Server busy");
+    }
+    std::lock_guard lg(pending_mutex);
+    if (answer.first != status_type::authorized) {
+        cred.ticket.clear();    // The next attempt sends the password
+        throw std::runtime_error("Login refused: " + answer.second);
+    }
+    if (auto separator = answer.second.find("||"); separator != std::string::npos) cred.ticket = answer.second.substr(separator + 2);
+}
+
+void Restore_Client::send(Connection &connection, action_type action, const boost::property_tree::ptree &pt) {
+    std::stringstream request_stream;
+    boost::property_tree::write_json(request_stream, pt, false);
+    Message request(pool);
+    request.encode_message(action, request_stream.str());
+    boost::asio::write(connection.transport, request.buffer());
+}
+
+std::pair<int, std::string> Restore_Client::receive(Connection &connection) {
+    size_t length = boost::asio::read_until(connection.transport, connection.read_buf, delimiter);
+    Message msg(pool);
+    msg.decode_message(std::string_view(static_cast<const char*>(connection.read_buf.data().data()), length));
+    connection.read_buf.consume(length);    // What follows may be the raw content of a file
+    return {msg.get_header(), std::string(msg.get_data())};
+}
+
+std::vector<Restore_Entry> Restore_Client::fetch_manifest(Connection &connection) {
+    boost::property_tree::ptree request;
+    request.put("path", path);
+    request.put("manifest", true);
+    if (snapshot != 0) request.put("snapshot", snapshot);
+    if (version != 0) request.put("version", version);
+    send(connection, action_type::restore, request);
+    std::vector<Restore_Entry> entries;
+    bool done = false;
+    while (!done) {     // The manifest comes in pages
+        auto answer = receive(connection);
+        if (answer.first != status_type::restored) continue;
+        boost::property_tree::ptree pt;
+        std::stringstream data_stream(answer.second);
+        boost::property_tree::read_json(data_stream, pt);
+        if (auto manifest = pt.get_child_optional("manifest")) {
+            for (auto &element : *manifest) {
+                entries.push_back({element.second.get<std::string>("path"), element.second.get<int64_t>("version"),
+                                   element.second.get<bool>("isFile"), element.second.get<uint64_t>("size"),
+                                   element.second.get<std::string>("hash"), element.second.get<std::string>("meta", "")});
+            }
+        }
+        done = pt.get<bool>("done");
+    }
+    return entries;
+}
+
+void Restore_Client::do_stream() {
+    Connection connection(tls);
+    bool connected = false;
+    Retry_Policy retry(std::chrono::seconds(1), std::chrono::seconds(8));   // The streams interrupted together do not reconnect together
+    while (true) {
+        Restore_Entry entry;
+        {
+            std::lock_guard lg(pending_mutex);
+            if (pending.empty()) break;
+            entry = std::move(pending.front());
+            pending.pop_front();
+        }
+        bool restored = false;
+        for (int attempt = 1; attempt <= 3 && !restored; attempt++) {
+            try {
+                if (!connected) {
+                    open(connection);
+                    connected = true;
+                }
+                restored = restore_file(connection, entry);     // A mismatching content is downloaded again from scratch
+                retry.succeeded();
+            } catch (const std::exception &err) {   // Connection lost or refused, the part file keeps what has been written
+                connected = false;
+                Logger::log(Log_Level::warning, "Restore of " + entry.path + " interrupted (" + err.what() + "), attempt " + std::to_string(attempt));
+                boost::this_thread::sleep_for(boost::chrono::milliseconds(retry.failed().count()));    // A thread of its own, nothing else waits on it
+            }
+        }
+        if (!restored) {
+            files_failed.add();
+            std::lock_guard lg(pending_mutex);
+            failed.push_back(local_path(entry.path));
+        }
+    }
+}
+
+bool Restore_Client::restore_file(Connection &connection, const Restore_Entry &entry) {
+    std::string file = local_path(entry.path);
+    boost::system::error_code ec;
+    if (boost::filesystem::file_size(file, ec) == entry.size && !ec && (entry.size == 0 || hash_file(file) == entry.hash)) {
+        files_present++;    // Restored by a previous run
+        return true;
+    }
+    boost::filesystem::create_directories(boost::filesystem::path(file).parent_path(), ec);
+    std::string part = file + ".rab-part";
+    int fd = ::open(part.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) throw std::ios_base::failure("Unable to open " + part);
+    std::unique_ptr<int, void (*)(int*)> closer(&fd, [](int *descriptor) {::close(*descriptor);});
+    struct stat info{};
+    ::fstat(fd, &info);
+    uint64_t offset = static_cast<uint64_t>(info.st_size);     // The size of the part is what previous attempts have written
+    if (offset > entry.size) {
+        if (::ftruncate(fd, 0) != 0) throw std::ios_base::failure("Unable to truncate " + part);
+        offset = 0;
+    }
+    if (entry.size > 0) ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(entry.size));     // Contiguous blocks, without moving the resume point
+    Content_Hasher hasher;
+    std::vector<char> buffer(chunk_size);
+    for (uint64_t hashed = 0; hashed < offset;) {   // Hashing the bytes kept from the previous attempts
+        ssize_t n = ::pread(fd, buffer.data(), std::min<uint64_t>(buffer.size(), offset - hashed), static_cast<off_t>(hashed));
+        if (n <= 0) throw std::ios_base::failure("Unable to read " + part);
+        hasher.update(buffer.data(), static_cast<size_t>(n));
+        hashed += static_cast<uint64_t>(n);
+    }
+    boost::property_tree::ptree request;
+    request.put("path", entry.path);
+    request.put("version", entry.version);
+    request.put("offset", offset);
+    request.put("raw", true);
+    send(connection, action_type::restore, request);
+    std::pair<int, std::string> answer;
+    do answer = receive(connection); while (answer.first != status_type::restored);
+    boost::property_tree::ptree pt;
+    std::stringstream data_stream(answer.second);
+    boost::property_tree::read_json(data_stream, pt);
+    if (pt.get_optional<std::string>("error")) {
+        Logger::log(Log_Level::error, "The server has no content for " + entry.path);
+        return false;
+    }
+    uint64_t position = pt.get<uint64_t>("offset");
+    uint64_t remaining = pt.get<uint64_t>("length");
+    while (remaining > 0) {     // The raw content follows the message, part of it may already be in the buffer
+        size_t n;
+        if (connection.read_buf.size() > 0) {
+            n = boost::asio::buffer_copy(boost::asio::buffer(buffer.data(), std::min<uint64_t>(buffer.size(), remaining)), connection.read_buf.data());
+            connection.read_buf.consume(n);
+        } else {
+            n = connection.transport.read_some(boost::asio::buffer(buffer.data(), std::min<uint64_t>(buffer.size(), remaining)));
+        }
+        for (size_t written = 0; written < n;) {
+            ssize_t w = ::pwrite(fd, buffer.data() + written, n - written, static_cast<off_t>(position + written));
+            if (w < 0) throw std::ios_base::failure("Unable to write " + part);
+            written += static_cast<size_t>(w);
+        }
+        hasher.update(buffer.data(), n);
+        position += n;
+        remaining -= n;
+        bytes_received += n;
+        bytes_restored.add(static_cast<double>(n));
+    }
+    if (position != entry.size || (entry.size > 0 && hasher.final() != entry.hash)) {
+        Logger::log(Log_Level::warning, "Content of " + entry.path + " does not match its hash, downloading it again");
+        ::ftruncate(fd, 0);
+        return false;
+    }
+    boost::filesystem::rename(part, file);
+    files_restored++;
+    Logger::log(Log_Level::debug, "Restored " + file);
+    return true;
+}
+
+std::string Restore_Client::local_path(const std::string &element) const {
+    std::string local = element;
+    while (local.find(':') < local.size()) local.replace(local.find(':'), 1, ".");     // Resetting the original path format
+    for (auto &part : boost::filesystem::path(local)) {
+        if (part == "..") throw std::ios_base::failure("Refusing to restore " + local + " outside of " + destination);
+    }
+    return (boost::filesystem::path(destination) / local).string();
+}
+
+void Restore_Client::apply_metadata(const std::vector<Restore_Entry> &entries) {
+    std::set<std::string> unrestored(failed.begin(), failed.end());
+    bool ownership = ::geteuid() == 0;
+    for (int directories = 0; directories < 2; directories++) {
+        for (auto entry = entries.rbegin(); entry != entries.rend(); ++entry) {     // The manifest lists the parents first
+            if (entry->isFile == (directories == 1) || entry->metadata.empty()) continue;
+            auto element = local_path(entry->path);
+            if (unrestored.count(element)) continue;
+            try {
+                if (!File_Metadata::decode(entry->metadata).apply(element, ownership))
+                    Logger::log(Log_Level::warning, "Unable to restore the metadata of " + element);
+            } catch (const std::invalid_argument &err) {
+                Logger::log(Log_Level::warning, "Malformed metadata of " + element + " ignored");
+            }
+        }
+    }
+}
+
+std::string Restore_Client::hash_file(const std::string &file) {
+    Content_Hasher hasher;
+    std::ifstream in(file, std::ios::in|std::ios::binary);
+    std::vector<char> buffer(1 << 16);
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) hasher.update(buffer.data(), in.gcount());
+    return hasher.final();
+}
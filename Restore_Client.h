@@ -0,0 +1,96 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Client.h"
+#include "Content_Hasher.h"
+#include "Headers.h"
+#include "Logger.h"
+#include "Message.h"
+#include "Metrics.h"
+#include "Transport.h"
+
+/// An element listed by the restore manifest of the server
+struct Restore_Entry {
+    std::string path;       // As sent by the server, with ':' in place of '.'
+    int64_t version = 0;
+    bool isFile = true;
+    uint64_t size = 0;
+    std::string hash;
+    std::string metadata;   // Record of its File_Metadata, empty if the server has none
+};
+
+/// Restore mode of the client: downloads a tree, a subtree or a snapshot into a local directory over parallel
+/// connections, the server sending the file contents with sendfile. Every file is written to a ".rab-part" file next
+/// to its destination and renamed once its hash matches, so running an interrupted restore again resumes it. The
+/// permissions, owners, times, attributes and links are applied once every content is in place
+class Restore_Client {
+    /// A connection to the server, used by one thread only
+    struct Connection {
+        boost::asio::io_context io_context;
+        tcp::socket socket{io_context};
+        Transport transport;
+        boost::asio::streambuf read_buf;
+
+        explicit Connection(std::shared_ptr<Tls_Context> tls) : transport(socket, std::move(tls)) {}
+    };
+
+    tcp::resolver::results_type endpoints;
+    Credentials cred;
+    std::string destination;
+    std::string path;
+    int64_t snapshot;
+    int64_t version;
+    unsigned streams;
+    std::shared_ptr<Tls_Context> tls;
+    std::shared_ptr<Buffer_Pool> pool = std::make_shared<Buffer_Pool>();
+    std::deque<Restore_Entry> pending;      // Files not taken by a stream yet, largest first
+    std::vector<std::string> failed;
+    std::mutex pending_mutex;      // Guards pending, failed and the ticket of cred
+    std::atomic<uint64_t> bytes_received{0};
+    std::atomic<size_t> files_restored{0};
+    std::atomic<size_t> files_present{0};
+
+    /// Connects and logs in, throws std::runtime_error if the server refuses the credentials
+    void open(Connection &connection);
+
+    /// Sends a request with the given json data
+    void send(Connection &connection, action_type action, const boost::property_tree::ptree &pt);
+
+    /// Reads the next message, leaving in the buffer the bytes that follow it, and returns its header and data
+    std::pair<int, std::string> receive(Connection &connection);
+
+    /// Gets the elements to restore from the server
+    std::vector<Restore_Entry> fetch_manifest(Connection &connection);
+
+    /// Takes the pending files one by one until none is left, reconnecting if the connection drops
+    void do_stream();
+
+    /// Downloads a file from the bytes already in its part file; returns false if the content does not match its hash
+    bool restore_file(Connection &connection, const Restore_Entry &entry);
+
+    /// Gets the local path of an element, throws std::ios_base::failure if it would land outside the destination
+    std::string local_path(const std::string &element) const;
+
+    /// Applies the metadata of the restored elements, the directories last and deepest first so that restoring their
+    /// content does not change them again; the owner is restored only when running as root
+    void apply_metadata(const std::vector<Restore_Entry> &entries);
+
+    /// Hashes a local file as the client does before uploading it
+    static std::string hash_file(const std::string &file);
+
+public:
+
+    /// Restores path (empty for the whole tree) as it is now, at the given snapshot or at the given version of a file
+    Restore_Client(const tcp::resolver::results_type &endpoints, Credentials cred, std::string destination, std::string path,
+                   int64_t snapshot = 0, int64_t version = 0, unsigned streams = 4, std::shared_ptr<Tls_Context> tls = nullptr);
+
+    /// Downloads everything and returns true if no element failed, throws if the server can not be reached
+    bool run();
+};
@@ -0,0 +1,28 @@
+#include "Retry_Policy.h"
+#include <algorithm>
+
+Retry_Policy::Retry_Policy(std::chrono::milliseconds initial, std::chrono::milliseconds longest, unsigned max_failures, double jitter, uint32_t seed)
+        : initial(std::max(initial, std::chrono::milliseconds(1))), longest(std::max(longest, this->initial)), max_failures(max_failures),
+        jitter(std::clamp(jitter, 0.0, 1.0)), next(this->initial), generator(seed) {}
+
+std::chrono::milliseconds Retry_Policy::failed() {
+    failures++;
+    auto wait = is_open() ? longest : next;     // Once open, only a probe now and then
+    next = std::min(next * 2, longest);
+    auto spread = static_cast<std::chrono::milliseconds::rep>(static_cast<double>(wait.count()) * jitter);
+    if (spread > 0) wait -= std::chrono::milliseconds(generator() % (spread + 1));
+    return wait;
+}
+
+void Retry_Policy::succeeded() {
+    failures = 0;
+    next = initial;
+}
+
+bool Retry_Policy::is_open() const {
+    return max_failures != 0 && failures >= max_failures;
+}
+
+unsigned Retry_Policy::failure_count() const {
+    return failures;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+/// Spaces out the attempts of an operation that keeps failing. The waits grow exponentially from the initial one up to
+/// the longest one, each shortened at random by up to the jitter fraction so that many clients failing together do not
+/// come back together. After max_failures failures in a row the circuit opens: the caller stops retrying on its own, or
+/// only probes once every longest wait, until an attempt succeeds and closes it again
+class Retry_Policy {
+    std::chrono::milliseconds initial;
+    std::chrono::milliseconds longest;
+    unsigned max_failures;
+    double jitter;
+    std::chrono::milliseconds next;     // Wait after the next failure, before the jitter
+    unsigned failures = 0;      // Failures in a row
+    std::minstd_rand generator;
+
+public:
+
+    /// A policy whose circuit never opens when max_failures is 0
+    Retry_Policy(std::chrono::milliseconds initial, std::chrono::milliseconds longest, unsigned max_failures = 0, double jitter = 0.5,
+                 uint32_t seed = std::random_device{}());
+
+    /// Counts a failure and gets the wait before the next attempt
+    std::chrono::milliseconds failed();
+
+    /// Closes the circuit and starts again from the initial wait
+    void succeeded();
+
+    /// Whether the failures in a row reached max_failures
+    bool is_open() const;
+
+    /// Gets the number of failures in a row
+    unsigned failure_count() const;
+};
@@ -0,0 +1,97 @@
+#include "Scrubber.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "File_Extents.h"
+#include "Server_Session.h"
+
+namespace {
+    auto &scrubbed_files = Metrics::instance().counter("rab_scrub_files_total");
+    auto &scrubbed_bytes = Metrics::instance().counter("rab_scrub_bytes_total");
+    auto &mismatches = Metrics::instance().counter("rab_scrub_mismatches_total");
+}
+
+Scrubber::Scrubber(std::chrono::seconds interval, double iops) : interval(interval), read_ops(iops) {
+    if (interval.count() > 0) scrubber = boost::thread([this](){do_scrub();});
+}
+
+Scrubber::~Scrubber() {
+    {
+        std::lock_guard lg(scrub_mutex);
+        running = false;
+    }
+    cv.notify_all();
+    if (scrubber.joinable()) scrubber.join();
+}
+
+bool Scrubber::is_running() {
+    std::lock_guard lg(scrub_mutex);
+    return running;
+}
+
+void Scrubber::do_scrub() {
+    while (true) {
+        {
+            std::unique_lock ul(scrub_mutex);
+            if (cv.wait_for(ul, interval, [this](){return !running;})) return;
+        }
+        Logger::log(Log_Level::info, "Verifying the stored files...");
+        try {
+            scrub_pass();
+        } catch (const boost::filesystem::filesystem_error &err) {
+            Logger::log(Log_Level::error, std::string("Error while verifying the stored files: ") + err.what());
+        } catch (const boost::property_tree::ptree_error &err) {
+            Logger::log(Log_Level::error, std::string("Error while reading the database: ") + err.what());
+        }
+    }
+}
+
+void Scrubber::scrub_pass() {
+    if (!boost::filesystem::is_directory("../../server")) return;
+    for (auto &user_directory : boost::filesystem::directory_iterator("../../server")) {
+        if (!boost::filesystem::is_directory(user_directory)) continue;
+        std::string username = user_directory.path().filename().string();
+        std::map<std::string, std::string> paths;
+        if (!std::get<0>(db.get_paths(paths, username))) continue;
+        for (const auto &[path, hash] : paths) {
+            boost::filesystem::path file(Server_Session::stored_path(username, path));
+            boost::system::error_code ec;
+            if (!boost::filesystem::is_regular_file(file, ec) || boost::filesystem::file_size(file, ec) == 0) continue;
+            if (boost::filesystem::last_write_time(file, ec) > std::time(nullptr) - 60) continue;     // Possibly in the middle of a commit
+            std::string digest = hash_file(file);
+            if (digest.empty()) return;
+            scrubbed_files.add();
+            if (digest == hash) continue;
+            std::map<std::string, std::string> current;     // Ruling out a commit that happened while the file was being read
+            db.get_paths(current, username);
+            auto it = current.find(path);
+            if (it == current.end() || it->second != hash) continue;
+            mismatches.add();
+            Logger::log(Log_Level::error, "Content of " + file.string() + " does not match its hash, moving it to the quarantine");
+            quarantine(username, file);
+        }
+    }
+}
+
+std::string Scrubber::hash_file(const boost::filesystem::path &file) {
+    Content_Hasher hasher;
+    try {   // The holes of sparse files are not read
+        File_Reader reader(file.string());
+        scrubbed_bytes.add(hash_extents(reader, reader.size(), hasher, [this](size_t length) {
+            if (!is_running()) return false;
+            read_ops.acquire(read_operations(length));
+            return true;
+        }));
+    } catch (const std::ios_base::failure &err) {
+        throw boost::filesystem::filesystem_error(err.what(), file, boost::system::error_code(EIO, boost::system::system_category()));
+    }
+    if (!is_running()) return {};
+    return hasher.final();
+}
+
+void Scrubber::quarantine(const std::string &username, const boost::filesystem::path &file) {
+    auto relative = boost::filesystem::relative(file, boost::filesystem::path("../../server") / username);
+    auto target = boost::filesystem::path("../../quarantine") / username / relative;
+    boost::filesystem::create_directories(target.parent_path());
+    boost::filesystem::rename(file, target);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include "Content_Hasher.h"
+#include "Database_Connection.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Rate_Limiter.h"
+
+/// Background verification of the stored files against the hashes recorded in the database. The files whose content
+/// no longer matches are moved to the quarantine area, and the clients send them again at their next synchronization
+class Scrubber {
+    std::chrono::seconds interval;
+    Rate_Limiter read_ops;
+    Database_Connection db;
+    boost::thread scrubber;
+    bool running = true;
+    std::mutex scrub_mutex;
+    std::condition_variable cv;
+
+    /// Waits for the interval to elapse between the verification passes
+    void do_scrub();
+
+    /// Verifies all the files of every user once
+    void scrub_pass();
+
+    /// Hashes a stored file, pacing the reads at the allowed rate and skipping its holes; returns an empty string if the
+    /// scrubber is stopped, throws boost::filesystem::filesystem_error if the file can not be read
+    std::string hash_file(const boost::filesystem::path &file);
+
+    /// Moves a corrupted file to ../../quarantine, keeping its path relative to the storage
+    void quarantine(const std::string &username, const boost::filesystem::path &file);
+
+    bool is_running();
+
+public:
+
+    /// Verifies the storage every interval, issuing at most iops reads of 64 KiB per second; an interval of 0 disables it
+    Scrubber(std::chrono::seconds interval, double iops);
+
+    /// Stops the pass in progress and waits for the thread to end
+    ~Scrubber();
+};
@@ -1,6 +1,32 @@
 #include <iostream>
 #include <boost/asio.hpp>
 #include "Backup_Server.h"
+#include "Config.h"
+#include "Stats_Exporter.h"
+#include "Version_Store.h"
+
+/// Prints the storage taken by every user, from the usage counters of the version index
+int print_usage(const Server_Config &config) {
+    Version_Store versions(Retention_Policy{config.keep_versions, config.keep_days, config.keep_snapshots}, config.durable_writes);
+    auto limit = [](std::optional<uint64_t> value, uint64_t fallback) {
+        uint64_t limit = value.value_or(fallback);
+        return limit == 0 ? std::string("-") : std::to_string(limit);
+    };
+    std::cout << "user\tbytes\tfiles\tquota_bytes\tquota_files" << std::endl;
+    for (auto &usage : versions.usage())
+        std::cout << usage.username << "\t" << usage.bytes << "\t" << usage.files << "\t" << limit(usage.quota_bytes, config.quota_bytes)
+                  << "\t" << limit(usage.quota_files, config.quota_files) << std::endl;
+    return 0;
+}
+
+/// Sets the limits of a user, "default" keeps the one of the configuration
+int set_quota(const Server_Config &config, const std::string &username, const std::string &bytes, const std::string &files) {
+    Version_Store versions(Retention_Policy{config.keep_versions, config.keep_days, config.keep_snapshots}, config.durable_writes);
+    auto parse = [](const std::string &value) {
+        return value == "default" ? std::optional<uint64_t>() : std::optional<uint64_t>(std::stoull(value));
+    };
+    return versions.set_quota(username, parse(bytes), parse(files)) ? 0 : 1;
+}
 
 
 int main(int argc, char* argv[]) {
@@ -8,15 +34,32 @@ int main(int argc, char* argv[]) {
     try {
 
         if (argc < 2) {
-            std::cerr << "Usage: Backup_Server <port>\n";
+            std::cerr << "Usage: Backup_Server <port> [config.json]\n"
+                         "       Backup_Server --usage [config.json]\n"
+                         "       Backup_Server --quota <username> <bytes|default> <files|default> [config.json]\n";
             return 1;
         }
 
+        if (std::string(argv[1]) == "--usage") return print_usage(argc > 2 ? load_server_config(argv[2]) : Server_Config());
+        if (std::string(argv[1]) == "--quota") {
+            if (argc < 5) {
+                std::cerr << "Usage: Backup_Server --quota <username> <bytes|default> <files|default> [config.json]\n";
+                return 1;
+            }
+            return set_quota(argc > 5 ? load_server_config(argv[5]) : Server_Config(), argv[2], argv[3], argv[4]);
+        }
+
+        Server_Config config = argc > 2 ? load_server_config(argv[2]) : Server_Config();
+        Logger::set_level(Logger::parse_level(config.log_level));
+        Stats_Exporter exporter(config.metrics_port, config.stats_file, std::chrono::seconds(config.stats_interval));
+
+        boost::asio::thread_pool workers(config.workers ? config.workers : std::max(1u, std::thread::hardware_concurrency()));
         boost::asio::io_context io_context;
         boost::asio::ip::tcp::resolver resolver(io_context);
         boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), std::stoi(argv[1]));
-        Backup_Server bs(io_context, endpoint);
+        Backup_Server bs(io_context, workers, endpoint, config);
         io_context.run();
+        workers.join();     // The requests still being handled may post their answers to the io_context
 
     } catch (const std::exception& e) {
         std::cerr << "Exception: " << e.what() << "\n";
@@ -1,58 +1,211 @@
 #include "Server_Session.h"
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <openssl/rand.h>
+#include <random>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Content_Proof.h"
+#include "File_Extents.h"
+#include "File_Metadata.h"
 
-Server_Session::Server_Session(tcp::socket &socket) : socket_(std::move(socket)), successful_first_loading(false) {}
+namespace {
+    auto &bytes_received = Metrics::instance().counter("rab_bytes_received_total{side=\"server\"}");
+    auto &bytes_sent = Metrics::instance().counter("rab_bytes_sent_total{side=\"server\"}");
+    auto &queue_depth = Metrics::instance().gauge("rab_write_queue_depth{side=\"server\"}");
+    auto &queue_bytes = Metrics::instance().gauge("rab_queued_bytes{side=\"server\"}");
+    auto &read_pauses = Metrics::instance().counter("rab_backpressure_waits_total{side=\"server\"}");
+    auto &sessions = Metrics::instance().gauge("rab_sessions");
+    auto &quota_refusals = Metrics::instance().counter("rab_quota_refusals_total");
+    auto &server_busy = Metrics::instance().counter("rab_admission_refusals_total{reason=\"saturated\"}");
+    auto &user_busy = Metrics::instance().counter("rab_admission_refusals_total{reason=\"user_sessions\"}");
+    auto &session_lag = Metrics::instance().histogram("rab_session_lag_seconds");
+    auto &metadata_updates = Metrics::instance().counter("rab_metadata_updates_total");
+    auto &dedup_files = Metrics::instance().counter("rab_dedup_files_total");
+    auto &dedup_bytes = Metrics::instance().counter("rab_dedup_bytes_total");
+    auto &dedup_refusals = Metrics::instance().counter("rab_dedup_proof_mismatches_total");
+    Message_Counters messages_received("rab_messages_received_total", "server");
+    Message_Counters messages_sent("rab_messages_sent_total", "server");
+}
+
+Server_Session::Server_Session(tcp::socket &socket, boost::asio::thread_pool &workers, std::shared_ptr<Fair_Scheduler> scheduler, std::shared_ptr<Version_Store> versions,
+                               std::shared_ptr<Staging_Area> staging, std::shared_ptr<Authenticator> auth, std::shared_ptr<Tls_Context> tls, const Server_Config &config)
+        : socket_(std::move(socket)), transport(socket_, std::move(tls)), successful_first_loading(false), pool(std::make_shared<Buffer_Pool>()),
+        strand(boost::asio::make_strand(workers)), scheduler(std::move(scheduler)), max_sessions(config.max_sessions),
+        max_user_sessions(config.max_user_sessions), max_backlog(config.max_backlog_bytes), retry_seconds(std::max(1u, config.retry_seconds)),
+        max_queued_bytes(config.max_session_bytes), resume(socket_.get_executor()), commits(config.durable_writes, config.syncfs_threshold), versions(std::move(versions)),
+        staging(std::move(staging)), quota_bytes(config.quota_bytes), quota_files(config.quota_files), auth(std::move(auth)) {
+    flow = this->scheduler->open([strand = strand](std::function<void()> task) {boost::asio::post(strand, std::move(task));});
+    sessions.add(1);
+}
 
 void Server_Session::start() {
-    do_read();
+    boost::asio::co_spawn(socket_.get_executor(), read_requests(shared_from_this()), boost::asio::detached);
 }
 
-void Server_Session::do_read() {
-    std::cout << "Reading message..." << std::endl;
-    auto self(shared_from_this());
-    boost::asio::async_read_until(socket_, read_buf, delimiter,
-                                  [this, self](const boost::system::error_code ec, std::size_t length){
-                                      if (!ec) {
-                                          std::string str(boost::asio::buffers_begin(read_buf.data()),
-                                                          boost::asio::buffers_begin(read_buf.data()) + read_buf.size());
-                                          read_buf.consume(length);     // Cropping buffer in order to let the next do_read work properly
-                                          str.resize(length);           // Cropping in order to erase residuals taken from the buffer
-                                          Message msg;
-                                          *msg.get_msg_ptr() = str;
-                                          request_handler(msg);
-                                          do_read();
-                                      } else {
-                                          if (!username.empty()) std::cout << "Client " << username << " disconnected, closing session..." << std::endl;
-                                          else std::cerr << "Error during login phase, closing session..." << std::endl;
-                                      }
-                                  });
+boost::asio::awaitable<void> Server_Session::read_requests(std::shared_ptr<Server_Session> self) {
+    boost::system::error_code ec;
+    if (transport.secure()) {
+        co_await transport.async_handshake(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        if (ec) {
+            Logger::log(Log_Level::warning, "TLS handshake failed, closing session: " + ec.message());
+            co_return;
+        }
+    }
+    read_buf.prepare(Message::read_room);    // The reads take in up to this many bytes at once, many small messages with a single call
+    while (true) {
+        Logger::log(Log_Level::trace, "Reading message...");
+        size_t length = Message::complete_length(std::string_view(static_cast<const char*>(read_buf.data().data()), read_buf.size()));
+        if (length == 0) length = co_await boost::asio::async_read_until(transport, read_buf, delimiter, boost::asio::redirect_error(boost::asio::use_awaitable, ec));    // Messages already received are handled without waiting
+        if (ec) break;
+        bytes_received.add(length);
+        auto request = std::make_shared<Pooled_Buffer>(pool->acquire());   // Freeing the receive buffer, so that the reading goes on while the request is handled
+        request->str().assign(static_cast<const char*>(read_buf.data().data()), length);
+        read_buf.consume(length);     // Cropping buffer so that the next read starts from the following message
+        queued_requests++;
+        queued_bytes += length;
+        queue_bytes.add(static_cast<double>(length));
+        scheduler->submit(flow, length, [this, self, length, request = std::move(request)]() {
+            if (authenticating) deferred.push_back(std::move(*request));   // Waiting for the login outcome
+            else request_handler(request->str());
+            release_bytes(length);
+        });
+        if (queued_bytes >= max_queued_bytes) {   // Leaving the next requests in the socket, TCP slows the client down
+            read_paused = true;
+            read_pauses.add();
+            if (queued_bytes >= max_queued_bytes / 2 || !read_paused.exchange(false)) {
+                resume.expires_at(boost::asio::steady_timer::time_point::max());
+                boost::system::error_code cancelled;
+                co_await resume.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, cancelled));    // Cancelled by release_bytes
+                if (!socket_.is_open()) break;
+            }
+        }
+    }
+    if (!username.empty()) Logger::log(Log_Level::info, "Client " + username + " disconnected, closing session...");
+    else Logger::log(Log_Level::warning, "Error during login phase, closing session...");
+    scheduler->submit(flow, 0, [this, self]() {close_session();});
+}
+
+void Server_Session::release_bytes(size_t bytes) {
+    queued_bytes -= bytes;
+    queue_bytes.add(-static_cast<double>(bytes));
+    if (read_paused && queued_bytes < max_queued_bytes / 2 && read_paused.exchange(false))
+        boost::asio::post(socket_.get_executor(), [this, self = shared_from_this()]() {resume.cancel();});
+}
+
+File_Body &File_Body::operator=(File_Body &&other) noexcept {
+    if (this != &other) {
+        if (fd >= 0) ::close(fd);
+        fd = std::exchange(other.fd, -1);
+        offset = other.offset;
+        length = std::exchange(other.length, 0);
+    }
+    return *this;
+}
+
+File_Body::~File_Body() {
+    if (fd >= 0) ::close(fd);
 }
 
 void Server_Session::do_write() {
-    std::cout << "Writing message..." << std::endl;
+    Logger::log(Log_Level::trace, "Writing message...");
     auto self(shared_from_this());
-    boost::asio::async_write(socket_,
-                             boost::asio::dynamic_string_buffer(*write_queue_s.front().get_msg_ptr()),
-                             [this, self](boost::system::error_code ec, std::size_t length) {
+    boost::asio::const_buffer buffer;
+    bool body;
+    {
+        std::lock_guard lg(wq_mutex);
+        buffer = write_queue_s.front().msg.buffer();
+        body = write_queue_s.front().body.length > 0;
+    }
+    if (body) set_cork(true);   // Header and file leave in full segments, without waiting for the acks of a partial one
+    boost::asio::async_write(transport,
+                             buffer,
+                             [this, self, body](boost::system::error_code ec, std::size_t length) {
                                  if (!ec) {
-                                     std::lock_guard lg(wq_mutex);      // Lock in order to guarantee thread safe pop operation
-                                     write_queue_s.pop();
-                                     if (!write_queue_s.empty()) do_write();
+                                     bytes_sent.add(length);
+                                     if (body) do_send_body();
+                                     else finish_write();
                                  } else {
-                                     std::cerr << "Error inside do_write: " << ec.message() << std::endl;
+                                     Logger::log(Log_Level::error, "Error inside do_write: " + ec.message());
                                  }
                              });
 }
 
-void Server_Session::enqueue_msg(const Message &msg) {
+void Server_Session::do_send_body() {
+    File_Body *body;
+    {
+        std::lock_guard lg(wq_mutex);
+        body = &write_queue_s.front().body;     // References to the elements of the queue survive the pushes
+    }
+    boost::system::error_code ec;
+    socket_.native_non_blocking(true, ec);
+    while (!ec && body->length > 0) {
+        ssize_t sent = transport.send_file(body->fd, body->offset, std::min<size_t>(body->length, 1 << 30));    // sendfile, encrypted by the kernel with kTLS
+        if (sent > 0) {
+            body->length -= sent;
+            bytes_sent.add(sent);
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {    // Socket buffer full, going on once it drains
+            socket_.async_wait(tcp::socket::wait_write, [this, self = shared_from_this()](const boost::system::error_code &error) {
+                if (!error) do_send_body();
+                else Logger::log(Log_Level::error, "Error inside do_send_body: " + error.message());
+            });
+            return;
+        } else {
+            ec = sent == 0 ? boost::asio::error::eof : boost::system::error_code(errno, boost::system::system_category());
+        }
+    }
+    if (ec) {   // The client expects the announced length, the stream can not be resynchronized
+        Logger::log(Log_Level::error, "Error while sending a file: " + ec.message());
+        socket_.close(ec);
+        return;
+    }
+    set_cork(false);    // Flushing the last partial segment
+    finish_write();
+}
+
+void Server_Session::set_cork(bool cork) {
+    int value = cork;
+    ::setsockopt(socket_.native_handle(), IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+}
+
+void Server_Session::finish_write() {
+    bool more;
+    size_t written;
+    {
+        std::lock_guard lg(wq_mutex);      // Lock in order to guarantee thread safe pop operation
+        double lag = write_queue_s.front().msg.get_age();    // Time from the arrival of the request to the answer being written
+        session_lag.observe(lag);
+        if (lag_gauge) lag_gauge->set(lag);
+        written = write_queue_s.front().msg.size();
+        write_queue_s.pop();
+        queue_depth.add(-1);
+        if (restoring && write_queue_s.size() < restore_window)   // Reading the next chunks only once the previous ones are sent
+            scheduler->submit(flow, restore_chunk, [this, self = shared_from_this()]() {continue_restore();});     // Disk reads of the user, in its share
+        more = !write_queue_s.empty();
+    }
+    release_bytes(written);
+    if (more) do_write();
+}
+
+void Server_Session::enqueue_msg(Message &&msg) {
+    enqueue_file(std::move(msg), File_Body());
+}
+
+void Server_Session::enqueue_file(Message &&msg, File_Body &&body) {
     std::lock_guard lg(wq_mutex);       // Lock in order to guarantee thread safe push operation
     bool write_in_progress = !write_queue_s.empty();
-    write_queue_s.push(msg);
-    if (!write_in_progress) do_write();     // Calling do_write only if it is not already running
+    queued_bytes += msg.size();     // The file bodies are read from the page cache as they are sent, they do not count
+    queue_bytes.add(static_cast<double>(msg.size()));
+    write_queue_s.push({std::move(msg), std::move(body)});
+    queue_depth.add(1);
+    if (!write_in_progress) boost::asio::post(socket_.get_executor(), [this, self = shared_from_this()]() {do_write();});   // Writing from the network thread only
 }
 
-std::string Server_Session::do_write_element(action_type header, const std::string& data) {
+std::tuple<std::string, size_t, bool> Server_Session::do_write_element(action_type header, std::string_view data) {
     try {
-        std::lock_guard lg(fs_mutex);
+        std::unique_lock ul(fs_mutex);
         boost::property_tree::ptree pt;
         std::stringstream data_stream;
         data_stream << data;
@@ -60,26 +213,67 @@ std::string Server_Session::do_write_element(action_type header, const std::stri
         auto path = pt.get<std::string>("path");
         auto hash = pt.get<std::string>("hash");
         bool isFile = pt.get<bool>("isFile");
+        auto status = header == action_type::create ? status_type::created : status_type::updated;
         std::string directory = std::string("../../server/") + std::string(username);
         if (!boost::filesystem::is_directory(directory)) boost::filesystem::create_directory(directory);
-        std::string relative_path = directory + std::string("/") + std::string(path);   // Creating actual filesystem path
-        while (relative_path.find(':') < relative_path.size())     // Resetting the original path format of the file or directory
-            relative_path.replace(relative_path.find(':'), 1, ".");
+        std::string relative_path = stored_path(username, path);   // Creating actual filesystem path
+        if (commits.contains(relative_path)) {      // The previous version must be in place before this one is handled
+            ul.unlock();    // Taken again by the commit, the strand keeps the other requests out meanwhile
+            flush_commits();
+            ul.lock();
+        }
         if (header == action_type::create && !isFile) {     // Creating a directory with the specified name
-            if (boost::filesystem::create_directory(relative_path)) update_paths(path, hash);
-        } else {        // Creating a file with the specified name
-            auto content = pt.get<std::string>("content");
-            std::vector<BYTE> decodedData = base64_decode(content);
-            boost::filesystem::ofstream outFile(relative_path.data());
-            if (outFile.write(reinterpret_cast<const char *>(decodedData.data()), decodedData.size()).good()) {
-                update_paths(path, hash);
-                outFile.close();
-            } else {
-                outFile.close();
-                socket_.close();
-            }
+            boost::filesystem::create_directory(relative_path);
+            commits.add_directory(relative_path, [this, path, hash, status](bool ok) {commit_done(path, hash, false, 0, status, ok);});
+            return {path, 0, true};
+        }
+        if (pt.get<bool>("probe", false) || pt.count("proof")) {     // Asking whether the content has to be sent
+            auto size = pt.get<uint64_t>("size");
+            if (!reserve_quota(path, size)) throw Quota_Exceeded(path);
+            if (deduplicate(path, hash, size, pt.get<std::string>("proof", ""), status)) return {path, size, true};
+            return {path, committed_offset(path, hash), false};     // Sent from the bytes already staged
         }
-        return path;
+        // Appending the chunk to the partial upload in the staging area
+        auto offset = pt.get<size_t>("offset", 0);
+        const auto &content = pt.get_child("content").data();
+        decode_buffer.resize(base64_decoded_max_size(content.size()));      // The buffer is reused by the following chunks
+        size_t decoded_size = base64_decode(content.data(), content.size(), decode_buffer.data());
+        auto hole = pt.get<size_t>("hole", 0);     // Zeros before the content, left as a hole of the staging file
+        auto size = pt.get<size_t>("size", offset + hole + decoded_size);    // Messages without size carry the whole file
+        if (!reserve_quota(path, size)) throw Quota_Exceeded(path);    // Reserved by the first chunk or the probe, the rest of a refused file is refused too
+        std::string part = staging_path(path, hash);
+        if (offset == 0) discard_partials(path, hash);     // A new upload of the file makes the other partial ones stale
+        hold_staged(part);
+        size_t committed = committed_offset(path, hash);
+        if (committed < offset) {   // Sent before the upload was restarted, by a newer content or a snapshot of the file
+            Logger::log(Log_Level::debug, "Stale chunk of " + path + " at byte " + std::to_string(offset) + " ignored");
+            return {path, committed, false};
+        }
+        if (committed > offset) boost::filesystem::resize_file(part, offset);   // The client restarted from an earlier offset
+        auto upload = upload_hashes.find(part);
+        if (upload == upload_hashes.end() || upload->second.offset != offset)
+            upload = upload_hashes.insert_or_assign(part, resume_hash(part, offset)).first;
+        upload->second.hasher.update_zeros(hole);
+        upload->second.hasher.update(reinterpret_cast<const char *>(decode_buffer.data()), decoded_size);   // Hashing while streaming, no second pass
+        if (!write_chunk(part, offset, hole, decode_buffer.data(), decoded_size)) {
+            upload_hashes.erase(upload);
+            boost::system::error_code ec;
+            boost::filesystem::resize_file(part, offset, ec);    // Dropping the torn chunk, the upload can be resumed from offset
+            throw std::ios_base::failure("Unable to write the chunk of " + path);
+        }
+        committed = offset + hole + decoded_size;
+        upload->second.offset = committed;
+        if (committed < size) return {path, committed, false};
+        std::string digest = upload->second.hasher.final();
+        upload_hashes.erase(upload);
+        if (size > 0 && digest != hash) {   // Empty files are hashed by metadata on the client, there is nothing to check
+            boost::filesystem::remove(part);    // Rolling back, the stored copy, if any, stays the previous one
+            release_staged(part);
+            release_quota(path);
+            throw Content_Mismatch(path);
+        }
+        commits.add(part, relative_path, [this, path, hash, size, status](bool ok) {commit_done(path, hash, true, size, status, ok);});
+        return {path, committed, true};     // Answered by commit_done once the file is durable in place
     } catch (const boost::property_tree::ptree_error &err) {
         throw;
     } catch (const std::ios_base::failure &err) {
@@ -87,21 +281,217 @@ std::string Server_Session::do_write_element(action_type header, const std::stri
     }
 }
 
-void Server_Session::do_remove_element(const std::string& path) {
-    std::scoped_lock lg(paths_mutex, fs_mutex);    // Lock in order to guarantee thread safe operations on paths map and filesystem
-    std::string directory = std::string("../../server/") + std::string(username);
-    std::string relative_path = directory + std::string("/") + std::string(path);
+bool Server_Session::deduplicate(const std::string& path, const std::string& hash, uint64_t size, const std::string& proof, status_type status) {
+    auto object = versions->find_object(hash, size);
+    if (!object) return false;
+    auto issued = challenges.find(path);
+    if (proof.empty() || issued == challenges.end() || issued->second.second != hash) {
+        unsigned char random[16];
+        if (RAND_bytes(random, sizeof(random)) != 1) return false;
+        std::ostringstream nonce;
+        nonce << std::hex << std::setfill('0');
+        for (auto c : random) nonce << std::setw(2) << static_cast<int>(c);
+        challenges[path] = {nonce.str(), hash};
+        throw Possession_Challenge(path + " " + nonce.str());
+    }
+    std::string nonce = std::move(issued->second.first);
+    challenges.erase(issued);   // A nonce is good for a single proof
+    if (content_proof(object->content, nonce) != proof) {   // A different content with the same hash, or no content at all
+        dedup_refusals.add();
+        Logger::log(Log_Level::info, "Proof of " + path + " does not match the kept content, it is uploaded");
+        return false;
+    }
+    std::string part = staging_path(path, hash) + ".shared";    // Never written, unlike the partial uploads
+    hold_staged(part);
+    if (!versions->keep_content(object->content, part)) {
+        release_staged(part);
+        return false;
+    }
+    dedup_files.add();
+    dedup_bytes.add(static_cast<double>(size));
+    Logger::log(Log_Level::debug, "Content of " + path + " shared with version " + std::to_string(object->id) + " of " + object->username);
+    commits.add(part, stored_path(username, path), [this, path, hash, size, status](bool ok) {commit_done(path, hash, true, size, status, ok);});
+    return true;
+}
+
+bool Server_Session::reserve_quota(const std::string& path, uint64_t size) {
+    auto reserved = reservations.find(path);
+    if (reserved != reservations.end()) {
+        if (reserved->second.size == size) return true;
+        versions->release(username, reserved->second);     // Another content of the file, with its own size
+        reservations.erase(reserved);
+    }
+    auto reservation = versions->reserve(username, path, size, quota_bytes, quota_files);
+    if (!reservation) return false;
+    reservations.emplace(path, *reservation);
+    return true;
+}
+
+void Server_Session::release_quota(const std::string& path) {
+    auto reserved = reservations.find(path);
+    if (reserved == reservations.end()) return;
+    versions->release(username, reserved->second);
+    reservations.erase(reserved);
+}
+
+bool Server_Session::write_chunk(const std::string& part, size_t offset, size_t hole, const BYTE *data, size_t length) {
+    int fd = ::open(part.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = !hole || ::ftruncate(fd, static_cast<off_t>(offset + hole)) == 0;    // Growing the file without writing leaves a hole
+    for (size_t written = 0; ok && written < length;) {
+        ssize_t result = ::pwrite(fd, data + written, length - written, static_cast<off_t>(offset + hole + written));
+        if (result < 0 && errno == EINTR) continue;
+        ok = result > 0;
+        if (ok) written += result;
+    }
+    return ::close(fd) == 0 && ok;
+}
+
+Upload_Hash Server_Session::resume_hash(const std::string& part, size_t offset) {
+    Upload_Hash upload;
+    if (offset == 0) return upload;
+    File_Reader file(part);
+    if (file.size() < offset) throw std::ios_base::failure("Missing bytes before offset of " + part);
+    hash_extents(file, offset, upload.hasher);      // The holes left by the previous chunks are hashed without being read
+    upload.offset = offset;
+    return upload;
+}
+
+void Server_Session::flush_commits() {
+    if (commits.empty()) return;
+    {
+        std::lock_guard lg(fs_mutex);
+        commits.commit();
+    }
+    versions->record(username, pending_versions);    // The previous versions stay available from the history
+    {
+        std::lock_guard lg(fs_mutex);
+        for (auto &version : pending_versions) release_quota(version.path);    // Counted by the usage once recorded
+    }
+    pending_versions.clear();
+    {
+        std::lock_guard lg(paths_mutex);
+        update_db();    // One database write for the whole batch
+    }
+    for (auto &answer : commit_answers) enqueue_msg(std::move(answer));     // Acknowledging only what is durable and recorded
+    commit_answers.clear();
+}
+
+void Server_Session::commit_done(const std::string& path, const std::string& hash, bool isFile, uint64_t size, status_type status, bool ok) {
+    if (isFile) {   // Moved in place, or left to be sent again
+        release_staged(staging_path(path, hash));
+        release_staged(staging_path(path, hash) + ".shared");
+    }
+    if (!ok) release_quota(path);   // Recorded ones keep their room until the usage counts them
+    if (ok) {
+        update_paths(path, hash);
+        std::string metadata;
+        if (auto pending = pending_metadata.find(path); pending != pending_metadata.end()) {
+            metadata = std::move(pending->second);
+            pending_metadata.erase(pending);
+        }
+        pending_versions.push_back({0, path, hash, size, isFile, 0, false, isFile ? stored_path(username, path) : std::string(), std::move(metadata)});
+    }
+    if (closing) return;
+    Message answer(pool);
+    if (ok) {
+        messages_sent.count(status);
+        answer.encode_message(status, path + (status == status_type::created ? " created" : " updated"));
+    } else {
+        messages_sent.count(status_type::service_unavailable);
+        answer.encode_message(status_type::service_unavailable, "Communication error");    // The client synchronizes again and sends the file
+    }
+    commit_answers.push_back(std::move(answer));
+}
+
+void Server_Session::store_metadata(std::vector<std::pair<std::string, std::string>>& records) {
+    std::erase_if(records, [](const std::pair<std::string, std::string> &record) {
+        try {
+            File_Metadata::decode(record.second);
+            return false;
+        } catch (const std::invalid_argument &err) {
+            Logger::log(Log_Level::warning, "Malformed metadata of " + record.first + " ignored");
+            return true;
+        }
+    });
+    metadata_updates.add(static_cast<double>(records.size()));
+    if (!versions->set_metadata(username, records)) return;     // Sent again after the next login
+    for (auto &record : records) pending_metadata[record.first] = std::move(record.second);     // Their upload is not committed yet
+}
+
+std::string Server_Session::stored_path(const std::string& username, const std::string& path) {
+    std::string relative_path = std::string("../../server/") + username + std::string("/") + path;
     while (relative_path.find(':') < relative_path.size())     // Resetting the original path format of the file or directory
         relative_path.replace(relative_path.find(':'), 1, ".");
+    return relative_path;
+}
+
+void Server_Session::drop_missing_paths() {
+    std::lock_guard lg(paths_mutex);
+    for (auto it = paths.begin(); it != paths.end();) {
+        if (boost::filesystem::exists(stored_path(username, it->first))) {
+            ++it;
+        } else {
+            Logger::log(Log_Level::info, "Element " + it->first + " of " + username + " is missing from the storage");
+            it = paths.erase(it);
+        }
+    }
+}
+
+std::string Server_Session::staging_path(const std::string& path, const std::string& hash) {
+    Content_Hasher hasher;
+    hasher.update_raw(path.data(), path.size());    // Hashing the path in order to get a flat file name
+    return "../../staging/" + username + "/" + hasher.final() + "_" + hash + ".part";
+}
+
+size_t Server_Session::committed_offset(const std::string& path, const std::string& hash) {
+    boost::system::error_code ec;
+    auto committed = boost::filesystem::file_size(staging_path(path, hash), ec);
+    return ec ? 0 : committed;
+}
+
+void Server_Session::discard_partials(const std::string& path, const std::string& hash) {
+    boost::filesystem::path part(staging_path(path, hash));
+    boost::filesystem::create_directories(part.parent_path());
+    std::string prefix = part.filename().string().substr(0, 2 * MD5_DIGEST_LENGTH + 1);    // Partial uploads of the same path share the hashed path prefix
+    for (auto &element : boost::filesystem::directory_iterator(part.parent_path())) {
+        std::string name = element.path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) == 0 && element.path() != part) {
+            boost::filesystem::remove(element.path());
+            release_staged(element.path().string());
+        }
+    }
+}
+
+void Server_Session::hold_staged(const std::string& part) {
+    if (staged.insert(part).second) staging->hold(part);
+}
+
+void Server_Session::release_staged(const std::string& part) {
+    if (staged.erase(part)) staging->release(part);
+}
+
+void Server_Session::do_remove_element(const std::string& path) {
+    std::scoped_lock lg(paths_mutex, fs_mutex);    // Lock in order to guarantee thread safe operations on paths map and filesystem
+    std::string relative_path = stored_path(username, path);
+    std::vector<Version_Info> removals;     // The element and everything below it, their content stays in the versions area
+    auto mark_removed = [this, &removals](std::map<std::string, std::string>::iterator it) {
+        removals.push_back({0, it->first, std::string(), 0, boost::filesystem::is_regular_file(stored_path(username, it->first)), 0, true});
+        return paths.erase(it);
+    };
+    if (auto it = paths.find(path); it != paths.end()) mark_removed(it);
+    pending_metadata.erase(path);
+    for (auto it = paths.lower_bound(path + "/"); it != paths.end() && it->first < path + "0";) it = mark_removed(it);     // '0' follows '/'
     boost::filesystem::remove_all(relative_path.data());
-    paths.erase(path);
+    versions->record(username, removals);
     update_db();
 }
 
 void Server_Session::update_paths(const std::string& path, const std::string& hash) {
+    static auto &committed = Metrics::instance().counter("rab_elements_committed_total");
+    committed.add();
     std::lock_guard lg(paths_mutex);    // Lock in order to guarantee thread safe operations on paths map
     paths[path] = hash;
-    update_db();
 }
 
 void Server_Session::update_db() {
@@ -113,27 +503,27 @@ void Server_Session::update_db() {
                 do {
                     result = db.update_db_paths(paths, username);
                     if (!result) {
-                        std::cout << "Waiting for " << delay.count() << " sec..." << std::endl;
+                        Logger::log(Log_Level::warning, "Waiting for " + std::to_string(delay.count()) + " sec...");
                         boost::this_thread::sleep_for(delay);   // Waiting for an increasing amount of time
                         delay *= 2;
                     }
                 } while (!result && delay.count() <= 20);    // Looping until either the db is correctly accessed or the delay is too high
-                if (result) std::cout << "Database successfully updated" << std::endl;
-                else std::cout << "Database not updated" << std::endl;
+                if (result) Logger::log(Log_Level::debug, "Database successfully updated");
+                else Logger::log(Log_Level::error, "Database not updated");
                 delay = boost::chrono::milliseconds(30);     // Setting the delay to a value that can break the external loop
             } catch (const boost::property_tree::ptree_error &err) {
-                std::cout << "Waiting for " << delay.count() << " sec..." << std::endl;
+                Logger::log(Log_Level::warning, "Waiting for " + std::to_string(delay.count()) + " sec...");
                 if (delay.count() <= 20) {
                     boost::this_thread::sleep_for(delay);
                     delay *= 2;
                 }
-                if (delay.count() > 20) std::cout << "Database not updated" << std::endl;
+                if (delay.count() > 20) Logger::log(Log_Level::error, "Database not updated");
             }
         } else break;
     }
 }
 
-Diff_paths Server_Session::compare_paths(ptree &client_pt) {
+Diff_paths Server_Session::compare_paths(const std::map<std::string, std::string> &paths, ptree &client_pt, const std::string &root) {
     std::vector<std::string> toAdd;
     for (auto &entry : client_pt) {     // Scanning received map in search for new elements
         auto it = paths.find(entry.first);
@@ -146,42 +536,87 @@ Diff_paths Server_Session::compare_paths(ptree &client_pt) {
         }
     }
     std::vector<std::string> toRem;
-    for (auto &entry : paths) {     // Scanning local map in search for deprecated elements
-        auto it = client_pt.find(entry.first);
-        if (it == client_pt.not_found()) toRem.emplace_back(entry.first);
+    for (auto entry = paths.lower_bound(root); entry != paths.end(); ++entry) {     // Scanning local map in search for deprecated elements
+        if (entry->first.compare(0, root.size(), root) != 0) break;     // Past the elements starting like the root
+        bool inside = root.empty() || entry->first.size() == root.size() || entry->first[root.size()] == '/';
+        if (inside && client_pt.find(entry->first) == client_pt.not_found()) toRem.emplace_back(entry->first);
     }
     return {toAdd, toRem};
 }
 
-void Server_Session::request_handler(Message msg) {
-    Message response_msg;
+bool Server_Session::admitted() {
+    return (max_sessions == 0 || scheduler->session_count() <= max_sessions) && (max_backlog == 0 || scheduler->backlog() <= max_backlog);
+}
+
+std::string Server_Session::retry_hint() const {
+    thread_local std::minstd_rand jitter(std::random_device{}());
+    return "login||" + std::to_string(retry_seconds + jitter() % (retry_seconds + 1));
+}
+
+void Server_Session::finish_login(const std::string& user, const Auth_Result& result) {
+    Message response_msg(pool);
+    int status_type;
     std::string response_str;
+    if (result.status == Auth_Result::granted && !scheduler->join(flow, user, max_user_sessions)) {
+        user_busy.add();
+        Logger::log(Log_Level::warning, "Session refused, " + user + " already has " + std::to_string(max_user_sessions) + " sessions");
+        status_type = 7;
+        response_str = retry_hint();
+    } else if (result.status == Auth_Result::granted) {
+        username = user;
+        lag_gauge = &Metrics::instance().gauge("rab_session_last_lag_seconds{user=\"" + username + "\"}");
+        status_type = 0;
+        response_str = std::string("Access granted||") + result.ticket;    // The ticket lets the client log in again without its password
+    } else if (result.status == Auth_Result::denied) {
+        status_type = 1;
+        response_str = std::string("Access denied, try again");
+    } else {
+        status_type = 7;
+        response_str = std::string("login");
+    }
+    messages_sent.count(status_type);
+    response_msg.encode_message(status_type, response_str);
+    enqueue_msg(std::move(response_msg));
+    authenticating = false;
+    auto pending = std::move(deferred);
+    deferred.clear();
+    for (auto &request : pending) {     // A deferred login defers the following requests again
+        if (authenticating) deferred.push_back(std::move(request));
+        else request_handler(request.str());
+    }
+}
+
+void Server_Session::request_handler(std::string_view request) {
+    Message msg(pool);
+    Message response_msg(pool);
+    Pooled_Buffer response = pool->acquire();
+    std::string &response_str = response.str();
     int status_type = 999;      // Setting status type to an unreachable (wrong) value
+    queued_requests--;
     try {
-        msg.decode_message();
+        msg.decode_message(request);
         auto header = static_cast<action_type>(msg.get_header());
-        std::string data = msg.get_data();
+        messages_received.count(header);
+        if (header != action_type::create && header != action_type::update) flush_commits();    // The other requests see the uploads in place
+        std::string_view data = msg.get_data();
         if (header != action_type::login && username.empty()) {
             status_type = 1;
             response_str = std::string("Login needed");
         } else {
             switch (header) {
                 case (action_type::login) : {
-                    auto credentials = msg.get_credentials();
-                    auto count_avail = db.check_database(std::get<0>(credentials), std::get<1>(credentials));
-                    if (std::get<1>(count_avail)) {         // If db is available
-                        if (std::get<0>(count_avail)) {     // If there is a match
-                            username = std::get<0>(credentials);
-                            status_type = 0;
-                            response_str = std::string("Access granted");
-                        } else {
-                            status_type = 1;
-                            response_str = std::string("Access denied, try again");
-                        }
-                    } else {
+                    if (username.empty() && !admitted()) {     // Refused before the expensive verification
+                        server_busy.add();
                         status_type = 7;
-                        response_str = std::string("login");
+                        response_str = retry_hint();
+                        break;
                     }
+                    auto credentials = msg.get_credentials();
+                    authenticating = true;      // Answered by finish_login, possibly after other logins
+                    auth->authenticate(std::get<0>(credentials), std::get<1>(credentials),
+                                       [this, self = shared_from_this(), user = std::get<0>(credentials)](Auth_Result result) {
+                        boost::asio::post(strand, [this, self, user, result = std::move(result)]() {finish_login(user, result);});
+                    });
                     break;
                 }
                 case (action_type::synchronize) : {
@@ -189,18 +624,21 @@ void Server_Session::request_handler(Message msg) {
                     std::stringstream data_stream;
                     data_stream << data;
                     boost::property_tree::read_json(data_stream, pt);  // Re-creating json from data stream
+                    auto root = pt.get<std::string>(Message::sync_root_key, "");    // Set by the clients backing up several roots
+                    pt.erase(Message::sync_root_key);
                     auto found_avail = db.get_paths(paths, username);
                     if (std::get<1>(found_avail)) {     //  If the database is available
                         successful_first_loading = true;
+                        drop_missing_paths();       // Elements quarantined by the scrubber are sent again
                         if (std::get<0>(found_avail)) {     // Comparing the maps and answering either with in_need o no_need
-                            Diff_paths diffs = compare_paths(pt);
+                            Diff_paths diffs = compare_paths(paths, pt, root);
                             if (diffs.toAdd.empty()) {
                                 status_type = 5;
                                 response_str = "No need";
                             } else {
                                 status_type = 6;
-                                for (const auto &path : diffs.toAdd)
-                                    response_str += path + "||";    // Adding missing paths to the response message
+                                for (const auto &path : diffs.toAdd)    // Adding missing paths and the bytes already staged to the response message
+                                    response_str += path + "|" + std::to_string(committed_offset(path, pt.find(path)->second.data())) + "||";
                             }
                             if (!diffs.toRem.empty()) {
                                 for (const auto &path : diffs.toRem)
@@ -208,7 +646,8 @@ void Server_Session::request_handler(Message msg) {
                             }
                         } else {    // Answering being in_need with the whole map
                             status_type = 6;
-                            for (const auto &path : pt) response_str += path.first + "||";
+                            for (const auto &path : pt)
+                                response_str += path.first + "|" + std::to_string(committed_offset(path.first, path.second.data())) + "||";
                         }
                     } else {
                         status_type = 7;
@@ -216,16 +655,33 @@ void Server_Session::request_handler(Message msg) {
                     }
                     break;
                 }
-                case (action_type::create) : {
-                    std::string path = do_write_element(header, data);
-                    status_type = 2;
-                    response_str = std::string(path) + std::string(" created");
-                    break;
-                }
+                case (action_type::create) :
                 case (action_type::update) : {
-                    std::string path = do_write_element(header, data);
-                    status_type = 3;
-                    response_str = std::string(path) + std::string(" updated");
+                    std::string path;
+                    size_t committed;
+                    bool complete;
+                    try {
+                        std::tie(path, committed, complete) = do_write_element(header, data);
+                    } catch (const Content_Mismatch &err) {     // Asking the client to send the file again
+                        Logger::log(Log_Level::warning, std::string("Content of ") + err.what() + " does not match its hash, upload rejected");
+                        status_type = 10;
+                        response_str.append(err.what());
+                        break;
+                    } catch (const Possession_Challenge &err) {     // Answered by a proof instead of the content
+                        status_type = 15;
+                        response_str.append(err.what());
+                        break;
+                    } catch (const Quota_Exceeded &err) {     // Nothing is stored, the client keeps the file until room is made
+                        quota_refusals.add();
+                        Logger::log(Log_Level::warning, "Upload of " + std::string(err.what()) + " refused, " + username + " is over quota");
+                        status_type = 14;
+                        response_str.append(err.what());
+                        break;
+                    }
+                    if (!complete) {        // Reporting the committed offset of the partial upload, complete ones are answered once committed
+                        status_type = 9;
+                        response_str.append(path).append(" ").append(std::to_string(committed));
+                    }
                     break;
                 }
                 case (action_type::erase) : {
@@ -236,7 +692,40 @@ void Server_Session::request_handler(Message msg) {
                     auto path = pt.get<std::string>("path");
                     do_remove_element(path);
                     status_type = 4;
-                    response_str = std::string(path) + std::string(" erased");
+                    response_str.append(path).append(" erased");
+                    break;
+                }
+                case (action_type::metadata) : {    // Not answered, a malformed frame makes the client synchronize again
+                    boost::property_tree::ptree pt;
+                    std::stringstream data_stream;
+                    data_stream << data;
+                    boost::property_tree::read_json(data_stream, pt);  // Re-creating json from data stream
+                    std::vector<std::pair<std::string, std::string>> records;
+                    for (auto &entry : pt.get_child("entries"))
+                        records.emplace_back(entry.second.get<std::string>("path"), entry.second.get<std::string>("meta"));
+                    store_metadata(records);
+                    break;
+                }
+                case (action_type::history) :
+                case (action_type::snapshot) :
+                case (action_type::restore) : {
+                    boost::property_tree::ptree pt;
+                    std::stringstream data_stream;
+                    data_stream << data;
+                    boost::property_tree::read_json(data_stream, pt);  // Re-creating json from data stream
+                    if (header == action_type::history) {
+                        status_type = 11;
+                        response_str = list_history(pt);
+                    } else if (header == action_type::snapshot) {
+                        status_type = 12;
+                        response_str = list_snapshots(pt);
+                    } else if (pt.get<bool>("manifest", false)) {
+                        send_manifest(pt);
+                    } else if (pt.get<bool>("raw", false)) {
+                        send_file(pt);
+                    } else {
+                        start_restore(pt);      // Answered by the restore messages
+                    }
                     break;
                 }
                 default : {
@@ -245,27 +734,237 @@ void Server_Session::request_handler(Message msg) {
                 }
             }
         }
-        if (status_type <= 8) {     // In case of error no message is sent to the client
+        if (status_type <= 15) {     // In case of error no message is sent to the client
+            messages_sent.count(status_type);
             response_msg.encode_message(status_type, response_str);
-            enqueue_msg(response_msg);
+            enqueue_msg(std::move(response_msg));
         }
+        if (!commits.empty() && (queued_requests == 0 || commits.size() >= max_commit_batch || commits.age() >= max_commit_delay))
+            flush_commits();    // Committing when the session is idle, so that a burst of files shares the syncs
     } catch (const boost::property_tree::ptree_error &err) {
         response_str = std::string("Communication error");
         try {
             response_msg.encode_message(7, response_str);
-            enqueue_msg(response_msg);
-            std::cerr << "Server is not working properly." << std::endl;
+            enqueue_msg(std::move(response_msg));
+            Logger::log(Log_Level::error, "Server is not working properly.");
         } catch (const boost::property_tree::ptree_error &err) {
             socket_.close();
         }
     } catch (const std::ios_base::failure &err) {
         response_str = std::string("Communication error");
         response_msg.encode_message(7, response_str);
-        enqueue_msg(response_msg);
-        std::cerr << "Server is not working properly." << std::endl;
+        enqueue_msg(std::move(response_msg));
+        Logger::log(Log_Level::error, "Server is not working properly.");
+    } catch (const boost::filesystem::filesystem_error &err) {
+        response_str = std::string("Communication error");
+        response_msg.encode_message(7, response_str);
+        enqueue_msg(std::move(response_msg));
+        Logger::log(Log_Level::error, std::string("Server is not working properly: ") + err.what());
     }
 }
 
-Server_Session::~Server_Session() {
+std::string Server_Session::list_history(const ptree& pt) {
+    auto path = pt.get<std::string>("path");
+    ptree answer;
+    ptree list;
+    for (auto &version : versions->history(username, path)) {
+        ptree entry;
+        entry.put("id", version.id);
+        entry.put("hash", version.hash);
+        entry.put("size", version.size);
+        entry.put("time", version.committed_at);
+        entry.put("erased", version.erased);
+        list.push_back({"", entry});
+    }
+    answer.put("path", path);
+    answer.add_child("versions", list);
+    std::stringstream answer_stream;
+    boost::property_tree::write_json(answer_stream, answer, false);
+    return answer_stream.str();
+}
+
+std::string Server_Session::list_snapshots(const ptree& pt) {
+    ptree answer;
+    answer.put("path", pt.get<std::string>("path"));
+    auto name = pt.get<std::string>("name", "");
+    if (!name.empty()) answer.put("taken", versions->take_snapshot(username, name).id);   // 0 if the snapshot could not be taken
+    ptree list;
+    for (auto &snapshot : versions->snapshots(username)) {
+        ptree entry;
+        entry.put("id", snapshot.id);
+        entry.put("name", snapshot.name);
+        entry.put("time", snapshot.taken_at);
+        list.push_back({"", entry});
+    }
+    answer.add_child("snapshots", list);
+    std::stringstream answer_stream;
+    boost::property_tree::write_json(answer_stream, answer, false);
+    return answer_stream.str();
+}
+
+void Server_Session::start_restore(const ptree& pt) {
+    auto job = std::make_unique<Restore_Job>();
+    job->request = pt.get<std::string>("path", "");
+    auto id = pt.get<int64_t>("version", 0);
+    if (id != 0) {
+        auto version = versions->version(username, job->request, id);
+        if (version.id != 0 && !version.erased) job->versions.push_back(std::move(version));
+    } else {
+        for (auto &version : versions->resolve(username, job->request, pt.get<int64_t>("snapshot", 0)))
+            job->versions.push_back(std::move(version));
+    }
+    if (restore_job) Logger::log(Log_Level::warning, "Restore of " + restore_job->request + " replaced by the one of " + job->request);
+    Logger::log(Log_Level::info, "Restoring " + std::to_string(job->versions.size()) + " elements of " + username);
+    restore_job = std::move(job);
+    restoring = true;
+    continue_restore();
+}
+
+void Server_Session::continue_restore() {
+    while (restore_job) {
+        {
+            std::lock_guard lg(wq_mutex);
+            if (write_queue_s.size() >= restore_window) return;     // The write completions call back once there is room
+        }
+        auto &job = *restore_job;
+        ptree pt;
+        pt.put("request", job.request);
+        if (job.versions.empty()) {     // Telling the client that the restore is over
+            pt.put("path", job.request);
+            pt.put("done", true);
+            pt.put("files", job.files);
+            restore_job.reset();
+            restoring = false;
+        } else {
+            auto &version = job.versions.front();
+            pt.put("path", version.path);
+            pt.put("version", version.id);
+            pt.put("isFile", version.isFile);
+            if (!version.metadata.empty()) pt.put("meta", version.metadata);
+            if (version.isFile) {
+                if (!job.in.is_open()) {
+                    job.in.open(versions->content_path(username, version.id), std::ios::in|std::ios::binary);
+                    if (!job.in.is_open()) {
+                        Logger::log(Log_Level::error, "Content of version " + std::to_string(version.id) + " of " + version.path + " is missing");
+                        job.in.clear();
+                        job.versions.pop_front();
+                        continue;
+                    }
+                }
+                job.buffer.resize(static_cast<size_t>(std::min<uint64_t>(restore_chunk, version.size - job.offset)));
+                job.in.read(reinterpret_cast<char*>(job.buffer.data()), static_cast<std::streamsize>(job.buffer.size()));
+                job.buffer.resize(job.in.gcount());
+                std::string content(base64_encoded_size(job.buffer.size()), '\0');
+                base64_encode(job.buffer.data(), job.buffer.size(), content.data());
+                pt.put("hash", version.hash);
+                pt.put("offset", job.offset);
+                pt.put("size", version.size);
+                pt.put("content", content);
+                job.offset += job.buffer.size();
+            }
+            if (!version.isFile || job.offset >= version.size || job.buffer.empty()) {     // Moving on to the next element
+                if (version.isFile && job.offset < version.size)
+                    Logger::log(Log_Level::error, "Content of version " + std::to_string(version.id) + " of " + version.path + " is truncated");
+                job.in.close();
+                job.in.clear();
+                job.offset = 0;
+                job.files++;
+                job.versions.pop_front();
+            }
+        }
+        std::stringstream data_stream;
+        boost::property_tree::write_json(data_stream, pt, false);
+        Message restore_msg(pool);
+        messages_sent.count(status_type::restored);
+        restore_msg.encode_message(status_type::restored, data_stream.str());
+        enqueue_msg(std::move(restore_msg));
+    }
+}
+
+void Server_Session::send_manifest(const ptree& pt) {
+    auto request = pt.get<std::string>("path", "");
+    std::vector<Version_Info> elements;
+    if (auto id = pt.get<int64_t>("version", 0); id != 0) {
+        auto version = versions->version(username, request, id);
+        if (version.id != 0 && !version.erased) elements.push_back(std::move(version));
+    } else {
+        elements = versions->resolve(username, request, pt.get<int64_t>("snapshot", 0));
+    }
+    size_t next = 0;
+    do {
+        ptree answer;
+        ptree list;
+        for (size_t end = std::min(elements.size(), next + manifest_page); next < end; next++) {
+            ptree entry;
+            entry.put("path", elements[next].path);
+            entry.put("version", elements[next].id);
+            entry.put("isFile", elements[next].isFile);
+            entry.put("size", elements[next].size);
+            entry.put("hash", elements[next].hash);
+            if (!elements[next].metadata.empty()) entry.put("meta", elements[next].metadata);
+            list.push_back({"", entry});
+        }
+        answer.put("request", request);
+        answer.add_child("manifest", list);
+        answer.put("done", next == elements.size());
+        std::stringstream answer_stream;
+        boost::property_tree::write_json(answer_stream, answer, false);
+        Message page(pool);
+        messages_sent.count(status_type::restored);
+        page.encode_message(status_type::restored, answer_stream.str());
+        enqueue_msg(std::move(page));
+    } while (next < elements.size());
+}
+
+void Server_Session::send_file(const ptree& pt) {
+    auto path = pt.get<std::string>("path");
+    auto version = versions->version(username, path, pt.get<int64_t>("version"));
+    auto offset = pt.get<uint64_t>("offset", 0);
+    File_Body body;
+    uint64_t size = 0;
+    if (version.id != 0 && version.isFile && !version.erased) {
+        body.fd = ::open(versions->content_path(username, version.id).c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info{};
+        if (body.fd >= 0 && ::fstat(body.fd, &info) == 0) size = static_cast<uint64_t>(info.st_size);
+    }
+    ptree answer;
+    answer.put("request", path);
+    answer.put("path", path);
+    answer.put("version", version.id);
+    answer.put("raw", true);
+    if (body.fd < 0) {
+        Logger::log(Log_Level::error, "Content of version " + std::to_string(version.id) + " of " + path + " is missing");
+        answer.put("error", "missing");
+    } else {
+        ::posix_fadvise(body.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        body.offset = static_cast<off_t>(std::min(offset, size));
+        body.length = size - static_cast<uint64_t>(body.offset);
+    }
+    answer.put("offset", body.offset);
+    answer.put("length", body.length);      // Raw bytes following the message
+    answer.put("size", size);
+    std::stringstream answer_stream;
+    boost::property_tree::write_json(answer_stream, answer, false);
+    Message header(pool);
+    messages_sent.count(status_type::restored);
+    header.encode_message(status_type::restored, answer_stream.str());
+    enqueue_file(std::move(header), std::move(body));
+}
+
+void Server_Session::close_session() {
+    closing = true;
+    flush_commits();    // The client is gone, but the uploads it completed are kept
     update_db();
+    std::lock_guard lg(fs_mutex);
+    for (auto &part : staged) staging->release(part);   // The partial uploads left are collected once abandoned
+    staged.clear();
+    for (auto &[path, reservation] : reservations) versions->release(username, reservation);
+    reservations.clear();
+}
+
+Server_Session::~Server_Session() {
+    scheduler->close(flow);
+    sessions.add(-1);
+    queue_depth.add(-static_cast<double>(write_queue_s.size()));
+    queue_bytes.add(-static_cast<double>(queued_bytes));
 }
@@ -6,18 +6,82 @@
 #include <boost/thread.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/property_tree/exceptions.hpp>
+#include <fstream>
+#include <openssl/md5.h>
 #include <queue>
 #include <sqlite3.h>
+#include "Authenticator.h"
 #include "Base64/base64.h"
+#include "Buffer_Pool.h"
+#include "Commit_Batch.h"
+#include "Config.h"
+#include "Content_Hasher.h"
 #include "Database_Connection.h"
+#include "Fair_Scheduler.h"
 #include "Headers.h"
+#include "Logger.h"
 #include "Message.h"
+#include "Metrics.h"
+#include "Staging_Area.h"
+#include "Transport.h"
+#include "Version_Store.h"
 
 #define delimiter "\n}\n"
 
 using boost::asio::ip::tcp;
 using boost::property_tree::ptree;
 
+/// Raised when the content of a completed upload does not match the hash declared by the client
+struct Content_Mismatch : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+/// Raised when an upload would take the storage of the user beyond its quota
+struct Quota_Exceeded : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+/// Raised when the server has the content of an upload and asks for a proof of it instead, the message holds the path
+/// and the nonce of the proof
+struct Possession_Challenge : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+/// Hash of a partial upload, updated while its chunks are written to the staging area
+struct Upload_Hash {
+    Content_Hasher hasher;
+    size_t offset = 0;      // Bytes hashed so far
+};
+
+/// A restore being streamed to the client, one chunk at a time as the write queue drains
+struct Restore_Job {
+    std::string request;    // Path asked by the client, echoed by every message
+    std::deque<Version_Info> versions;
+    std::ifstream in;       // Content of the first version, while it is being sent
+    uint64_t offset = 0;
+    size_t files = 0;
+    std::vector<BYTE> buffer;
+};
+
+/// Range of a file written on the socket right after a message, straight from the page cache; owns the descriptor
+struct File_Body {
+    int fd = -1;
+    off_t offset = 0;
+    size_t length = 0;      // Bytes still to send
+
+    File_Body() = default;
+    File_Body(int fd, off_t offset, size_t length) : fd(fd), offset(offset), length(length) {}
+    File_Body(File_Body &&other) noexcept : fd(std::exchange(other.fd, -1)), offset(other.offset), length(std::exchange(other.length, 0)) {}
+    File_Body &operator=(File_Body &&other) noexcept;
+    ~File_Body();
+};
+
+/// A message waiting in the write queue of the session, followed by raw file bytes for the restore streams
+struct Outgoing {
+    Message msg;
+    File_Body body;
+};
+
 /// Tracks the differences between the local paths map and the one sent by the client
 struct Diff_paths {
     std::vector<std::string> toAdd;
@@ -26,48 +90,198 @@ struct Diff_paths {
 
 class Server_Session : public std::enable_shared_from_this<Server_Session> {
     tcp::socket socket_;
+    Transport transport;    // Plain or TLS stream over socket_
     std::string username;
     std::map<std::string, std::string> paths;
     bool successful_first_loading;
-    std::queue<Message> write_queue_s;
+    std::queue<Outgoing> write_queue_s;
     boost::asio::streambuf read_buf;
+    std::shared_ptr<Buffer_Pool> pool;      // Buffers of the messages of the session
     std::mutex paths_mutex;
     std::mutex wq_mutex;
     std::mutex fs_mutex;
+    std::vector<BYTE> decode_buffer;     // Decoded content of the last chunk, guarded by fs_mutex
+    std::map<std::string, Upload_Hash> upload_hashes;    // Hashes of the partial uploads by staging path, guarded by fs_mutex
+    std::map<std::string, std::pair<std::string, std::string>> challenges;  // Nonce and hash of the proofs asked for, by path; guarded by fs_mutex
+    boost::asio::strand<boost::asio::thread_pool::executor_type> strand;    // Handles the requests in order, off the network thread
+    std::shared_ptr<Fair_Scheduler> scheduler;
+    std::shared_ptr<Fair_Scheduler::Flow> flow;     // Queues the requests until the scheduler hands them to the strand
+    size_t max_sessions;
+    size_t max_user_sessions;
+    uint64_t max_backlog;
+    unsigned retry_seconds;
+    std::atomic<size_t> queued_requests{0};     // Requests posted to the strand and not handled yet
+    size_t max_queued_bytes;
+    std::atomic<size_t> queued_bytes{0};    // Requests not handled yet and answers not written yet
+    std::atomic<bool> read_paused{false};   // Set when the queued bytes reach the limit, the client waits in its socket buffer
+    boost::asio::steady_timer resume;       // Awaited by the paused reading, cancelled once the queues drain
+    Commit_Batch commits;       // Complete uploads waiting to be synced and moved in place, guarded by fs_mutex
+    std::vector<Message> commit_answers;    // Answers to the committed uploads, sent once the database records them
+    bool closing = false;       // Set once the connection is over, the last commits are not answered
+    std::shared_ptr<Version_Store> versions;
+    std::shared_ptr<Staging_Area> staging;
+    std::set<std::string> staged;   // Files of the staging area held by the session, guarded by fs_mutex
+    uint64_t quota_bytes;       // Defaults of the users without their own limits
+    uint64_t quota_files;
+    std::map<std::string, Quota_Reservation> reservations;  // Room reserved by the uploads in progress, by path; guarded by fs_mutex
+    std::vector<Version_Info> pending_versions;     // Versions of the committed uploads, recorded together with the batch
+    std::map<std::string, std::string> pending_metadata;    // Metadata of the paths whose upload is not committed yet, by path
+    std::unique_ptr<Restore_Job> restore_job;       // Handled on the strand
+    std::atomic<bool> restoring{false};
+    std::shared_ptr<Authenticator> auth;
+    bool authenticating = false;    // Set on the strand while the login is verified
+    std::vector<Pooled_Buffer> deferred;    // Requests received during the verification, handled once it ends
     Database_Connection db;
+    Gauge *lag_gauge = nullptr;
 
-    /// Reads the message from the socket and calls the appropriate handler
-    void do_read();
+    /// Completes the TLS handshake if the server uses it, then reads the requests and hands them to the scheduler
+    /// until the connection ends; the reading waits on the resume timer while the queued bytes are over the limit
+    boost::asio::awaitable<void> read_requests(std::shared_ptr<Server_Session> self);
+
+    /// Accounts for bytes leaving the queues, and resumes the reading once they are below half the limit
+    void release_bytes(size_t bytes);
 
     /// Writes the available messages from the queue to the socket
     void do_write();
 
+    /// Sends the file body of the message just written, waiting for the socket whenever its buffer is full
+    void do_send_body();
+
+    /// Holds back the partial segments of the socket until it is uncorked
+    void set_cork(bool cork);
+
+    /// Removes the written message from the queue and writes the next one
+    void finish_write();
+
     /// Adds messages to the write queue
-    void enqueue_msg(const Message& msg);
+    void enqueue_msg(Message&& msg);
+
+    /// Adds a message followed by a file range to the write queue
+    void enqueue_file(Message&& msg, File_Body&& body);
+
+    /// Whether the server has room for another user session
+    bool admitted();
+
+    /// Gets the answer to a login refused for lack of room, with the seconds the client should wait, spread so that
+    /// the refused clients do not all come back at once
+    std::string retry_hint() const;
+
+    /// Answers the login once the credentials are verified, then handles the requests deferred in the meantime
+    void finish_login(const std::string& user, const Auth_Result& result);
+
+    /// Creates or updates file or directories received, appending file chunks to the staging area until the last one
+    /// arrives, and returns the path, the number of committed bytes and whether the element is complete
+    std::tuple<std::string, size_t, bool> do_write_element(action_type header, std::string_view data);
 
-    /// Creates or updates file or directories received
-    std::string do_write_element(action_type header, const std::string& data);
+    /// Stores a file whose content the server already keeps, for this user or another one, without its upload: the
+    /// client asks before sending the content, and is challenged to prove it holds the same bytes, since the hash is
+    /// weak and may be known without the file. Once the proof matches, the kept content is linked or cloned in place.
+    /// Throws Possession_Challenge to ask for the proof, returns false if the content has to be sent
+    bool deduplicate(const std::string& path, const std::string& hash, uint64_t size, const std::string& proof, status_type status);
+
+    /// Reserves the room of an upload when it starts, so that the following chunks are not checked again and the
+    /// uploads in progress count against the quota; a new size of the file reserves its room again. Returns false if
+    /// the upload would go over quota
+    bool reserve_quota(const std::string& path, uint64_t size);
+
+    /// Gives back the room reserved by the upload of a path, once recorded or abandoned
+    void release_quota(const std::string& path);
+
+    /// Writes a chunk to the partial upload, after a hole of the given length starting at offset; returns false if it fails
+    static bool write_chunk(const std::string& part, size_t offset, size_t hole, const BYTE *data, size_t length);
+
+    /// Hashes the first offset bytes already in the staging area, needed when an upload is resumed by another session
+    Upload_Hash resume_hash(const std::string& part, size_t offset);
+
+    /// Commits the complete uploads, records them with a single database write and answers the client
+    void flush_commits();
+
+    /// Keeps the uploads the client completed and writes its paths once the connection is over, then gives back the
+    /// staging files and the quota the session held; queued on the flow after the last requests, so that it runs on
+    /// the strand and the destructor never waits for the database
+    void close_session();
+
+    /// Records an upload of the batch and prepares its answer, the failed ones are reported to the client
+    void commit_done(const std::string& path, const std::string& hash, bool isFile, uint64_t size, status_type status, bool ok);
+
+    /// Keeps the metadata records of a batch of paths with their current versions, so that a change of the metadata
+    /// alone needs no upload; the record of an upload not committed yet waits for its commit. The stored files keep the
+    /// modes and the owner of the server, the metadata is applied by the restores
+    void store_metadata(std::vector<std::pair<std::string, std::string>>& records);
+
+    /// Answers with the last versions of a path
+    std::string list_history(const ptree& pt);
+
+    /// Takes a snapshot if the request names one, and answers with the snapshots of the user
+    std::string list_snapshots(const ptree& pt);
+
+    /// Starts streaming a file version, or the elements below a path as they are now or at a snapshot
+    void start_restore(const ptree& pt);
+
+    /// Sends the next chunks of the restore, as long as the write queue has room for them
+    void continue_restore();
+
+    /// Answers with the elements to restore, in pages, so that the client can download them over parallel streams
+    void send_manifest(const ptree& pt);
+
+    /// Answers with a header followed by the raw content of a file version from the requested offset
+    void send_file(const ptree& pt);
+
+    /// Removes from the paths map the elements no longer in the storage, so that the client sends them again
+    void drop_missing_paths();
+
+    /// Gets the path of the partial upload of a file with the given content hash in the staging area
+    std::string staging_path(const std::string& path, const std::string& hash);
+
+    /// Gets the number of bytes of a file with the given content hash already committed in the staging area
+    size_t committed_offset(const std::string& path, const std::string& hash);
+
+    /// Removes the partial uploads of the given file whose content hash is different from the given one
+    void discard_partials(const std::string& path, const std::string& hash);
+
+    /// Keeps a file of the staging area from being collected until the session commits or removes it, or ends
+    void hold_staged(const std::string& part);
+
+    /// Drops the hold of the session on a file of the staging area
+    void release_staged(const std::string& part);
 
     /// Deletes file or directories received
     void do_remove_element(const std::string& path);
 
-    /// Updates the paths map
+    /// Updates the paths map, the database is written by the caller
     void update_paths(const std::string& path, const std::string& hash);
 
     /// Updates the database after an operation on the file system
     void update_db();
 
-    /// Compares the local map with the one sent by the client
-    Diff_paths compare_paths(ptree &client_pt);
-
-    /// Decodes message and takes the needed actions
-    void request_handler(Message msg);
+    /// Decodes the message and takes the needed actions, it runs on the strand of the session
+    void request_handler(std::string_view request);
 
 public:
 
-    Server_Session(tcp::socket &socket);
+    /// Groups of complete uploads are committed together, at most this many at once
+    static constexpr size_t max_commit_batch = 64;
+    /// Seconds a complete upload may wait for the following ones before being committed
+    static constexpr double max_commit_delay = 0.05;
+    /// Messages of a restore waiting in the write queue at most, the next chunks are read once they are sent
+    static constexpr size_t restore_window = 4;
+    /// File bytes carried by a restore message
+    static constexpr size_t restore_chunk = 1 << 20;
+    /// Elements listed by a page of the restore manifest
+    static constexpr size_t manifest_page = 1000;
+
+    /// Creating a session whose requests are handled by the given worker pool, when the scheduler gives them a turn
+    Server_Session(tcp::socket &socket, boost::asio::thread_pool &workers, std::shared_ptr<Fair_Scheduler> scheduler, std::shared_ptr<Version_Store> versions,
+                   std::shared_ptr<Staging_Area> staging, std::shared_ptr<Authenticator> auth, std::shared_ptr<Tls_Context> tls = nullptr, const Server_Config &config = {});
+
+    /// Gets the path where the element of the given user is stored
+    static std::string stored_path(const std::string& username, const std::string& path);
+
+    /// Compares the local map with the one sent by the client, the local elements outside of the given root directory
+    /// are not removed; an empty root covers the whole tree
+    static Diff_paths compare_paths(const std::map<std::string, std::string> &paths, ptree &client_pt, const std::string &root = {});
 
-    /// Calls for the first time the function that reads from the socket
+    /// Starts the coroutine that reads the requests of the session, it keeps the session alive until the connection ends
     void start();
 
     ~Server_Session();
@@ -0,0 +1,33 @@
+#include "Staging_Area.h"
+
+Staging_Area::Staging_Area(std::string root) : root(std::move(root)) {}
+
+void Staging_Area::hold(const std::string &part) {
+    std::lock_guard lg(staging_mutex);
+    held.insert(part);
+}
+
+void Staging_Area::release(const std::string &part) {
+    std::lock_guard lg(staging_mutex);
+    if (auto it = held.find(part); it != held.end()) held.erase(it);
+}
+
+void Staging_Area::collect(std::time_t expiration) {
+    std::vector<boost::filesystem::path> stale;
+    try {
+        if (!boost::filesystem::is_directory(root)) return;
+        for (auto &element : boost::filesystem::recursive_directory_iterator(root)) {
+            if (!boost::filesystem::is_regular_file(element)) continue;
+            bool shared = element.path().extension() == ".shared";    // Its time is the one of the shared content, not of the upload
+            if (shared || boost::filesystem::last_write_time(element) < expiration) stale.push_back(element.path());
+        }
+    } catch (const boost::filesystem::filesystem_error &err) {
+        Logger::log(Log_Level::error, std::string("Error while collecting partial uploads: ") + err.what());
+    }
+    for (auto &part : stale) {  // Removed once the walk is over, the iterator does not survive the removal of its entries
+        std::lock_guard lg(staging_mutex);     // A session can not take the file while it is being removed
+        if (held.count(part.string())) continue;
+        boost::system::error_code ec;
+        if (boost::filesystem::remove(part, ec)) Logger::log(Log_Level::info, "Removed stale partial upload " + part.string());
+    }
+}
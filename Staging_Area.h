@@ -0,0 +1,30 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <ctime>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "Logger.h"
+
+/// Partial uploads and links to shared contents waiting in the staging area. The sessions hold the files they are
+/// writing or about to commit, so that the collection of the abandoned ones never removes them
+class Staging_Area {
+    std::string root;
+    std::mutex staging_mutex;
+    std::multiset<std::string> held;    // Files in use, once per session using them
+
+public:
+    explicit Staging_Area(std::string root = "../../staging");
+
+    /// Marks a file of the staging area as in use, before it is created
+    void hold(const std::string &part);
+
+    /// Drops a hold taken by hold, the file is collected once abandoned
+    void release(const std::string &part);
+
+    /// Removes the partial uploads untouched since expiration and the leftover links to shared contents, skipping the
+    /// files held by a session; it walks the whole area, so it runs on the worker pool
+    void collect(std::time_t expiration);
+};
@@ -0,0 +1,54 @@
+#include <fstream>
+#include <iostream>
+#include "Stats_Exporter.h"
+
+Stats_Exporter::Stats_Exporter(unsigned short port, std::string stats_file, std::chrono::seconds interval)
+        : acceptor(exporter_context), file_timer(exporter_context), stats_file(std::move(stats_file)), interval(interval) {
+    if (port != 0) {
+        tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);    // Metrics are only exposed on the local host
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(tcp::acceptor::reuse_address(true));
+        acceptor.bind(endpoint);
+        acceptor.listen();
+        do_accept();
+    }
+    if (!this->stats_file.empty()) do_write_file();
+    exporter = boost::thread([this](){exporter_context.run();});
+}
+
+void Stats_Exporter::do_accept() {
+    acceptor.async_accept([this](boost::system::error_code ec, tcp::socket socket) {
+        if (!ec) {
+            auto peer = std::make_shared<tcp::socket>(std::move(socket));
+            auto request = std::make_shared<boost::asio::streambuf>();
+            boost::asio::async_read_until(*peer, *request, "\r\n\r\n", [peer, request](boost::system::error_code ec, std::size_t) {
+                if (ec) return;
+                auto body = Metrics::instance().render();
+                auto response = std::make_shared<std::string>("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                        + std::to_string(body.size()) + "\r\n\r\n" + body);
+                boost::asio::async_write(*peer, boost::asio::buffer(*response), [peer, response](boost::system::error_code, std::size_t) {
+                    boost::system::error_code ignored;
+                    peer->shutdown(tcp::socket::shutdown_both, ignored);
+                });
+            });
+        }
+        if (acceptor.is_open()) do_accept();
+    });
+}
+
+void Stats_Exporter::do_write_file() {
+    {
+        std::ofstream out(stats_file + ".tmp", std::ios::out|std::ios::trunc);
+        out << Metrics::instance().render();
+    }
+    std::rename((stats_file + ".tmp").c_str(), stats_file.c_str());     // Readers never see a half written file
+    file_timer.expires_after(interval);
+    file_timer.async_wait([this](const boost::system::error_code &ec) {
+        if (!ec) do_write_file();
+    });
+}
+
+Stats_Exporter::~Stats_Exporter() {
+    exporter_context.stop();
+    if (exporter.joinable()) exporter.join();
+}
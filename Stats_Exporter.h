@@ -0,0 +1,31 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <string>
+#include "Metrics.h"
+
+using boost::asio::ip::tcp;
+
+class Stats_Exporter {
+    boost::asio::io_context exporter_context;
+    tcp::acceptor acceptor;
+    boost::asio::steady_timer file_timer;
+    std::string stats_file;
+    std::chrono::seconds interval;
+    boost::thread exporter;
+
+    /// Accepts local scrapes and answers each of them with the current metrics
+    void do_accept();
+
+    /// Periodically rewrites the stats file with the current metrics
+    void do_write_file();
+
+public:
+
+    /// Serves the metrics on http://127.0.0.1:port/metrics (if port is not 0) and writes them to stats_file
+    /// every interval (if the name is not empty), both from a thread of its own
+    Stats_Exporter(unsigned short port, std::string stats_file, std::chrono::seconds interval);
+
+    ~Stats_Exporter();
+};
@@ -0,0 +1,192 @@
+#include "Transport.h"
+#include <cerrno>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include "Logger.h"
+#include "Metrics.h"
+
+namespace {
+    auto &full_handshakes = Metrics::instance().counter("rab_tls_handshakes_total{resumed=\"false\"}");
+    auto &resumed_handshakes = Metrics::instance().counter("rab_tls_handshakes_total{resumed=\"true\"}");
+    auto &kernel_offloads = Metrics::instance().counter("rab_tls_kernel_offload_total");
+
+    /// Gets the reason of the last OpenSSL failure
+    std::string openssl_error() {
+        char text[256];
+        ERR_error_string_n(ERR_get_error(), text, sizeof(text));
+        return text;
+    }
+
+    SSL_CTX *new_context(const SSL_METHOD *method) {
+        SSL_CTX *ctx = SSL_CTX_new(method);
+        if (!ctx) throw std::runtime_error("Unable to create the TLS context, " + openssl_error());
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);   // Handing the record layer to the kernel when it supports the cipher
+        SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);     // The messages carry their own end, a truncated one is never taken as complete
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+        return ctx;
+    }
+}
+
+Tls_Context::Tls_Context(SSL_CTX *ctx, bool server_side, std::string server_name)
+        : ctx(ctx), server_side(server_side), server_name(std::move(server_name)) {
+    SSL_CTX_set_app_data(ctx, this);
+}
+
+std::shared_ptr<Tls_Context> Tls_Context::server(const std::string &cert_file, const std::string &key_file) {
+    SSL_CTX *ctx = new_context(TLS_server_method());
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_file.c_str()) != 1
+            || SSL_CTX_use_PrivateKey_file(ctx, key_file.c_str(), SSL_FILETYPE_PEM) != 1
+            || SSL_CTX_check_private_key(ctx) != 1) {
+        std::string reason = openssl_error();
+        SSL_CTX_free(ctx);
+        throw std::runtime_error("Unable to load " + cert_file + " and " + key_file + ", " + reason);
+    }
+    SSL_CTX_set_num_tickets(ctx, 1);    // One resumption ticket per connection, the clients keep only the last one
+    return std::shared_ptr<Tls_Context>(new Tls_Context(ctx, true, {}));
+}
+
+std::shared_ptr<Tls_Context> Tls_Context::client(const std::string &ca_file, const std::string &server_name, bool verify) {
+    SSL_CTX *ctx = new_context(TLS_client_method());
+    bool trusted = ca_file.empty() ? SSL_CTX_set_default_verify_paths(ctx) == 1
+                                   : SSL_CTX_load_verify_locations(ctx, ca_file.c_str(), nullptr) == 1;
+    if (!trusted) {
+        std::string reason = openssl_error();
+        SSL_CTX_free(ctx);
+        throw std::runtime_error("Unable to load the trusted certificates " + ca_file + ", " + reason);
+    }
+    if (verify) {
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    } else {
+        Logger::log(Log_Level::warning, "The certificate of the server is not verified");
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+    }
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, on_new_session);
+    return std::shared_ptr<Tls_Context>(new Tls_Context(ctx, false, verify ? server_name : std::string()));
+}
+
+Tls_Context::~Tls_Context() {
+    if (session) SSL_SESSION_free(session);
+    SSL_CTX_free(ctx);
+}
+
+int Tls_Context::on_new_session(SSL *ssl, SSL_SESSION *session) {
+    auto *context = static_cast<Tls_Context*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    std::lock_guard lg(context->session_mutex);
+    if (context->session) SSL_SESSION_free(context->session);
+    context->session = session;
+    return 1;   // Keeping the reference OpenSSL passes
+}
+
+SSL *Tls_Context::create(int fd) {
+    SSL *ssl = SSL_new(ctx);
+    if (!ssl) return nullptr;
+    SSL_set_fd(ssl, fd);    // A socket BIO, which kTLS needs
+    if (server_side) {
+        SSL_set_accept_state(ssl);
+        return ssl;
+    }
+    SSL_set_connect_state(ssl);
+    if (!server_name.empty()) {
+        SSL_set_tlsext_host_name(ssl, server_name.c_str());
+        SSL_set1_host(ssl, server_name.c_str());
+    }
+    std::lock_guard lg(session_mutex);
+    if (session && SSL_SESSION_is_resumable(session)) SSL_set_session(ssl, session);
+    return ssl;
+}
+
+bool Tls_Context::is_server() const {
+    return server_side;
+}
+
+Transport::Transport(tcp::socket &socket, std::shared_ptr<Tls_Context> tls) : socket(socket), tls(std::move(tls)) {}
+
+Transport::~Transport() {
+    if (ssl) SSL_free(ssl);
+}
+
+bool Transport::secure() const {
+    return tls != nullptr;
+}
+
+bool Transport::kernel_tls() const {
+    return ssl && BIO_get_ktls_send(SSL_get_wbio(ssl));
+}
+
+boost::system::error_code Transport::start_tls() {
+    if (ssl) SSL_free(ssl);
+    boost::system::error_code ec;
+    socket.native_non_blocking(true, ec);      // OpenSSL works on the descriptor, the waits go through asio
+    if (ec) return ec;
+    ssl = tls->create(socket.native_handle());
+    if (!ssl) return boost::system::error_code(static_cast<int>(ERR_get_error()), boost::asio::error::get_ssl_category());
+    return {};
+}
+
+void Transport::handshake() {
+    boost::system::error_code ec;
+    if (!tls) return;
+    ec = start_tls();
+    if (!ec) sync_tls([this]() {return SSL_do_handshake(ssl);}, ec);
+    if (ec) throw boost::system::system_error(ec, "TLS handshake");
+    handshake_done();
+}
+
+void Transport::handshake_done() {
+    bool resumed = SSL_session_reused(ssl);
+    (resumed ? resumed_handshakes : full_handshakes).add();
+    if (kernel_tls()) kernel_offloads.add();
+    Logger::log(Log_Level::debug, std::string(SSL_get_version(ssl)) + " " + SSL_get_cipher_name(ssl) + (resumed ? ", resumed" : "")
+                                  + (kernel_tls() ? ", encrypted by the kernel" : ""));
+}
+
+boost::system::error_code Transport::tls_error(int error) const {
+    switch (error) {
+        case SSL_ERROR_NONE :
+            return {};
+        case SSL_ERROR_ZERO_RETURN :
+            return boost::asio::error::eof;
+        case SSL_ERROR_SYSCALL : {
+            auto code = ERR_get_error();
+            if (code != 0) return boost::system::error_code(static_cast<int>(code), boost::asio::error::get_ssl_category());
+            if (errno != 0) return boost::system::error_code(errno, boost::system::system_category());
+            return boost::asio::error::eof;     // The peer closed the connection without a close_notify
+        }
+        default : {
+            auto code = ERR_get_error();
+            if (code != 0) Logger::log(Log_Level::debug, "TLS error: " + std::string(ERR_reason_error_string(code) ? ERR_reason_error_string(code) : "unknown"));
+            return boost::system::error_code(static_cast<int>(code), boost::asio::error::get_ssl_category());
+        }
+    }
+}
+
+ssize_t Transport::send_file(int fd, off_t &offset, size_t length) {
+    if (!ssl) return ::sendfile(socket.native_handle(), fd, &offset, length);
+    ERR_clear_error();
+    ossl_ssize_t sent;
+    if (kernel_tls()) {     // Straight from the page cache, the kernel builds the records
+        sent = SSL_sendfile(ssl, fd, offset, length, 0);
+    } else {    // The same bytes are read again if OpenSSL asks to retry the write
+        file_buffer.resize(1 << 18);
+        ssize_t n = ::pread(fd, file_buffer.data(), std::min(length, file_buffer.size()), offset);
+        if (n <= 0) {
+            if (n == 0) errno = EIO;    // The file shrank under the announced length
+            return -1;
+        }
+        sent = SSL_write(ssl, file_buffer.data(), static_cast<int>(n));
+    }
+    if (sent > 0) {
+        offset += sent;
+        return sent;
+    }
+    int error = SSL_get_error(ssl, static_cast<int>(sent));
+    if (error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ) {
+        errno = EAGAIN;
+    } else {
+        auto ec = tls_error(error);
+        errno = ec.category() == boost::system::system_category() ? ec.value() : EPROTO;
+    }
+    return -1;
+}
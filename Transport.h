@@ -0,0 +1,246 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl/error.hpp>
+#include <memory>
+#include <mutex>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <string>
+#include <vector>
+
+using boost::asio::ip::tcp;
+
+/// TLS settings shared by the connections of a process. The client keeps the session of its last connection, so that
+/// its reconnections resume it with an abbreviated handshake
+class Tls_Context {
+    SSL_CTX *ctx;
+    bool server_side;
+    std::string server_name;        // Checked against the certificate of the server, client side only
+    SSL_SESSION *session = nullptr;     // Last session granted by the server, client side only
+    std::mutex session_mutex;
+
+    Tls_Context(SSL_CTX *ctx, bool server_side, std::string server_name);
+
+    /// Keeps the sessions the server grants, they arrive after the handshake with TLS 1.3
+    static int on_new_session(SSL *ssl, SSL_SESSION *session);
+
+public:
+
+    /// Creates the server settings from PEM files, throws std::runtime_error if they can not be loaded
+    static std::shared_ptr<Tls_Context> server(const std::string &cert_file, const std::string &key_file);
+
+    /// Creates the client settings trusting the certificates of ca_file, the system ones if it is empty; with verify
+    /// false the server is not authenticated, which is only meant for tests
+    static std::shared_ptr<Tls_Context> client(const std::string &ca_file, const std::string &server_name, bool verify);
+
+    ~Tls_Context();
+
+    Tls_Context(const Tls_Context&) = delete;
+    Tls_Context& operator=(const Tls_Context&) = delete;
+
+    /// Creates the state of a connection on the given socket, with the last session of the client to resume
+    SSL *create(int fd);
+
+    bool is_server() const;
+};
+
+/// The byte stream of a connection, either plain TCP or TLS over it. It meets the asio stream requirements, so that the
+/// messages keep being read and written with the composed operations. The records are handled by OpenSSL right on the
+/// non blocking socket, which lets the kernel take over the encryption (kTLS) when it supports the negotiated cipher:
+/// the file bodies are then sent with sendfile as on plain connections
+class Transport {
+    tcp::socket &socket;
+    std::shared_ptr<Tls_Context> tls;   // Null for plain TCP
+    SSL *ssl = nullptr;
+    std::vector<char> file_buffer;      // File bytes encrypted in user space, when the kernel does not do it
+
+    /// Replaces the TLS state of the previous connection with a new one on the current socket
+    boost::system::error_code start_tls();
+
+    /// Logs and counts a completed handshake
+    void handshake_done();
+
+    /// Maps the error of an OpenSSL call on the socket
+    boost::system::error_code tls_error(int error) const;
+
+    /// Runs an OpenSSL call until it completes, waiting for the socket whenever OpenSSL asks, then calls the handler
+    /// with the error and the result of the call
+    template <typename Operation, typename Handler>
+    void async_tls(Operation operation, Handler handler);
+
+    /// Runs an OpenSSL call until it completes, blocking on the socket
+    template <typename Operation>
+    size_t sync_tls(Operation operation, boost::system::error_code &ec);
+
+    template <typename BufferSequence>
+    static auto first_buffer(const BufferSequence &buffers) {
+        auto buffer = *boost::asio::buffer_sequence_begin(buffers);
+        for (auto it = boost::asio::buffer_sequence_begin(buffers); it != boost::asio::buffer_sequence_end(buffers); ++it) {
+            if (it->size() > 0) return decltype(buffer)(*it);
+        }
+        return buffer;
+    }
+
+public:
+
+    using executor_type = tcp::socket::executor_type;
+
+    Transport(tcp::socket &socket, std::shared_ptr<Tls_Context> tls = nullptr);
+
+    ~Transport();
+
+    Transport(const Transport&) = delete;
+    Transport& operator=(const Transport&) = delete;
+
+    executor_type get_executor() {return socket.get_executor();}
+
+    bool secure() const;
+
+    /// Whether the kernel encrypts what is sent, so that files leave the page cache without being copied
+    bool kernel_tls() const;
+
+    /// Starts a connection just established, the completion gets the error of the TLS handshake; any asio completion
+    /// token is accepted, use_awaitable included
+    template <typename CompletionToken>
+    auto async_handshake(CompletionToken &&token);
+
+    /// Blocking form of async_handshake, throws boost::system::system_error if it fails
+    void handshake();
+
+    template <typename MutableBufferSequence, typename Handler>
+    void async_read_some(const MutableBufferSequence &buffers, Handler &&handler);
+
+    template <typename ConstBufferSequence, typename Handler>
+    void async_write_some(const ConstBufferSequence &buffers, Handler &&handler);
+
+    template <typename MutableBufferSequence>
+    size_t read_some(const MutableBufferSequence &buffers, boost::system::error_code &ec);
+
+    template <typename MutableBufferSequence>
+    size_t read_some(const MutableBufferSequence &buffers);
+
+    template <typename ConstBufferSequence>
+    size_t write_some(const ConstBufferSequence &buffers, boost::system::error_code &ec);
+
+    template <typename ConstBufferSequence>
+    size_t write_some(const ConstBufferSequence &buffers);
+
+    /// Sends up to length bytes of a file from offset, advancing it, without blocking: returns -1 with errno set to
+    /// EAGAIN when the socket buffer is full, as sendfile does
+    ssize_t send_file(int fd, off_t &offset, size_t length);
+};
+
+template <typename Operation, typename Handler>
+void Transport::async_tls(Operation operation, Handler handler) {
+    ERR_clear_error();
+    int result = operation();
+    int error = result > 0 ? SSL_ERROR_NONE : SSL_get_error(ssl, result);
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+        socket.async_wait(error == SSL_ERROR_WANT_READ ? tcp::socket::wait_read : tcp::socket::wait_write,
+                          [this, operation, handler = std::move(handler)](const boost::system::error_code &ec) mutable {
+                              if (ec) handler(ec, size_t(0));
+                              else async_tls(operation, std::move(handler));
+                          });
+        return;
+    }
+    boost::system::error_code ec = tls_error(error);
+    size_t bytes = result > 0 ? static_cast<size_t>(result) : 0;
+    boost::asio::post(socket.get_executor(), [handler = std::move(handler), ec, bytes]() mutable {handler(ec, bytes);});
+}
+
+template <typename Operation>
+size_t Transport::sync_tls(Operation operation, boost::system::error_code &ec) {
+    while (true) {
+        ERR_clear_error();
+        int result = operation();
+        int error = result > 0 ? SSL_ERROR_NONE : SSL_get_error(ssl, result);
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+            socket.wait(error == SSL_ERROR_WANT_READ ? tcp::socket::wait_read : tcp::socket::wait_write, ec);
+            if (ec) return 0;
+            continue;
+        }
+        ec = tls_error(error);
+        return result > 0 ? static_cast<size_t>(result) : 0;
+    }
+}
+
+template <typename CompletionToken>
+auto Transport::async_handshake(CompletionToken &&token) {
+    return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code)>([this](auto handler) {
+        boost::system::error_code ec;
+        if (tls) ec = start_tls();
+        if (!tls || ec) {
+            boost::asio::post(socket.get_executor(), [handler = std::move(handler), ec]() mutable {handler(ec);});
+            return;
+        }
+        async_tls([this]() {return SSL_do_handshake(ssl);}, [this, handler = std::move(handler)](const boost::system::error_code &ec, size_t) mutable {
+            if (!ec) handshake_done();
+            handler(ec);
+        });
+    }, token);
+}
+
+template <typename MutableBufferSequence, typename Handler>
+void Transport::async_read_some(const MutableBufferSequence &buffers, Handler &&handler) {
+    if (!ssl) {
+        socket.async_read_some(buffers, std::forward<Handler>(handler));
+        return;
+    }
+    boost::asio::mutable_buffer buffer = first_buffer(buffers);
+    if (buffer.size() == 0) {
+        boost::asio::post(socket.get_executor(), [handler = std::forward<Handler>(handler)]() mutable {handler(boost::system::error_code(), size_t(0));});
+        return;
+    }
+    async_tls([this, buffer]() {return SSL_read(ssl, buffer.data(), static_cast<int>(std::min<size_t>(buffer.size(), INT32_MAX)));},
+              std::forward<Handler>(handler));
+}
+
+template <typename ConstBufferSequence, typename Handler>
+void Transport::async_write_some(const ConstBufferSequence &buffers, Handler &&handler) {
+    if (!ssl) {
+        socket.async_write_some(buffers, std::forward<Handler>(handler));
+        return;
+    }
+    boost::asio::const_buffer buffer = first_buffer(buffers);
+    if (buffer.size() == 0) {
+        boost::asio::post(socket.get_executor(), [handler = std::forward<Handler>(handler)]() mutable {handler(boost::system::error_code(), size_t(0));});
+        return;
+    }
+    async_tls([this, buffer]() {return SSL_write(ssl, buffer.data(), static_cast<int>(std::min<size_t>(buffer.size(), INT32_MAX)));},
+              std::forward<Handler>(handler));
+}
+
+template <typename MutableBufferSequence>
+size_t Transport::read_some(const MutableBufferSequence &buffers, boost::system::error_code &ec) {
+    if (!ssl) return socket.read_some(buffers, ec);
+    boost::asio::mutable_buffer buffer = first_buffer(buffers);
+    ec = {};
+    if (buffer.size() == 0) return 0;
+    return sync_tls([this, buffer]() {return SSL_read(ssl, buffer.data(), static_cast<int>(std::min<size_t>(buffer.size(), INT32_MAX)));}, ec);
+}
+
+template <typename MutableBufferSequence>
+size_t Transport::read_some(const MutableBufferSequence &buffers) {
+    boost::system::error_code ec;
+    size_t bytes = read_some(buffers, ec);
+    if (ec) throw boost::system::system_error(ec);
+    return bytes;
+}
+
+template <typename ConstBufferSequence>
+size_t Transport::write_some(const ConstBufferSequence &buffers, boost::system::error_code &ec) {
+    if (!ssl) return socket.write_some(buffers, ec);
+    boost::asio::const_buffer buffer = first_buffer(buffers);
+    ec = {};
+    if (buffer.size() == 0) return 0;
+    return sync_tls([this, buffer]() {return SSL_write(ssl, buffer.data(), static_cast<int>(std::min<size_t>(buffer.size(), INT32_MAX)));}, ec);
+}
+
+template <typename ConstBufferSequence>
+size_t Transport::write_some(const ConstBufferSequence &buffers) {
+    boost::system::error_code ec;
+    size_t bytes = write_some(buffers, ec);
+    if (ec) throw boost::system::system_error(ec);
+    return bytes;
+}
@@ -0,0 +1,569 @@
+#include "Version_Store.h"
+#include "Commit_Batch.h"
+#include <algorithm>
+#include <ctime>
+#include <fcntl.h>
+#include <limits>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+    auto &versions_recorded = Metrics::instance().counter("rab_versions_recorded_total");
+    auto &versions_pruned = Metrics::instance().counter("rab_versions_pruned_total");
+    auto &contents_copied = Metrics::instance().counter("rab_version_copies_total");
+
+    constexpr const char *schema =
+            "CREATE TABLE IF NOT EXISTS versions (id INTEGER PRIMARY KEY, username TEXT NOT NULL, path TEXT NOT NULL,"
+            " hash TEXT NOT NULL, size INTEGER NOT NULL, is_file INTEGER NOT NULL, committed_at INTEGER NOT NULL,"
+            " erased INTEGER NOT NULL DEFAULT 0, metadata TEXT NOT NULL DEFAULT '');"
+            "CREATE INDEX IF NOT EXISTS versions_by_path ON versions (username, path, id);"
+            "CREATE INDEX IF NOT EXISTS versions_by_hash ON versions (hash, size);"
+            "CREATE TABLE IF NOT EXISTS snapshots (id INTEGER PRIMARY KEY, username TEXT NOT NULL, name TEXT NOT NULL,"
+            " taken_at INTEGER NOT NULL, last_version INTEGER NOT NULL);"
+            "CREATE INDEX IF NOT EXISTS snapshots_by_user ON snapshots (username, id);";
+
+    constexpr const char *usage_schema =
+            "CREATE TABLE usage (username TEXT PRIMARY KEY, bytes INTEGER NOT NULL DEFAULT 0, files INTEGER NOT NULL DEFAULT 0,"
+            " quota_bytes INTEGER, quota_files INTEGER);";
+
+    constexpr const char *version_columns = "id, path, hash, size, is_file, committed_at, erased, metadata";
+
+    void bind_text(sqlite3_stmt *statement, int index, const std::string &text) {
+        sqlite3_bind_text(statement, index, text.data(), static_cast<int>(text.size()), SQLITE_TRANSIENT);
+    }
+}
+
+Version_Store::Version_Store(Retention_Policy policy, bool durable, std::string db_name, std::string root)
+        : db_name(std::move(db_name)), root(std::move(root)), policy(policy), durable(durable) {
+    if (sqlite3_open(this->db_name.c_str(), &conn) != SQLITE_OK) {
+        Logger::log(Log_Level::error, std::string("Unable to open the version index, ") + sqlite3_errmsg(conn));
+        sqlite3_close(conn);
+        conn = nullptr;
+        return;
+    }
+    sqlite3_busy_timeout(conn, 5000);
+    execute("PRAGMA journal_mode = WAL;");      // Readers of the history do not block the uploads being recorded
+    execute(durable ? "PRAGMA synchronous = FULL;" : "PRAGMA synchronous = OFF;");
+    execute(schema);
+    add_metadata_column();
+    build_usage();
+}
+
+Version_Store::~Version_Store() {
+    if (conn) sqlite3_close(conn);
+}
+
+bool Version_Store::execute(const std::string &sql) {
+    char *error = nullptr;
+    if (sqlite3_exec(conn, sql.c_str(), nullptr, nullptr, &error) == SQLITE_OK) return true;
+    Logger::log(Log_Level::error, std::string("Version index error, ") + (error ? error : "unknown"));
+    sqlite3_free(error);
+    return false;
+}
+
+std::string Version_Store::content_path(const std::string &username, int64_t id) const {
+    return root + "/" + username + "/" + std::to_string(id / 4096) + "/" + std::to_string(id);   // Sharded, so that no directory grows too much
+}
+
+bool Version_Store::keep_content(const std::string &stored, const std::string &content) {
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(boost::filesystem::path(content).parent_path(), ec);
+    ::unlink(content.c_str());      // Left by a transaction interrupted before its commit, the id is being reused
+    if (::link(stored.c_str(), content.c_str()) == 0) return true;
+    int in = ::open(stored.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) return false;
+    int out = ::open(content.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = out >= 0;
+    if (ok && ::ioctl(out, FICLONE, in) != 0) {     // No hard links on this file system, sharing the extents instead
+        contents_copied.add();
+        ssize_t copied;
+        while ((copied = ::copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0)) > 0);
+        ok = copied == 0 && (!durable || ::fdatasync(out) == 0);
+    }
+    if (out >= 0 && ::close(out) != 0) ok = false;
+    ::close(in);
+    if (!ok) ::unlink(content.c_str());
+    return ok;
+}
+
+std::optional<Stored_Object> Version_Store::find_object(const std::string &hash, uint64_t size) {
+    std::lock_guard lg(db_mutex);
+    if (!conn) return std::nullopt;
+    sqlite3_stmt *statement;
+    std::optional<Stored_Object> object;
+    if (sqlite3_prepare_v2(conn, "SELECT username, id FROM versions WHERE hash = ?1 AND size = ?2 AND is_file = 1 AND erased = 0"
+                                 " ORDER BY id DESC LIMIT 4;", -1, &statement, nullptr) == SQLITE_OK) {
+        bind_text(statement, 1, hash);
+        sqlite3_bind_int64(statement, 2, static_cast<int64_t>(size));
+        while (!object && sqlite3_step(statement) == SQLITE_ROW) {
+            Stored_Object found{reinterpret_cast<const char*>(sqlite3_column_text(statement, 0)), sqlite3_column_int64(statement, 1)};
+            found.content = content_path(found.username, found.id);
+            if (::access(found.content.c_str(), R_OK) == 0) object = std::move(found);    // Not kept if its link failed
+        }
+    }
+    sqlite3_finalize(statement);
+    return object;
+}
+
+Version_Info Version_Store::read_version(sqlite3_stmt *statement) {
+    Version_Info info;
+    info.id = sqlite3_column_int64(statement, 0);
+    info.path = reinterpret_cast<const char*>(sqlite3_column_text(statement, 1));
+    info.hash = reinterpret_cast<const char*>(sqlite3_column_text(statement, 2));
+    info.size = static_cast<uint64_t>(sqlite3_column_int64(statement, 3));
+    info.isFile = sqlite3_column_int(statement, 4) != 0;
+    info.committed_at = sqlite3_column_int64(statement, 5);
+    info.erased = sqlite3_column_int(statement, 6) != 0;
+    info.metadata = reinterpret_cast<const char*>(sqlite3_column_text(statement, 7));
+    return info;
+}
+
+bool Version_Store::record(const std::string &username, std::vector<Version_Info> &versions) {
+    if (versions.empty()) return true;
+    std::lock_guard lg(db_mutex);
+    if (!conn || !execute("BEGIN;")) return false;
+    sqlite3_stmt *insert = nullptr;
+    sqlite3_stmt *remove = nullptr;
+    // A version without metadata keeps the one of the previous version of its path, until the client sends the new one
+    bool ok = sqlite3_prepare_v2(conn, "INSERT INTO versions (username, path, hash, size, is_file, committed_at, erased, metadata)"
+                                       " VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, CASE WHEN ?8 = '' AND ?7 = 0 THEN COALESCE((SELECT metadata"
+                                       " FROM versions WHERE username = ?1 AND path = ?2 ORDER BY id DESC LIMIT 1), '') ELSE ?8 END);",
+                                 -1, &insert, nullptr) == SQLITE_OK
+            && sqlite3_prepare_v2(conn, "DELETE FROM versions WHERE id = ?1;", -1, &remove, nullptr) == SQLITE_OK;
+    std::set<std::string> directories;
+    auto now = static_cast<int64_t>(std::time(nullptr));
+    for (auto &version : versions) {
+        if (!ok) break;
+        if (version.committed_at == 0) version.committed_at = now;
+        ok = account(username, version);
+        if (!ok) break;
+        bind_text(insert, 1, username);
+        bind_text(insert, 2, version.path);
+        bind_text(insert, 3, version.hash);
+        sqlite3_bind_int64(insert, 4, static_cast<int64_t>(version.size));
+        sqlite3_bind_int(insert, 5, version.isFile);
+        sqlite3_bind_int64(insert, 6, version.committed_at);
+        sqlite3_bind_int(insert, 7, version.erased);
+        bind_text(insert, 8, version.metadata);
+        ok = sqlite3_step(insert) == SQLITE_DONE;
+        sqlite3_reset(insert);
+        if (!ok) break;
+        version.id = sqlite3_last_insert_rowid(conn);
+        if (!version.isFile || version.erased || version.stored.empty()) continue;
+        auto content = content_path(username, version.id);
+        if (keep_content(version.stored, content)) {
+            directories.insert(boost::filesystem::path(content).parent_path().string());
+        } else {    // The upload stays, only its history is incomplete
+            Logger::log(Log_Level::error, "Unable to keep version " + std::to_string(version.id) + " of " + version.path);
+            sqlite3_bind_int64(remove, 1, version.id);
+            sqlite3_step(remove);
+            sqlite3_reset(remove);
+            version.id = 0;
+        }
+    }
+    sqlite3_finalize(insert);
+    sqlite3_finalize(remove);
+    if (ok && durable) {    // The links must survive a crash before the index refers to them
+        for (auto &directory : directories) {
+            Commit_Batch::sync_directory(directory);
+            Commit_Batch::sync_directory(boost::filesystem::path(directory).parent_path().string());
+        }
+    }
+    if (!ok) {
+        Logger::log(Log_Level::error, std::string("Unable to record the versions, ") + sqlite3_errmsg(conn));
+        execute("ROLLBACK;");
+        return false;
+    }
+    if (!execute("COMMIT;")) {
+        execute("ROLLBACK;");
+        return false;
+    }
+    versions_recorded.add(static_cast<double>(versions.size()));
+    return true;
+}
+
+std::optional<uint64_t> Version_Store::current_size(const std::string &username, const std::string &path) {
+    std::optional<uint64_t> size;
+    sqlite3_stmt *statement;
+    if (sqlite3_prepare_v2(conn, "SELECT size, is_file, erased FROM versions WHERE username = ?1 AND path = ?2 ORDER BY id DESC LIMIT 1;",
+                           -1, &statement, nullptr) == SQLITE_OK) {
+        bind_text(statement, 1, username);
+        bind_text(statement, 2, path);
+        if (sqlite3_step(statement) == SQLITE_ROW && sqlite3_column_int(statement, 1) != 0 && sqlite3_column_int(statement, 2) == 0)
+            size = static_cast<uint64_t>(sqlite3_column_int64(statement, 0));
+    }
+    sqlite3_finalize(statement);
+    return size;
+}
+
+bool Version_Store::account(const std::string &username, const Version_Info &version) {
+    int64_t bytes = version.isFile && !version.erased ? static_cast<int64_t>(version.size) : 0;
+    int64_t files = version.isFile && !version.erased ? 1 : 0;
+    if (auto current = current_size(username, version.path)) {     // Replacing the stored content of the path
+        bytes -= static_cast<int64_t>(*current);
+        files -= 1;
+    }
+    if (bytes == 0 && files == 0) return true;
+    sqlite3_stmt *statement;
+    bool ok = sqlite3_prepare_v2(conn, "INSERT INTO usage (username, bytes, files) VALUES (?1, ?2, ?3)"
+                                  " ON CONFLICT (username) DO UPDATE SET bytes = bytes + ?2, files = files + ?3;", -1, &statement, nullptr) == SQLITE_OK;
+    if (ok) {
+        bind_text(statement, 1, username);
+        sqlite3_bind_int64(statement, 2, bytes);
+        sqlite3_bind_int64(statement, 3, files);
+        ok = sqlite3_step(statement) == SQLITE_DONE;
+    }
+    sqlite3_finalize(statement);
+    return ok;
+}
+
+void Version_Store::add_metadata_column() {
+    if (!conn) return;
+    sqlite3_stmt *statement;
+    bool exists = false;
+    if (sqlite3_prepare_v2(conn, "SELECT 1 FROM pragma_table_info('versions') WHERE name = 'metadata';", -1, &statement, nullptr) == SQLITE_OK)
+        exists = sqlite3_step(statement) == SQLITE_ROW;
+    sqlite3_finalize(statement);
+    if (!exists) execute("ALTER TABLE versions ADD COLUMN metadata TEXT NOT NULL DEFAULT '';");    // Index created before the metadata was kept
+}
+
+bool Version_Store::set_metadata(const std::string &username, std::vector<std::pair<std::string, std::string>> &records) {
+    if (records.empty()) return true;
+    std::lock_guard lg(db_mutex);
+    if (!conn || !execute("BEGIN;")) return false;     // A single sync for the whole batch
+    sqlite3_stmt *statement;
+    bool ok = sqlite3_prepare_v2(conn, "UPDATE versions SET metadata = ?3 WHERE id = (SELECT MAX(id) FROM versions WHERE username = ?1"
+                                       " AND path = ?2) AND erased = 0;", -1, &statement, nullptr) == SQLITE_OK;
+    std::vector<std::pair<std::string, std::string>> missing;
+    for (auto &record : records) {
+        if (!ok) break;
+        bind_text(statement, 1, username);
+        bind_text(statement, 2, record.first);
+        bind_text(statement, 3, record.second);
+        ok = sqlite3_step(statement) == SQLITE_DONE;
+        if (ok && sqlite3_changes(conn) == 0) missing.push_back(std::move(record));
+        sqlite3_reset(statement);
+    }
+    sqlite3_finalize(statement);
+    if (!ok || !execute("COMMIT;")) {
+        Logger::log(Log_Level::error, std::string("Unable to record the metadata, ") + sqlite3_errmsg(conn));
+        execute("ROLLBACK;");
+        return false;
+    }
+    records = std::move(missing);
+    return true;
+}
+
+void Version_Store::build_usage() {
+    if (!conn) return;
+    sqlite3_stmt *statement;
+    bool exists = false;
+    if (sqlite3_prepare_v2(conn, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'usage';", -1, &statement, nullptr) == SQLITE_OK)
+        exists = sqlite3_step(statement) == SQLITE_ROW;
+    sqlite3_finalize(statement);
+    if (exists) return;
+    // A single pass over the index, once: from now on record keeps the usage up to date
+    if (!execute("BEGIN;")) return;
+    if (!execute(usage_schema) || !execute("INSERT INTO usage (username, bytes, files) SELECT username, SUM(size), COUNT(*) FROM"
+                                           " (SELECT username, size, is_file, erased, MAX(id) FROM versions GROUP BY username, path)"
+                                           " WHERE is_file = 1 AND erased = 0 GROUP BY username;") || !execute("COMMIT;")) {
+        execute("ROLLBACK;");
+        return;
+    }
+    Logger::log(Log_Level::info, "Storage usage computed from the version index");
+}
+
+Storage_Usage Version_Store::usage(const std::string &username) {
+    std::lock_guard lg(db_mutex);
+    return read_usage(username);
+}
+
+Storage_Usage Version_Store::read_usage(const std::string &username) {
+    Storage_Usage usage;
+    usage.username = username;
+    if (!conn) return usage;
+    sqlite3_stmt *statement;
+    if (sqlite3_prepare_v2(conn, "SELECT bytes, files, quota_bytes, quota_files FROM usage WHERE username = ?1;", -1, &statement, nullptr) == SQLITE_OK) {
+        bind_text(statement, 1, username);
+        if (sqlite3_step(statement) == SQLITE_ROW) {
+            usage.bytes = static_cast<uint64_t>(sqlite3_column_int64(statement, 0));
+            usage.files = static_cast<uint64_t>(sqlite3_column_int64(statement, 1));
+            if (sqlite3_column_type(statement, 2) != SQLITE_NULL) usage.quota_bytes = static_cast<uint64_t>(sqlite3_column_int64(statement, 2));
+            if (sqlite3_column_type(statement, 3) != SQLITE_NULL) usage.quota_files = static_cast<uint64_t>(sqlite3_column_int64(statement, 3));
+        }
+    }
+    sqlite3_finalize(statement);
+    return usage;
+}
+
+std::vector<Storage_Usage> Version_Store::usage() {
+    std::vector<Storage_Usage> users;
+    std::lock_guard lg(db_mutex);
+    if (!conn) return users;
+    sqlite3_stmt *statement;
+    if (sqlite3_prepare_v2(conn, "SELECT username, bytes, files, quota_bytes, quota_files FROM usage ORDER BY username;", -1, &statement, nullptr) == SQLITE_OK) {
+        while (sqlite3_step(statement) == SQLITE_ROW) {
+            Storage_Usage usage;
+            usage.username = reinterpret_cast<const char*>(sqlite3_column_text(statement, 0));
+            usage.bytes = static_cast<uint64_t>(sqlite3_column_int64(statement, 1));
+            usage.files = static_cast<uint64_t>(sqlite3_column_int64(statement, 2));
+            if (sqlite3_column_type(statement, 3) != SQLITE_NULL) usage.quota_bytes = static_cast<uint64_t>(sqlite3_column_int64(statement, 3));
+            if (sqlite3_column_type(statement, 4) != SQLITE_NULL) usage.quota_files = static_cast<uint64_t>(sqlite3_column_int64(statement, 4));
+            users.push_back(std::move(usage));
+        }
+    }
+    sqlite3_finalize(statement);
+    return users;
+}
+
+std::optional<Quota_Reservation> Version_Store::reserve(const std::string &username, const std::string &path, uint64_t size,
+                                                        uint64_t default_bytes, uint64_t default_files) {
+    std::lock_guard lg(db_mutex);
+    Quota_Reservation reservation{size, static_cast<int64_t>(size), 1};
+    if (!conn) return reservation;
+    auto usage = read_usage(username);      // Read again for every upload, the limits are set by another process
+    if (auto current = current_size(username, path)) {
+        reservation.bytes -= static_cast<int64_t>(*current);
+        reservation.files = 0;
+    }
+    auto &taken = reserved[username];
+    uint64_t max_bytes = usage.quota_bytes.value_or(default_bytes);
+    uint64_t max_files = usage.quota_files.value_or(default_files);
+    int64_t bytes = static_cast<int64_t>(usage.bytes) + taken.bytes + reservation.bytes;
+    int64_t files = static_cast<int64_t>(usage.files) + taken.files + reservation.files;
+    if ((reservation.bytes > 0 && max_bytes != 0 && bytes > static_cast<int64_t>(max_bytes))
+        || (reservation.files > 0 && max_files != 0 && files > static_cast<int64_t>(max_files))) {
+        if (taken.bytes == 0 && taken.files == 0) reserved.erase(username);
+        return std::nullopt;
+    }
+    taken.bytes += reservation.bytes;
+    taken.files += reservation.files;
+    return reservation;
+}
+
+void Version_Store::release(const std::string &username, const Quota_Reservation &reservation) {
+    std::lock_guard lg(db_mutex);
+    auto taken = reserved.find(username);
+    if (taken == reserved.end()) return;
+    taken->second.bytes -= reservation.bytes;
+    taken->second.files -= reservation.files;
+    if (taken->second.bytes == 0 && taken->second.files == 0) reserved.erase(taken);
+}
+
+bool Version_Store::set_quota(const std::string &username, std::optional<uint64_t> bytes, std::optional<uint64_t> files) {
+    std::lock_guard lg(db_mutex);
+    if (!conn) return false;
+    sqlite3_stmt *statement;
+    bool ok = sqlite3_prepare_v2(conn, "INSERT INTO usage (username, quota_bytes, quota_files) VALUES (?1, ?2, ?3)"
+                                       " ON CONFLICT (username) DO UPDATE SET quota_bytes = ?2, quota_files = ?3;", -1, &statement, nullptr) == SQLITE_OK;
+    if (ok) {
+        bind_text(statement, 1, username);
+        if (bytes) sqlite3_bind_int64(statement, 2, static_cast<int64_t>(*bytes));
+        if (files) sqlite3_bind_int64(statement, 3, static_cast<int64_t>(*files));
+        ok = sqlite3_step(statement) == SQLITE_DONE;
+    }
+    sqlite3_finalize(statement);
+    if (!ok) Logger::log(Log_Level::error, std::string("Unable to set the quota of ") + username + ", " + sqlite3_errmsg(conn));
+    return ok;
+}
+
+std::vector<Version_Info> Version_Store::history(const std::string &username, const std::string &path, unsigned limit) {
+    std::vector<Version_Info> versions;
+    std::lock_guard lg(db_mutex);
+    if (!conn) return versions;
+    sqlite3_stmt *statement;
+    std::string sql = std::string("SELECT ") + version_columns + " FROM versions WHERE username = ?1 AND path = ?2 ORDER BY id DESC LIMIT ?3;";
+    if (sqlite3_prepare_v2(conn, sql.c_str(), -1, &statement, nullptr) == SQLITE_OK) {
+        bind_text(statement, 1, username);
+        bind_text(statement, 2, path);
+        sqlite3_bind_int(statement, 3, static_cast<int>(limit));
+        while (sqlite3_step(statement) == SQLITE_ROW) versions.push_back(read_version(statement));
+    }
+    sqlite3_finalize(statement);
+    return versions;
+}
+
+Snapshot_Info Version_Store::take_snapshot(const std::string &username, const std::string &name) {
+    Snapshot_Info snapshot;
+    std::lock_guard lg(db_mutex);
+    if (!conn) return snapshot;
+    sqlite3_stmt *statement;
+    if (sqlite3_prepare_v2(conn, "INSERT INTO snapshots (username, name, taken_at, last_version)"
+                                 " SELECT ?1, ?2, ?3, COALESCE(MAX(id), 0) FROM versions;", -1, &statement, nullptr) == SQLITE_OK) {
+        snapshot.name = name;
+        snapshot.taken_at = static_cast<int64_t>(std::time(nullptr));
+        bind_text(statement, 1, username);
+        bind_text(statement, 2, name);
+        sqlite3_bind_int64(statement, 3, snapshot.taken_at);
+        if (sqlite3_step(statement) == SQLITE_DONE) snapshot.id = sqlite3_last_insert_rowid(conn);
+    }
+    sqlite3_finalize(statement);
+    if (snapshot.id == 0) {
+        Logger::log(Log_Level::error, std::string("Unable to take the snapshot, ") + sqlite3_errmsg(conn));
+        return snapshot;
+    }
+    if (sqlite3_prepare_v2(conn, "SELECT last_version FROM snapshots WHERE id = ?1;", -1, &statement, nullptr) == SQLITE_OK) {
+        sqlite3_bind_int64(statement, 1, snapshot.id);
+        if (sqlite3_step(statement) == SQLITE_ROW) snapshot.last_version = sqlite3_column_int64(statement, 0);
+    }
+    sqlite3_finalize(statement);
+    return snapshot;
+}
+
+std::vector<Snapshot_Info> Version_Store::snapshots(const std::string &username) {
+    std::vector<Snapshot_Info> snapshots;
+    std::lock_guard lg(db_mutex);
+    if (!conn) return snapshots;
+    sqlite3_stmt *statement;
+    if (sqlite3_prepare_v2(conn, "SELECT id, name, taken_at, last_version FROM snapshots WHERE username = ?1 ORDER BY id DESC;",
+                           -1, &statement, nullptr) == SQLITE_OK) {
+        bind_text(statement, 1, username);
+        while (sqlite3_step(statement) == SQLITE_ROW) {
+            snapshots.push_back({sqlite3_column_int64(statement, 0), reinterpret_cast<const char*>(sqlite3_column_text(statement, 1)),
+                                 sqlite3_column_int64(statement, 2), sqlite3_column_int64(statement, 3)});
+        }
+    }
+    sqlite3_finalize(statement);
+    return snapshots;
+}
+
+std::vector<Version_Info> Version_Store::resolve(const std::string &username, const std::string &path, int64_t snapshot) {
+    std::vector<Version_Info> versions;
+    std::lock_guard lg(db_mutex);
+    if (!conn) return versions;
+    sqlite3_stmt *statement;
+    int64_t last_version = std::numeric_limits<int64_t>::max();
+    if (snapshot != 0) {
+        last_version = -1;
+        if (sqlite3_prepare_v2(conn, "SELECT last_version FROM snapshots WHERE id = ?1 AND username = ?2;", -1, &statement, nullptr) == SQLITE_OK) {
+            sqlite3_bind_int64(statement, 1, snapshot);
+            bind_text(statement, 2, username);
+            if (sqlite3_step(statement) == SQLITE_ROW) last_version = sqlite3_column_int64(statement, 0);
+        }
+        sqlite3_finalize(statement);
+        if (last_version < 0) return versions;
+    }
+    // The bare columns of a MAX aggregate come from the row holding the maximum, that is the last version of every path.
+    // Below a path, the range from the path to the one following its children, '0' after '/', is searched on the index
+    std::string sql = "SELECT MAX(id), path, hash, size, is_file, committed_at, erased, metadata FROM versions WHERE username = ?1";
+    if (!path.empty()) sql += " AND path >= ?3 AND path < (?3 || '0') AND (path = ?3 OR path > (?3 || '/'))";
+    sql += " AND id <= ?2 GROUP BY path ORDER BY path;";
+    if (sqlite3_prepare_v2(conn, sql.c_str(), -1, &statement, nullptr) == SQLITE_OK) {
+        bind_text(statement, 1, username);
+        sqlite3_bind_int64(statement, 2, last_version);
+        if (!path.empty()) bind_text(statement, 3, path);
+        while (sqlite3_step(statement) == SQLITE_ROW) {
+            auto version = read_version(statement);
+            if (!version.erased) versions.push_back(std::move(version));
+        }
+    }
+    sqlite3_finalize(statement);
+    return versions;
+}
+
+Version_Info Version_Store::version(const std::string &username, const std::string &path, int64_t id) {
+    Version_Info info;
+    std::lock_guard lg(db_mutex);
+    if (!conn) return info;
+    sqlite3_stmt *statement;
+    std::string sql = std::string("SELECT ") + version_columns + " FROM versions WHERE username = ?1 AND path = ?2 AND id = ?3;";
+    if (sqlite3_prepare_v2(conn, sql.c_str(), -1, &statement, nullptr) == SQLITE_OK) {
+        bind_text(statement, 1, username);
+        bind_text(statement, 2, path);
+        sqlite3_bind_int64(statement, 3, id);
+        if (sqlite3_step(statement) == SQLITE_ROW) info = read_version(statement);
+    }
+    sqlite3_finalize(statement);
+    return info;
+}
+
+void Version_Store::apply_retention() {
+    std::vector<std::string> users;
+    {
+        std::lock_guard lg(db_mutex);
+        if (!conn) return;
+        sqlite3_stmt *statement;
+        if (sqlite3_prepare_v2(conn, "SELECT DISTINCT username FROM versions;", -1, &statement, nullptr) == SQLITE_OK) {
+            while (sqlite3_step(statement) == SQLITE_ROW) users.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(statement, 0)));
+        }
+        sqlite3_finalize(statement);
+    }
+    auto now = static_cast<int64_t>(std::time(nullptr));
+    for (auto &username : users) {
+        std::vector<Version_Info> expired;
+        {
+            std::lock_guard lg(db_mutex);   // Released between the users, so that the uploads are recorded meanwhile
+            expired = apply_retention(username, now);
+        }
+        for (auto &version : expired) {     // Once the index no longer refers to them
+            if (version.isFile && !version.erased) ::unlink(content_path(username, version.id).c_str());
+        }
+        if (expired.empty()) continue;
+        versions_pruned.add(static_cast<double>(expired.size()));
+        Logger::log(Log_Level::info, "Retention removed " + std::to_string(expired.size()) + " versions of " + username);
+    }
+}
+
+std::vector<Version_Info> Version_Store::apply_retention(const std::string &username, int64_t now) {
+    if (!conn || !execute("BEGIN;")) return {};     // The snapshots and the versions of the user are pruned together
+    sqlite3_stmt *statement;
+    bool ok = true;
+    if (sqlite3_prepare_v2(conn, "DELETE FROM snapshots WHERE username = ?1 AND id NOT IN"
+                                 " (SELECT id FROM snapshots WHERE username = ?1 ORDER BY id DESC LIMIT ?2);", -1, &statement, nullptr) == SQLITE_OK) {
+        bind_text(statement, 1, username);
+        sqlite3_bind_int(statement, 2, static_cast<int>(policy.keep_snapshots));
+        ok = sqlite3_step(statement) == SQLITE_DONE;
+    }
+    sqlite3_finalize(statement);
+    std::vector<int64_t> snapshots;     // Last version of every kept snapshot, in increasing order
+    if (sqlite3_prepare_v2(conn, "SELECT last_version FROM snapshots WHERE username = ?1 ORDER BY last_version;", -1, &statement, nullptr) == SQLITE_OK) {
+        bind_text(statement, 1, username);
+        while (sqlite3_step(statement) == SQLITE_ROW) snapshots.push_back(sqlite3_column_int64(statement, 0));
+    }
+    sqlite3_finalize(statement);
+    auto cutoff = now - static_cast<int64_t>(policy.keep_days) * 24 * 60 * 60;
+    auto in_snapshot = [&snapshots](int64_t id, int64_t next) {   // A version is seen by the snapshots taken before the next one of its path
+        auto it = std::lower_bound(snapshots.begin(), snapshots.end(), id);
+        return it != snapshots.end() && *it < next;
+    };
+    std::vector<Version_Info> expired;
+    std::vector<Version_Info> group;    // Versions of the same path, most recent first
+    auto select_expired = [&]() {
+        bool older_kept = false;
+        for (size_t i = group.size(); i-- > 0;) {
+            int64_t next = i == 0 ? std::numeric_limits<int64_t>::max() : group[i - 1].id;
+            bool keep = group[i].committed_at >= cutoff || in_snapshot(group[i].id, next);
+            if (i == 0) keep = keep || (group[i].erased ? older_kept : true);    // A removal is only needed to hide the older versions
+            else keep = keep || i < policy.keep_versions;
+            if (keep) older_kept = true;
+            else expired.push_back(std::move(group[i]));
+        }
+        group.clear();
+    };
+    std::string sql = std::string("SELECT ") + version_columns + " FROM versions WHERE username = ?1 ORDER BY path, id DESC;";
+    if (sqlite3_prepare_v2(conn, sql.c_str(), -1, &statement, nullptr) == SQLITE_OK) {
+        bind_text(statement, 1, username);
+        while (sqlite3_step(statement) == SQLITE_ROW) {
+            auto version = read_version(statement);
+            if (!group.empty() && group.front().path != version.path) select_expired();
+            group.push_back(std::move(version));
+        }
+        if (!group.empty()) select_expired();
+    }
+    sqlite3_finalize(statement);
+    ok = ok && sqlite3_prepare_v2(conn, "DELETE FROM versions WHERE id = ?1;", -1, &statement, nullptr) == SQLITE_OK;
+    for (auto &version : expired) {
+        if (!ok) break;
+        sqlite3_bind_int64(statement, 1, version.id);
+        ok = sqlite3_step(statement) == SQLITE_DONE;
+        sqlite3_reset(statement);
+    }
+    sqlite3_finalize(statement);
+    if (!ok || !execute("COMMIT;")) {
+        Logger::log(Log_Level::error, "Unable to apply the retention policy to " + username + ", " + sqlite3_errmsg(conn));
+        execute("ROLLBACK;");
+        return {};
+    }
+    return expired;
+}
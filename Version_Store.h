@@ -0,0 +1,173 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+#include "Logger.h"
+#include "Metrics.h"
+
+/// A version of a file or directory of a user, the content of the file ones is kept in the versions area
+struct Version_Info {
+    int64_t id = 0;
+    std::string path;
+    std::string hash;
+    uint64_t size = 0;
+    bool isFile = true;
+    int64_t committed_at = 0;   // Seconds since the epoch
+    bool erased = false;        // Marks the removal of the element, the older versions stay available
+    std::string stored{};       // Stored file the content is linked from when the version is recorded
+    std::string metadata{};     // Record of the File_Metadata of the element, empty if the client did not send it
+};
+
+/// Content of a file version, shared with the uploads of the same content by any user
+struct Stored_Object {
+    std::string username;   // Owner of the version
+    int64_t id = 0;
+    std::string content{};  // File holding the content
+};
+
+/// A point in time of the tree of a user: for every path, the last version recorded before it
+struct Snapshot_Info {
+    int64_t id = 0;
+    std::string name;
+    int64_t taken_at = 0;
+    int64_t last_version = 0;
+};
+
+/// Storage taken by the current tree of a user, the older versions are not counted; a limit of 0 means unlimited
+struct Storage_Usage {
+    std::string username;
+    uint64_t bytes = 0;
+    uint64_t files = 0;
+    std::optional<uint64_t> quota_bytes;    // Limits of the user, the server defaults when not set
+    std::optional<uint64_t> quota_files;
+};
+
+/// Room taken by an upload from its start until its version is recorded or the upload is abandoned
+struct Quota_Reservation {
+    uint64_t size = 0;      // Declared size of the file
+    int64_t bytes = 0;      // Growth of the usage once the file is recorded, negative when it replaces a larger one
+    int64_t files = 0;
+};
+
+/// How long the versions that are neither current nor part of a kept snapshot survive
+struct Retention_Policy {
+    unsigned keep_versions = 10;    // Versions kept per path regardless of their age, the current one included
+    int keep_days = 30;             // Older versions are kept for this many days
+    unsigned keep_snapshots = 30;   // Most recent snapshots kept per user
+};
+
+/// History of the stored elements, indexed in its own database. Every file version is a hard link to the stored file,
+/// which the server only ever replaces by rename, so keeping it costs no copy; where links are not possible the content
+/// is cloned, and copied as a last resort. Snapshots only record the last version id, so taking one is a single insert.
+/// The usage of every user is updated in the same transaction as the versions, from the previous version of each path.
+/// The versions are indexed by hash as well, so that a content already kept for any user is found without a walk
+class Version_Store {
+    std::string db_name;
+    std::string root;
+    Retention_Policy policy;
+    bool durable;
+    sqlite3 *conn = nullptr;
+    std::mutex db_mutex;
+    std::map<std::string, Quota_Reservation> reserved;  // Room taken by the uploads in progress, by user; guarded by db_mutex
+
+    /// Runs a statement without results, returns false and logs the error if it fails
+    bool execute(const std::string &sql);
+
+    /// Reads the current row of a statement selecting id, path, hash, size, is_file, committed_at, erased, metadata
+    static Version_Info read_version(sqlite3_stmt *statement);
+
+    /// Gets the size of the current version of a path, empty if it is not a stored file
+    std::optional<uint64_t> current_size(const std::string &username, const std::string &path);
+
+    /// Reads the usage row of a user, the caller holds db_mutex
+    Storage_Usage read_usage(const std::string &username);
+
+    /// Moves the usage of a user by the difference between a version and the previous one of its path, within the
+    /// transaction recording it
+    bool account(const std::string &username, const Version_Info &version);
+
+    /// Adds the metadata column to an index created before it existed
+    void add_metadata_column();
+
+    /// Fills the usage table from the versions recorded before it existed
+    void build_usage();
+
+    /// Applies the retention policy to the versions and snapshots of a user in a single transaction, the caller holds
+    /// db_mutex; returns the versions removed from the index, whose contents are left to the caller
+    std::vector<Version_Info> apply_retention(const std::string &username, int64_t now);
+
+public:
+
+    /// Opens (creating it if needed) the version index; with durable false its writes are not synced
+    Version_Store(Retention_Policy policy = {}, bool durable = true, std::string db_name = "../Versions.sqlite",
+                  std::string root = "../../versions");
+
+    ~Version_Store();
+
+    Version_Store(const Version_Store&) = delete;
+    Version_Store& operator=(const Version_Store&) = delete;
+
+    /// Records the given versions in a single transaction, setting their ids, and keeps the content of the file ones
+    bool record(const std::string &username, std::vector<Version_Info> &versions);
+
+    /// Sets the metadata records of the current versions of the given paths in a single transaction: a change of the
+    /// metadata alone amends that version instead of recording a new one. The records of the paths without a current
+    /// version are left in records; returns false if the database could not be written
+    bool set_metadata(const std::string &username, std::vector<std::pair<std::string, std::string>> &records);
+
+    /// Gets the last versions of a path, most recent first
+    std::vector<Version_Info> history(const std::string &username, const std::string &path, unsigned limit = 100);
+
+    /// Records a snapshot of the current tree of the user and returns it, with id 0 if the database is not available
+    Snapshot_Info take_snapshot(const std::string &username, const std::string &name);
+
+    /// Gets the snapshots of the user, most recent first
+    std::vector<Snapshot_Info> snapshots(const std::string &username);
+
+    /// Gets the versions to restore for a path and the elements below it, empty for the whole tree, as they were at the
+    /// given snapshot (0 means now); the erased elements are left out
+    std::vector<Version_Info> resolve(const std::string &username, const std::string &path, int64_t snapshot = 0);
+
+    /// Gets a single version of a path, with id 0 if it does not exist
+    Version_Info version(const std::string &username, const std::string &path, int64_t id);
+
+    /// Gets the file holding the content of a version
+    std::string content_path(const std::string &username, int64_t id) const;
+
+    /// Links or clones the stored file as the content of a version, or as any other file that is only ever replaced by
+    /// rename; copies it as a last resort
+    bool keep_content(const std::string &stored, const std::string &content);
+
+    /// Finds a kept file content with the given hash and size among the versions of every user, most recent first; the
+    /// hash is weak, the caller compares the contents before sharing them
+    std::optional<Stored_Object> find_object(const std::string &hash, uint64_t size);
+
+    /// Gets the storage taken by a user, kept up to date by record so that no file system walk is needed
+    Storage_Usage usage(const std::string &username);
+
+    /// Gets the storage taken by every user, by name
+    std::vector<Storage_Usage> usage();
+
+    /// Reserves the room of an upload of the given size at path, replacing the current version of the path, against
+    /// the limits of the user or the given defaults; the recorded usage and the room already reserved by the other
+    /// uploads of the user are counted. Returns empty if the upload would go over quota
+    std::optional<Quota_Reservation> reserve(const std::string &username, const std::string &path, uint64_t size,
+                                             uint64_t default_bytes, uint64_t default_files);
+
+    /// Gives back the room of an upload, once its version is recorded or the upload is abandoned
+    void release(const std::string &username, const Quota_Reservation &reservation);
+
+    /// Sets the limits of a user, unset ones fall back to the server defaults
+    bool set_quota(const std::string &username, std::optional<uint64_t> bytes, std::optional<uint64_t> files);
+
+    /// Removes the versions and snapshots the retention policy no longer keeps, one user per transaction so that the
+    /// index is not held for the whole pass
+    void apply_retention();
+};
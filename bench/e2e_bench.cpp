@@ -0,0 +1,271 @@
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sqlite3.h>
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include "Backup_Server.h"
+#include "Client.h"
+#include "DirectoryWatcher.h"
+#include "Metrics.h"
+
+namespace fs = boost::filesystem;
+
+/// Struct describing the synthetic tree of a scenario and the changes applied once it is synchronized
+struct Scenario {
+    std::string name;
+    size_t files;           // Number of regular files in the initial tree
+    size_t file_size;       // Size of each of them in bytes
+    int depth;              // Nesting level of the directories holding the files
+    size_t changes;         // Number of changes measured in the steady state
+    bool churn;             // If true the changes also create and erase files, otherwise they only rewrite them
+};
+
+/// Struct for collecting the results of a run
+struct Results {
+    double initial_sync_seconds = 0;
+    double throughput_mb_s = 0;
+    double change_latency_median = 0;
+    double change_latency_p95 = 0;
+    double cpu_seconds = 0;
+    long peak_rss_kb = 0;
+};
+
+/// Returns the scenario with the given name, counts and sizes multiplied by scale
+Scenario make_scenario(const std::string &name, double scale) {
+    auto scaled = [scale](size_t value) {return std::max<size_t>(1, static_cast<size_t>(value * scale));};
+    if (name == "small") return {name, scaled(2000), 4096, 2, scaled(50), false};
+    if (name == "huge") return {name, std::max<size_t>(1, scaled(4)), scaled(64 << 20), 1, 4, false};
+    if (name == "deep") return {name, scaled(400), 16384, 24, scaled(50), false};
+    if (name == "churn") return {name, scaled(500), 8192, 3, scaled(100), true};
+    throw std::invalid_argument("Unknown scenario " + name + ", use small, huge, deep or churn");
+}
+
+/// Writes size pseudo random bytes to the given file
+void write_random_file(const fs::path &path, size_t size, std::mt19937_64 &generator) {
+    std::vector<uint64_t> block(8192);
+    std::ofstream out(path.string(), std::ios::out|std::ios::binary|std::ios::trunc);
+    while (size > 0) {
+        for (auto &word : block) word = generator();
+        size_t length = std::min(size, block.size() * sizeof(uint64_t));
+        out.write(reinterpret_cast<const char*>(block.data()), length);
+        size -= length;
+    }
+}
+
+/// Returns the directory of the index-th file, spreading the files over the nesting levels
+fs::path file_directory(const fs::path &tree, const Scenario &scenario, size_t index) {
+    fs::path directory = tree;
+    int level = static_cast<int>(index % scenario.depth);
+    for (int i = 0; i <= level; i++) directory /= "d" + std::to_string(i) + "_" + std::to_string(index % 7);
+    return directory;
+}
+
+/// Generates the tree of the scenario and returns the number of elements (files and directories) it contains
+size_t generate_tree(const fs::path &tree, const Scenario &scenario, std::mt19937_64 &generator) {
+    fs::create_directories(tree);
+    for (size_t i = 0; i < scenario.files; i++) {
+        fs::path directory = file_directory(tree, scenario, i);
+        fs::create_directories(directory);
+        write_random_file(directory / ("f" + std::to_string(i) + ".bin"), scenario.file_size, generator);
+    }
+    size_t elements = 0;
+    for (auto it = fs::recursive_directory_iterator(tree); it != fs::recursive_directory_iterator(); ++it) elements++;
+    return elements;
+}
+
+/// Creates the server database with a single user "bench", the stored value is the SHA-256 of the password "bench"
+void create_database(const std::string &db_path) {
+    sqlite3 *conn;
+    if (sqlite3_open(db_path.c_str(), &conn) != SQLITE_OK) throw std::runtime_error("Unable to create " + db_path);
+    const char *statements = "CREATE TABLE Client (username text not null constraint Client_pk primary key, password text not null, paths int);"
+                             "INSERT INTO Client VALUES ('bench', '1b32c28cb38c05480eccc1bd60ff97029b57a05c96718b96dad7e9d84894f549', NULL);";
+    char *error = nullptr;
+    sqlite3_exec(conn, statements, nullptr, nullptr, &error);
+    sqlite3_close(conn);
+    if (error) {
+        std::string message(error);
+        sqlite3_free(error);
+        throw std::runtime_error(message);
+    }
+}
+
+/// Returns true if the two files have the same content
+bool same_content(const fs::path &first, const fs::path &second) {
+    boost::system::error_code ec;
+    if (!fs::exists(second, ec) || fs::file_size(first, ec) != fs::file_size(second, ec)) return false;
+    std::ifstream a(first.string(), std::ios::binary), b(second.string(), std::ios::binary);
+    return std::equal(std::istreambuf_iterator<char>(a), std::istreambuf_iterator<char>(), std::istreambuf_iterator<char>(b));
+}
+
+/// Waits until the predicate is true, returns false if the timeout expires first
+template <typename Predicate>
+bool wait_for(Predicate predicate, std::chrono::seconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!predicate()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+/// Returns the user plus system time consumed by the process so far
+double cpu_seconds() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+Results run_scenario(const Scenario &scenario, const fs::path &workdir, std::chrono::seconds timeout) {
+    Results results;
+    std::mt19937_64 generator(42);
+    fs::path tree = fs::absolute(workdir / "tree");
+    fs::create_directories(workdir / "a" / "b");
+    create_database((workdir / "a" / "Clients.sqlite").string());
+    size_t elements = generate_tree(tree, scenario, generator);
+    fs::path stored = workdir / "server" / "bench";
+    fs::create_directories(workdir / "server");
+    fs::current_path(workdir / "a" / "b");     // The server keeps its data in ../../server and its database in ../Clients.sqlite
+
+    // Starting the server on an ephemeral loopback port
+    boost::asio::thread_pool server_workers(2);
+    boost::asio::io_context server_context;
+    Backup_Server server(server_context, server_workers, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    std::thread server_thread([&server_context](){server_context.run();});
+    auto &committed = Metrics::instance().counter("rab_elements_committed_total");
+    auto committed_before = committed.get();
+
+    // Initial synchronization, the scan and the hashing of the tree included
+    double cpu_start = cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    auto running_client = std::make_shared<bool>(true);
+    auto running_watcher = std::make_shared<bool>(true);
+    auto stop = std::make_shared<bool>(false);
+    Client_Config config;
+    config.username = "bench";
+    config.password = "bench";
+    boost::asio::io_context client_context;
+    auto dw = std::make_shared<DirectoryWatcher>(tree.string(), boost::chrono::milliseconds(50), running_watcher);
+    auto client = std::make_unique<Client>(client_context, "127.0.0.1", std::to_string(server.port()), running_client, tree.string(), dw, stop, running_watcher, config,
+                                           Throttling{}, nullptr, std::string(), false);     // Nobody to read the input from
+    std::thread client_thread([&client_context](){client_context.run();});
+    bool synced = wait_for([&](){return committed.get() - committed_before >= elements;}, timeout);
+    results.initial_sync_seconds = seconds_since(start);
+    results.throughput_mb_s = scenario.files * scenario.file_size / 1e6 / results.initial_sync_seconds;
+
+    // Steady state, one change at a time, measuring how long the server takes to apply it
+    std::vector<double> latencies;
+    for (size_t i = 0; synced && i < scenario.changes; i++) {
+        size_t index = (i * 7919) % scenario.files;
+        fs::path directory = file_directory(tree, scenario, index);
+        fs::path file = directory / ("f" + std::to_string(index) + ".bin");
+        if (scenario.churn && i % 3 == 2) file = directory / ("new" + std::to_string(i) + ".bin");
+        auto change_start = std::chrono::steady_clock::now();
+        if (scenario.churn && i % 3 == 1 && fs::exists(file)) {
+            fs::remove(file);
+            auto server_file = stored / fs::relative(file, tree);
+            synced = wait_for([&](){return !fs::exists(server_file);}, timeout);
+        } else {
+            std::time_t previous = fs::exists(file) ? fs::last_write_time(file) : 0;
+            write_random_file(file, std::min<size_t>(scenario.file_size, 1 << 20), generator);
+            if (fs::last_write_time(file) <= previous) fs::last_write_time(file, previous + 1);    // The watcher compares times with a one second resolution
+            auto server_file = stored / fs::relative(file, tree);
+            synced = wait_for([&](){return same_content(file, server_file);}, timeout);
+        }
+        latencies.push_back(seconds_since(change_start));
+    }
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        results.change_latency_median = latencies[latencies.size() / 2];
+        results.change_latency_p95 = latencies[std::min(latencies.size() - 1, latencies.size() * 95 / 100)];
+    }
+    results.cpu_seconds = cpu_seconds() - cpu_start;
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    results.peak_rss_kb = usage.ru_maxrss;
+
+    // Shutting down the client first, then the server
+    *running_client = *running_watcher = false;
+    client_context.stop();
+    client_thread.join();
+    client.reset();
+    server_context.stop();
+    server_thread.join();
+    server_workers.join();
+    if (!synced) throw std::runtime_error("Timeout expired before the server caught up with the client");
+    return results;
+}
+
+int main(int argc, char* argv[]) {
+    std::string scenario_name = "small";
+    double scale = 1;
+    std::string json_file;
+    std::string baseline_file;
+    double tolerance = 0.2;
+    int timeout = 600;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string option(argv[i]);
+        if (option == "--scenario") scenario_name = argv[i + 1];
+        else if (option == "--scale") scale = std::stod(argv[i + 1]);
+        else if (option == "--json") json_file = argv[i + 1];
+        else if (option == "--baseline") baseline_file = argv[i + 1];
+        else if (option == "--tolerance") tolerance = std::stod(argv[i + 1]);
+        else if (option == "--timeout") timeout = std::stoi(argv[i + 1]);
+        else {
+            std::cerr << "Usage: e2e_bench [--scenario small|huge|deep|churn] [--scale factor] [--json out.json]"
+                         " [--baseline previous.json] [--tolerance fraction] [--timeout seconds]\n";
+            return 2;
+        }
+    }
+    fs::path workdir = fs::temp_directory_path() / fs::unique_path("rab_bench_%%%%%%%%");
+    int exit_code = 0;
+    try {
+        Logger::set_level(Log_Level::warning);
+        Scenario scenario = make_scenario(scenario_name, scale);
+        fs::path original_dir = fs::current_path();
+        Results results = run_scenario(scenario, workdir, std::chrono::seconds(timeout));
+        fs::current_path(original_dir);
+        std::cout << "scenario               " << scenario.name << " (" << scenario.files << " files of " << scenario.file_size << " bytes)\n"
+                  << "initial_sync_seconds   " << results.initial_sync_seconds << "\n"
+                  << "throughput_mb_s        " << results.throughput_mb_s << "\n"
+                  << "change_latency_median  " << results.change_latency_median << "\n"
+                  << "change_latency_p95     " << results.change_latency_p95 << "\n"
+                  << "cpu_seconds            " << results.cpu_seconds << "\n"
+                  << "peak_rss_kb            " << results.peak_rss_kb << std::endl;
+        boost::property_tree::ptree pt;
+        pt.put("scenario", scenario.name);
+        pt.put("scale", scale);
+        pt.put("initial_sync_seconds", results.initial_sync_seconds);
+        pt.put("throughput_mb_s", results.throughput_mb_s);
+        pt.put("change_latency_median", results.change_latency_median);
+        pt.put("change_latency_p95", results.change_latency_p95);
+        pt.put("cpu_seconds", results.cpu_seconds);
+        pt.put("peak_rss_kb", results.peak_rss_kb);
+        if (!json_file.empty()) boost::property_tree::write_json(json_file, pt);
+        if (!baseline_file.empty()) {   // Failing if a time grew or the throughput dropped by more than the tolerance
+            boost::property_tree::ptree baseline;
+            boost::property_tree::read_json(baseline_file, baseline);
+            for (const char *key : {"initial_sync_seconds", "change_latency_median", "cpu_seconds"}) {
+                if (pt.get<double>(key) > baseline.get<double>(key) * (1 + tolerance)) {
+                    std::cerr << "Regression: " << key << " " << pt.get<double>(key) << " vs " << baseline.get<double>(key) << std::endl;
+                    exit_code = 1;
+                }
+            }
+            if (pt.get<double>("throughput_mb_s") < baseline.get<double>("throughput_mb_s") * (1 - tolerance)) {
+                std::cerr << "Regression: throughput_mb_s " << pt.get<double>("throughput_mb_s") << " vs "
+                          << baseline.get<double>("throughput_mb_s") << std::endl;
+                exit_code = 1;
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        exit_code = 1;
+    }
+    boost::system::error_code ec;
+    fs::remove_all(workdir, ec);
+    return exit_code;
+}
@@ -0,0 +1,220 @@
+#include <benchmark/benchmark.h>
+#include <fstream>
+#include <random>
+#include <boost/filesystem.hpp>
+#include "Base64/base64.h"
+#include "DirectoryWatcher.h"
+#include "Ignore_Rules.h"
+#include "Message.h"
+#include "Server_Session.h"
+#include "Transport.h"
+
+namespace fs = boost::filesystem;
+
+/// Returns size pseudo random bytes, always the same ones for a given size
+static std::vector<BYTE> random_bytes(size_t size) {
+    std::mt19937 generator(static_cast<unsigned>(size));
+    std::vector<BYTE> bytes(size);
+    for (auto &byte : bytes) byte = static_cast<BYTE>(generator());
+    return bytes;
+}
+
+static void BM_Message_encode(benchmark::State &state) {
+    std::string data = base64_encode(random_bytes(state.range(0)).data(), state.range(0));
+    auto pool = std::make_shared<Buffer_Pool>();
+    for (auto _ : state) {
+        Message msg(pool);
+        msg.encode_message(2, data);
+        benchmark::DoNotOptimize(msg.buffer());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_Message_encode)->Arg(64)->Arg(64 << 10)->Arg(1 << 20);
+
+static void BM_Message_decode(benchmark::State &state) {
+    std::string data = base64_encode(random_bytes(state.range(0)).data(), state.range(0));
+    Message encoded;
+    encoded.encode_message(2, data);
+    std::string wire(static_cast<const char*>(encoded.buffer().data()), encoded.size());
+    auto pool = std::make_shared<Buffer_Pool>();
+    for (auto _ : state) {
+        Message msg(pool);
+        msg.decode_message(wire);
+        benchmark::DoNotOptimize(msg.get_header());
+    }
+    state.SetBytesProcessed(state.iterations() * wire.size());
+}
+BENCHMARK(BM_Message_decode)->Arg(64)->Arg(64 << 10)->Arg(1 << 20);
+
+/// Round trip of a status message as the server sends it after each chunk, the shape of the steady state traffic
+static void BM_Message_control_round_trip(benchmark::State &state) {
+    auto pool = std::make_shared<Buffer_Pool>();
+    std::string data = "dir/sub/some_file:txt updated";
+    for (auto _ : state) {
+        Message response(pool);
+        response.encode_message(3, data);
+        Message msg(pool);
+        msg.decode_message(std::string_view(static_cast<const char*>(response.buffer().data()), response.size()));
+        benchmark::DoNotOptimize(msg.get_data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Message_control_round_trip);
+
+static void BM_base64_encode(benchmark::State &state) {
+    auto bytes = random_bytes(state.range(0));
+    for (auto _ : state) benchmark::DoNotOptimize(base64_encode(bytes.data(), bytes.size()));
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_base64_encode)->Arg(64)->Arg(64 << 10)->Arg(1 << 20);
+
+static void BM_base64_decode(benchmark::State &state) {
+    auto bytes = random_bytes(state.range(0));
+    std::string encoded = base64_encode(bytes.data(), bytes.size());
+    for (auto _ : state) benchmark::DoNotOptimize(base64_decode(encoded));
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_base64_decode)->Arg(64)->Arg(64 << 10)->Arg(1 << 20);
+
+/// Encoding into a caller buffer with each kernel the CPU supports, range(0) is the kernel and range(1) the size
+static void BM_base64_encode_kernel(benchmark::State &state) {
+    auto kernel = static_cast<Base64_Kernel>(state.range(0));
+    auto previous = base64_kernel();
+    if (!base64_use_kernel(kernel)) return state.SkipWithError("Kernel not supported by this CPU");
+    state.SetLabel(base64_kernel_name(kernel));
+    auto bytes = random_bytes(state.range(1));
+    std::string encoded(base64_encoded_size(bytes.size()), '\0');
+    for (auto _ : state) benchmark::DoNotOptimize(base64_encode(bytes.data(), bytes.size(), encoded.data()));
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+    base64_use_kernel(previous);
+}
+BENCHMARK(BM_base64_encode_kernel)->ArgsProduct({{0, 1, 2, 3}, {64 << 10, 1 << 20}});
+
+static void BM_base64_decode_kernel(benchmark::State &state) {
+    auto kernel = static_cast<Base64_Kernel>(state.range(0));
+    auto previous = base64_kernel();
+    if (!base64_use_kernel(kernel)) return state.SkipWithError("Kernel not supported by this CPU");
+    state.SetLabel(base64_kernel_name(kernel));
+    auto bytes = random_bytes(state.range(1));
+    std::string encoded = base64_encode(bytes.data(), bytes.size());
+    std::vector<BYTE> decoded(base64_decoded_max_size(encoded.size()));
+    for (auto _ : state) benchmark::DoNotOptimize(base64_decode(encoded.data(), encoded.size(), decoded.data()));
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+    base64_use_kernel(previous);
+}
+BENCHMARK(BM_base64_decode_kernel)->ArgsProduct({{0, 1, 2, 3}, {64 << 10, 1 << 20}});
+
+static void BM_make_hash(benchmark::State &state) {
+    fs::path dir = fs::temp_directory_path() / fs::unique_path("rab_micro_%%%%%%%%");
+    fs::create_directories(dir);
+    fs::path file = dir / "data.bin";
+    auto bytes = random_bytes(state.range(0));
+    std::ofstream(file.string(), std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    auto running = std::make_shared<bool>(false);
+    DirectoryWatcher dw(dir.string(), boost::chrono::milliseconds(500), running);
+    fs::directory_entry element(file);
+    for (auto _ : state) benchmark::DoNotOptimize(dw.make_hash(element));
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+    fs::remove_all(dir);
+}
+BENCHMARK(BM_make_hash)->Arg(4 << 10)->Arg(1 << 20)->Arg(16 << 20);
+
+static void BM_compare_paths(benchmark::State &state) {
+    std::map<std::string, std::string> paths;
+    ptree client_pt;
+    for (int i = 0; i < state.range(0); i++) {     // One path in ten differs, one in a hundred exists only on the server
+        std::string path = "dir" + std::to_string(i % 97) + "/file" + std::to_string(i) + ":txt";
+        std::string hash = std::to_string(i * 2654435761u);
+        paths[path] = hash;
+        if (i % 100 != 0) client_pt.add_child(ptree::path_type(path, '\0'), ptree(i % 10 == 0 ? hash + "x" : hash));
+    }
+    for (auto _ : state) benchmark::DoNotOptimize(Server_Session::compare_paths(paths, client_pt));
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_compare_paths)->Arg(1000)->Arg(100000);
+
+/// Matching cost per path with a typical rule set grown to the given number of rules, one third each of plain names,
+/// extensions and globs, over paths of which about one in four is excluded
+static void BM_ignore_rules(benchmark::State &state) {
+    Ignore_Rules rules;
+    for (auto rule : {"node_modules/", ".git/", "build/", "*.tmp", "*.o", "*.swp", "**/cache/**", "/dist", "logs/**/*.log", "!keep.tmp"})
+        rules.add(rule);
+    for (int i = 0; rules.size() < static_cast<size_t>(state.range(0)); i++) {
+        switch (i % 3) {
+            case 0 : rules.add("name" + std::to_string(i)); break;
+            case 1 : rules.add("*.ext" + std::to_string(i)); break;
+            default : rules.add("dir" + std::to_string(i) + "/**/*.[ch]"); break;
+        }
+    }
+    std::vector<std::pair<std::string, bool>> paths;
+    const char *names[] = {"main.cpp", "notes.tmp", "keep.tmp", "module.o", "README.md", "node_modules", "app.log", "cache"};
+    for (int i = 0; i < 1024; i++) {
+        std::string path = "src/dir" + std::to_string(i % 13) + "/sub" + std::to_string(i % 7) + "/" + names[i % 8];
+        if (i % 5 == 0) path = "logs/2024/" + std::to_string(i) + "/app.log";
+        paths.emplace_back(path, i % 8 == 5 || i % 8 == 7);
+    }
+    size_t excluded = 0;
+    for (auto _ : state) {
+        for (auto &[path, directory] : paths) excluded += rules.ignored(path, directory);
+    }
+    benchmark::DoNotOptimize(excluded);
+    state.SetItemsProcessed(state.iterations() * paths.size());
+}
+BENCHMARK(BM_ignore_rules)->Arg(10)->Arg(100)->Arg(1000);
+
+/// Reads the messages with a handler that starts the next read, as the sessions did before their coroutines: every
+/// message goes through the socket operation, even when it is already in the buffer
+static void read_with_callbacks(Transport &transport, boost::asio::streambuf &buffer, size_t remaining, size_t &read) {
+    boost::asio::async_read_until(transport, buffer, "\n}\n", [&transport, &buffer, remaining, &read](boost::system::error_code ec, size_t length) {
+        if (ec) return;
+        buffer.consume(length);
+        read += length;
+        if (remaining > 1) read_with_callbacks(transport, buffer, remaining - 1, read);
+    });
+}
+
+/// Reads the messages with a loop of co_await, as the sessions do, waiting only when no complete message is buffered
+static boost::asio::awaitable<void> read_with_coroutine(Transport &transport, boost::asio::streambuf &buffer, size_t count, size_t &read) {
+    boost::system::error_code ec;
+    for (size_t i = 0; i < count; i++) {
+        size_t length = Message::complete_length(std::string_view(static_cast<const char*>(buffer.data().data()), buffer.size()));
+        if (length == 0) length = co_await boost::asio::async_read_until(transport, buffer, "\n}\n", boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        if (ec) co_return;
+        buffer.consume(length);
+        read += length;
+    }
+}
+
+/// Reading loop of a session over loopback TCP, with callbacks (0) or with a coroutine (1): every iteration writes a
+/// burst of 1 KiB messages, then times their reading through the Transport
+static void BM_read_loop(benchmark::State &state) {
+    constexpr size_t burst = 64;
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    tcp::socket writer(io_context), reader(io_context);
+    writer.connect(acceptor.local_endpoint());
+    acceptor.accept(reader);
+    Transport transport(reader);
+    Message msg;
+    msg.encode_message(2, std::string(1024, 'a'));
+    std::string wire;
+    for (size_t i = 0; i < burst; i++) wire.append(static_cast<const char*>(msg.buffer().data()), msg.size());
+    boost::asio::streambuf buffer;
+    buffer.prepare(Message::read_room);
+    size_t read = 0;
+    for (auto _ : state) {
+        state.PauseTiming();    // Only the reading is measured
+        boost::asio::write(writer, boost::asio::buffer(wire));
+        state.ResumeTiming();
+        if (state.range(0) == 0) read_with_callbacks(transport, buffer, burst, read);
+        else boost::asio::co_spawn(io_context, read_with_coroutine(transport, buffer, burst, read), boost::asio::detached);
+        io_context.run();
+        io_context.restart();
+    }
+    if (read != state.iterations() * wire.size()) state.SkipWithError("Messages lost");
+    state.SetItemsProcessed(state.iterations() * burst);
+    state.SetBytesProcessed(read);
+}
+BENCHMARK(BM_read_loop)->Arg(0)->Arg(1);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,57 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+#include "Base64/base64.h"
+
+/// Randomly corrupts the encoded text, so that the decoders also meet padding, invalid characters and truncations
+void mutate(std::string &encoded, std::mt19937_64 &generator) {
+    static const char alphabet[] = "AZaz09+/=\n -_\x80\xff";
+    if (encoded.empty()) return;
+    switch (generator() % 4) {
+        case 0:
+            break;
+        case 1:
+            for (int i = generator() % 4; i >= 0; i--) encoded[generator() % encoded.size()] = alphabet[generator() % (sizeof(alphabet) - 1)];
+            break;
+        case 2:
+            encoded.resize(generator() % (encoded.size() + 1));
+            break;
+        default:
+            encoded.insert(generator() % encoded.size(), 1, alphabet[generator() % (sizeof(alphabet) - 1)]);
+    }
+}
+
+/// Compares every kernel the CPU supports with the scalar one on random inputs of every length up to max_size
+int main(int argc, char* argv[]) {
+    size_t iterations = argc > 1 ? std::stoul(argv[1]) : 200000;
+    auto seed = argc > 2 ? std::stoull(argv[2]) : std::random_device()();
+    std::mt19937_64 generator(seed);
+    const size_t max_size = 1024;
+    std::vector<BYTE> bytes(max_size), expected_bytes(max_size), actual_bytes(max_size);
+    std::string expected(base64_encoded_size(max_size) + 1, '\0'), actual(expected.size(), '\0');
+    auto kernels = base64_available_kernels();
+    for (size_t i = 0; i < iterations; i++) {
+        size_t size = i < max_size ? i : generator() % max_size;
+        for (size_t j = 0; j < size; j++) bytes[j] = static_cast<BYTE>(generator());
+        size_t encoded_size = base64_encode_scalar(bytes.data(), size, expected.data());
+        std::string encoded = expected.substr(0, encoded_size);
+        mutate(encoded, generator);
+        size_t decoded_size = base64_decode_scalar(encoded.data(), encoded.size(), expected_bytes.data());
+        for (auto kernel : kernels) {
+            base64_use_kernel(kernel);
+            if (base64_encode(bytes.data(), size, actual.data()) != encoded_size || actual.compare(0, encoded_size, expected, 0, encoded_size) != 0) {
+                std::cerr << base64_kernel_name(kernel) << " encoder differs on " << size << " bytes, seed " << seed << std::endl;
+                return 1;
+            }
+            if (base64_decode(encoded.data(), encoded.size(), actual_bytes.data()) != decoded_size ||
+                !std::equal(expected_bytes.begin(), expected_bytes.begin() + decoded_size, actual_bytes.begin())) {
+                std::cerr << base64_kernel_name(kernel) << " decoder differs on \"" << encoded << "\", seed " << seed << std::endl;
+                return 1;
+            }
+        }
+    }
+    for (auto kernel : kernels) std::cout << base64_kernel_name(kernel) << " ";
+    std::cout << "match the scalar codec on " << iterations << " inputs" << std::endl;
+    return 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+
+/// Reports a failed check and makes the check function return false
+#define CHECK(condition) do { if (!(condition)) { std::cerr << "Check failed at " << __FILE__ << ":" << __LINE__ << ": " #condition << std::endl; return false; } } while (false)
+
+/// Temporary directory of a test, removed with its content when the test ends
+struct Scratch_Directory {
+    boost::filesystem::path path;
+
+    explicit Scratch_Directory(const std::string &prefix)
+            : path(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path(prefix + "_%%%%%%")) {
+        boost::filesystem::create_directories(path);
+    }
+
+    ~Scratch_Directory() {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(path, ec);
+    }
+};
+
+/// Runs the checks in order up to the first one failing and reports the outcome; returns the exit status of the test
+inline int run_checks(const std::string &name, std::initializer_list<std::function<bool()>> checks) {
+    for (auto &check : checks)
+        if (!check()) return 1;
+    std::cout << name << " checks passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Fair_Scheduler.h"
+#include "check.h"
+
+/// Executor of the sessions run by hand, one task at a time, so that the order the scheduler picks is observable
+struct Manual_Executor {
+    std::deque<std::function<void()>> pending;
+
+    Fair_Scheduler::Dispatch dispatch() {
+        return [this](std::function<void()> task) {pending.push_back(std::move(task));};
+    }
+
+    /// Runs the tasks handed out until none is left
+    void drain() {
+        while (!pending.empty()) {
+            auto task = std::move(pending.front());
+            pending.pop_front();
+            task();
+        }
+    }
+};
+
+/// A user with three sessions gets the same share as a user with one, and every flow keeps its own order
+bool check_sessions_do_not_buy_shares() {
+    Manual_Executor executor;
+    auto scheduler = std::make_shared<Fair_Scheduler>(1);
+    std::vector<std::shared_ptr<Fair_Scheduler::Flow>> flows;
+    for (auto user : {"heavy", "heavy", "heavy", "light"}) {
+        flows.push_back(scheduler->open(executor.dispatch()));
+        CHECK(scheduler->join(flows.back(), user, 0));
+    }
+    std::vector<std::pair<size_t, int>> order;     // Flow and sequence number of the tasks, as they ran
+    for (int n = 0; n < 20; n++)
+        for (size_t f = 0; f < flows.size(); f++) scheduler->submit(flows[f], 1 << 20, [&order, f, n]() {order.emplace_back(f, n);});
+    executor.drain();
+    CHECK(order.size() == 80);
+    size_t light = 0;
+    for (size_t i = 0; i < 40; i++) light += order[i].first == 3;
+    CHECK(light >= 19);     // Every other task until the light user runs out of work
+    std::map<size_t, int> last;
+    for (auto [f, n] : order) {
+        CHECK(!last.contains(f) || last[f] == n - 1);
+        last[f] = n;
+    }
+    for (auto &flow : flows) scheduler->close(flow);
+    CHECK(scheduler->session_count() == 0 && scheduler->backlog() == 0);
+    return true;
+}
+
+/// The shares are counted in bytes: a user sending small requests runs many of them for each large one of the other
+bool check_shares_follow_bytes() {
+    Manual_Executor executor;
+    auto scheduler = std::make_shared<Fair_Scheduler>(1);
+    auto large = scheduler->open(executor.dispatch()), small = scheduler->open(executor.dispatch());
+    CHECK(scheduler->join(large, "large", 0) && scheduler->join(small, "small", 0));
+    const uint64_t large_cost = (1 << 20) - Fair_Scheduler::task_overhead, small_cost = (64 << 10) - Fair_Scheduler::task_overhead;
+    std::vector<std::string> order;
+    for (int n = 0; n < 8; n++) scheduler->submit(large, large_cost, [&order]() {order.emplace_back("large");});
+    for (int n = 0; n < 128; n++) scheduler->submit(small, small_cost, [&order]() {order.emplace_back("small");});
+    CHECK(scheduler->backlog() == 7 * (1ull << 20) + 128 * (64ull << 10));     // The first large task already started
+    executor.drain();
+    CHECK(order.size() == 136);
+    int64_t balance = 0;    // Bytes of the large user minus bytes of the small one, while both have work
+    for (size_t i = 0; i < 68; i++) {
+        balance += order[i] == "large" ? 1 << 20 : -(64 << 10);
+        CHECK(balance <= (1 << 20) && balance >= -(1 << 20));   // Never more than one large task apart
+    }
+    scheduler->close(large);
+    scheduler->close(small);
+    return true;
+}
+
+/// A user past its sessions is refused and the flow stays anonymous, a session closing makes room again
+bool check_admission() {
+    Manual_Executor executor;
+    auto scheduler = std::make_shared<Fair_Scheduler>(2);
+    auto first = scheduler->open(executor.dispatch()), second = scheduler->open(executor.dispatch());
+    auto third = scheduler->open(executor.dispatch());
+    CHECK(scheduler->session_count() == 3);
+    CHECK(scheduler->join(first, "user", 2) && scheduler->join(second, "user", 2));
+    CHECK(!scheduler->join(third, "user", 2));
+    CHECK(scheduler->join(first, "user", 2));     // Logged in again on the same connection
+    bool ran = false;
+    scheduler->submit(third, 0, [&ran]() {ran = true;});     // The refused session still gets its answer out
+    executor.drain();
+    CHECK(ran);
+    scheduler->close(second);
+    CHECK(scheduler->session_count() == 2);
+    CHECK(scheduler->join(third, "user", 2));
+    CHECK(scheduler->join(scheduler->open(executor.dispatch()), "other", 2));     // The limit is per user
+    scheduler->close(first);
+    scheduler->close(third);
+    return true;
+}
+
+int main() {
+    return run_checks("Fair scheduler", {check_sessions_do_not_buy_shares, check_shares_follow_bytes, check_admission});
+}
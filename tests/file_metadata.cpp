@@ -0,0 +1,105 @@
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "DirectoryWatcher.h"
+#include "File_Metadata.h"
+#include "check.h"
+
+/// Records survive the encoding, links and attributes with spaces and binary bytes included
+bool check_records() {
+    File_Metadata metadata;
+    metadata.mode = S_IFLNK | 0777;
+    metadata.uid = 1000;
+    metadata.gid = 100;
+    metadata.mtime_ns = 1700000000123456789;
+    metadata.link = "../a target/with spaces";
+    metadata.xattrs = {{"user.comment", std::string("binary\0 value", 13)}, {"user.empty", ""}};
+    auto decoded = File_Metadata::decode(metadata.encode());
+    CHECK(decoded.mode == metadata.mode && decoded.uid == metadata.uid && decoded.gid == metadata.gid);
+    CHECK(decoded.mtime_ns == metadata.mtime_ns && decoded.link == metadata.link && decoded.xattrs == metadata.xattrs);
+    CHECK(decoded.is_link() && !decoded.is_directory());
+    CHECK(File_Metadata::decode("33188 0 0 -5").mtime_ns == -5);
+    for (auto malformed : {"", "1 2 3", "1 2 3 x", "1 2 3 4 y", "1 2 3 4 xAAAA"}) {
+        try {
+            File_Metadata::decode(malformed);
+            CHECK(false);
+        } catch (const std::invalid_argument &) {}
+    }
+    return true;
+}
+
+/// The metadata read from a file can be applied to another one, a link takes the place of the element
+bool check_apply(const boost::filesystem::path &directory) {
+    auto source = (directory / "source").string();
+    auto copy = (directory / "copy").string();
+    std::ofstream(source) << "content";
+    std::ofstream(copy) << "content";
+    ::chmod(source.c_str(), 0640);
+    timespec times[2] = {{0, UTIME_OMIT}, {1600000000, 987654321}};
+    ::utimensat(AT_FDCWD, source.c_str(), times, 0);
+    auto metadata = File_Metadata::read(source);
+    CHECK(metadata && metadata->mtime_ns == 1600000000987654321 && (metadata->mode & 07777) == 0640 && metadata->size == 7);
+    CHECK(metadata->apply(copy, false));
+    auto applied = File_Metadata::read(copy);
+    CHECK(applied && applied->encode() == metadata->encode());
+
+    auto link = (directory / "link").string();
+    ::symlink("source", link.c_str());
+    auto link_metadata = File_Metadata::read(link);
+    CHECK(link_metadata && link_metadata->is_link() && link_metadata->link == "source");
+    CHECK(link_metadata->apply(copy, false));
+    CHECK(boost::filesystem::is_symlink(copy) && boost::filesystem::read_symlink(copy).string() == "source");
+    CHECK(!File_Metadata::read((directory / "missing").string()));
+    return true;
+}
+
+/// A change of the permissions or of the time of last edit alone is reported as a metadata change, a new content is not
+bool check_watcher(const boost::filesystem::path &directory) {
+    auto root = directory / "root";
+    boost::filesystem::create_directories(root / "sub");
+    auto file = (root / "sub" / "file").string();
+    std::ofstream(file) << "first";
+    ::symlink("sub/file", (root / "link").c_str());
+    auto watching = std::make_shared<bool>(false);
+    DirectoryWatcher watcher(root.string(), boost::chrono::milliseconds(0), watching);
+    CHECK(watcher.getPaths().size() == 3);
+    CHECK(watcher.getNode((root / "link").string()).isFile);
+    CHECK(!watcher.getNode((root / "link").string()).metadata.empty());
+
+    auto changes_of = [&]() {   // The changes reported by the scans of the next 200 ms
+        std::vector<std::pair<std::string, FileStatus>> changes;
+        *watching = true;
+        boost::thread stopper([&watching]() {
+            boost::this_thread::sleep_for(boost::chrono::milliseconds(200));
+            *watching = false;
+        });
+        watcher.start([&](std::string path, FileStatus status, bool) {
+            changes.emplace_back(boost::filesystem::path(path).filename().string(), status);
+        });
+        stopper.join();
+        return changes;
+    };
+    CHECK(changes_of().empty());
+    ::chmod(file.c_str(), 0600);
+    auto changes = changes_of();
+    CHECK(changes.size() == 1 && changes[0].first == "file" && changes[0].second == FileStatus::metadata);
+    auto hash = watcher.getNode(file).hash;
+    timespec times[2] = {{0, UTIME_OMIT}, {1500000000, 1}};
+    ::utimensat(AT_FDCWD, file.c_str(), times, 0);
+    changes = changes_of();
+    CHECK(changes.size() == 1 && changes[0].second == FileStatus::metadata && watcher.getNode(file).hash == hash);
+    std::ofstream(file) << "second";
+    changes = changes_of();
+    bool modified = false;
+    for (auto &change : changes) modified |= change.first == "file" && change.second == FileStatus::modified;
+    CHECK(modified && watcher.getNode(file).hash != hash);
+    return true;
+}
+
+int main() {
+    Scratch_Directory scratch("rab_metadata");
+    return run_checks("File metadata", {check_records, [&]() {return check_apply(scratch.path);}, [&]() {return check_watcher(scratch.path);}});
+}
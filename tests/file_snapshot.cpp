@@ -0,0 +1,144 @@
+#include <boost/filesystem.hpp>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <linux/fs.h>
+#include <random>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "File_Snapshot.h"
+#include "Metrics.h"
+#include "check.h"
+
+/// Returns size pseudo random bytes, the same ones for the same seed
+std::string random_content(size_t size, unsigned seed) {
+    std::mt19937 generator(seed);
+    std::string content(size, '\0');
+    for (auto &c : content) c = static_cast<char>(generator());
+    return content;
+}
+
+/// Writes the file and dates it a minute back, so that a write in the same clock tick still changes its time
+void write_file(const std::string &path, const std::string &content) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc).write(content.data(), static_cast<std::streamsize>(content.size()));
+    struct timespec times[2] = {{::time(nullptr) - 60, 0}, {::time(nullptr) - 60, 0}};
+    ::utimensat(AT_FDCWD, path.c_str(), times, 0);
+}
+
+std::string read_file(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+std::string content_hash(const std::string &content) {
+    Content_Hasher hasher;
+    hasher.update(content.data(), content.size());
+    return hasher.final();
+}
+
+/// Whether the file system of the directory shares extents between files
+bool supports_reflinks(const boost::filesystem::path &directory) {
+    auto source = (directory / "reflink_source").string(), target = (directory / "reflink_target").string();
+    std::ofstream(source) << "content";
+    int from = ::open(source.c_str(), O_RDONLY | O_CLOEXEC), to = ::open(target.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    bool supported = from >= 0 && to >= 0 && ::ioctl(to, FICLONE, from) == 0;
+    if (from >= 0) ::close(from);
+    if (to >= 0) ::close(to);
+    boost::filesystem::remove(source);
+    boost::filesystem::remove(target);
+    return supported;
+}
+
+/// Runs the read of a chunk, the writer getting in while the data is consumed; returns whether the writer succeeded and
+/// File_Changed was thrown
+bool changed_while_read(const std::string &path, const std::function<bool(int)> &writer) {
+    File_Reader file(path);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    bool written = false, changed = false;
+    try {
+        read_unchanged(file, 0, 1 << 20, file_version(file.descriptor()), [&](const Extent &, std::string_view) {written = writer(fd);});
+    } catch (const File_Changed &) {
+        changed = true;
+    }
+    ::close(fd);
+    return written && changed;
+}
+
+/// A chunk is refused when the file is written, grown or truncated between the lookup of its extent and the end of
+/// its read, and when it was written since it was hashed; an unchanged file reads as it is
+bool check_changes_detected(const boost::filesystem::path &directory) {
+    auto path = (directory / "changing").string();
+    std::string content = random_content(3 << 20, 1);
+    write_file(path, content);
+    CHECK(changed_while_read(path, [](int fd) {return ::pwrite(fd, "x", 1, 100) == 1;}));    // In place, same size
+    write_file(path, content);
+    CHECK(changed_while_read(path, [](int fd) {return ::pwrite(fd, "x", 1, 4 << 20) == 1;}));
+    write_file(path, content);
+    CHECK(changed_while_read(path, [](int fd) {return ::ftruncate(fd, 1 << 10) == 0;}));
+    write_file(path, content);
+    CHECK(!changed_while_read(path, [](int) {return true;}));
+    File_Reader file(path);
+    auto hashed = file_version(file.descriptor());
+    std::ofstream(path, std::ios::binary | std::ios::in) << content[0];    // The same byte, but written again, now
+    bool consumed = false;
+    try {
+        read_unchanged(file, 0, 1 << 20, hashed, [&consumed](const Extent &, std::string_view) {consumed = true;});
+        CHECK(false);
+    } catch (const File_Changed &) {}
+    CHECK(!consumed);
+    std::string read;
+    Extent extent = read_unchanged(file, 1 << 20, 1 << 20, std::nullopt, [&read](const Extent &, std::string_view data) {read = data;});
+    CHECK(extent.hole == 0 && extent.data == 1 << 20 && read == content.substr(1 << 20, 1 << 20));
+    return true;
+}
+
+/// The snapshot keeps the content and the hash the file had when it was taken, however the file changes afterwards,
+/// and is taken the way the counter of kind tells
+bool check_snapshot(const boost::filesystem::path &directory, const std::string &kind) {
+    auto &taken = Metrics::instance().counter("rab_snapshots_total{kind=\"" + kind + "\"}");
+    auto taken_before = taken.get();
+    auto path = (directory / "snapshot_source").string();
+    std::string content = random_content((2 << 20) + 123, 2);
+    write_file(path, content);
+    auto snapshot = File_Snapshot::take(path);
+    CHECK(snapshot);
+    CHECK(taken.get() == taken_before + 1);
+    write_file(path, random_content(content.size(), 3));
+    std::ofstream(path, std::ios::app) << "appended";
+    CHECK(read_file(snapshot->path()) == content);
+    CHECK(snapshot->hash() == content_hash(content) && snapshot->size() == content.size());
+    boost::filesystem::remove(path);
+    CHECK(read_file(snapshot->path()) == content);    // Unnamed, it outlives the file
+    return true;
+}
+
+/// Without reflinks a snapshot is a copy of the file, refused past the copy limit
+bool check_copy_fallback(const boost::filesystem::path &directory) {
+    CHECK(check_snapshot(directory, "copy"));
+    auto path = (directory / "huge").string();
+    std::ofstream(path).close();
+    boost::filesystem::resize_file(path, max_snapshot_copy + 1);     // Sparse, no room taken
+    CHECK(!File_Snapshot::take(path));
+    return true;
+}
+
+int main() {
+    namespace fs = boost::filesystem;
+    Scratch_Directory scratch("rab_snapshot");
+    bool reflinks = supports_reflinks(scratch.path);
+    const char *reflink_directory = std::getenv("RAB_REFLINK_DIR");   // A file system with reflinks, where the temporary one has none
+    fs::path clones = reflinks ? scratch.path : reflink_directory ? fs::path(reflink_directory) : fs::path();
+    if (!clones.empty() && !supports_reflinks(clones)) clones.clear();
+    if (clones.empty()) std::cout << "No file system with reflinks, the clones are not checked; see RAB_REFLINK_DIR" << std::endl;
+    fs::path copies = reflinks ? "/dev/shm" / fs::unique_path("rab_snapshot_%%%%%%") : scratch.path;   // tmpfs never shares extents
+    if (reflinks) fs::create_directories(copies);
+    int status = run_checks("File snapshot", {
+        [&]() {return check_changes_detected(scratch.path);},
+        [&]() {return check_copy_fallback(copies);},
+        [&]() {return clones.empty() || check_snapshot(clones, "clone");}});
+    boost::system::error_code ec;
+    if (reflinks) fs::remove_all(copies, ec);
+    return status;
+}
@@ -0,0 +1,189 @@
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Ignore_Rules.h"
+#include "check.h"
+
+/// A rule of the reference matcher, parsed the way a .gitignore line is
+struct Reference_Rule {
+    std::string pattern;
+    bool negated = false;
+    bool directory_only = false;
+    bool anchored = false;
+};
+
+/// Matches pattern from i against the text by backtracking over the wildcards, the plain way the compiled automaton
+/// and the lookup tables have to agree with
+bool reference_match(const std::string &pattern, size_t i, std::string_view text) {
+    if (i == pattern.size()) return text.empty();
+    bool segment_start = i == 0 || pattern[i - 1] == '/';
+    if (segment_start && pattern.compare(i, 3, "**/") == 0) {     // Zero or more directories
+        if (reference_match(pattern, i + 3, text)) return true;
+        for (size_t k = 0; k < text.size(); k++)
+            if (text[k] == '/' && reference_match(pattern, i + 3, text.substr(k + 1))) return true;
+        return false;
+    }
+    if (segment_start && pattern.compare(i, std::string::npos, "**") == 0) return true;   // Everything below
+    char c = pattern[i];
+    if (c == '*') {
+        while (i + 1 < pattern.size() && pattern[i + 1] == '*') i++;
+        for (size_t k = 0; k <= text.size(); k++) {
+            if (reference_match(pattern, i + 1, text.substr(k))) return true;
+            if (k < text.size() && text[k] == '/') break;
+        }
+        return false;
+    }
+    if (text.empty()) return false;
+    if (c == '?') return text.front() != '/' && reference_match(pattern, i + 1, text.substr(1));
+    if (c == '[') {
+        if (text.front() == '/') return false;
+        size_t end = pattern.find(']', i + 2);
+        std::string_view set = std::string_view(pattern).substr(i + 1, end - i - 1);
+        bool negated = !set.empty() && (set.front() == '!' || set.front() == '^');
+        if (negated) set.remove_prefix(1);
+        auto byte = static_cast<unsigned char>(text.front());
+        bool member = false;
+        for (size_t j = 0; j < set.size(); j++) {
+            bool range = j + 2 < set.size() && set[j + 1] == '-';
+            auto from = static_cast<unsigned char>(set[j]), to = range ? static_cast<unsigned char>(set[j + 2]) : from;
+            member |= from <= byte && byte <= to;
+            if (range) j += 2;
+        }
+        return member != negated && reference_match(pattern, end + 1, text.substr(1));
+    }
+    if (c == '\\' && i + 1 < pattern.size()) c = pattern[++i];
+    return c == text.front() && reference_match(pattern, i + 1, text.substr(1));
+}
+
+/// Parses the rules one by one and lets the last matching one decide, as Ignore_Rules is documented to do
+bool reference_ignored(const std::vector<std::string> &lines, std::string_view path, bool is_directory) {
+    auto slash = path.rfind('/');
+    std::string_view name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+    bool ignored = false;
+    for (std::string_view line : lines) {
+        if (line.empty() || line.front() == '#') continue;
+        Reference_Rule rule;
+        if (line.front() == '!') {
+            rule.negated = true;
+            line.remove_prefix(1);
+        }
+        if (!line.empty() && line.back() == '/') {
+            rule.directory_only = true;
+            line.remove_suffix(1);
+        }
+        rule.anchored = line.find('/') != std::string_view::npos;
+        if (!line.empty() && line.front() == '/') line.remove_prefix(1);
+        if (line.compare(0, 3, "**/") == 0 && line.find('/', 3) == std::string_view::npos) {
+            line.remove_prefix(3);
+            rule.anchored = false;
+        }
+        rule.pattern = line;
+        if (rule.pattern.empty() || (rule.directory_only && !is_directory)) continue;
+        if (reference_match(rule.pattern, 0, rule.anchored ? path : name)) ignored = !rule.negated;
+    }
+    return ignored;
+}
+
+/// Builds the rules from the lines, failing if one of them is refused
+bool build(const std::vector<std::string> &lines, Ignore_Rules &rules) {
+    for (auto &line : lines) CHECK(rules.add(line));
+    return true;
+}
+
+/// Checks the engine on the given paths against the expected outcome and against the reference matcher
+bool check_cases(const std::vector<std::string> &lines, const std::vector<std::tuple<std::string, bool, bool>> &cases) {
+    Ignore_Rules rules;
+    CHECK(build(lines, rules));
+    for (auto &[path, is_directory, expected] : cases) {
+        if (rules.ignored(path, is_directory) != expected || reference_ignored(lines, path, is_directory) != expected) {
+            std::cerr << "Unexpected outcome for " << path << (is_directory ? "/" : "") << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/// A pattern with a '/' is matched against the whole path from the watched directory, otherwise against the name
+bool check_anchoring() {
+    CHECK(check_cases({"build"}, {{"build", true, true}, {"src/build", true, true}, {"src/builder", false, false}}));
+    CHECK(check_cases({"/build"}, {{"build", true, true}, {"src/build", true, false}}));
+    CHECK(check_cases({"src/*.c"}, {{"src/a.c", false, true}, {"lib/src/a.c", false, false}, {"src/x/a.c", false, false}}));
+    CHECK(check_cases({"docs/api"}, {{"docs/api", true, true}, {"x/docs/api", true, false}, {"api", true, false}}));
+    return true;
+}
+
+/// '**' spans directories at the start, in the middle and at the end of a pattern, and is a plain '*' elsewhere
+bool check_double_star() {
+    CHECK(check_cases({"**/cache"}, {{"cache", true, true}, {"a/b/cache", true, true}, {"a/cached", true, false}}));
+    CHECK(check_cases({"logs/**/*.log"}, {{"logs/a.log", false, true}, {"logs/x/y/a.log", false, true}, {"other/logs/a.log", false, false}}));
+    CHECK(check_cases({"out/**"}, {{"out/x", false, true}, {"out/x/y", true, true}, {"out", true, false}, {"output/x", false, false}}));
+    CHECK(check_cases({"a**b"}, {{"ab", false, true}, {"axxb", false, true}, {"a/b", false, false}}));
+    return true;
+}
+
+/// Classes match one byte other than '/', with ranges and negation
+bool check_classes() {
+    CHECK(check_cases({"*.[ch]"}, {{"a.c", false, true}, {"x/a.h", false, true}, {"a.o", false, false}}));
+    CHECK(check_cases({"[!a]x"}, {{"bx", false, true}, {"ax", false, false}}));
+    CHECK(check_cases({"file[0-9]"}, {{"file5", false, true}, {"filex", false, false}, {"file", false, false}}));
+    CHECK(check_cases({"a[/]b"}, {{"a/b", false, false}}));
+    Ignore_Rules rules;
+    CHECK(!rules.add("broken[") && !rules.add("[x"));   // Never closed
+    return true;
+}
+
+/// A trailing '/' only excludes directories, '!' includes again and the last matching rule decides
+bool check_directories_and_negation() {
+    CHECK(check_cases({"tmp/"}, {{"tmp", true, true}, {"tmp", false, false}, {"a/tmp", true, true}}));
+    CHECK(check_cases({"*.log", "!keep.log"}, {{"a.log", false, true}, {"keep.log", false, false}, {"x/keep.log", false, false}}));
+    CHECK(check_cases({"!keep.log", "*.log"}, {{"keep.log", false, true}}));
+    CHECK(check_cases({"cache/", "!cache"}, {{"cache", true, false}}));
+    CHECK(check_cases({"*", "!*.c", "!src/"}, {{"a.c", false, false}, {"a.h", false, true}, {"src", true, false}, {"src", false, true}}));
+    CHECK(check_cases({"# comment", "", "\\#literal"}, {{"# comment", false, false}, {"#literal", false, true}}));
+    return true;
+}
+
+/// Rules of the extension table match every name ending with the suffix, whatever the dots before it
+bool check_extensions() {
+    CHECK(check_cases({"*.tmp"}, {{"a.tmp", false, true}, {"x/b.c.tmp", false, true}, {".tmp", false, true}, {"a.tmpx", false, false}, {"tmp", false, false}}));
+    CHECK(check_cases({"*.tar.gz", "!*.gz"}, {{"a.tar.gz", false, false}, {"a.gz", false, false}}));
+    CHECK(check_cases({"*.gz", "!keep.tar.gz", "*.tar.gz"}, {{"keep.tar.gz", false, true}, {"a.gz", false, true}}));
+    return true;
+}
+
+/// Random rule sets over a small alphabet, so that the wildcards often meet, agree with the reference matcher
+bool check_random_rules() {
+    std::mt19937 generator(41);
+    const std::vector<std::string> tokens = {"a", "b", ".", "/", "*", "?", "[ab]", "[!a]", "[a-b]", "**/", "**", "\\*"};
+    const std::vector<std::string> segments = {"a", "b", "ab", "ba", "a.b", ".a", "*", "aab"};
+    for (int round = 0; round < 2000; round++) {
+        std::vector<std::string> lines;
+        for (int n = 1 + generator() % 4; n > 0; n--) {
+            std::string line = generator() % 4 == 0 ? "!" : "";
+            for (int length = 1 + generator() % 6; length > 0; length--) line += tokens[generator() % tokens.size()];
+            if (line == "!" || line.find_first_not_of("!/") == std::string::npos) continue;    // Empty once parsed
+            lines.push_back(line);
+        }
+        Ignore_Rules rules;
+        CHECK(build(lines, rules));
+        for (int p = 0; p < 20; p++) {
+            std::string path;
+            for (int depth = 1 + generator() % 4; depth > 0; depth--) path += (path.empty() ? "" : "/") + segments[generator() % segments.size()];
+            for (bool is_directory : {false, true}) {
+                if (rules.ignored(path, is_directory) != reference_ignored(lines, path, is_directory)) {
+                    std::cerr << "Mismatch for " << path << (is_directory ? "/" : "") << " with the rules:";
+                    for (auto &line : lines) std::cerr << " '" << line << "'";
+                    std::cerr << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+int main() {
+    return run_checks("Ignore rules", {check_anchoring, check_double_star, check_classes, check_directories_and_negation,
+                                       check_extensions, check_random_rules});
+}
@@ -0,0 +1,207 @@
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <boost/algorithm/string/replace.hpp>
+#include "Message.h"
+#include "check.h"
+
+/// Writes the message with the boost json writer, the reference of the wire format
+std::string boost_encode(int header, const std::string &data) {
+    boost::property_tree::ptree pt;
+    pt.put("header", header);
+    pt.put("data", data);
+    std::ostringstream out;
+    boost::property_tree::write_json(out, pt);
+    return out.str();
+}
+
+/// Gets the wire text of an encoded message
+std::string wire_text(const Message &message) {
+    return {static_cast<const char*>(message.buffer().data()), message.size()};
+}
+
+/// Reads the data of a message with the boost json parser, empty if it refuses the text
+std::optional<std::string> boost_decode(const std::string &text) {
+    boost::property_tree::ptree pt;
+    std::istringstream in(text);
+    try {
+        boost::property_tree::read_json(in, pt);
+        return pt.get<std::string>("data");
+    } catch (const boost::property_tree::ptree_error &err) {
+        return std::nullopt;
+    }
+}
+
+/// Reads the data of a message with the parser of Message, empty if it refuses the text
+std::optional<std::string> message_decode(const std::string &text) {
+    Message message;
+    try {
+        message.decode_message(text);
+        return std::string(message.get_data());
+    } catch (const boost::property_tree::json_parser_error &err) {
+        return std::nullopt;
+    }
+}
+
+/// Random bytes, the ones the escaper handles apart drawn more often than the others
+std::string random_data(std::mt19937_64 &generator, unsigned char limit) {
+    static const std::string special = "\"\\/\b\f\n\r\t\x01\x1f\x7f{}:,";
+    std::string data(generator() % 300, '\0');
+    for (auto &c : data) {
+        c = generator() % 4 == 0 ? special[generator() % special.size()] : static_cast<char>(generator() % (limit + 1u));
+    }
+    return data;
+}
+
+/// Writes a string literal of random content the way any JSON writer may: plain characters and every kind of escape,
+/// the code points beyond the BMP as surrogate pairs; the characters are ASCII, the unescaped text may not be
+std::string random_literal(std::mt19937_64 &generator) {
+    static const char *escapes[] = {"\\\"", "\\\\", "\\/", "\\b", "\\f", "\\n", "\\r", "\\t"};
+    std::string literal;
+    char hex[16];
+    for (int n = generator() % 60; n > 0; n--) {
+        switch (generator() % 4) {
+            case 0:
+                literal += escapes[generator() % 8];
+                break;
+            case 1: {   // A code point of the BMP other than a surrogate, upper or lower case digits
+                unsigned code_point = 1 + generator() % 0xFFFE;
+                if (code_point >= 0xD800 && code_point < 0xE000) code_point -= 0x800;
+                std::snprintf(hex, sizeof(hex), generator() % 2 ? "\\u%04X" : "\\u%04x", code_point);
+                literal += hex;
+                break;
+            }
+            case 2: {   // Beyond the BMP
+                unsigned code_point = 0x10000 + generator() % 0x100000;
+                std::snprintf(hex, sizeof(hex), "\\u%04X\\u%04X", 0xD800 + ((code_point - 0x10000) >> 10), 0xDC00 + ((code_point - 0x10000) & 0x3FF));
+                literal += hex;
+                break;
+            }
+            default:
+                literal += static_cast<char>(0x20 + generator() % 0x5F);
+                if (literal.back() == '"' || literal.back() == '\\') literal.back() = 'y';
+        }
+    }
+    return literal;
+}
+
+/// Wraps a string literal into a message laid out as the boost writer does
+std::string wrap(int header, const std::string &literal) {
+    return "{\n    \"header\": \"" + std::to_string(header) + "\",\n    \"data\": \"" + literal + "\"\n}\n";
+}
+
+/// Any bytes, binary and control characters included, come back as they were sent, and the message ends as the
+/// readers expect it to
+bool check_round_trip() {
+    std::mt19937_64 generator(31);
+    for (int i = 0; i < 20000; i++) {
+        std::string data = random_data(generator, 0xFF);
+        int header = static_cast<int>(generator() % 20);
+        Message message;
+        message.encode_message(header, data);
+        std::string wire = wire_text(message);
+        CHECK(message.get_data() == data);     // Unescaped from the wire text
+        CHECK(Message::complete_length(wire) == wire.size());
+        Message received;
+        received.decode_message(wire);
+        CHECK(received.get_header() == header && received.get_data() == data);
+    }
+    return true;
+}
+
+/// The wire text is the one of the boost writer, except for '/' which is left unescaped, and either parser reads what
+/// the other writer wrote
+bool check_against_boost() {
+    std::mt19937_64 generator(32);
+    for (int i = 0; i < 20000; i++) {
+        std::string data = random_data(generator, 0xFF);
+        Message message;
+        message.encode_message(7, data);
+        std::string reference = boost_encode(7, data);
+        CHECK(message_decode(reference) == data);
+        boost::replace_all(reference, "\\/", "/");
+        CHECK(wire_text(message) == reference);
+        std::string ascii = random_data(generator, 0x7F);     // The boost parser wants UTF-8, which any ASCII text is
+        message.encode_message(7, ascii);
+        CHECK(boost_decode(wire_text(message)) == ascii);
+    }
+    return true;
+}
+
+/// Every escape, the unicode ones and the surrogate pairs included, is read as the boost parser reads it
+bool check_escapes() {
+    std::mt19937_64 generator(33);
+    for (int i = 0; i < 20000; i++) {
+        std::string text = wrap(1, random_literal(generator));
+        auto expected = boost_decode(text);
+        CHECK(expected);
+        CHECK(message_decode(text) == expected);
+    }
+    for (auto literal : {"\\uD83D\\uDE00", "\\u00e9\\u20AC", "a\\/b", "\\uD800", "\\uD800x", "\\uD800\\u0041", "\\uDC00",
+                         "\\u12", "\\u12G4", "\\x", "\\"}) {
+        std::string text = wrap(1, literal);
+        if (message_decode(text) != boost_decode(text)) {
+            std::cerr << "Parsers disagree on " << literal << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Every strict prefix of a message is refused like the boost parser refuses it: unterminated strings, escapes and
+/// objects, and a missing header or data
+bool check_truncations() {
+    std::mt19937_64 generator(34);
+    for (int i = 0; i < 300; i++) {
+        std::string text = i % 2 ? wrap(2, random_literal(generator)) : boost_encode(2, random_data(generator, 0x7F));
+        for (size_t length = 0; length <= text.size(); length++) {
+            std::string prefix = text.substr(0, length);
+            auto expected = boost_decode(prefix);
+            if (message_decode(prefix) != expected) {
+                std::cerr << "Parsers disagree on the first " << length << " bytes of " << text << std::endl;
+                return false;
+            }
+            CHECK(expected.has_value() == (length + 1 >= text.size()));    // Only the final line break may be missing
+        }
+    }
+    return true;
+}
+
+/// An object written field by field is the text the boost writer makes of the same tree, except for '/', and the boost
+/// parser reads the fields back from the data, a plain field holding what was written in its room
+bool check_objects() {
+    std::mt19937_64 generator(35);
+    for (int i = 0; i < 5000; i++) {
+        boost::property_tree::ptree expected;
+        Message message;
+        message.begin_object(3);
+        std::string key = "k";
+        for (int n = generator() % 5; n > 0; n--) {
+            key += 'k';    // Distinct keys, a path of the tree can not hold the escapes of any random key
+            std::string value = random_data(generator, 0x7F);
+            message.add_field(key, value);
+            expected.add(key, value);
+        }
+        std::string plain = random_data(generator, 0x7F);
+        std::erase_if(plain, [](char c) {return c < 0x20 || c == '"' || c == '\\';});
+        plain.copy(message.add_plain_field("plain", plain.size()), plain.size());
+        expected.add("plain", plain);
+        message.end_object();
+        std::ostringstream reference;
+        boost::property_tree::write_json(reference, expected, false);
+        std::string object(message.get_data());
+        CHECK(object + "\n" == boost::replace_all_copy(reference.str(), "\\/", "/"));
+        CHECK(message.get_header() == 3 && Message::complete_length(wire_text(message)) == message.size());
+        boost::property_tree::ptree read;
+        std::istringstream in(object);
+        boost::property_tree::read_json(in, read);
+        CHECK(read == expected);
+    }
+    return true;
+}
+
+int main() {
+    return run_checks("Message JSON", {check_round_trip, check_against_boost, check_escapes, check_truncations, check_objects});
+}
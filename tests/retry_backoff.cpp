@@ -0,0 +1,129 @@
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+#include <atomic>
+#include <csignal>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include "Client.h"
+#include "DirectoryWatcher.h"
+#include "Retry_Policy.h"
+#include "check.h"
+
+using boost::asio::ip::tcp;
+
+/// The waits double up to the longest one, the jitter only shortens them and the circuit opens after max_failures
+bool check_policy() {
+    Retry_Policy exact(std::chrono::milliseconds(100), std::chrono::milliseconds(800), 5, 0.0);
+    for (auto expected : {100, 200, 400, 800}) CHECK(exact.failed().count() == expected);
+    CHECK(!exact.is_open());
+    CHECK(exact.failed().count() == 800);
+    CHECK(exact.is_open() && exact.failure_count() == 5);
+    CHECK(exact.failed().count() == 800);   // Probing every longest wait while open
+    exact.succeeded();
+    CHECK(!exact.is_open() && exact.failed().count() == 100);
+
+    Retry_Policy jittered(std::chrono::milliseconds(1000), std::chrono::milliseconds(60000), 0, 0.5, 42);
+    int64_t expected = 1000;
+    bool spread = false;
+    for (int i = 0; i < 20; i++) {
+        auto wait = jittered.failed().count();
+        CHECK(wait <= expected && wait >= expected / 2);
+        spread |= wait != expected;
+        expected = std::min<int64_t>(expected * 2, 60000);
+    }
+    CHECK(spread && !jittered.is_open());
+    return true;
+}
+
+/// Runs a client against the endpoint for the given time while posting handlers to its io_context, returns the longest
+/// delay before one of them ran; the client is then stopped the way a service manager does
+std::chrono::milliseconds probe_client(const tcp::endpoint &endpoint, std::chrono::milliseconds duration) {
+    Scratch_Directory scratch("rab_retry");
+    auto &tree = scratch.path;
+    std::ofstream(tree.string() + "/file.txt") << "content";
+    Client_Config config;
+    config.username = "user";
+    config.password = "password";
+    config.daemon = true;
+    config.retry_initial_seconds = 0.1;
+    config.reconnect_max_seconds = 2;
+    auto running_client = std::make_shared<bool>(true);
+    auto running_watcher = std::make_shared<bool>(true);
+    auto stop = std::make_shared<bool>(false);
+    boost::asio::io_context io_context;
+    auto dw = std::make_shared<DirectoryWatcher>(tree.string(), boost::chrono::milliseconds(50), running_watcher);
+    std::chrono::milliseconds worst{0};
+    {
+        Client client(io_context, endpoint.address().to_string(), std::to_string(endpoint.port()), running_client, tree.string(), dw, stop, running_watcher, config);
+        std::thread loop([&io_context]() {io_context.run();});
+        auto end = std::chrono::steady_clock::now() + duration;
+        while (std::chrono::steady_clock::now() < end) {
+            std::promise<std::chrono::steady_clock::time_point> ran;
+            auto posted = std::chrono::steady_clock::now();
+            boost::asio::post(io_context, [&ran]() {ran.set_value(std::chrono::steady_clock::now());});
+            auto future = ran.get_future();
+            if (future.wait_for(std::chrono::seconds(5)) != std::future_status::ready) {
+                worst = std::chrono::milliseconds::max();
+                break;
+            }
+            worst = std::max(worst, std::chrono::duration_cast<std::chrono::milliseconds>(future.get() - posted));
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        std::raise(SIGTERM);    // Caught by the client, which leaves the io_context without work
+        loop.join();
+    }
+    return worst;
+}
+
+/// While the server can not be reached the connection attempts go on, spaced by the timer, and the loop keeps running
+bool check_unreachable_server() {
+    boost::asio::io_context io_context;
+    tcp::acceptor probe(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    auto endpoint = probe.local_endpoint();
+    probe.close();      // Nothing listens on the port any more
+    auto &retries = Metrics::instance().counter("rab_retry_waits_total{side=\"client\"}");
+    auto before = retries.get();
+    auto worst = probe_client(endpoint, std::chrono::milliseconds(1500));
+    std::cout << "Unreachable server: " << retries.get() - before << " waits, longest handler delay " << worst.count() << " ms" << std::endl;
+    CHECK(retries.get() - before >= 3);
+    CHECK(worst < std::chrono::milliseconds(100));
+    return true;
+}
+
+/// A busy server asks to retry the login after a second, the client waits on its timer and the loop keeps running
+bool check_busy_server() {
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    std::atomic<int> logins{0};
+    std::thread server([&acceptor, &logins]() {
+        try {
+            tcp::socket socket = acceptor.accept();
+            boost::asio::streambuf buffer;
+            boost::system::error_code ec;
+            while (true) {
+                auto length = boost::asio::read_until(socket, buffer, "\n}\n", ec);
+                if (ec) break;
+                buffer.consume(length);
+                logins++;
+                Message answer;
+                answer.encode_message(status_type::service_unavailable, "login||1");
+                boost::asio::write(socket, answer.buffer(), ec);
+            }
+        } catch (const std::exception &err) {
+            std::cerr << "Server: " << err.what() << std::endl;
+        }
+    });
+    auto worst = probe_client(acceptor.local_endpoint(), std::chrono::milliseconds(2500));
+    server.join();
+    std::cout << "Busy server: " << logins << " logins, longest handler delay " << worst.count() << " ms" << std::endl;
+    CHECK(logins >= 3);
+    CHECK(worst < std::chrono::milliseconds(100));
+    return true;
+}
+
+/// Checks the retry policy, then that the client event loop stays responsive while it backs off
+int main() {
+    Logger::set_level(Log_Level::error);
+    return run_checks("Retry and backoff", {check_policy, check_unreachable_server, check_busy_server});
+}
@@ -0,0 +1,178 @@
+#include <fstream>
+#include <random>
+#include <sqlite3.h>
+#include <thread>
+#include <boost/asio.hpp>
+#include "Backup_Server.h"
+#include "Client.h"
+#include "Content_Hasher.h"
+#include "DirectoryWatcher.h"
+#include "Metrics.h"
+#include "Version_Store.h"
+#include "check.h"
+
+namespace fs = boost::filesystem;
+
+/// Directories of a check: the tree of the client and the data of the server, which runs from a/b and keeps its files
+/// in ../../server, its partial uploads in ../../staging and its databases in ..; the check runs from a/b as well
+struct Workspace {
+    Scratch_Directory scratch{"server_uploads"};
+    fs::path previous = fs::current_path();
+    fs::path tree = scratch.path / "tree";
+    fs::path stored = scratch.path / "server" / "bench";
+
+    /// Creates the directories and the user "bench", the stored value is the SHA-256 of the password "bench"
+    Workspace() {
+        fs::create_directories(scratch.path / "a" / "b");
+        fs::create_directories(tree);
+        fs::create_directories(scratch.path / "server");
+        sqlite3 *conn;
+        sqlite3_open((scratch.path / "a" / "Clients.sqlite").string().c_str(), &conn);
+        sqlite3_exec(conn, "CREATE TABLE Client (username text not null constraint Client_pk primary key, password text not null, paths int);"
+                           "INSERT INTO Client VALUES ('bench', '1b32c28cb38c05480eccc1bd60ff97029b57a05c96718b96dad7e9d84894f549', NULL);",
+                     nullptr, nullptr, nullptr);
+        sqlite3_close(conn);
+        fs::current_path(scratch.path / "a" / "b");
+    }
+
+    ~Workspace() {
+        fs::current_path(previous);     // Before the scratch directory goes
+    }
+};
+
+/// Returns size pseudo random bytes, the same ones for the same seed
+std::string random_content(size_t size, unsigned seed) {
+    std::mt19937 generator(seed);
+    std::string content(size, '\0');
+    for (auto &c : content) c = static_cast<char>(generator());
+    return content;
+}
+
+void write_file(const fs::path &path, const std::string &content) {
+    std::ofstream out(path.string(), std::ios::binary | std::ios::trunc);
+    out.write(content.data(), static_cast<std::streamsize>(content.size()));
+}
+
+/// Returns the content of a file, empty if it can not be read
+std::string read_file(const fs::path &path) {
+    std::ifstream in(path.string(), std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+/// Returns the hash of a file content as the client computes it
+std::string content_hash(const std::string &content) {
+    Content_Hasher hasher;
+    hasher.update(content.data(), content.size());
+    return hasher.final();
+}
+
+/// Returns the name of a partial upload of the user "bench" in the staging area, as Server_Session names them
+std::string staging_path(const std::string &remote_path, const std::string &hash) {
+    Content_Hasher hasher;
+    hasher.update_raw(remote_path.data(), remote_path.size());
+    return "../../staging/bench/" + hasher.final() + "_" + hash + ".part";
+}
+
+/// Runs a server with the given configuration and a client of the user "bench" on the tree of the workspace until
+/// done returns true; returns false if it does not within a minute
+bool run_backup(const Workspace &workspace, const Server_Config &config, const std::function<bool()> &done) {
+    boost::asio::thread_pool server_workers(2);
+    boost::asio::io_context server_context;
+    Backup_Server server(server_context, server_workers, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), config);
+    std::thread server_thread([&server_context](){server_context.run();});
+    auto running_client = std::make_shared<bool>(true);
+    auto running_watcher = std::make_shared<bool>(true);
+    auto stop = std::make_shared<bool>(false);
+    Client_Config client_config;
+    client_config.username = "bench";
+    client_config.password = "bench";
+    boost::asio::io_context client_context;
+    auto dw = std::make_shared<DirectoryWatcher>(workspace.tree.string(), boost::chrono::milliseconds(50), running_watcher);
+    auto client = std::make_unique<Client>(client_context, "127.0.0.1", std::to_string(server.port()), running_client,
+                                           workspace.tree.string(), dw, stop, running_watcher, client_config, Throttling{},
+                                           nullptr, std::string(), false);
+    std::thread client_thread([&client_context](){client_context.run();});
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    bool finished;
+    while (!(finished = done()) && std::chrono::steady_clock::now() < deadline) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    *running_client = *running_watcher = false;
+    client_context.stop();
+    client_thread.join();
+    client.reset();
+    server_context.stop();
+    server_thread.join();
+    server_workers.join();
+    return finished;
+}
+
+/// The server configuration of the checks, without the periodic work and the syncs
+Server_Config test_config() {
+    Server_Config config;
+    config.scrub_interval = 0;
+    config.durable_writes = false;
+    return config;
+}
+
+/// An upload going over the quota is refused, the files within it are stored
+bool check_quota_refusal() {
+    Workspace workspace;
+    auto &refusals = Metrics::instance().counter("rab_quota_refusals_total");
+    auto &committed = Metrics::instance().counter("rab_elements_committed_total");
+    auto refusals_before = refusals.get(), committed_before = committed.get();
+    write_file(workspace.tree / "first.bin", random_content(600 << 10, 1));
+    write_file(workspace.tree / "second.bin", random_content(600 << 10, 2));
+    auto config = test_config();
+    config.quota_bytes = 1 << 20;   // Room for one of the files only
+    CHECK(run_backup(workspace, config, [&]() {return refusals.get() > refusals_before && committed.get() > committed_before;}));
+    CHECK(fs::exists(workspace.stored / "first.bin") != fs::exists(workspace.stored / "second.bin"));
+    Version_Store versions;
+    auto usage = versions.usage("bench");
+    CHECK(usage.files == 1 && usage.bytes == 600 << 10);
+    return true;
+}
+
+/// A kept content with the hash and size of the upload but different bytes is not shared: the proof of the client does
+/// not match it and the file is uploaded instead
+bool check_wrong_proof() {
+    Workspace workspace;
+    auto &mismatches = Metrics::instance().counter("rab_dedup_proof_mismatches_total");
+    auto &shared = Metrics::instance().counter("rab_dedup_files_total");
+    auto mismatches_before = mismatches.get(), shared_before = shared.get();
+    std::string content = random_content(3 << 20, 3);
+    write_file(workspace.tree / "big.bin", content);
+    {   // Another user keeps a colliding content
+        write_file("decoy", random_content(content.size(), 4));
+        Version_Store versions;
+        std::vector<Version_Info> kept(1);
+        kept[0].path = "other:bin";
+        kept[0].hash = content_hash(content);
+        kept[0].size = content.size();
+        kept[0].stored = "decoy";
+        CHECK(versions.record("other", kept));
+        CHECK(versions.find_object(content_hash(content), content.size()));
+    }
+    CHECK(run_backup(workspace, test_config(), [&]() {return read_file(workspace.stored / "big.bin") == content;}));
+    CHECK(mismatches.get() == mismatches_before + 1);
+    CHECK(shared.get() == shared_before);
+    return true;
+}
+
+/// An upload interrupted after its first bytes were staged goes on from there instead of starting again
+bool check_resume() {
+    Workspace workspace;
+    auto &received = Metrics::instance().counter("rab_bytes_received_total{side=\"server\"}");
+    auto received_before = received.get();
+    std::string content = random_content(3 << 20, 5);
+    write_file(workspace.tree / "big.bin", content);
+    std::string part = staging_path("big:bin", content_hash(content));
+    fs::create_directories(fs::path(part).parent_path());
+    write_file(part, content.substr(0, 2 << 20));     // Committed by an earlier session
+    CHECK(run_backup(workspace, test_config(), [&]() {return read_file(workspace.stored / "big.bin") == content;}));
+    CHECK(received.get() - received_before < 2 << 20);   // The missing MiB in base64 and the requests, not the whole file
+    CHECK(!fs::exists(part));
+    return true;
+}
+
+int main() {
+    return run_checks("Server uploads", {check_quota_refusal, check_wrong_proof, check_resume});
+}
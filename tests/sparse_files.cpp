@@ -0,0 +1,96 @@
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <iostream>
+#include <random>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "File_Extents.h"
+#include "check.h"
+
+/// Writes length pseudo random bytes at offset, line breaks included
+void write_data(int fd, uint64_t offset, size_t length, std::mt19937 &generator) {
+    std::vector<char> data(length);
+    for (auto &byte : data) byte = static_cast<char>(generator());
+    if (::pwrite(fd, data.data(), data.size(), static_cast<off_t>(offset)) != static_cast<ssize_t>(data.size())) throw std::runtime_error("pwrite");
+}
+
+/// Hashes the whole file reading every byte, as the hash was computed before the holes were known
+std::string dense_hash(int fd, uint64_t size) {
+    Content_Hasher hasher;
+    std::vector<char> buffer(65536);
+    for (uint64_t offset = 0; offset < size;) {
+        ssize_t got = ::pread(fd, buffer.data(), buffer.size(), static_cast<off_t>(offset));
+        if (got <= 0) break;
+        hasher.update(buffer.data(), got);
+        offset += got;
+    }
+    return hasher.final();
+}
+
+/// The extents cover the file in order, their data fits the limit and the hashes do not depend on the holes
+bool check_file(const std::string &path, uint64_t size, bool sparse) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    CHECK(fd >= 0);
+    uint64_t offset = 0, holes = 0;
+    while (offset < size) {
+        Extent extent = next_extent(fd, offset, size, 1 << 20);
+        CHECK(extent.hole + extent.data > 0);
+        CHECK(extent.data <= (1 << 20));
+        CHECK(extent.hole == 0 || extent.hole >= min_hole || offset + extent.hole == size);
+        holes += extent.hole;
+        offset += extent.hole + extent.data;
+    }
+    CHECK(offset == size);
+    Content_Hasher hasher;
+    File_Reader file(path);
+    uint64_t read = hash_extents(file, size, hasher);
+    CHECK(hasher.final() == dense_hash(fd, size));
+    CHECK(read + holes == size);
+    if (sparse) CHECK(holes > size / 2);     // Only when the file system reports the holes
+    ::close(fd);
+    return true;
+}
+
+/// A file truncated while it is read shows zeros past its new end, instead of raising SIGBUS
+bool check_truncation(const std::string &path, std::mt19937 &generator) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    write_data(fd, 0, 3 * read_window, generator);
+    File_Reader file(path);
+    CHECK(file.read(0, read_window).size() == read_window && !file.truncated());
+    ::ftruncate(fd, static_cast<off_t>(read_window));
+    ::close(fd);
+    auto rest = file.read(2 * read_window, read_window);
+    CHECK(rest.size() == read_window && rest.find_first_not_of('\0') == std::string_view::npos && file.truncated());
+    CHECK(File_Reader(path).read(read_window, read_window).empty());
+    return true;
+}
+
+int main() {
+    Scratch_Directory scratch("rab_sparse");
+    auto &directory = scratch.path;
+    std::mt19937 generator(7);
+    std::string path = (directory / "disk.img").string();
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    uint64_t size = 64 << 20;
+    ::ftruncate(fd, static_cast<off_t>(size));
+    write_data(fd, 1 << 20, 3 << 20, generator);    // Longer than a chunk
+    write_data(fd, 20 << 20, 4096, generator);
+    write_data(fd, (20 << 20) + 16384, 4096, generator);    // After a hole shorter than min_hole
+    write_data(fd, (40 << 20) + 123, 1000, generator);      // Not aligned to the blocks, the file ends with a hole
+    ::fsync(fd);
+    ::close(fd);
+    struct stat info{};
+    ::stat(path.c_str(), &info);
+    bool sparse = static_cast<uint64_t>(info.st_blocks) * 512 < size / 2;
+
+    std::string dense = (directory / "dense.bin").string();
+    fd = ::open(dense.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    write_data(fd, 0, (2 << 20) + 17, generator);
+    ::close(fd);
+
+    if (!sparse) std::cout << "The file system does not report holes, the extents are all data" << std::endl;
+    return run_checks("Sparse file", {[&]() {return check_file(path, size, sparse);},
+                                      [&]() {return check_file(dense, (2 << 20) + 17, false);},
+                                      [&]() {return check_file(path, 0, false);},
+                                      [&]() {return check_truncation((directory / "shrinking.bin").string(), generator);}});
+}